@@ -0,0 +1,124 @@
+#pragma once
+
+#include "olcPixelGameEngine.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <random>
+#include <string>
+#include <vector>
+
+struct BenchmarkResult{
+	std::string kernel;
+	// 0 where the kernel doesn't depend on it
+	int brush_size = 0;
+	int blend_range = 0;
+	int iterations = 0;
+	double ns_per_op = 0.0;
+	double cells_per_second = 0.0;
+};
+
+// Times kernels over a fixed number of iterations and collects one result per
+// call to Run(). The iteration count is fixed rather than adapted to the time
+// taken so that an edit kernel sees the same sequence of terrain every run.
+class BenchmarkRunner{
+	std::vector<BenchmarkResult> results;
+
+public:
+	int iterations = 50;
+	// untimed iterations before the timed ones, so caches and buffers are warm
+	int warmup_iterations = 2;
+
+	// prepare(iteration) runs untimed before every op(iteration), which returns
+	// the number of cells it processed
+	template <typename Prepare, typename Op>
+	const BenchmarkResult& Run(const std::string& kernel, int brush_size, int blend_range, Prepare&& prepare, Op&& op){
+		using clock = std::chrono::steady_clock;
+
+		for (int iteration = 0; iteration < warmup_iterations; iteration++) {
+			prepare(iteration);
+			op(iteration);
+		}
+
+		clock::duration total{ 0 };
+		double cells = 0.0;
+		for (int iteration = warmup_iterations; iteration < warmup_iterations + iterations; iteration++) {
+			prepare(iteration);
+			clock::time_point start = clock::now();
+			cells += double(op(iteration));
+			total += clock::now() - start;
+		}
+
+		double ns = double(std::chrono::duration_cast<std::chrono::nanoseconds>(total).count());
+		BenchmarkResult result;
+		result.kernel = kernel;
+		result.brush_size = brush_size;
+		result.blend_range = blend_range;
+		result.iterations = iterations;
+		result.ns_per_op = iterations > 0 ? ns / iterations : 0.0;
+		result.cells_per_second = ns > 0.0 ? cells * 1e9 / ns : 0.0;
+		results.push_back(result);
+		return results.back();
+	}
+
+	const std::vector<BenchmarkResult>& Results() const{
+		return results;
+	}
+
+	void WriteCsv(std::ostream& out) const{
+		out << "kernel,brush_size,blend_range,iterations,ns_per_op,cells_per_second\n";
+		for (const BenchmarkResult& result : results) {
+			out << result.kernel << ',' << result.brush_size << ',' << result.blend_range << ',' << result.iterations << ','
+				<< uint64_t(result.ns_per_op) << ',' << uint64_t(result.cells_per_second) << '\n';
+		}
+	}
+
+	void WriteJson(std::ostream& out) const{
+		out << "[\n";
+		for (size_t i = 0; i < results.size(); i++) {
+			const BenchmarkResult& result = results[i];
+			out << "\t{ \"kernel\": \"" << result.kernel << "\", \"brush_size\": " << result.brush_size
+				<< ", \"blend_range\": " << result.blend_range << ", \"iterations\": " << result.iterations
+				<< ", \"ns_per_op\": " << uint64_t(result.ns_per_op) << ", \"cells_per_second\": " << uint64_t(result.cells_per_second)
+				<< (i + 1 < results.size() ? " },\n" : " }\n");
+		}
+		out << "]\n";
+	}
+};
+
+// Reproducible terrain for the benchmarks: solid ground with a cave of radius
+// CaveRadius() around the middle, and fractional and empty pockets scattered
+// through both. Only raw mt19937 output is used, which the standard fixes, so
+// a seed gives the same map on every platform.
+template <typename Field>
+class BenchmarkTerrain{
+public:
+	static int CaveRadius(const Field& field){
+		return std::max(1, std::min(field.Width(), field.Height()) / 4);
+	}
+
+	static olc::vi2d Centre(const Field& field){
+		return field.Size() / 2;
+	}
+
+	static void Generate(Field& field, uint32_t seed){
+		std::mt19937 random(seed);
+		olc::vi2d size = field.Size();
+		int cave_radius = CaveRadius(field);
+
+		field.Fill(1.0f);
+		field.FillCircle(Centre(field), cave_radius, 0.0f);
+
+		int pockets = std::max(1, size.x * size.y / 2048);
+		for (int i = 0; i < pockets; i++) {
+			olc::vi2d pos{ int(random() % uint32_t(size.x)), int(random() % uint32_t(size.y)) };
+			int radius = 2 + int(random() % uint32_t(std::max(1, cave_radius / 8)));
+			float value = float(random() % 256) / 255.0f;
+			field.FillCircle(pos, radius, value);
+		}
+
+		field.MarkDirty({ 0, 0 }, size - olc::vi2d{ 1, 1 });
+	}
+};
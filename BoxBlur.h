@@ -0,0 +1,111 @@
+#pragma once
+
+#include "olcPixelGameEngine.h"
+#include "Simd.h"
+#include "WorkerPool.h"
+
+#include <vector>
+
+// Separable box blur of a block of samples: every output cell is the average of
+// the (2 * radius + 1) x (2 * radius + 1) source cells around it.
+//
+// Both passes are running window sums done simd::width lines at a time (rows in
+// the x pass, columns in the y pass). Every lane adds and removes the values in
+// the same order as a scalar sliding window would, so the averages match it
+// exactly. The x pass reads the source column by column, which is why the source
+// is kept column major; its output is written back row major for the y pass.
+// Packets are independent and run as jobs on a WorkerPool. Buffers are kept
+// between runs, so a brush can own one and reuse it each frame.
+class SeparableBoxBlur{
+	olc::vi2d size;
+	int radius = 0;
+	// source rows and output columns, rounded up to whole packets
+	int source_rows_padded = 0;
+	int columns_padded = 0;
+
+	std::vector<float> source;
+	std::vector<float> horizontal;
+	std::vector<float> result;
+
+public:
+	// Prepares for a size output blurred over radius; the source then covers
+	// size + 2 * radius cells, offset by -radius from the output
+	void Resize(olc::vi2d size, int radius){
+		this->size = size;
+		this->radius = radius;
+		int source_rows = size.y + 2 * radius;
+		source_rows_padded = (source_rows + simd::width - 1) / simd::width * simd::width;
+		columns_padded = (size.x + simd::width - 1) / simd::width * simd::width;
+
+		source.assign(size_t(size.x + 2 * radius) * source_rows_padded, 0.0f);
+		horizontal.assign(size_t(source_rows) * columns_padded, 0.0f);
+		// slack so a packet started near the end of the last row stays in the buffer
+		result.assign(size_t(size.y) * columns_padded + simd::width, 0.0f);
+	}
+
+	// Source cell (x, y) is at SourceData()[x * SourceXStride() + y]
+	float* SourceData(){
+		return source.data();
+	}
+	ptrdiff_t SourceXStride() const{
+		return source_rows_padded;
+	}
+
+	// size.x averages of output row y
+	const float* ResultRow(int y) const{
+		return result.data() + size_t(y) * columns_padded;
+	}
+
+	// Each packet of lines is one job on the pool
+	void Run(WorkerPool& pool){
+		using namespace simd;
+
+		const Float window = Set1(float(2 * radius + 1));
+		const int source_rows = size.y + 2 * radius;
+
+		// x blur, width rows at a time
+		pool.ParallelFor((source_rows + width - 1) / width, [&](int packet, int){
+			int first_row = packet * width;
+			const float* column = source.data() + first_row;
+			int lanes = std::min(width, source_rows - first_row);
+			alignas(32) float averages[width];
+
+			Float colour_sum = Set1(0.0f);
+			for (int x = 0; x <= 2 * radius; x++) {
+				colour_sum = colour_sum + Load(column + size_t(x) * source_rows_padded);
+			}
+
+			for (int x = 0; x < size.x; x++) {
+				if (x > 0) {
+					colour_sum = colour_sum + Load(column + size_t(x + 2 * radius) * source_rows_padded);
+					colour_sum = colour_sum - Load(column + size_t(x - 1) * source_rows_padded);
+				}
+
+				Store(averages, colour_sum / window);
+				for (int lane = 0; lane < lanes; lane++) {
+					horizontal[size_t(first_row + lane) * columns_padded + x] = averages[lane];
+				}
+			}
+		});
+
+		// y blur, width columns at a time
+		pool.ParallelFor((size.x + width - 1) / width, [&](int packet, int){
+			int first_column = packet * width;
+			const float* rows = horizontal.data() + first_column;
+
+			Float colour_sum = Set1(0.0f);
+			for (int y = 0; y <= 2 * radius; y++) {
+				colour_sum = colour_sum + Load(rows + size_t(y) * columns_padded);
+			}
+
+			for (int y = 0; y < size.y; y++) {
+				if (y > 0) {
+					colour_sum = colour_sum + Load(rows + size_t(y + 2 * radius) * columns_padded);
+					colour_sum = colour_sum - Load(rows + size_t(y - 1) * columns_padded);
+				}
+
+				Store(result.data() + size_t(y) * columns_padded + first_column, colour_sum / window);
+			}
+		});
+	}
+};
@@ -0,0 +1,157 @@
+#pragma once
+
+#include "Simd.h"
+
+#include <cmath>
+
+// The curves the brushes shape their strength with, as policies the kernels
+// are instantiated on. Every policy has
+//   EaseInOutCubic(x) for x in [0, 1]
+//   GaussianCurve(x) = e^(-x^2) for x in [-1, 1]
+// for a float and for simd::width lanes at once. They differ in how:
+//   ExactCurves       the original double precision pow() calls, the reference
+//   PolynomialCurves  branch free float maths (cubic exactly, e^-u to ~5e-7)
+//   TableCurves<n>    n step tables built at compile time, linearly interpolated
+// BrushCurves is the one the editor uses, PolynomialCurves unless
+// TERRAIN_CURVES_EXACT or TERRAIN_CURVES_TABLE is defined.
+
+struct ExactCurves{
+	static float EaseInOutCubic(float x){
+		return (x < 0.5) ? (4 * x * x * x) : float(1 - std::pow(-2 * x + 2, 3) / 2);
+	}
+	static float GaussianCurve(float x){
+		return float(std::pow(2.718281828459045, -x * x));
+	}
+
+	static simd::Float EaseInOutCubic(simd::Float x){
+		return PerLane(x, [](float lane){ return EaseInOutCubic(lane); });
+	}
+	static simd::Float GaussianCurve(simd::Float x){
+		return PerLane(x, [](float lane){ return GaussianCurve(lane); });
+	}
+
+private:
+	template <typename Function>
+	static simd::Float PerLane(simd::Float x, Function function){
+		float lanes[simd::width];
+		simd::Store(lanes, x);
+		for (float& lane : lanes) {
+			lane = function(lane);
+		}
+		return simd::Load(lanes);
+	}
+};
+
+struct PolynomialCurves{
+	static float EaseInOutCubic(float x){
+		float t = 2.0f - 2.0f * x;
+		float rising = 4.0f * x * x * x;
+		float falling = 1.0f - t * t * t / 2.0f;
+		return x < 0.5f ? rising : falling;
+	}
+	// degree 5 fit of e^-u over u = x^2 in [0, 1], Chebyshev nodes
+	static float GaussianCurve(float x){
+		float u = x * x;
+		return 0.999999583f + u * (-0.999967873f + u * (0.499620885f + u * (-0.165012717f + u * (0.038338922f + u * -0.00509972777f))));
+	}
+
+	static simd::Float EaseInOutCubic(simd::Float x){
+		using namespace simd;
+		Float rising = Set1(4.0f) * x * x * x;
+		Float t = Set1(2.0f) - Set1(2.0f) * x;
+		Float falling = Set1(1.0f) - t * t * t / Set1(2.0f);
+		return Select(x < Set1(0.5f), rising, falling);
+	}
+	static simd::Float GaussianCurve(simd::Float x){
+		using namespace simd;
+		Float u = x * x;
+		Float sum = Set1(-0.00509972777f);
+		sum = sum * u + Set1(0.038338922f);
+		sum = sum * u + Set1(-0.165012717f);
+		sum = sum * u + Set1(0.499620885f);
+		sum = sum * u + Set1(-0.999967873f);
+		return sum * u + Set1(0.999999583f);
+	}
+};
+
+template <int steps>
+struct TableCurves{
+	static_assert(steps >= 2, "a table needs a few steps");
+
+	// values at i / steps for i in 0..steps, then the last repeated so that an
+	// input of exactly 1 can interpolate towards it
+	struct Table{
+		float values[steps + 2];
+	};
+
+	static constexpr double ExpNegative(double u){
+		// Taylor series, u in [0, 1] converges well within these terms
+		double sum = 1.0;
+		double term = 1.0;
+		for (int n = 1; n < 24; n++) {
+			term *= -u / double(n);
+			sum += term;
+		}
+		return sum;
+	}
+	static constexpr Table BuildEase(){
+		Table table{};
+		for (int i = 0; i <= steps; i++) {
+			double x = double(i) / steps;
+			double t = 2.0 - 2.0 * x;
+			table.values[i] = float(x < 0.5 ? 4.0 * x * x * x : 1.0 - t * t * t / 2.0);
+		}
+		table.values[steps + 1] = table.values[steps];
+		return table;
+	}
+	static constexpr Table BuildGaussian(){
+		Table table{};
+		for (int i = 0; i <= steps; i++) {
+			double x = double(i) / steps;
+			table.values[i] = float(ExpNegative(x * x));
+		}
+		table.values[steps + 1] = table.values[steps];
+		return table;
+	}
+
+	static constexpr Table ease_table = BuildEase();
+	static constexpr Table gaussian_table = BuildGaussian();
+
+	// x clamped to [0, 1]
+	static float Lookup(const Table& table, float x){
+		float position = std::fmin(std::fmax(x, 0.0f), 1.0f) * float(steps);
+		int i = int(position);
+		float fraction = position - float(i);
+		return table.values[i] + (table.values[i + 1] - table.values[i]) * fraction;
+	}
+	static simd::Float Lookup(const Table& table, simd::Float x){
+		using namespace simd;
+		Float position = Min(Max(x, Set1(0.0f)), Set1(1.0f)) * Set1(float(steps));
+		Int i = ToInt(position);
+		Float fraction = position - ToFloat(i);
+		Float below = Gather(table.values, i);
+		Float above = Gather(table.values, i + Set1(int32_t(1)));
+		return below + (above - below) * fraction;
+	}
+
+	static float EaseInOutCubic(float x){
+		return Lookup(ease_table, x);
+	}
+	static float GaussianCurve(float x){
+		return Lookup(gaussian_table, std::fabs(x));
+	}
+	static simd::Float EaseInOutCubic(simd::Float x){
+		return Lookup(ease_table, x);
+	}
+	static simd::Float GaussianCurve(simd::Float x){
+		return Lookup(gaussian_table, simd::Max(x, -x));
+	}
+};
+
+#if defined(TERRAIN_CURVES_EXACT)
+	using BrushCurves = ExactCurves;
+#elif defined(TERRAIN_CURVES_TABLE)
+	using BrushCurves = TableCurves<1024>;
+#else
+	using BrushCurves = PolynomialCurves;
+#endif
@@ -0,0 +1,96 @@
+#pragma once
+
+#include "olcPixelGameEngine.h"
+#include "WorkerPool.h"
+
+#include <vector>
+
+// A tile of a brush area handed to one worker: the cells from..to (inclusive,
+// map coordinates) it is responsible for, and for halo kernels a private copy
+// of the field over the tile grown by halo cells on every side.
+struct BrushTile{
+	olc::vi2d from;
+	olc::vi2d to;
+	int halo = 0;
+	const float* cells = nullptr;
+	int stride = 0;
+
+	// field value at (x, y), which has to lie within the tile plus its halo
+	float Sample(int x, int y) const{
+		return cells[size_t(y - from.y + halo) * stride + (x - from.x + halo)];
+	}
+};
+
+// Runs brush kernels over their bounding box in square tiles spread across a
+// persistent WorkerPool. Tiles never overlap, so a kernel may write any cell of
+// its own tile into a shared buffer with no locking; writing the field itself
+// from tiles needs its chunks materialised first (MaterialiseRect).
+class BrushExecutor{
+	WorkerPool pool;
+	// one halo copy per worker
+	std::vector<std::vector<float>> halo_cells;
+
+	struct TileGrid{
+		olc::vi2d from;
+		olc::vi2d to;
+		int tiles_x = 0;
+		int count = 0;
+
+		TileGrid(olc::vi2d from, olc::vi2d to) : from(from), to(to){
+			if (from.x > to.x || from.y > to.y) {
+				return;
+			}
+			tiles_x = (to.x - from.x) / tile_size + 1;
+			count = tiles_x * ((to.y - from.y) / tile_size + 1);
+		}
+
+		void Tile(int index, olc::vi2d& tile_from, olc::vi2d& tile_to) const{
+			tile_from = from + olc::vi2d{ index % tiles_x, index / tiles_x } * tile_size;
+			tile_to = (tile_from + olc::vi2d{ tile_size - 1, tile_size - 1 }).min(to);
+		}
+	};
+
+public:
+	static constexpr int tile_size = 32;
+
+	explicit BrushExecutor(int worker_count = WorkerPool::DefaultWorkerCount()) : pool(worker_count){
+	}
+
+	WorkerPool& Pool(){
+		return pool;
+	}
+
+	// Calls kernel(tile_from, tile_to) for every tile of from..to (inclusive)
+	template <typename Kernel>
+	void ForEachTile(olc::vi2d from, olc::vi2d to, Kernel&& kernel){
+		TileGrid grid{ from, to };
+		pool.ParallelFor(grid.count, [&](int index, int){
+			olc::vi2d tile_from, tile_to;
+			grid.Tile(index, tile_from, tile_to);
+			kernel(tile_from, tile_to);
+		});
+	}
+
+	// Calls kernel(const BrushTile&) for every tile of from..to (inclusive), with
+	// the field read over the tile and halo cells around it (0 off the map) so
+	// neighbourhood kernels sample a flat buffer instead of the chunks
+	template <typename Field, typename Kernel>
+	void ForEachTile(const Field& field, olc::vi2d from, olc::vi2d to, int halo, Kernel&& kernel){
+		TileGrid grid{ from, to };
+		halo_cells.resize(pool.ThreadCount());
+		pool.ParallelFor(grid.count, [&](int index, int worker){
+			BrushTile tile;
+			grid.Tile(index, tile.from, tile.to);
+			tile.halo = halo;
+			tile.stride = tile.to.x - tile.from.x + 1 + 2 * halo;
+			int rows = tile.to.y - tile.from.y + 1 + 2 * halo;
+
+			std::vector<float>& cells = halo_cells[worker];
+			cells.resize(size_t(tile.stride) * rows);
+			field.ReadRect(tile.from - olc::vi2d{ halo, halo }, { tile.stride, rows }, cells.data(), 1, tile.stride);
+			tile.cells = cells.data();
+
+			kernel(static_cast<const BrushTile&>(tile));
+		});
+	}
+};
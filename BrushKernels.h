@@ -0,0 +1,111 @@
+#pragma once
+
+#include "BrushStampCache.h"
+#include "olcPixelGameEngine.h"
+
+#include <algorithm>
+
+// Brush kernels put together from policies at compile time, so each tool gets
+// a loop of its own with nothing left to decide per cell:
+//   falloff   the RadialMask the tool built its weights into (BrushStampCache.h)
+//   easing    the Curves the tool shaped its values with (BrushCurves.h)
+//   combine   how a weight and a value change a cell, the ops below
+//   cells     whether the brush is inside the map or over its edge
+// StampRadialMask() picks the cells policy for a stamp and runs the kernel.
+
+// Every op has Apply(current, value, weight) -> new value of a cell
+struct SubtractOp{
+	static float Apply(float current, float, float weight){
+		return current - weight;
+	}
+};
+
+struct AddOp{
+	static float Apply(float current, float, float weight){
+		return current + weight;
+	}
+};
+
+struct SetOp{
+	static float Apply(float, float value, float){
+		return value;
+	}
+};
+
+// weight is the share of the current value kept, as the blend masks hold it
+struct LerpOp{
+	static float Apply(float current, float value, float weight){
+		return value * (1 - weight) + current * weight;
+	}
+};
+
+// A brush wholly inside the map: its rows are used as they are
+struct InteriorCells{
+	template <typename Field>
+	static bool ClipRow(const Field&, int, int&, int&){
+		return true;
+	}
+};
+
+// A brush over the map's edge: rows off it are skipped and the rest are clipped
+struct EdgeCells{
+	template <typename Field>
+	static bool ClipRow(const Field& field, int y, int& from_x, int& to_x){
+		if (y < 0 || y >= field.Height()) {
+			return false;
+		}
+		from_x = std::max(from_x, 0);
+		to_x = std::min(to_x, field.Width() - 1);
+		return from_x <= to_x;
+	}
+};
+
+// Combines the cells of mask around centre with value(x, y) and the mask's
+// weights, for the offsets from..to (inclusive) of it; cells outside the
+// mask's spans are left alone. Field chunks have to be materialised first when
+// several threads run this on distinct offsets at once.
+template <typename Combine, typename Cells, typename Field, typename Value>
+void ApplyRadialMask(Field& field, olc::vi2d centre, const RadialMask& mask, olc::vi2d from, olc::vi2d to, Value&& value){
+	using traits = typename Field::traits;
+	using Cell = typename Field::cell_type;
+
+	for (int y = from.y; y <= to.y; y++) {
+		int span = mask.Span(y);
+		int from_x = centre.x + std::max(from.x, -span);
+		int to_x = centre.x + std::min(to.x, span);
+		int y0 = centre.y + y;
+		if (from_x > to_x || !Cells::ClipRow(field, y0, from_x, to_x)) {
+			continue;
+		}
+
+		field.EditSpan(from_x, to_x, y0, [&](Cell* cells, int x0, int count) {
+			int x = x0 - centre.x;
+			const float* weights = mask.Row(y) + x;
+			for (int i = 0; i < count; i++) {
+				float current = traits::ToFloat(cells[i]);
+				cells[i] = traits::FromFloat(Combine::Apply(current, value(x + i, y), weights[i]));
+			}
+		});
+	}
+}
+
+template <typename Combine, typename Field, typename Value>
+void StampRadialMask(Field& field, olc::vi2d centre, const RadialMask& mask, olc::vi2d from, olc::vi2d to, Value&& value){
+	olc::vi2d radius{ mask.Radius(), mask.Radius() };
+	olc::vi2d map_end{ field.Width() - 1, field.Height() - 1 };
+	bool inside = (centre - radius).x >= 0 && (centre - radius).y >= 0
+		&& (centre + radius).x <= map_end.x && (centre + radius).y <= map_end.y;
+	if (inside) {
+		ApplyRadialMask<Combine, InteriorCells>(field, centre, mask, from, to, value);
+	}
+	else {
+		ApplyRadialMask<Combine, EdgeCells>(field, centre, mask, from, to, value);
+	}
+}
+
+// The whole mask around centre
+template <typename Combine, typename Field, typename Value>
+void StampRadialMask(Field& field, olc::vi2d centre, const RadialMask& mask, Value&& value){
+	olc::vi2d radius{ mask.Radius(), mask.Radius() };
+	StampRadialMask<Combine>(field, centre, mask, -radius, radius, value);
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include "Simd.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+// Per cell weights of a round brush stamp around its centre, computed once for
+// a brush size instead of for every cell of every stamp. Rows are addressed by
+// offset from the centre, and each knows the half width of its span of cells
+// inside the brush (the brushes are symmetric circles, so a row's span is too).
+// Cells outside it hold outside_weight, as do simd::width cells of padding
+// past every row, so a packet that starts inside a span can run over its end.
+class RadialMask{
+	int radius = -1;
+	ptrdiff_t stride = 0;
+	std::vector<float> weights;
+	std::vector<int> spans;
+
+public:
+	// inside(x, y) and weight(x, y) for the offsets in -radius..radius
+	template <typename Inside, typename Weight>
+	void Build(int radius, float outside_weight, Inside inside, Weight weight){
+		this->radius = radius;
+		stride = 2 * radius + 1 + simd::width;
+		weights.assign(size_t(stride) * (2 * radius + 1), outside_weight);
+		spans.assign(size_t(2 * radius + 1), -1);
+		for (int y = -radius; y <= radius; y++) {
+			float* row = weights.data() + (y + radius) * stride + radius;
+			for (int x = -radius; x <= radius; x++) {
+				if (inside(x, y)) {
+					row[x] = weight(x, y);
+					spans[y + radius] = std::max(spans[y + radius], x < 0 ? -x : x);
+				}
+			}
+		}
+	}
+
+	int Radius() const{
+		return radius;
+	}
+
+	// Weights of row y, indexed by x offset from -Radius() to Radius() (+ padding)
+	const float* Row(int y) const{
+		return weights.data() + (y + radius) * stride + radius;
+	}
+
+	// Cells -Span(y)..Span(y) of row y are inside; -1 if none are
+	int Span(int y) const{
+		return spans[y + radius];
+	}
+};
+
+// What a cached stamp was built for; fields a tool doesn't use stay 0
+struct StampKey{
+	int tool = 0;
+	int brush_size = 0;
+	// rays of a cone
+	int ray_count = 0;
+	float angle = 0.0f;
+	float step = 0.0f;
+
+	bool operator==(const StampKey& other) const{
+		return tool == other.tool && brush_size == other.brush_size && ray_count == other.ray_count
+			&& angle == other.angle && step == other.step;
+	}
+};
+
+// The last few stamps of one kind, most recently used first. Get() builds a
+// stamp the first time its key comes up, so going back and forth between a
+// couple of brush sizes doesn't rebuild either.
+template <typename Stamp>
+class StampCache{
+	std::vector<std::pair<StampKey, Stamp>> entries;
+
+public:
+	size_t capacity = 8;
+
+	// build(stamp) fills in a stamp for key when it isn't cached
+	template <typename Build>
+	const Stamp& Get(const StampKey& key, Build build){
+		for (size_t i = 0; i < entries.size(); i++) {
+			if (entries[i].first == key) {
+				std::rotate(entries.begin(), entries.begin() + i, entries.begin() + i + 1);
+				return entries.front().second;
+			}
+		}
+
+		if (entries.size() >= capacity && !entries.empty()) {
+			entries.pop_back();
+		}
+		entries.insert(entries.begin(), { key, Stamp{} });
+		build(entries.front().second);
+		return entries.front().second;
+	}
+
+	void Clear(){
+		entries.clear();
+	}
+};
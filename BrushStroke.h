@@ -0,0 +1,66 @@
+#pragma once
+
+#include "olcPixelGameEngine.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// Where a brush is applied from: the tools cast from the player towards the mouse
+struct BrushStamp{
+	olc::vf2d player_pos;
+	olc::vf2d mouse_pos;
+};
+
+// Turns a held button into stamps at a fixed rate, whatever the frame rate.
+// The first stamp lands as the button goes down; after that one is due every
+// interval seconds, the unspent time carries over between frames, and each
+// stamp is placed where the player and mouse were at its moment, interpolated
+// between the previous frame and this one.
+class StrokeTimer{
+	olc::vf2d last_player_pos;
+	olc::vf2d last_mouse_pos;
+	float carried = 0.0f;
+	bool active = false;
+
+public:
+	float interval;
+	// a very slow frame drops the stamps past this instead of stalling the next one
+	int max_stamps_per_frame = 8;
+
+	explicit StrokeTimer(float interval) : interval(interval){
+	}
+
+	// Appends the stamps due this frame to stamps
+	void Advance(bool held, float elapsed_time, olc::vf2d player_pos, olc::vf2d mouse_pos, std::vector<BrushStamp>& stamps){
+		if (!held) {
+			Stop();
+			return;
+		}
+
+		if (!active) {
+			active = true;
+			carried = 0.0f;
+			stamps.push_back({ player_pos, mouse_pos });
+		}
+		else if (interval > 0.0f && elapsed_time > 0.0f) {
+			float previous = carried;
+			carried += elapsed_time;
+			// a little slack so a stamp due exactly at the end of the frame isn't lost to rounding
+			int count = int(std::floor(carried / interval + 1e-3f));
+			for (int i = 1; i <= std::min(count, max_stamps_per_frame); i++) {
+				// how far into this frame stamp i is due
+				float t = std::min((float(i) * interval - previous) / elapsed_time, 1.0f);
+				stamps.push_back({ last_player_pos + (player_pos - last_player_pos) * t, last_mouse_pos + (mouse_pos - last_mouse_pos) * t });
+			}
+			carried = count > max_stamps_per_frame ? 0.0f : std::max(carried - float(count) * interval, 0.0f);
+		}
+
+		last_player_pos = player_pos;
+		last_mouse_pos = mouse_pos;
+	}
+
+	void Stop(){
+		active = false;
+	}
+};
@@ -0,0 +1,335 @@
+#pragma once
+
+#include "TerrainFile.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Reads the chunks of a TerrainFile in on a thread of its own, so the frame
+// never waits for the disk. Every Update() asks for the chunks Ensure() is
+// still waiting on, then those of the view and of the tools' reach around the
+// player, then for where both are heading judging by how they moved, nearest
+// first; blocks decoded since the last
+// Update() are installed, and a chunk stays its mean value until then. Once
+// more chunks are in memory than max_resident_chunks, the farthest ones that
+// match the file again are evicted.
+//
+// Everything but the decoding happens on the calling thread, which must also
+// be the one editing the field. Saves go through Save() and SaveAs(), which
+// wait for a decode in progress rather than moving the file under it.
+template <typename Field>
+class ChunkStreamer{
+	using Block = typename Field::Block;
+	static constexpr int chunk_size = Field::chunk_size;
+
+	enum : uint8_t{ idle, queued, loading };
+
+	struct Loaded{
+		int chunk_index;
+		uint32_t generation;
+		std::unique_ptr<Block> block;
+	};
+
+	TerrainFile<Field>& file;
+	Field& field;
+
+	std::thread thread;
+	// guards requests, state, loaded and stopping
+	std::mutex mutex;
+	std::condition_variable work_ready;
+	std::deque<int> requests;
+	std::vector<uint8_t> state;
+	std::vector<Loaded> loaded;
+	bool stopping = false;
+	// held while the file is read from or written to
+	std::mutex file_mutex;
+
+	// bumped by every eviction, so a block read before one is not installed after it
+	std::vector<uint32_t> generation;
+	// the Update() that last wanted each chunk
+	std::vector<uint32_t> wanted_in;
+	uint32_t update_count = 0;
+	// the chunks Ensure() asked for, read before wanted until they are installed
+	std::vector<int> ensured;
+	std::vector<std::pair<float, int>> wanted;
+	std::vector<std::pair<float, int>> resident;
+	std::vector<Loaded> installing;
+
+	void WorkerLoop(){
+		std::unique_lock<std::mutex> lock(mutex);
+		while (true) {
+			work_ready.wait(lock, [&]{ return stopping || !requests.empty(); });
+			if (stopping) {
+				return;
+			}
+			int chunk_index = requests.front();
+			requests.pop_front();
+			state[chunk_index] = loading;
+			uint32_t chunk_generation = generation[chunk_index];
+			lock.unlock();
+
+			auto block = std::make_unique<Block>(chunk_size, chunk_size);
+			bool decoded;
+			{
+				std::lock_guard<std::mutex> file_lock(file_mutex);
+				decoded = file.Decode(chunk_index, *block);
+			}
+
+			lock.lock();
+			if (!decoded) {
+				// a broken payload stays the mean
+				block.reset();
+			}
+			loaded.push_back({ chunk_index, chunk_generation, std::move(block) });
+		}
+	}
+
+	// the file may have been opened again since the last call
+	void Prepare(){
+		size_t chunk_count = size_t(file.ChunkCount());
+		if (state.size() == chunk_count) {
+			return;
+		}
+		Stop();
+		state.assign(chunk_count, idle);
+		generation.assign(chunk_count, 0);
+		wanted_in.assign(chunk_count, 0);
+		ensured.clear();
+		requests.clear();
+		loaded.clear();
+	}
+
+	// Adds the pending chunks overlapping from..to to wanted, ranked after every
+	// chunk of the areas added before and by distance to centre
+	void Want(olc::vf2d from, olc::vf2d to, olc::vf2d centre, float rank){
+		olc::vi2d last_chunk = olc::vi2d{ field.ChunksX(), field.ChunksY() } - olc::vi2d{ 1, 1 };
+		olc::vi2d chunk_from = (olc::vi2d(from.floor()) / chunk_size).max({ 0, 0 });
+		olc::vi2d chunk_to = (olc::vi2d(to.ceil()) / chunk_size).min(last_chunk);
+		for (int chunk_y = chunk_from.y; chunk_y <= chunk_to.y; chunk_y++) {
+			for (int chunk_x = chunk_from.x; chunk_x <= chunk_to.x; chunk_x++) {
+				int chunk_index = chunk_y * field.ChunksX() + chunk_x;
+				if (wanted_in[chunk_index] == update_count) {
+					continue;
+				}
+				wanted_in[chunk_index] = update_count;
+				if (file.IsPending(chunk_index)) {
+					olc::vf2d chunk_centre = olc::vf2d(field.ChunkOrigin(chunk_x, chunk_y)) + olc::vf2d{ 0.5f, 0.5f } * float(chunk_size);
+					wanted.push_back({ rank + (chunk_centre - centre).mag(), chunk_index });
+				}
+			}
+		}
+	}
+
+	void Install(){
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			std::swap(installing, loaded);
+			for (const Loaded& block : installing) {
+				state[block.chunk_index] = idle;
+			}
+		}
+		for (Loaded& block : installing) {
+			if (block.block && block.generation == generation[block.chunk_index]) {
+				file.Install(block.chunk_index, std::move(block.block));
+			}
+		}
+		installing.clear();
+	}
+
+	void Evict(olc::vf2d player_pos){
+		resident.clear();
+		for (int chunk_index = 0; chunk_index < file.ChunkCount(); chunk_index++) {
+			int chunk_x = chunk_index % field.ChunksX();
+			int chunk_y = chunk_index / field.ChunksX();
+			if (!file.IsPending(chunk_index) && !field.GetChunk(chunk_x, chunk_y).IsUniform()) {
+				olc::vf2d chunk_centre = olc::vf2d(field.ChunkOrigin(chunk_x, chunk_y)) + olc::vf2d{ 0.5f, 0.5f } * float(chunk_size);
+				resident.push_back({ (chunk_centre - player_pos).mag2(), chunk_index });
+			}
+		}
+		if (resident.size() <= max_resident_chunks) {
+			return;
+		}
+
+		// farthest first
+		std::sort(resident.begin(), resident.end(), [](const auto& a, const auto& b){ return a.first > b.first; });
+		size_t excess = resident.size() - max_resident_chunks;
+		for (size_t i = 0; i < resident.size() && excess > 0; i++) {
+			int chunk_index = resident[i].second;
+			if (wanted_in[chunk_index] != update_count && file.Evict(chunk_index)) {
+				// the workers compare generations under the mutex
+				std::lock_guard<std::mutex> lock(mutex);
+				generation[chunk_index]++;
+				excess--;
+			}
+		}
+	}
+
+public:
+	// chunks kept in memory, not counting uniform ones and those edited since the last save
+	size_t max_resident_chunks = 4096;
+	// seconds ahead of the player and view to read chunks for
+	float lookahead = 1.0f;
+	// cells around the view, so a small pan doesn't show placeholders
+	float view_margin = float(chunk_size);
+	// Update() calls between resident chunk counts when nothing was installed
+	int evict_interval = 30;
+
+	ChunkStreamer(TerrainFile<Field>& file, Field& field) : file(file), field(field){
+	}
+	~ChunkStreamer(){
+		Stop();
+	}
+
+	ChunkStreamer(const ChunkStreamer&) = delete;
+	ChunkStreamer& operator=(const ChunkStreamer&) = delete;
+
+	// Waits for the chunk being read, if any, and drops the rest of the requests
+	void Stop(){
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+			requests.clear();
+		}
+		work_ready.notify_all();
+		if (thread.joinable()) {
+			thread.join();
+		}
+		stopping = false;
+		loaded.clear();
+		std::fill(state.begin(), state.end(), idle);
+	}
+
+	// Once a frame: reach is how far the tools work from player_pos, velocities are in cells per second
+	void Update(olc::vf2d player_pos, olc::vf2d player_velocity, float reach, olc::vf2d view_tl, olc::vf2d view_br, olc::vf2d view_velocity){
+		if (!file.IsOpen()) {
+			return;
+		}
+		Prepare();
+		bool installed = false;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			installed = !loaded.empty();
+		}
+		Install();
+		update_count++;
+
+		// wanted this Update() too, so one installed just now isn't evicted before it's used
+		size_t still_pending = 0;
+		for (int chunk_index : ensured) {
+			wanted_in[chunk_index] = update_count;
+			if (file.IsPending(chunk_index)) {
+				ensured[still_pending++] = chunk_index;
+			}
+		}
+		ensured.resize(still_pending);
+
+		olc::vf2d margin{ view_margin, view_margin };
+		olc::vf2d view_centre = (view_tl + view_br) * 0.5f;
+		olc::vf2d reach_size{ reach, reach };
+		olc::vf2d player_ahead = player_velocity * lookahead;
+		olc::vf2d view_ahead = view_velocity * lookahead;
+		// every chunk of an area comes before those of the next
+		float rank = float(field.Width() + field.Height()) * 2.0f;
+
+		wanted.clear();
+		Want(view_tl - margin, view_br + margin, view_centre, 0.0f);
+		Want(player_pos - reach_size, player_pos + reach_size, player_pos, rank);
+		Want(view_tl + view_ahead - margin, view_br + view_ahead + margin, view_centre + view_ahead, rank * 2.0f);
+		Want(player_pos + player_ahead - reach_size, player_pos + player_ahead + reach_size, player_pos + player_ahead, rank * 2.0f);
+		std::sort(wanted.begin(), wanted.end());
+		// asking for more than fits would evict what was just read
+		if (wanted.size() > max_resident_chunks) {
+			wanted.resize(max_resident_chunks);
+		}
+
+		if ((!wanted.empty() || !ensured.empty()) && !thread.joinable()) {
+			thread = std::thread([this]{ WorkerLoop(); });
+		}
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			for (int chunk_index : requests) {
+				state[chunk_index] = idle;
+			}
+			requests.clear();
+			for (int chunk_index : ensured) {
+				if (state[chunk_index] == idle) {
+					state[chunk_index] = queued;
+					requests.push_back(chunk_index);
+				}
+			}
+			for (const auto& chunk : wanted) {
+				if (state[chunk.second] == idle) {
+					state[chunk.second] = queued;
+					requests.push_back(chunk.second);
+				}
+			}
+		}
+		work_ready.notify_one();
+
+		if (installed || update_count % uint32_t(std::max(evict_interval, 1)) == 0) {
+			Evict(player_pos);
+		}
+	}
+
+	// True if every chunk overlapping from..to (inclusive) is in memory; the
+	// missing ones are read next, and ahead of what Update() wants until they are in
+	bool Ensure(olc::vi2d from, olc::vi2d to){
+		if (!file.IsOpen() || file.PendingChunks() == 0) {
+			return true;
+		}
+		Prepare();
+		from = from.max({ 0, 0 });
+		to = to.min(field.Size() - olc::vi2d{ 1, 1 });
+		bool resident = true;
+		bool requested = false;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			for (int chunk_y = from.y / chunk_size; chunk_y <= to.y / chunk_size; chunk_y++) {
+				for (int chunk_x = from.x / chunk_size; chunk_x <= to.x / chunk_size; chunk_x++) {
+					int chunk_index = chunk_y * field.ChunksX() + chunk_x;
+					if (!file.IsPending(chunk_index)) {
+						continue;
+					}
+					resident = false;
+					if (std::find(ensured.begin(), ensured.end(), chunk_index) == ensured.end()) {
+						ensured.push_back(chunk_index);
+					}
+					if (state[chunk_index] == idle) {
+						state[chunk_index] = queued;
+						requests.push_front(chunk_index);
+						requested = true;
+					}
+				}
+			}
+		}
+		if (requested) {
+			if (!thread.joinable()) {
+				thread = std::thread([this]{ WorkerLoop(); });
+			}
+			work_ready.notify_one();
+		}
+		return resident;
+	}
+
+	bool EnsureChunk(int chunk_index){
+		olc::vi2d origin = field.ChunkOrigin(chunk_index % field.ChunksX(), chunk_index / field.ChunksX());
+		return Ensure(origin, origin);
+	}
+
+	bool Save(){
+		std::lock_guard<std::mutex> file_lock(file_mutex);
+		return file.Save();
+	}
+
+	bool SaveAs(const std::string& path){
+		std::lock_guard<std::mutex> file_lock(file_mutex);
+		return file.SaveAs(field, path);
+	}
+};
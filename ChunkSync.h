@@ -0,0 +1,176 @@
+#pragma once
+
+#include "ChunkedDensityField.h"
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Keeps the chunks of a field comparable between the peers of an editing
+// session. Every chunk has a version, bumped each time an op writes to it
+// (Commit() after each op): peers applying the same ops in the same order hold
+// the same versions, and with them the same cells. Checksum() and the version
+// let a peer tell whether its copy of a chunk has drifted from the host's, and
+// Encode() / Decode() replace it with the host's when it has. Cells go as runs
+// of (uint16 length, cell) over the chunk's extent, a uniform chunk being one run.
+template <typename Field>
+class ChunkSync{
+	using Cell = typename Field::cell_type;
+
+	Field* field = nullptr;
+	ChunkDirtyTracker dirty;
+	std::vector<uint32_t> versions;
+	// written since the last TakeChanged()
+	std::vector<uint8_t> changed;
+	std::vector<int> changed_chunks;
+
+	olc::vi2d ChunkXY(int index) const{
+		return { index % field->ChunksX(), index / field->ChunksX() };
+	}
+
+	template <typename Func>
+	void ForEachCell(int index, Func&& func) const{
+		olc::vi2d chunk_xy = ChunkXY(index);
+		const typename Field::Chunk& chunk = field->GetChunk(chunk_xy.x, chunk_xy.y);
+		olc::vi2d extent = field->ChunkExtent(chunk_xy.x, chunk_xy.y);
+		for (int y = 0; y < extent.y; y++) {
+			for (int x = 0; x < extent.x; x++) {
+				func(chunk.GetCell(x, y));
+			}
+		}
+	}
+
+public:
+	~ChunkSync(){
+		Detach();
+	}
+
+	void Attach(Field& field){
+		Detach();
+		this->field = &field;
+		field.AddDirtyTracker(&dirty);
+		size_t count = size_t(field.ChunksX()) * field.ChunksY();
+		versions.assign(count, 0);
+		changed.assign(count, 0);
+		changed_chunks.clear();
+	}
+
+	void Detach(){
+		if (field) {
+			field->RemoveDirtyTracker(&dirty);
+			field = nullptr;
+		}
+	}
+
+	// Writes before the session started don't count
+	void Discard(){
+		dirty.Consume([](int, int, olc::vi2d, olc::vi2d){});
+	}
+
+	// Bumps the versions of the chunks written since the last call
+	void Commit(){
+		dirty.Consume([&](int chunk_x, int chunk_y, olc::vi2d, olc::vi2d){
+			int index = chunk_y * field->ChunksX() + chunk_x;
+			versions[index]++;
+			if (!changed[index]) {
+				changed[index] = 1;
+				changed_chunks.push_back(index);
+			}
+		});
+	}
+
+	uint32_t Version(int index) const{
+		return versions[index];
+	}
+
+	size_t ChunkCount() const{
+		return versions.size();
+	}
+
+	// FNV-1a of the chunk's cells inside the map
+	uint64_t Checksum(int index) const{
+		uint64_t hash = 14695981039346656037ull;
+		ForEachCell(index, [&](Cell cell) {
+			for (size_t i = 0; i < sizeof(cell); i++) {
+				hash = (hash ^ ((uint64_t(cell) >> (8 * i)) & 0xff)) * 1099511628211ull;
+			}
+		});
+		return hash;
+	}
+
+	// Hands over the chunks Commit() bumped since the last call
+	void TakeChanged(std::vector<int>& chunks){
+		chunks.swap(changed_chunks);
+		changed_chunks.clear();
+		for (int index : chunks) {
+			changed[index] = 0;
+		}
+	}
+
+	// Appends the chunk's cells to out
+	void Encode(int index, std::vector<uint8_t>& out) const{
+		uint16_t length = 0;
+		Cell value = Cell();
+		auto flush = [&]() {
+			const uint8_t* run_length = reinterpret_cast<const uint8_t*>(&length);
+			const uint8_t* run_value = reinterpret_cast<const uint8_t*>(&value);
+			out.insert(out.end(), run_length, run_length + sizeof(length));
+			out.insert(out.end(), run_value, run_value + sizeof(value));
+		};
+		ForEachCell(index, [&](Cell cell) {
+			if (length > 0 && (cell != value || length == UINT16_MAX)) {
+				flush();
+				length = 0;
+			}
+			value = cell;
+			length++;
+		});
+		if (length > 0) {
+			flush();
+		}
+	}
+
+	// Replaces the chunk's cells with Encode()'s output and takes version as its
+	// own; false (nothing written) if the data doesn't cover the chunk exactly
+	// or has an empty run, which Encode() never writes
+	bool Decode(int index, uint32_t version, const uint8_t* data, size_t size){
+		olc::vi2d chunk_xy = ChunkXY(index);
+		olc::vi2d origin = field->ChunkOrigin(chunk_xy.x, chunk_xy.y);
+		olc::vi2d extent = field->ChunkExtent(chunk_xy.x, chunk_xy.y);
+		constexpr size_t run_size = sizeof(uint16_t) + sizeof(Cell);
+
+		size_t total = 0;
+		for (size_t at = 0; at + run_size <= size; at += run_size) {
+			uint16_t length;
+			std::memcpy(&length, data + at, sizeof(length));
+			if (length == 0) {
+				return false;
+			}
+			total += length;
+		}
+		if (size % run_size != 0 || total != size_t(extent.x) * extent.y) {
+			return false;
+		}
+
+		size_t at = 0;
+		uint16_t left = 0;
+		Cell value = Cell();
+		for (int y = 0; y < extent.y; y++) {
+			field->EditSpan(origin.x, origin.x + extent.x - 1, origin.y + y, [&](Cell* cells, int, int count) {
+				for (int i = 0; i < count; i++) {
+					if (left == 0) {
+						std::memcpy(&left, data + at, sizeof(left));
+						std::memcpy(&value, data + at + sizeof(left), sizeof(value));
+						at += run_size;
+					}
+					cells[i] = value;
+					left--;
+				}
+			});
+		}
+		// everyone else redraws it, the version is the host's
+		field->MarkDirty(origin, origin + extent - olc::vi2d{ 1, 1 }, &dirty);
+		versions[index] = version;
+		return true;
+	}
+};
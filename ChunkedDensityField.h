@@ -0,0 +1,420 @@
+#pragma once
+
+#include "DensityField.h"
+
+#include <memory>
+
+// Per-chunk dirty rectangles for one consumer of a chunked field (display,
+// caches, ...). Regions are kept in chunk-local cells, both ends inclusive.
+class ChunkDirtyTracker{
+	struct Region{
+		olc::vi2d from;
+		olc::vi2d to;
+		bool dirty = false;
+	};
+
+	std::vector<Region> regions;
+	std::vector<int> dirty_chunks;
+	int chunks_x = 0;
+	int chunk_size_log2 = 0;
+
+public:
+	void Resize(int chunks_x, int chunks_y, int chunk_size_log2){
+		this->chunks_x = chunks_x;
+		this->chunk_size_log2 = chunk_size_log2;
+		regions.assign(size_t(chunks_x) * chunks_y, Region{});
+		dirty_chunks.clear();
+	}
+
+	// from and to are map cells, inclusive, already clipped to the map
+	void Mark(olc::vi2d from, olc::vi2d to){
+		int chunk_mask = (1 << chunk_size_log2) - 1;
+		for (int chunk_y = from.y >> chunk_size_log2; chunk_y <= to.y >> chunk_size_log2; chunk_y++) {
+			for (int chunk_x = from.x >> chunk_size_log2; chunk_x <= to.x >> chunk_size_log2; chunk_x++) {
+				olc::vi2d origin{ chunk_x << chunk_size_log2, chunk_y << chunk_size_log2 };
+				olc::vi2d local_from = (from - origin).max({ 0, 0 });
+				olc::vi2d local_to = (to - origin).min({ chunk_mask, chunk_mask });
+
+				int index = chunk_y * chunks_x + chunk_x;
+				Region& region = regions[index];
+				if (!region.dirty) {
+					region = Region{ local_from, local_to, true };
+					dirty_chunks.push_back(index);
+				}
+				else {
+					region.from = region.from.min(local_from);
+					region.to = region.to.max(local_to);
+				}
+			}
+		}
+	}
+
+	bool Empty() const{
+		return dirty_chunks.empty();
+	}
+
+	bool IsDirty(int chunk_x, int chunk_y) const{
+		return regions[size_t(chunk_y) * chunks_x + chunk_x].dirty;
+	}
+
+	// Calls func(chunk_x, chunk_y, local_from, local_to) for every dirty chunk and clears them
+	template <typename Func>
+	void Consume(Func&& func){
+		for (int index : dirty_chunks) {
+			Region& region = regions[index];
+			func(index % chunks_x, index / chunks_x, region.from, region.to);
+			region.dirty = false;
+		}
+		dirty_chunks.clear();
+	}
+};
+
+// Sparse terrain store made of fixed size square chunks in a paged grid.
+// A chunk whose cells all hold the same value (typically fully empty or fully
+// solid) is kept as that single value; cell storage is only allocated once a
+// write makes it non-uniform. Compact() folds edited chunks back to a value when
+// they become uniform again, so memory follows edited detail rather than area.
+template <typename T>
+class ChunkedDensityField{
+public:
+	static constexpr int chunk_size_log2 = 6;
+	static constexpr int chunk_size = 1 << chunk_size_log2;
+	static constexpr int chunk_mask = chunk_size - 1;
+
+	using cell_type = T;
+	using traits = DensityTraits<T>;
+	using Block = DensityField<T>;
+
+	struct Chunk{
+		// null while every cell of the chunk holds uniform_value
+		std::unique_ptr<Block> cells;
+		T uniform_value = T();
+		bool touched = false;
+
+		bool IsUniform() const{
+			return !cells;
+		}
+		T GetCell(int local_x, int local_y) const{
+			return cells ? cells->GetCellUnchecked(local_x, local_y) : uniform_value;
+		}
+	};
+
+	// Told about a chunk right before its first write since the last Compact(),
+	// while it still holds the old cells; writes made by filling the whole map,
+	// or straight into Chunk::cells, aren't reported
+	class WriteListener{
+	public:
+		virtual void BeforeWrite(int chunk_index, const Chunk& chunk) = 0;
+
+	protected:
+		~WriteListener() = default;
+	};
+
+private:
+	std::vector<Chunk> chunks;
+	std::vector<int> touched_chunks;
+	std::vector<ChunkDirtyTracker*> dirty_trackers;
+	WriteListener* write_listener = nullptr;
+	int width = 0;
+	int height = 0;
+	int chunks_x = 0;
+	int chunks_y = 0;
+
+	Chunk& ChunkAt(int x, int y){
+		return chunks[size_t(y >> chunk_size_log2) * chunks_x + (x >> chunk_size_log2)];
+	}
+	const Chunk& ChunkAt(int x, int y) const{
+		return chunks[size_t(y >> chunk_size_log2) * chunks_x + (x >> chunk_size_log2)];
+	}
+
+	// gives the chunk writable storage, expanding its uniform value into cells
+	Block& Materialise(Chunk& chunk, int chunk_index){
+		if (!chunk.touched) {
+			if (write_listener) {
+				write_listener->BeforeWrite(chunk_index, chunk);
+			}
+			chunk.touched = true;
+			touched_chunks.push_back(chunk_index);
+		}
+		if (!chunk.cells) {
+			chunk.cells = std::make_unique<Block>(chunk_size, chunk_size, chunk.uniform_value);
+		}
+		return *chunk.cells;
+	}
+
+	Block& Materialise(int x, int y){
+		int index = (y >> chunk_size_log2) * chunks_x + (x >> chunk_size_log2);
+		return Materialise(chunks[index], index);
+	}
+
+public:
+	ChunkedDensityField() = default;
+
+	ChunkedDensityField(int width, int height) : width(width), height(height){
+		chunks_x = (width + chunk_mask) >> chunk_size_log2;
+		chunks_y = (height + chunk_mask) >> chunk_size_log2;
+		chunks.resize(size_t(chunks_x) * size_t(chunks_y));
+	}
+
+	int Width() const{
+		return width;
+	}
+	int Height() const{
+		return height;
+	}
+	olc::vi2d Size() const{
+		return { width, height };
+	}
+	int ChunksX() const{
+		return chunks_x;
+	}
+	int ChunksY() const{
+		return chunks_y;
+	}
+
+	bool Contains(int x, int y) const{
+		return x >= 0 && x < width && y >= 0 && y < height;
+	}
+
+	Chunk& GetChunk(int chunk_x, int chunk_y){
+		return chunks[size_t(chunk_y) * chunks_x + chunk_x];
+	}
+	const Chunk& GetChunk(int chunk_x, int chunk_y) const{
+		return chunks[size_t(chunk_y) * chunks_x + chunk_x];
+	}
+
+	// Trackers receive every MarkDirty() from now on; they must outlive the field or be removed
+	void AddDirtyTracker(ChunkDirtyTracker* tracker){
+		tracker->Resize(chunks_x, chunks_y, chunk_size_log2);
+		dirty_trackers.push_back(tracker);
+	}
+	void RemoveDirtyTracker(ChunkDirtyTracker* tracker){
+		dirty_trackers.erase(std::remove(dirty_trackers.begin(), dirty_trackers.end(), tracker), dirty_trackers.end());
+	}
+
+	// At most one; null removes it
+	void SetWriteListener(WriteListener* listener){
+		write_listener = listener;
+	}
+
+	// Writers report the region they edited (inclusive, clipped here) once per
+	// operation instead of per cell; Fill() reports the whole map itself. A
+	// writer that is itself a tracker (a loader, say) passes it as skip.
+	void MarkDirty(olc::vi2d from, olc::vi2d to, const ChunkDirtyTracker* skip = nullptr){
+		from = from.max({ 0, 0 });
+		to = to.min({ width - 1, height - 1 });
+		if (from.x > to.x || from.y > to.y) {
+			return;
+		}
+		for (ChunkDirtyTracker* tracker : dirty_trackers) {
+			if (tracker != skip) {
+				tracker->Mark(from, to);
+			}
+		}
+	}
+
+	// map area covered by a chunk, clipped to the map edge
+	olc::vi2d ChunkOrigin(int chunk_x, int chunk_y) const{
+		return { chunk_x << chunk_size_log2, chunk_y << chunk_size_log2 };
+	}
+	olc::vi2d ChunkExtent(int chunk_x, int chunk_y) const{
+		olc::vi2d origin = ChunkOrigin(chunk_x, chunk_y);
+		return { std::min(chunk_size, width - origin.x), std::min(chunk_size, height - origin.y) };
+	}
+
+	T GetCell(int x, int y) const{
+		return Contains(x, y) ? GetCellUnchecked(x, y) : T();
+	}
+	T GetCellUnchecked(int x, int y) const{
+		return ChunkAt(x, y).GetCell(x & chunk_mask, y & chunk_mask);
+	}
+	void SetCellUnchecked(int x, int y, T value){
+		Chunk& chunk = ChunkAt(x, y);
+		if (chunk.IsUniform() && chunk.uniform_value == value) {
+			return;
+		}
+		Materialise(x, y).SetCellUnchecked(x & chunk_mask, y & chunk_mask, value);
+	}
+
+	float Get(int x, int y) const{
+		return traits::ToFloat(GetCell(x, y));
+	}
+	float Get(olc::vi2d pos) const{
+		return Get(pos.x, pos.y);
+	}
+	float GetUnchecked(int x, int y) const{
+		return traits::ToFloat(GetCellUnchecked(x, y));
+	}
+
+	void Set(int x, int y, float value){
+		if (Contains(x, y)) {
+			SetUnchecked(x, y, value);
+		}
+	}
+	void Set(olc::vi2d pos, float value){
+		Set(pos.x, pos.y, value);
+	}
+	void SetUnchecked(int x, int y, float value){
+		SetCellUnchecked(x, y, traits::FromFloat(value));
+	}
+
+	// drops every chunk buffer
+	void Fill(float value){
+		T cell = traits::FromFloat(value);
+		for (Chunk& chunk : chunks) {
+			chunk.cells.reset();
+			chunk.uniform_value = cell;
+			chunk.touched = false;
+		}
+		touched_chunks.clear();
+		MarkDirty({ 0, 0 }, { width - 1, height - 1 });
+	}
+
+	// from and to inclusive, clipped to the map
+	void FillSpan(int from_x, int to_x, int y, float value){
+		if (y < 0 || y >= height) {
+			return;
+		}
+		from_x = std::max(from_x, 0);
+		to_x = std::min(to_x, width - 1);
+
+		T cell = traits::FromFloat(value);
+		while (from_x <= to_x) {
+			int chunk_end = std::min(to_x, from_x | chunk_mask);
+			Chunk& chunk = ChunkAt(from_x, y);
+			if (!chunk.IsUniform() || chunk.uniform_value != cell) {
+				T* row = Materialise(from_x, y).Row(y & chunk_mask);
+				std::fill(row + (from_x & chunk_mask), row + (chunk_end & chunk_mask) + 1, cell);
+			}
+			from_x = chunk_end + 1;
+		}
+	}
+
+	// Gives every chunk overlapping from..to (inclusive, clipped) its cell buffer
+	// up front. Writes inside the rect then only touch cells, so several threads
+	// may write distinct cells of it at once.
+	void MaterialiseRect(olc::vi2d from, olc::vi2d to){
+		from = from.max({ 0, 0 });
+		to = to.min({ width - 1, height - 1 });
+		for (int chunk_y = from.y >> chunk_size_log2; chunk_y <= to.y >> chunk_size_log2 && from.y <= to.y; chunk_y++) {
+			for (int chunk_x = from.x >> chunk_size_log2; chunk_x <= to.x >> chunk_size_log2 && from.x <= to.x; chunk_x++) {
+				int index = chunk_y * chunks_x + chunk_x;
+				Materialise(chunks[index], index);
+			}
+		}
+	}
+
+	// Writes count values from values[0] at (from_x, y) onwards, clipped to the map
+	void WriteSpan(int from_x, int y, const float* values, int count){
+		if (y < 0 || y >= height) {
+			return;
+		}
+		int to_x = std::min(from_x + count - 1, width - 1);
+		int x = std::max(from_x, 0);
+
+		while (x <= to_x) {
+			int chunk_end = std::min(to_x, x | chunk_mask);
+			T* row = Materialise(x, y).Row(y & chunk_mask);
+			for (; x <= chunk_end; x++) {
+				row[x & chunk_mask] = traits::FromFloat(values[x - from_x]);
+			}
+		}
+	}
+
+	// Calls edit(cells, x, count) for the piece of from_x..to_x (inclusive) of
+	// row y in every chunk it crosses, cells pointing at cell x of the piece.
+	// The span has to lie within the map; clipping is up to the caller, so a
+	// brush known to be inside it doesn't pay for that per row.
+	template <typename Edit>
+	void EditSpan(int from_x, int to_x, int y, Edit&& edit){
+		int x = from_x;
+		while (x <= to_x) {
+			int chunk_end = std::min(to_x, x | chunk_mask);
+			T* row = Materialise(x, y).Row(y & chunk_mask);
+			edit(row + (x & chunk_mask), x, chunk_end - x + 1);
+			x = chunk_end + 1;
+		}
+	}
+
+	// Reads the size cells from from as floats (0 outside the map) so that cell
+	// (from.x + i, from.y + j) lands at dst[i * x_stride + j * y_stride]; walks
+	// chunk rows instead of looking up every cell
+	void ReadRect(olc::vi2d from, olc::vi2d size, float* dst, ptrdiff_t x_stride, ptrdiff_t y_stride) const{
+		for (int j = 0; j < size.y; j++) {
+			int y = from.y + j;
+			float* out = dst + j * y_stride;
+			if (y < 0 || y >= height) {
+				for (int i = 0; i < size.x; i++) {
+					out[i * x_stride] = 0.0f;
+				}
+				continue;
+			}
+
+			int i = 0;
+			for (; i < size.x && from.x + i < 0; i++) {
+				out[i * x_stride] = 0.0f;
+			}
+			while (i < size.x && from.x + i < width) {
+				int x = from.x + i;
+				int chunk_end = std::min(from.x + size.x - 1, std::min(width - 1, x | chunk_mask));
+				const Chunk& chunk = ChunkAt(x, y);
+				if (chunk.IsUniform()) {
+					float value = traits::ToFloat(chunk.uniform_value);
+					for (; x <= chunk_end; x++, i++) {
+						out[i * x_stride] = value;
+					}
+				}
+				else {
+					const T* row = chunk.cells->Row(y & chunk_mask);
+					for (; x <= chunk_end; x++, i++) {
+						out[i * x_stride] = traits::ToFloat(row[x & chunk_mask]);
+					}
+				}
+			}
+			for (; i < size.x; i++) {
+				out[i * x_stride] = 0.0f;
+			}
+		}
+	}
+
+	void FillCircle(olc::vi2d pos, int32_t radius, float value){
+		ForEachCircleSpan(pos, radius, [&](int from_x, int to_x, int y){
+			FillSpan(from_x, to_x, y, value);
+		});
+	}
+
+	// Folds chunks written since the last call back into a single value when
+	// they ended up uniform. Only visits chunks that were actually edited.
+	void Compact(){
+		for (int index : touched_chunks) {
+			Chunk& chunk = chunks[index];
+			chunk.touched = false;
+			if (!chunk.cells) {
+				continue;
+			}
+
+			// cells past the map edge are never read, so only the clipped extent counts
+			olc::vi2d extent = ChunkExtent(index % chunks_x, index / chunks_x);
+			T value = chunk.cells->GetCellUnchecked(0, 0);
+			bool uniform = true;
+			for (int y = 0; y < extent.y && uniform; y++) {
+				const T* row = chunk.cells->Row(y);
+				uniform = std::all_of(row, row + extent.x, [&](T cell){ return cell == value; });
+			}
+
+			if (uniform) {
+				chunk.uniform_value = value;
+				chunk.cells.reset();
+			}
+		}
+		touched_chunks.clear();
+	}
+
+	size_t DenseChunkCount() const{
+		size_t count = 0;
+		for (const Chunk& chunk : chunks) {
+			count += chunk.IsUniform() ? 0 : 1;
+		}
+		return count;
+	}
+};
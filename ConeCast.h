@@ -0,0 +1,102 @@
+#pragma once
+
+#include "olcPixelGameEngine.h"
+#include "Raycast.h"
+#include "Simd.h"
+
+#include <cmath>
+#include <vector>
+
+struct ConeHit{
+	// offset from the cone centre in degrees
+	float angle = 0.0f;
+	bool hit = false;
+	olc::vi2d cell;
+	olc::vi2d previous_cell;
+};
+
+// Casts the fan of rays the Gauss tools use in one call: from -half_angle to
+// +half_angle (degrees, both inclusive) every angle_step, rotated from centre_dir
+// the same way as Example::RotateVector. Every ray is a RaycastGrid walk and
+// gets one entry in the hits, in angle order.
+//
+// The per ray setup is done for the whole fan at once, simd::width rays at a
+// time: one cos/sin per lane for the first packet, then every packet is the
+// previous one rotated by a fixed increment, and the unit step sizes come out
+// of the same pass. The walks themselves stay scalar; with the occupancy jumps
+// a ray is mostly lookups, and lock step packets spent more time waiting on
+// their slowest lane than they saved.
+class ConeCaster{
+	// per ray, padded to a multiple of simd::width
+	std::vector<float> ray_dir_x;
+	std::vector<float> ray_dir_y;
+	std::vector<float> ray_unit_x;
+	std::vector<float> ray_unit_y;
+
+	std::vector<ConeHit> hits;
+
+	void PrepareRays(olc::vf2d centre_dir, float half_angle, float angle_step, int ray_count){
+		using namespace simd;
+		constexpr float degrees_to_radians = 3.14159265358979f / 180.0f;
+
+		size_t padded = size_t((ray_count + width - 1) / width) * width;
+		ray_dir_x.resize(padded);
+		ray_dir_y.resize(padded);
+		ray_unit_x.resize(padded);
+		ray_unit_y.resize(padded);
+
+		for (int lane = 0; lane < width; lane++) {
+			float radians = (-half_angle + float(lane) * angle_step) * degrees_to_radians;
+			ray_dir_x[lane] = centre_dir.x * std::cos(radians) + centre_dir.y * std::sin(radians);
+			ray_dir_y[lane] = centre_dir.x * -std::sin(radians) + centre_dir.y * std::cos(radians);
+		}
+
+		const Float packet_cos = Set1(std::cos(float(width) * angle_step * degrees_to_radians));
+		const Float packet_sin = Set1(std::sin(float(width) * angle_step * degrees_to_radians));
+		const Float one = Set1(1.0f);
+
+		Float dir_x = Load(ray_dir_x.data());
+		Float dir_y = Load(ray_dir_y.data());
+		for (size_t first = 0; first < padded; first += width) {
+			Store(ray_dir_x.data() + first, dir_x);
+			Store(ray_dir_y.data() + first, dir_y);
+			// RaycastUnitStep for every lane
+			Store(ray_unit_x.data() + first, Sqrt(one + (dir_y / dir_x) * (dir_y / dir_x)));
+			Store(ray_unit_y.data() + first, Sqrt(one + (dir_x / dir_y) * (dir_x / dir_y)));
+
+			// same handedness as RotateVector
+			Float next_x = dir_x * packet_cos + dir_y * packet_sin;
+			Float next_y = dir_y * packet_cos - dir_x * packet_sin;
+			dir_x = next_x;
+			dir_y = next_y;
+		}
+	}
+
+public:
+	// Results stay valid until the next Cast()
+	template <typename Occupancy, typename IsHit>
+	const std::vector<ConeHit>& Cast(olc::vi2d origin, olc::vf2d centre_dir, float half_angle, float angle_step, float max_distance,
+		olc::vi2d map_size, const Occupancy* occupancy, uint8_t occupancy_mask, IsHit&& is_hit){
+		hits.clear();
+		if (!(angle_step > 0.0f) || half_angle < 0.0f) {
+			return hits;
+		}
+
+		int ray_count = int(std::floor(2.0f * half_angle / angle_step)) + 1;
+		hits.resize(ray_count);
+		PrepareRays(centre_dir, half_angle, angle_step, ray_count);
+
+		for (int ray = 0; ray < ray_count; ray++) {
+			RaycastResult result = RaycastGrid(origin, olc::vf2d{ ray_dir_x[ray], ray_dir_y[ray] }, olc::vf2d{ ray_unit_x[ray], ray_unit_y[ray] },
+				max_distance, map_size, occupancy, occupancy_mask, is_hit);
+
+			ConeHit& hit = hits[ray];
+			hit.angle = -half_angle + float(ray) * angle_step;
+			hit.hit = result.hit;
+			hit.cell = result.cell;
+			hit.previous_cell = result.previous_cell;
+		}
+
+		return hits;
+	}
+};
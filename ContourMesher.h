@@ -0,0 +1,417 @@
+#pragma once
+
+#include "ChunkedDensityField.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// A piece of the iso contour, in map coordinates (a cell's value sits at its
+// centre). Lines wind with the solid side on their left as drawn on screen
+// (y down); a line that isn't closed ends on the edge of its chunk, where the
+// line of the neighbouring chunk goes on from the very same point.
+struct ContourLine{
+	std::vector<olc::vf2d> points;
+	bool closed = false;
+};
+
+// Marching squares outline of a chunked field at iso (the 0.5 RaycastPixelTarget
+// counts as solid by default), the crossings placed between the two cell values
+// rather than at edge midpoints. Lines are kept per chunk and follow the field's
+// dirty reports like OccupancyPyramid: Update() redoes only the chunks that
+// changed, and those above and to the left of them, whose last row and column
+// of squares read their first cells. Off the map counts as empty, so shapes
+// touching the edge are closed along it.
+template <typename Field>
+class ContourMesher{
+	static constexpr int chunk_size = Field::chunk_size;
+	// a chunk's samples, one more on each side for the squares that straddle it
+	static constexpr int window_size = chunk_size + 2;
+
+	struct Segment{
+		int from_key;
+		int to_key;
+		olc::vf2d from;
+		olc::vf2d to;
+	};
+
+	Field* field = nullptr;
+	ChunkDirtyTracker dirty;
+	std::vector<std::vector<ContourLine>> chunk_lines;
+	std::vector<uint8_t> stale;
+	int chunks_x = 0;
+	int chunks_y = 0;
+	float tolerance = 0.0f;
+
+	// scratch of Extract()
+	std::vector<float> window;
+	std::vector<Segment> segments;
+	std::vector<int> starting_at;
+	std::vector<int> ending_at;
+	std::vector<uint8_t> used;
+
+	// Crossing of the edges between window samples (x, y) and (x + 1, y) (horizontal)
+	// or (x, y + 1); both squares on an edge work it out from the same two values
+	// in the same order, so they agree on its point to the bit
+	int EdgeKey(int x, int y, bool vertical) const{
+		return (y * window_size + x) * 2 + (vertical ? 1 : 0);
+	}
+
+	olc::vf2d Crossing(olc::vi2d window_origin, int x, int y, bool vertical) const{
+		float a = window[size_t(y) * window_size + x];
+		float b = vertical ? window[size_t(y + 1) * window_size + x] : window[size_t(y) * window_size + x + 1];
+		float t = (iso - a) / (b - a);
+		olc::vf2d position = olc::vf2d(window_origin + olc::vi2d{ x, y }) + olc::vf2d{ 0.5f, 0.5f };
+		return vertical ? position + olc::vf2d{ 0.0f, t } : position + olc::vf2d{ t, 0.0f };
+	}
+
+	void Extract(int chunk_x, int chunk_y){
+		olc::vi2d origin = field->ChunkOrigin(chunk_x, chunk_y);
+		olc::vi2d extent = field->ChunkExtent(chunk_x, chunk_y);
+		olc::vi2d window_origin = origin - olc::vi2d{ 1, 1 };
+		window.resize(size_t(window_size) * window_size);
+		field->ReadRect(window_origin, { window_size, window_size }, window.data(), 1, window_size);
+
+		// squares by their top left sample; the first chunk of a row or column
+		// also has the ones hanging over the map's edge
+		int square_from_x = chunk_x == 0 ? 0 : 1;
+		int square_from_y = chunk_y == 0 ? 0 : 1;
+		segments.clear();
+		for (int y = square_from_y; y <= extent.y; y++) {
+			for (int x = square_from_x; x <= extent.x; x++) {
+				const float* row = window.data() + size_t(y) * window_size + x;
+				// corners clockwise from the top left; edge i runs from corner i to i + 1
+				float corners[4] = { row[0], row[1], row[window_size + 1], row[window_size] };
+				int solid = 0;
+				for (int i = 0; i < 4; i++) {
+					solid |= (corners[i] >= iso ? 1 : 0) << i;
+				}
+				if (solid == 0 || solid == 15) {
+					continue;
+				}
+
+				int edge_keys[4] = { EdgeKey(x, y, false), EdgeKey(x + 1, y, true), EdgeKey(x, y + 1, false), EdgeKey(x, y, true) };
+				olc::vi2d edge_starts[4] = { { x, y }, { x + 1, y }, { x, y + 1 }, { x, y } };
+				bool edge_vertical[4] = { false, true, false, true };
+				auto add = [&](int from_edge, int to_edge) {
+					segments.push_back({ edge_keys[from_edge], edge_keys[to_edge],
+						Crossing(window_origin, edge_starts[from_edge].x, edge_starts[from_edge].y, edge_vertical[from_edge]),
+						Crossing(window_origin, edge_starts[to_edge].x, edge_starts[to_edge].y, edge_vertical[to_edge]) });
+				};
+
+				// an edge is entered going empty to solid clockwise and left going solid to empty
+				auto corner_solid = [&](int i) { return (solid >> (i & 3)) & 1; };
+				if (solid == 5 || solid == 10) {
+					// saddle: the centre decides whether the solid corners meet
+					float centre = (corners[0] + corners[1] + corners[2] + corners[3]) * 0.25f;
+					bool joined = centre >= iso;
+					int entry_a = solid == 5 ? 3 : 0;
+					int entry_b = entry_a + 2;
+					if (joined) {
+						add(entry_a, (entry_a + 3) & 3);
+						add(entry_b & 3, (entry_b + 3) & 3);
+					}
+					else {
+						add(entry_a, (entry_a + 1) & 3);
+						add(entry_b & 3, (entry_b + 1) & 3);
+					}
+					continue;
+				}
+				for (int entry = 0; entry < 4; entry++) {
+					if (corner_solid(entry) || !corner_solid(entry + 1)) {
+						continue;
+					}
+					int exit = entry + 1;
+					while (corner_solid(exit + 1)) {
+						exit++;
+					}
+					add(entry, exit & 3);
+				}
+			}
+		}
+
+		std::vector<ContourLine>& lines = chunk_lines[size_t(chunk_y) * chunks_x + chunk_x];
+		lines.clear();
+		Chain(lines);
+		if (tolerance > 0.0f) {
+			for (ContourLine& line : lines) {
+				Simplify(line);
+			}
+		}
+	}
+
+	// joins the segments that share crossings into lines
+	void Chain(std::vector<ContourLine>& lines){
+		size_t key_count = size_t(window_size) * window_size * 2;
+		starting_at.assign(key_count, -1);
+		ending_at.assign(key_count, -1);
+		used.assign(segments.size(), 0);
+		for (size_t i = 0; i < segments.size(); i++) {
+			starting_at[segments[i].from_key] = int(i);
+			ending_at[segments[i].to_key] = int(i);
+		}
+
+		auto follow = [&](int first) {
+			ContourLine line;
+			line.points.push_back(segments[first].from);
+			int segment = first;
+			while (segment >= 0 && !used[segment]) {
+				used[segment] = 1;
+				line.points.push_back(segments[segment].to);
+				segment = starting_at[segments[segment].to_key];
+			}
+			if (segment == first) {
+				// back where it started
+				line.points.pop_back();
+				line.closed = true;
+			}
+			lines.push_back(std::move(line));
+		};
+		// open lines first, from the segments nothing leads into, then the loops
+		for (size_t i = 0; i < segments.size(); i++) {
+			if (ending_at[segments[i].from_key] < 0) {
+				follow(int(i));
+			}
+		}
+		for (size_t i = 0; i < segments.size(); i++) {
+			if (!used[i]) {
+				follow(int(i));
+			}
+		}
+	}
+
+	static float DistanceToSegment(olc::vf2d point, olc::vf2d a, olc::vf2d b){
+		olc::vf2d ab = b - a;
+		float length2 = ab.mag2();
+		float t = length2 > 0.0f ? std::clamp((point - a).dot(ab) / length2, 0.0f, 1.0f) : 0.0f;
+		return (point - (a + ab * t)).mag();
+	}
+
+	// Douglas-Peucker over points first..last, keep marking what stays
+	void SimplifyRange(const std::vector<olc::vf2d>& points, size_t first, size_t last, std::vector<uint8_t>& keep) const{
+		while (last > first + 1) {
+			float farthest = -1.0f;
+			size_t split = first;
+			for (size_t i = first + 1; i < last; i++) {
+				float distance = DistanceToSegment(points[i], points[first], points[last]);
+				if (distance > farthest) {
+					farthest = distance;
+					split = i;
+				}
+			}
+			if (farthest <= tolerance) {
+				return;
+			}
+			keep[split] = 1;
+			SimplifyRange(points, first, split, keep);
+			first = split;
+		}
+	}
+
+	// keeps the ends, so lines still meet those of the neighbouring chunks
+	void Simplify(ContourLine& line) const{
+		std::vector<olc::vf2d>& points = line.points;
+		if (points.size() < 3) {
+			return;
+		}
+		std::vector<uint8_t> keep(points.size(), 0);
+		keep.front() = 1;
+		keep.back() = 1;
+		if (line.closed) {
+			// a loop is two open halves between its first point and the one farthest from it
+			size_t opposite = 0;
+			for (size_t i = 1; i < points.size(); i++) {
+				if ((points[i] - points[0]).mag2() > (points[opposite] - points[0]).mag2()) {
+					opposite = i;
+				}
+			}
+			keep[opposite] = 1;
+			std::vector<olc::vf2d> looped = points;
+			looped.push_back(points[0]);
+			keep.push_back(1);
+			SimplifyRange(looped, 0, opposite, keep);
+			SimplifyRange(looped, opposite, looped.size() - 1, keep);
+			keep.pop_back();
+		}
+		else {
+			SimplifyRange(points, 0, points.size() - 1, keep);
+		}
+
+		size_t kept = 0;
+		for (size_t i = 0; i < points.size(); i++) {
+			if (keep[i]) {
+				points[kept++] = points[i];
+			}
+		}
+		points.resize(kept);
+	}
+
+	void MarkStale(int chunk_x, int chunk_y){
+		if (chunk_x >= 0 && chunk_y >= 0) {
+			stale[size_t(chunk_y) * chunks_x + chunk_x] = 1;
+		}
+	}
+
+public:
+	float iso = 0.5f;
+
+	~ContourMesher(){
+		Detach();
+	}
+
+	void Attach(Field& field){
+		Detach();
+		this->field = &field;
+		field.AddDirtyTracker(&dirty);
+		chunks_x = field.ChunksX();
+		chunks_y = field.ChunksY();
+		chunk_lines.assign(size_t(chunks_x) * chunks_y, {});
+		stale.assign(size_t(chunks_x) * chunks_y, 1);
+	}
+
+	void Detach(){
+		if (field) {
+			field->RemoveDirtyTracker(&dirty);
+			field = nullptr;
+		}
+	}
+
+	// Douglas-Peucker tolerance in cells, 0 keeps every crossing; redoes every chunk
+	void SetSimplifyTolerance(float tolerance){
+		if (tolerance != this->tolerance) {
+			this->tolerance = tolerance;
+			std::fill(stale.begin(), stale.end(), 1);
+		}
+	}
+	float SimplifyTolerance() const{
+		return tolerance;
+	}
+
+	// Re-extracts the chunks changed since the last call; returns how many
+	int Update(){
+		dirty.Consume([&](int chunk_x, int chunk_y, olc::vi2d local_from, olc::vi2d){
+			MarkStale(chunk_x, chunk_y);
+			if (local_from.x == 0) {
+				MarkStale(chunk_x - 1, chunk_y);
+			}
+			if (local_from.y == 0) {
+				MarkStale(chunk_x, chunk_y - 1);
+			}
+			if (local_from.x == 0 && local_from.y == 0) {
+				MarkStale(chunk_x - 1, chunk_y - 1);
+			}
+		});
+		int extracted = 0;
+		for (int chunk_y = 0; chunk_y < chunks_y; chunk_y++) {
+			for (int chunk_x = 0; chunk_x < chunks_x; chunk_x++) {
+				uint8_t& chunk_stale = stale[size_t(chunk_y) * chunks_x + chunk_x];
+				if (chunk_stale) {
+					Extract(chunk_x, chunk_y);
+					chunk_stale = 0;
+					extracted++;
+				}
+			}
+		}
+		return extracted;
+	}
+
+	// As of the last Update()
+	const std::vector<ContourLine>& ChunkLines(int chunk_x, int chunk_y) const{
+		return chunk_lines[size_t(chunk_y) * chunks_x + chunk_x];
+	}
+
+	// Every line of the map, those of neighbouring chunks joined where they meet
+	std::vector<ContourLine> StitchedLines() const{
+		std::vector<const ContourLine*> open;
+		std::vector<ContourLine> result;
+		for (const std::vector<ContourLine>& lines : chunk_lines) {
+			for (const ContourLine& line : lines) {
+				if (line.closed) {
+					result.push_back(line);
+				}
+				else if (!line.points.empty()) {
+					open.push_back(&line);
+				}
+			}
+		}
+
+		auto key = [](olc::vf2d point) {
+			uint32_t x, y;
+			std::memcpy(&x, &point.x, sizeof(x));
+			std::memcpy(&y, &point.y, sizeof(y));
+			return (uint64_t(x) << 32) | y;
+		};
+		std::unordered_map<uint64_t, size_t> starting_at;
+		std::unordered_map<uint64_t, size_t> ending_at;
+		for (size_t i = 0; i < open.size(); i++) {
+			starting_at[key(open[i]->points.front())] = i;
+			ending_at[key(open[i]->points.back())] = i;
+		}
+
+		std::vector<uint8_t> joined(open.size(), 0);
+		auto follow = [&](size_t first) {
+			ContourLine line;
+			line.points.push_back(open[first]->points.front());
+			size_t current = first;
+			while (true) {
+				joined[current] = 1;
+				line.points.insert(line.points.end(), open[current]->points.begin() + 1, open[current]->points.end());
+				auto next = starting_at.find(key(open[current]->points.back()));
+				if (next == starting_at.end()) {
+					break;
+				}
+				if (next->second == first) {
+					line.points.pop_back();
+					line.closed = true;
+					break;
+				}
+				if (joined[next->second]) {
+					break;
+				}
+				current = next->second;
+			}
+			result.push_back(std::move(line));
+		};
+		for (size_t i = 0; i < open.size(); i++) {
+			if (!joined[i] && ending_at.find(key(open[i]->points.front())) == ending_at.end()) {
+				follow(i);
+			}
+		}
+		for (size_t i = 0; i < open.size(); i++) {
+			if (!joined[i]) {
+				follow(i);
+			}
+		}
+		return result;
+	}
+
+	// StitchedLines() as a Wavefront OBJ of polylines ("v x y 0", "l a b c ...",
+	// closed lines repeating their first vertex), in map cells
+	bool ExportObj(const std::string& path) const{
+		std::ofstream file(path);
+		if (!file) {
+			return false;
+		}
+		file << "# iso " << iso << " contour, " << field->Width() << "x" << field->Height() << " cells\n";
+		size_t vertex = 1;
+		for (const ContourLine& line : StitchedLines()) {
+			for (const olc::vf2d& point : line.points) {
+				file << "v " << point.x << " " << point.y << " 0\n";
+			}
+			file << "l";
+			for (size_t i = 0; i < line.points.size(); i++) {
+				file << " " << vertex + i;
+			}
+			if (line.closed) {
+				file << " " << vertex;
+			}
+			file << "\n";
+			vertex += line.points.size();
+		}
+		return bool(file);
+	}
+};
@@ -0,0 +1,198 @@
+#pragma once
+
+#include "olcPixelGameEngine.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// Conversion between the stored cell type and the [0, 1] density used by the tools.
+template <typename T>
+struct DensityTraits;
+
+template <>
+struct DensityTraits<uint8_t>{
+	static constexpr uint8_t max_value = 255;
+
+	static float ToFloat(uint8_t value){
+		return float(value) * (1.0f / 255.0f);
+	}
+	static uint8_t FromFloat(float value){
+		return uint8_t(std::clamp(value, 0.0f, 1.0f) * 255.0f + 0.5f);
+	}
+	static uint8_t ToByte(uint8_t value){
+		return value;
+	}
+};
+
+template <>
+struct DensityTraits<uint16_t>{
+	static constexpr uint16_t max_value = 65535;
+
+	static float ToFloat(uint16_t value){
+		return float(value) * (1.0f / 65535.0f);
+	}
+	static uint16_t FromFloat(float value){
+		return uint16_t(std::clamp(value, 0.0f, 1.0f) * 65535.0f + 0.5f);
+	}
+	static uint8_t ToByte(uint16_t value){
+		return uint8_t(value >> 8);
+	}
+};
+
+template <>
+struct DensityTraits<float>{
+	static constexpr float max_value = 1.0f;
+
+	static float ToFloat(float value){
+		return value;
+	}
+	static float FromFloat(float value){
+		return std::clamp(value, 0.0f, 1.0f);
+	}
+	static uint8_t ToByte(float value){
+		return uint8_t(value * 255.0f);
+	}
+};
+
+// Same rasterisation as PixelGameEngine::FillCircle, so tools keep their shape.
+// Calls span(from_x, to_x, y) with both ends inclusive; spans may repeat a row.
+template <typename SpanFunc>
+void ForEachCircleSpan(olc::vi2d pos, int32_t radius, SpanFunc&& span){
+	if (radius < 0) {
+		return;
+	}
+	if (radius == 0) {
+		span(pos.x, pos.x, pos.y);
+		return;
+	}
+
+	int x0 = 0;
+	int y0 = radius;
+	int d = 3 - 2 * radius;
+
+	while (y0 >= x0) {
+		span(pos.x - y0, pos.x + y0, pos.y - x0);
+		if (x0 > 0) span(pos.x - y0, pos.x + y0, pos.y + x0);
+
+		if (d < 0) {
+			d += 4 * x0++ + 6;
+		}
+		else {
+			if (x0 != y0) {
+				span(pos.x - x0, pos.x + x0, pos.y - y0);
+				span(pos.x - x0, pos.x + x0, pos.y + y0);
+			}
+			d += 4 * (x0++ - y0--) + 10;
+		}
+	}
+}
+
+// Single channel terrain density stored row-major in one allocation.
+// Get/Set are bounds checked (outside reads as empty, outside writes are dropped),
+// the *Unchecked variants are meant for loops that already clipped to the field.
+template <typename T>
+class DensityField{
+	std::vector<T> cells;
+	int width = 0;
+	int height = 0;
+
+public:
+	using cell_type = T;
+	using traits = DensityTraits<T>;
+
+	DensityField() = default;
+
+	DensityField(int width, int height, T value = T()) : width(width), height(height){
+		cells.resize(size_t(width) * size_t(height), value);
+	}
+
+	int Width() const{
+		return width;
+	}
+	int Height() const{
+		return height;
+	}
+	olc::vi2d Size() const{
+		return { width, height };
+	}
+
+	bool Contains(int x, int y) const{
+		return x >= 0 && x < width && y >= 0 && y < height;
+	}
+
+	T* Row(int y){
+		return cells.data() + size_t(y) * width;
+	}
+	const T* Row(int y) const{
+		return cells.data() + size_t(y) * width;
+	}
+
+	T GetCell(int x, int y) const{
+		return Contains(x, y) ? cells[size_t(y) * width + x] : T();
+	}
+	T GetCellUnchecked(int x, int y) const{
+		return cells[size_t(y) * width + x];
+	}
+	void SetCellUnchecked(int x, int y, T value){
+		cells[size_t(y) * width + x] = value;
+	}
+
+	float Get(int x, int y) const{
+		return traits::ToFloat(GetCell(x, y));
+	}
+	float Get(olc::vi2d pos) const{
+		return Get(pos.x, pos.y);
+	}
+	float GetUnchecked(int x, int y) const{
+		return traits::ToFloat(GetCellUnchecked(x, y));
+	}
+
+	void Set(int x, int y, float value){
+		if (Contains(x, y)) {
+			SetUnchecked(x, y, value);
+		}
+	}
+	void Set(olc::vi2d pos, float value){
+		Set(pos.x, pos.y, value);
+	}
+	void SetUnchecked(int x, int y, float value){
+		cells[size_t(y) * width + x] = traits::FromFloat(value);
+	}
+
+	void Fill(float value){
+		std::fill(cells.begin(), cells.end(), traits::FromFloat(value));
+	}
+
+	// from and to inclusive, clipped to the field
+	void FillSpan(int from_x, int to_x, int y, float value){
+		if (y < 0 || y >= height) {
+			return;
+		}
+		from_x = std::max(from_x, 0);
+		to_x = std::min(to_x, width - 1);
+		if (from_x > to_x) {
+			return;
+		}
+		T* row = Row(y);
+		std::fill(row + from_x, row + to_x + 1, traits::FromFloat(value));
+	}
+
+	void FillCircle(olc::vi2d pos, int32_t radius, float value){
+		ForEachCircleSpan(pos, radius, [&](int from_x, int to_x, int y){
+			FillSpan(from_x, to_x, y, value);
+		});
+	}
+
+	// Display path: expands density into greyscale RGBA, the only place pixels are produced
+	void CopyToSprite(olc::Sprite& sprite) const{
+		for (int y = 0; y < std::min(height, sprite.height); y++) {
+			const T* row = Row(y);
+			olc::Pixel* dst = sprite.GetData() + size_t(y) * sprite.width;
+			for (int x = 0; x < std::min(width, sprite.width); x++) {
+				uint8_t value = traits::ToByte(row[x]);
+				dst[x] = olc::Pixel{ value, value, value };
+			}
+		}
+	}
+};
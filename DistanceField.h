@@ -0,0 +1,344 @@
+#pragma once
+
+#include "ChunkedDensityField.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+struct SphereCastResult{
+	bool hit = false;
+	// how far the circle got along the ray, and its centre there
+	float distance = 0.0f;
+	olc::vf2d position;
+	// outward surface normal at the contact, when hit
+	olc::vf2d normal;
+};
+
+// Signed distance field next to a chunked field, for the player's collision
+// and to let raycasts jump over open space. Cells at or above solid_threshold
+// are solid (as RaycastPixelTarget counts them). Every cell keeps its clearance,
+// the distance from its centre to the nearest cell centre of the other kind,
+// negative inside solid and capped at max_clearance:
+//   CellClearance()  clearance of an empty cell, 0 for solid ones
+//   QueryDistance()  approximate distance of any point to the surface, half way
+//                    between solid and empty cell centres, negative inside
+//   SphereCast()     how far a circle moves along a ray before touching solid
+// Clearances come from a 3x3 chamfer pass (steps of 1 and sqrt(2)), scaled by
+// cos(22.5 degrees) so they never exceed the true Euclidean distance.
+//
+// Clearances are kept per chunk of the field. A chunk whose cells and those
+// within the cap around it are all of one kind (the bulk of open space and
+// rock) is kept as the single capped value, so memory follows the surface
+// rather than the map's area, like the field itself.
+//
+// It follows the field's dirty reports like OccupancyPyramid: Update() redoes
+// every reported region and the cells within the cap around it, chunk by
+// chunk, from the cells within twice the cap, so its cost follows the area
+// edited.
+template <typename Field>
+class DistanceField{
+	using traits = typename Field::traits;
+	static constexpr int chunk_size = Field::chunk_size;
+	static constexpr int chunk_size_log2 = Field::chunk_size_log2;
+	static constexpr int chunk_mask = Field::chunk_mask;
+
+	// 1/64 cell steps, which hold max_clearance many times over
+	static constexpr float fixed_scale = 64.0f;
+	// chamfer paths over-reach the Euclidean distance by at most 1 / cos(22.5 degrees)
+	static constexpr float chamfer_scale = 0.92387953f;
+
+public:
+	static constexpr float solid_threshold = 0.5f;
+	static constexpr float max_clearance = 16.0f;
+
+private:
+	// farthest chamfer reach that can still come in under max_clearance
+	static constexpr int margin = int(max_clearance / chamfer_scale) + 2;
+	// so a chunk's clearances only ever depend on the chunks next to it
+	static_assert(margin + 1 <= chunk_size, "clearance margin reaches past the neighbouring chunks");
+
+	// the capped clearances, as stored
+	static constexpr int16_t open_value = int16_t(max_clearance * fixed_scale);
+	static constexpr int16_t rock_value = int16_t(-max_clearance * fixed_scale);
+
+	struct Chunk{
+		// chunk_size^2 clearances, empty while every one is uniform_value
+		std::vector<int16_t> values;
+		int16_t uniform_value = open_value;
+
+		int16_t At(int local_x, int local_y) const{
+			return values.empty() ? uniform_value : values[size_t(local_y) * chunk_size + local_x];
+		}
+	};
+
+	Field* field = nullptr;
+	ChunkDirtyTracker dirty;
+	std::vector<Chunk> chunks;
+	int chunks_x = 0;
+	int chunks_y = 0;
+	int width = 0;
+	int height = 0;
+
+	// scratch of Rebuild()
+	std::vector<float> cells;
+	std::vector<float> to_solid;
+	std::vector<float> to_empty;
+	// scratch of Update(): the cells to redo, per chunk
+	ChunkDirtyTracker redo;
+
+	// 3x3 chamfer distance to the nearest cell seeded with 0, the others
+	// starting higher; two raster passes are exact for it on a rectangle. The
+	// window has a border of one cell that is never a seed, so the passes need
+	// no edge checks.
+	static void Chamfer(std::vector<float>& distances, int stride, int rows){
+		constexpr float diagonal = 1.41421356f;
+		float* d = distances.data();
+		for (int y = 1; y < rows - 1; y++) {
+			float* row = d + size_t(y) * stride;
+			const float* above = row - stride;
+			for (int x = 1; x < stride - 1; x++) {
+				float best = std::min(row[x], row[x - 1] + 1.0f);
+				best = std::min(best, above[x] + 1.0f);
+				best = std::min(best, std::min(above[x - 1], above[x + 1]) + diagonal);
+				row[x] = best;
+			}
+		}
+		for (int y = rows - 2; y >= 1; y--) {
+			float* row = d + size_t(y) * stride;
+			const float* below = row + stride;
+			for (int x = stride - 2; x >= 1; x--) {
+				float best = std::min(row[x], row[x + 1] + 1.0f);
+				best = std::min(best, below[x] + 1.0f);
+				best = std::min(best, std::min(below[x - 1], below[x + 1]) + diagonal);
+				row[x] = best;
+			}
+		}
+	}
+
+	// clearances of the cells from..to (inclusive, in the map, within one
+	// chunk) into values, read from margin further out on every side; cells
+	// off the map count as empty
+	void Rebuild(olc::vi2d from, olc::vi2d to, int16_t* values){
+		olc::vi2d window_from = from - olc::vi2d{ margin + 1, margin + 1 };
+		olc::vi2d window_size = to - from + olc::vi2d{ 2 * margin + 3, 2 * margin + 3 };
+		size_t count = size_t(window_size.x) * window_size.y;
+		cells.resize(count);
+		field->ReadRect(window_from, window_size, cells.data(), 1, window_size.x);
+
+		constexpr float max_reach = float(margin) * 2.0f;
+		to_solid.resize(count);
+		to_empty.resize(count);
+		for (size_t i = 0; i < count; i++) {
+			bool solid = cells[i] >= solid_threshold;
+			to_solid[i] = solid ? 0.0f : max_reach;
+			to_empty[i] = solid ? max_reach : 0.0f;
+		}
+		for (int y = 0; y < window_size.y; y++) {
+			for (int x = 0; x < window_size.x; x += (y == 0 || y == window_size.y - 1) ? 1 : window_size.x - 1) {
+				to_solid[size_t(y) * window_size.x + x] = max_reach;
+				to_empty[size_t(y) * window_size.x + x] = max_reach;
+			}
+		}
+		Chamfer(to_solid, window_size.x, window_size.y);
+		Chamfer(to_empty, window_size.x, window_size.y);
+
+		for (int y = from.y; y <= to.y; y++) {
+			size_t window_row = size_t(y - window_from.y) * window_size.x;
+			int16_t* out = values + size_t(y & chunk_mask) * chunk_size;
+			for (int x = from.x; x <= to.x; x++) {
+				size_t i = window_row + size_t(x - window_from.x);
+				// one of the two is 0
+				float clearance = std::min((to_solid[i] - to_empty[i]) * chamfer_scale, max_clearance);
+				clearance = std::max(clearance, -max_clearance);
+				// rounded down, so it stays an under estimate
+				out[x & chunk_mask] = int16_t(std::floor(clearance * fixed_scale));
+			}
+		}
+	}
+
+	// true if the cells of the chunk at chunk_x, chunk_y are all solid (or all
+	// empty), as solid says; chunks off the map are empty, and so is the part
+	// of a chunk the map edge cuts off
+	bool UniformKind(int chunk_x, int chunk_y, bool& solid) const{
+		solid = false;
+		if (chunk_x < 0 || chunk_y < 0 || chunk_x >= chunks_x || chunk_y >= chunks_y) {
+			return true;
+		}
+		const typename Field::Chunk& chunk = field->GetChunk(chunk_x, chunk_y);
+		if (!chunk.IsUniform()) {
+			return false;
+		}
+		solid = traits::ToFloat(chunk.uniform_value) >= solid_threshold;
+		return !solid || field->ChunkExtent(chunk_x, chunk_y) == olc::vi2d{ chunk_size, chunk_size };
+	}
+
+	// redoes the clearances of local_from..local_to of a chunk; one whose
+	// neighbourhood is all of one kind only needs the capped value
+	void RebuildChunk(int chunk_x, int chunk_y, olc::vi2d local_from, olc::vi2d local_to){
+		Chunk& chunk = chunks[size_t(chunk_y) * chunks_x + chunk_x];
+		bool uniform = true;
+		bool solid = false;
+		UniformKind(chunk_x, chunk_y, solid);
+		for (int y = chunk_y - 1; y <= chunk_y + 1 && uniform; y++) {
+			for (int x = chunk_x - 1; x <= chunk_x + 1 && uniform; x++) {
+				bool neighbour_solid;
+				uniform = UniformKind(x, y, neighbour_solid) && neighbour_solid == solid;
+			}
+		}
+		if (uniform) {
+			chunk.values.clear();
+			chunk.values.shrink_to_fit();
+			chunk.uniform_value = solid ? rock_value : open_value;
+			return;
+		}
+
+		if (chunk.values.empty()) {
+			// the cells outside the region keep the value they had
+			chunk.values.assign(size_t(chunk_size) * chunk_size, chunk.uniform_value);
+		}
+		olc::vi2d origin = field->ChunkOrigin(chunk_x, chunk_y);
+		Rebuild(origin + local_from, origin + local_to, chunk.values.data());
+
+		// a surface that only just reaches into the margin can leave the cells capped
+		olc::vi2d extent = field->ChunkExtent(chunk_x, chunk_y);
+		int16_t value = chunk.values[0];
+		uniform = true;
+		for (int y = 0; y < extent.y && uniform; y++) {
+			const int16_t* row = chunk.values.data() + size_t(y) * chunk_size;
+			uniform = std::all_of(row, row + extent.x, [&](int16_t cell){ return cell == value; });
+		}
+		if (uniform) {
+			chunk.values.clear();
+			chunk.values.shrink_to_fit();
+			chunk.uniform_value = value;
+		}
+	}
+
+	void RebuildMarked(){
+		redo.Consume([&](int chunk_x, int chunk_y, olc::vi2d local_from, olc::vi2d local_to){
+			RebuildChunk(chunk_x, chunk_y, local_from, local_to);
+		});
+	}
+
+	float Value(int x, int y) const{
+		const Chunk& chunk = chunks[size_t(y >> chunk_size_log2) * chunks_x + (x >> chunk_size_log2)];
+		return float(chunk.At(x & chunk_mask, y & chunk_mask)) * (1.0f / fixed_scale);
+	}
+
+	// signed distance of a cell centre to the surface
+	float SurfaceDistance(int x, int y) const{
+		float clearance = Value(x, y);
+		return clearance > 0.0f ? clearance - 0.5f : clearance + 0.5f;
+	}
+
+public:
+	~DistanceField(){
+		Detach();
+	}
+
+	void Attach(Field& field){
+		Detach();
+		this->field = &field;
+		field.AddDirtyTracker(&dirty);
+		width = field.Width();
+		height = field.Height();
+		chunks_x = field.ChunksX();
+		chunks_y = field.ChunksY();
+		chunks.clear();
+		chunks.resize(size_t(chunks_x) * chunks_y);
+		redo.Resize(chunks_x, chunks_y, chunk_size_log2);
+		// a chunk at a time keeps the scratch small on large maps, and only the
+		// chunks near non-uniform ones are rebuilt at all
+		redo.Mark({ 0, 0 }, { width - 1, height - 1 });
+		RebuildMarked();
+	}
+
+	void Detach(){
+		if (field) {
+			field->RemoveDirtyTracker(&dirty);
+			field = nullptr;
+		}
+	}
+
+	// Brings the clearances in line with everything reported dirty since the last call
+	void Update(){
+		if (dirty.Empty()) {
+			return;
+		}
+		olc::vi2d map_end{ width - 1, height - 1 };
+		// a brush across chunk edges reports a piece per chunk; their margins
+		// overlap, and the tracker merges them per chunk
+		dirty.Consume([&](int chunk_x, int chunk_y, olc::vi2d local_from, olc::vi2d local_to){
+			olc::vi2d origin = field->ChunkOrigin(chunk_x, chunk_y);
+			olc::vi2d from = (origin + local_from - olc::vi2d{ margin, margin }).max({ 0, 0 });
+			olc::vi2d to = (origin + local_to + olc::vi2d{ margin, margin }).min(map_end);
+			redo.Mark(from, to);
+		});
+		RebuildMarked();
+	}
+
+	// Distance from the centre of an in map cell to the nearest solid cell centre,
+	// at least max_clearance meaning "max_clearance or more"; 0 for solid cells
+	float CellClearance(olc::vi2d cell) const{
+		return std::max(Value(cell.x, cell.y), 0.0f);
+	}
+
+	// Approximate signed distance of point (map coordinates) to the solid surface,
+	// bilinear between cell centres and flat out from the outer ones to the map's
+	// edge; off the map it grows with the distance to it
+	float QueryDistance(olc::vf2d point) const{
+		olc::vf2d size{ float(width), float(height) };
+		olc::vf2d inside = point.max({ 0.0f, 0.0f }).min(size);
+		olc::vf2d grid = inside.max({ 0.5f, 0.5f }).min(size - olc::vf2d{ 0.5f, 0.5f }) - olc::vf2d{ 0.5f, 0.5f };
+		int x0 = std::min(int(grid.x), width - 1);
+		int y0 = std::min(int(grid.y), height - 1);
+		int x1 = std::min(x0 + 1, width - 1);
+		int y1 = std::min(y0 + 1, height - 1);
+		float fx = grid.x - float(x0);
+		float fy = grid.y - float(y0);
+		float top = SurfaceDistance(x0, y0) * (1.0f - fx) + SurfaceDistance(x1, y0) * fx;
+		float bottom = SurfaceDistance(x0, y1) * (1.0f - fx) + SurfaceDistance(x1, y1) * fx;
+		return top * (1.0f - fy) + bottom * fy + (point - inside).mag();
+	}
+
+	// Direction in which QueryDistance() grows fastest at point (unit length, or 0 on a flat spot)
+	olc::vf2d QueryNormal(olc::vf2d point) const{
+		olc::vf2d gradient{
+			QueryDistance(point + olc::vf2d{ 0.5f, 0.0f }) - QueryDistance(point - olc::vf2d{ 0.5f, 0.0f }),
+			QueryDistance(point + olc::vf2d{ 0.0f, 0.5f }) - QueryDistance(point - olc::vf2d{ 0.0f, 0.5f })
+		};
+		float length = gradient.mag();
+		return length > 0.0f ? gradient / length : olc::vf2d{ 0.0f, 0.0f };
+	}
+
+	// Moves a circle of radius from origin along dir (unit length) until it
+	// touches the surface or has gone max_distance, sphere tracing the steps:
+	// nothing is closer than QueryDistance() - radius, so that far is free.
+	// A circle already touching it hits at distance 0.
+	SphereCastResult SphereCast(olc::vf2d origin, olc::vf2d dir, float radius, float max_distance) const{
+		constexpr float contact = 0.01f;
+		constexpr int max_steps = 256;
+
+		SphereCastResult result;
+		float travelled = 0.0f;
+		for (int i = 0; i < max_steps; i++) {
+			olc::vf2d position = origin + dir * travelled;
+			float gap = QueryDistance(position) - radius;
+			if (gap < contact) {
+				result.hit = true;
+				result.normal = QueryNormal(position);
+				break;
+			}
+			if (travelled + gap >= max_distance) {
+				travelled = max_distance;
+				break;
+			}
+			travelled += gap;
+		}
+		result.distance = travelled;
+		result.position = origin + dir * travelled;
+		return result;
+	}
+};
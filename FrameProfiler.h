@@ -0,0 +1,206 @@
+#pragma once
+
+#include "olcPixelGameEngine.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Scoped timers for the phases of a frame. Each frame keeps its per phase
+// totals in a short history for the overlay graph, and every timed span goes
+// into a much longer ring of events that WriteChromeTrace() exports for
+// chrome://tracing or Perfetto. Everything is allocated up front, so timing a
+// frame costs a few clock reads.
+class FrameProfiler{
+public:
+	static constexpr int max_phases = 8;
+	// frames shown by the overlay, one pixel column each
+	static constexpr int history_frames = 240;
+	// spans kept for the trace, the oldest are overwritten first
+	static constexpr int max_events = 1 << 16;
+
+private:
+	using clock = std::chrono::steady_clock;
+
+	struct Phase{
+		std::string name;
+		olc::Pixel colour;
+	};
+
+	struct Frame{
+		// time since the previous frame started, as passed to BeginFrame()
+		float interval_ms = 0.0f;
+		float update_ms = 0.0f;
+		float phase_ms[max_phases] = {};
+	};
+
+	struct Event{
+		// -1 for the whole frame
+		int phase = -1;
+		int64_t start_ns = 0;
+		int64_t duration_ns = 0;
+	};
+
+	std::vector<Phase> phases;
+
+	std::vector<Frame> frames;
+	int frame_next = 0;
+	int frame_count = 0;
+	Frame current;
+	int64_t frame_start_ns = 0;
+
+	std::vector<Event> events;
+	int event_next = 0;
+	int event_count = 0;
+
+	clock::time_point epoch = clock::now();
+
+	int64_t Now() const{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - epoch).count();
+	}
+
+	void AddEvent(int phase, int64_t start_ns, int64_t duration_ns){
+		events[event_next] = { phase, start_ns, duration_ns };
+		event_next = (event_next + 1) % max_events;
+		event_count = std::min(event_count + 1, max_events);
+	}
+
+	// i-th newest frame, 0 being the last one ended
+	const Frame& History(int i) const{
+		return frames[(frame_next - 1 - i + history_frames) % history_frames];
+	}
+
+public:
+	// Times its own lifetime as one span of phase
+	class Scope{
+		FrameProfiler& profiler;
+		int phase;
+		int64_t start_ns;
+
+	public:
+		Scope(FrameProfiler& profiler, int phase) : profiler(profiler), phase(phase), start_ns(profiler.Now()){
+		}
+		~Scope(){
+			int64_t duration_ns = profiler.Now() - start_ns;
+			profiler.current.phase_ms[phase] += float(duration_ns) * 1e-6f;
+			profiler.AddEvent(phase, start_ns, duration_ns);
+		}
+
+		Scope(const Scope&) = delete;
+		Scope& operator=(const Scope&) = delete;
+	};
+
+	bool show_overlay = false;
+
+	FrameProfiler() : frames(history_frames), events(max_events){
+	}
+
+	// Returns the index to time the phase with; at most max_phases
+	int AddPhase(const std::string& name, olc::Pixel colour){
+		phases.push_back({ name, colour });
+		return int(phases.size()) - 1;
+	}
+
+	void BeginFrame(float elapsed_time){
+		current = Frame{};
+		current.interval_ms = elapsed_time * 1000.0f;
+		frame_start_ns = Now();
+	}
+
+	void EndFrame(){
+		int64_t duration_ns = Now() - frame_start_ns;
+		current.update_ms = float(duration_ns) * 1e-6f;
+		AddEvent(-1, frame_start_ns, duration_ns);
+
+		frames[frame_next] = current;
+		frame_next = (frame_next + 1) % history_frames;
+		frame_count = std::min(frame_count + 1, history_frames);
+	}
+
+	// Graph of the recent frames, a bar per frame stacked by phase with the
+	// frame interval as a grey dot, above the per phase averages in ms
+	void DrawOverlay(olc::PixelGameEngine& pge, olc::vi2d pos) const{
+		constexpr int graph_height = 64;
+		// full graph height
+		constexpr float graph_ms = 33.3f;
+		constexpr int averaged_frames = 60;
+		int text_rows = int(phases.size()) + 2;
+		olc::vi2d size{ history_frames + 8, graph_height + 12 + text_rows * 10 };
+
+		olc::Pixel::Mode pixel_mode = pge.GetPixelMode();
+		pge.SetPixelMode(olc::Pixel::ALPHA);
+		pge.FillRect(pos, size, olc::Pixel(0, 0, 0, 180));
+		pge.SetPixelMode(pixel_mode);
+
+		olc::vi2d graph_origin = pos + olc::vi2d{ 4, 4 + graph_height };
+		auto ms_to_height = [&](float ms) {
+			return std::min(graph_height, int(ms / graph_ms * float(graph_height)));
+		};
+
+		// 60 fps budget
+		int budget_y = graph_origin.y - ms_to_height(1000.0f / 60.0f);
+		pge.DrawLine({ graph_origin.x, budget_y }, { graph_origin.x + history_frames - 1, budget_y }, olc::DARK_GREY, 0xCCCCCCCC);
+
+		for (int i = 0; i < frame_count; i++) {
+			const Frame& frame = History(i);
+			int x = graph_origin.x + history_frames - 1 - i;
+			float stacked_ms = 0.0f;
+			for (size_t phase = 0; phase < phases.size(); phase++) {
+				int bottom = ms_to_height(stacked_ms);
+				stacked_ms += frame.phase_ms[phase];
+				int top = ms_to_height(stacked_ms);
+				if (top > bottom) {
+					pge.DrawLine({ x, graph_origin.y - bottom }, { x, graph_origin.y - top + 1 }, phases[phase].colour);
+				}
+			}
+			pge.Draw({ x, graph_origin.y - ms_to_height(frame.interval_ms) }, olc::GREY);
+		}
+
+		int averaged = std::min(frame_count, averaged_frames);
+		float interval_ms = 0.0f;
+		float update_ms = 0.0f;
+		float phase_ms[max_phases] = {};
+		for (int i = 0; i < averaged; i++) {
+			const Frame& frame = History(i);
+			interval_ms += frame.interval_ms;
+			update_ms += frame.update_ms;
+			for (size_t phase = 0; phase < phases.size(); phase++) {
+				phase_ms[phase] += frame.phase_ms[phase];
+			}
+		}
+		float scale = averaged > 0 ? 1.0f / float(averaged) : 0.0f;
+
+		char line[64];
+		olc::vi2d text = pos + olc::vi2d{ 4, graph_height + 10 };
+		std::snprintf(line, sizeof(line), "frame   %6.2f ms", interval_ms * scale);
+		pge.DrawString(text, line, olc::GREY);
+		text.y += 10;
+		std::snprintf(line, sizeof(line), "update  %6.2f ms", update_ms * scale);
+		pge.DrawString(text, line, olc::WHITE);
+		for (size_t phase = 0; phase < phases.size(); phase++) {
+			text.y += 10;
+			std::snprintf(line, sizeof(line), "%-7.7s %6.2f ms", phases[phase].name.c_str(), phase_ms[phase] * scale);
+			pge.DrawString(text, line, phases[phase].colour);
+		}
+	}
+
+	// Chrome trace event JSON of every span still in the ring, oldest first
+	void WriteChromeTrace(std::ostream& out) const{
+		out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+		out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"OnUserUpdate\"}}";
+
+		char line[160];
+		int first = (event_next - event_count + max_events) % max_events;
+		for (int i = 0; i < event_count; i++) {
+			const Event& event = events[(first + i) % max_events];
+			const char* name = event.phase < 0 ? "frame" : phases[event.phase].name.c_str();
+			std::snprintf(line, sizeof(line), ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%.3f,\"dur\":%.3f}",
+				name, double(event.start_ns) * 1e-3, double(event.duration_ns) * 1e-3);
+			out << line;
+		}
+		out << "\n]}\n";
+	}
+};
@@ -0,0 +1,438 @@
+#pragma once
+
+#include "olcPixelGameEngine.h"
+
+#include <algorithm>
+#include <cstdio>
+
+// Only the OpenGL 3.3 renderer has shaders; on the others (OpenGL 1.0, headless)
+// the brush stays on its CPU kernel
+#if defined(OLC_GFX_OPENGL33) && (defined(OLC_PLATFORM_X11) || defined(OLC_PLATFORM_WINAPI))
+	#define TERRAIN_GPU_BLEND
+#endif
+
+// The batched blend brush (AdjustTerrain_BlendBallFractionalFast2) as fragment
+// shader passes on the renderer's GL context: the source block goes up as a
+// float texture, an x pass sums every row window, and a y pass finishes the box
+// average, eases it and lerps it into the current cells by the brush circles.
+// Cells outside every circle come back exactly as they went up.
+//
+// The result is read into a pixel buffer without waiting for it; Resolve()
+// hands it over later (the next frame, usually long after the GPU finished),
+// or right away when another blend needs the cells. Everything has to run on
+// the thread owning the context, which for olc::PixelGameEngine is the one
+// calling OnUserCreate and OnUserUpdate.
+class GpuBlendBrush{
+public:
+	// centres one Submit() takes, the uniform array of the shader
+	static constexpr int max_centres = 16;
+
+	static constexpr bool Supported(){
+#if defined(TERRAIN_GPU_BLEND)
+		return true;
+#else
+		return false;
+#endif
+	}
+
+#if defined(TERRAIN_GPU_BLEND)
+private:
+	// past what the GL 1.1 headers define
+	enum : GLenum{
+		gl_r32f = 0x822E,
+		gl_clamp_to_edge = 0x812F,
+		gl_texture0 = 0x84C0,
+		gl_active_texture = 0x84E0,
+		gl_framebuffer = 0x8D40,
+		gl_framebuffer_binding = 0x8CA6,
+		gl_framebuffer_complete = 0x8CD5,
+		gl_color_attachment0 = 0x8CE0,
+		gl_pixel_pack_buffer = 0x88EB,
+		gl_stream_read = 0x88E1,
+		gl_read_only = 0x88B8,
+		gl_fragment_shader = 0x8B30,
+		gl_vertex_shader = 0x8B31,
+		gl_compile_status = 0x8B81,
+		gl_link_status = 0x8B82,
+		gl_current_program = 0x8B8D,
+		gl_vertex_array_binding = 0x85B5,
+	};
+
+	typedef void CALLSTYLE GetShaderiv_t(GLuint shader, GLenum name, GLint* value);
+	typedef void CALLSTYLE Uniform2fv_t(GLint location, GLsizei count, const GLfloat* value);
+	typedef void CALLSTYLE DeleteBuffers_t(GLsizei n, const GLuint* buffers);
+	typedef void CALLSTYLE DeleteVertexArrays_t(GLsizei n, const GLuint* arrays);
+	typedef void* CALLSTYLE MapBuffer_t(GLenum target, GLenum access);
+	typedef GLboolean CALLSTYLE UnmapBuffer_t(GLenum target);
+
+	olc::locCreateShader_t* CreateShader = nullptr;
+	olc::locShaderSource_t* ShaderSource = nullptr;
+	olc::locCompileShader_t* CompileShader = nullptr;
+	GetShaderiv_t* GetShaderiv = nullptr;
+	olc::locGetShaderInfoLog_t* GetShaderInfoLog = nullptr;
+	olc::locDeleteShader_t* DeleteShader = nullptr;
+	olc::locCreateProgram_t* CreateProgram = nullptr;
+	olc::locAttachShader_t* AttachShader = nullptr;
+	olc::locLinkProgram_t* LinkProgram = nullptr;
+	GetShaderiv_t* GetProgramiv = nullptr;
+	olc::locDeleteProgram_t* DeleteProgram = nullptr;
+	olc::locUseProgram_t* UseProgram = nullptr;
+	olc::locGetUniformLocation_t* GetUniformLocation = nullptr;
+	olc::locUniform1i_t* Uniform1i = nullptr;
+	olc::locUniform1f_t* Uniform1f = nullptr;
+	Uniform2fv_t* Uniform2fv = nullptr;
+	olc::locActiveTexture_t* ActiveTexture = nullptr;
+	olc::locGenFrameBuffers_t* GenFramebuffers = nullptr;
+	olc::locBindFrameBuffer_t* BindFramebuffer = nullptr;
+	olc::locFrameBufferTexture2D_t* FramebufferTexture2D = nullptr;
+	olc::locCheckFrameBufferStatus_t* CheckFramebufferStatus = nullptr;
+	olc::locDeleteFrameBuffers_t* DeleteFramebuffers = nullptr;
+	olc::locGenBuffers_t* GenBuffers = nullptr;
+	olc::locBindBuffer_t* BindBuffer = nullptr;
+	olc::locBufferData_t* BufferData = nullptr;
+	DeleteBuffers_t* DeleteBuffers = nullptr;
+	MapBuffer_t* MapBuffer = nullptr;
+	UnmapBuffer_t* UnmapBuffer = nullptr;
+	olc::locGenVertexArrays_t* GenVertexArrays = nullptr;
+	olc::locBindVertexArray_t* BindVertexArray = nullptr;
+	DeleteVertexArrays_t* DeleteVertexArrays = nullptr;
+
+	GLuint sum_x_program = 0;
+	GLuint blend_program = 0;
+	GLuint vertex_array = 0;
+	GLuint framebuffer = 0;
+	GLuint pixel_buffer = 0;
+	// source block, its row sums and the blended result
+	GLuint textures[3] = {};
+	GLint max_texture_size = 0;
+	bool ready = false;
+
+	// Submit()'s block, until Resolve()
+	bool pending = false;
+	olc::vi2d pending_from;
+	olc::vi2d pending_size;
+
+	template <typename Function>
+	static bool Load(Function*& function, const char* name){
+#if defined(OLC_PLATFORM_WINAPI)
+		function = reinterpret_cast<Function*>(wglGetProcAddress(name));
+#else
+		function = reinterpret_cast<Function*>(X11::glXGetProcAddress(reinterpret_cast<const unsigned char*>(name)));
+#endif
+		return function != nullptr;
+	}
+
+	GLuint Compile(GLenum type, const char* source){
+		GLuint shader = CreateShader(type);
+		ShaderSource(shader, 1, &source, nullptr);
+		CompileShader(shader);
+		GLint compiled = 0;
+		GetShaderiv(shader, gl_compile_status, &compiled);
+		if (!compiled) {
+			char log[512] = {};
+			GetShaderInfoLog(shader, sizeof(log) - 1, nullptr, log);
+			std::fprintf(stderr, "GPU blend shader: %s\n", log);
+			DeleteShader(shader);
+			return 0;
+		}
+		return shader;
+	}
+
+	GLuint Link(const char* vertex_source, const char* fragment_source){
+		GLuint vertex = Compile(gl_vertex_shader, vertex_source);
+		GLuint fragment = Compile(gl_fragment_shader, fragment_source);
+		GLuint program = 0;
+		if (vertex && fragment) {
+			program = CreateProgram();
+			AttachShader(program, vertex);
+			AttachShader(program, fragment);
+			LinkProgram(program);
+			GLint linked = 0;
+			GetProgramiv(program, gl_link_status, &linked);
+			if (!linked) {
+				DeleteProgram(program);
+				program = 0;
+			}
+		}
+		if (vertex) DeleteShader(vertex);
+		if (fragment) DeleteShader(fragment);
+		return program;
+	}
+
+	// the renderer's bindings, put back after every use
+	struct SavedState{
+		GLint viewport[4];
+		GLint framebuffer;
+		GLint program;
+		GLint vertex_array;
+		GLint active_texture;
+		GLint texture;
+		GLboolean blend;
+	};
+
+	SavedState Save() const{
+		SavedState state;
+		glGetIntegerv(GL_VIEWPORT, state.viewport);
+		glGetIntegerv(gl_framebuffer_binding, &state.framebuffer);
+		glGetIntegerv(gl_current_program, &state.program);
+		glGetIntegerv(gl_vertex_array_binding, &state.vertex_array);
+		glGetIntegerv(gl_active_texture, &state.active_texture);
+		glGetIntegerv(GL_TEXTURE_BINDING_2D, &state.texture);
+		state.blend = glIsEnabled(GL_BLEND);
+		return state;
+	}
+
+	void Restore(const SavedState& state){
+		BindFramebuffer(gl_framebuffer, GLuint(state.framebuffer));
+		glViewport(state.viewport[0], state.viewport[1], state.viewport[2], state.viewport[3]);
+		UseProgram(GLuint(state.program));
+		BindVertexArray(GLuint(state.vertex_array));
+		ActiveTexture(GLenum(state.active_texture));
+		glBindTexture(GL_TEXTURE_2D, GLuint(state.texture));
+		if (state.blend) {
+			glEnable(GL_BLEND);
+		}
+	}
+
+	void Target(GLuint texture, int width, int height){
+		FramebufferTexture2D(gl_framebuffer, gl_color_attachment0, GL_TEXTURE_2D, texture, 0);
+		glViewport(0, 0, width, height);
+	}
+
+	static void Allocate(GLuint texture, int width, int height, const float* cells){
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glTexImage2D(GL_TEXTURE_2D, 0, gl_r32f, width, height, 0, GL_RED, GL_FLOAT, cells);
+	}
+
+public:
+	GpuBlendBrush() = default;
+	GpuBlendBrush(const GpuBlendBrush&) = delete;
+	GpuBlendBrush& operator=(const GpuBlendBrush&) = delete;
+
+	// Loads the GL functions and builds the shaders. Needs the context current;
+	// false leaves the brush on the CPU.
+	bool Init(){
+		if (ready) {
+			return true;
+		}
+		bool loaded = Load(CreateShader, "glCreateShader") && Load(ShaderSource, "glShaderSource")
+			&& Load(CompileShader, "glCompileShader") && Load(GetShaderiv, "glGetShaderiv")
+			&& Load(GetShaderInfoLog, "glGetShaderInfoLog") && Load(DeleteShader, "glDeleteShader")
+			&& Load(CreateProgram, "glCreateProgram") && Load(AttachShader, "glAttachShader")
+			&& Load(LinkProgram, "glLinkProgram") && Load(GetProgramiv, "glGetProgramiv")
+			&& Load(DeleteProgram, "glDeleteProgram") && Load(UseProgram, "glUseProgram")
+			&& Load(GetUniformLocation, "glGetUniformLocation") && Load(Uniform1i, "glUniform1i")
+			&& Load(Uniform1f, "glUniform1f") && Load(Uniform2fv, "glUniform2fv")
+			&& Load(ActiveTexture, "glActiveTexture") && Load(GenFramebuffers, "glGenFramebuffers")
+			&& Load(BindFramebuffer, "glBindFramebuffer") && Load(FramebufferTexture2D, "glFramebufferTexture2D")
+			&& Load(CheckFramebufferStatus, "glCheckFramebufferStatus") && Load(DeleteFramebuffers, "glDeleteFramebuffers")
+			&& Load(GenBuffers, "glGenBuffers") && Load(BindBuffer, "glBindBuffer") && Load(BufferData, "glBufferData")
+			&& Load(DeleteBuffers, "glDeleteBuffers") && Load(MapBuffer, "glMapBuffer") && Load(UnmapBuffer, "glUnmapBuffer")
+			&& Load(GenVertexArrays, "glGenVertexArrays") && Load(BindVertexArray, "glBindVertexArray")
+			&& Load(DeleteVertexArrays, "glDeleteVertexArrays");
+		if (!loaded) {
+			return false;
+		}
+
+		// one triangle over the whole target
+		const char* vertex_source =
+			"#version 330 core\n"
+			"void main(){\n"
+			"	gl_Position = vec4(float((gl_VertexID & 1) * 4 - 1), float((gl_VertexID >> 1) * 4 - 1), 0.0, 1.0);\n"
+			"}\n";
+		// row sums of the 2 * radius + 1 wide window, for every source row
+		const char* sum_x_source =
+			"#version 330 core\n"
+			"uniform sampler2D source;\n"
+			"uniform int radius;\n"
+			"layout(location = 0) out float sum;\n"
+			"void main(){\n"
+			"	ivec2 cell = ivec2(gl_FragCoord.xy);\n"
+			"	float total = 0.0;\n"
+			"	for (int k = 0; k <= 2 * radius; k++) total += texelFetch(source, ivec2(cell.x + k, cell.y), 0).r;\n"
+			"	sum = total;\n"
+			"}\n";
+		// same maths as the CPU kernel: the strongest blend of the circles over a cell
+		const char* blend_source =
+			"#version 330 core\n"
+			"uniform sampler2D source;\n"
+			"uniform sampler2D sums;\n"
+			"uniform int radius;\n"
+			"uniform float brush_size_squared;\n"
+			"uniform int count;\n"
+			"uniform vec2 centres[16];\n"
+			"layout(location = 0) out float value;\n"
+			"void main(){\n"
+			"	ivec2 cell = ivec2(gl_FragCoord.xy);\n"
+			"	float current = texelFetch(source, cell + ivec2(radius), 0).r;\n"
+			"	float keep = 1.0;\n"
+			"	for (int i = 0; i < count; i++) {\n"
+			"		vec2 offset = vec2(cell) - centres[i];\n"
+			"		float distance = dot(offset, offset);\n"
+			"		if (distance < brush_size_squared) keep = min(keep, max(distance / brush_size_squared * 2.0 - 1.0, 0.0));\n"
+			"	}\n"
+			"	if (keep >= 1.0) { value = current; return; }\n"
+			"	float total = 0.0;\n"
+			"	for (int k = 0; k <= 2 * radius; k++) total += texelFetch(sums, ivec2(cell.x, cell.y + k), 0).r;\n"
+			"	float average = total / float((2 * radius + 1) * (2 * radius + 1));\n"
+			"	float t = 2.0 - 2.0 * average;\n"
+			"	average = average < 0.5 ? 4.0 * average * average * average : 1.0 - t * t * t / 2.0;\n"
+			"	value = average * (1.0 - keep) + current * keep;\n"
+			"}\n";
+
+		while (glGetError() != GL_NO_ERROR) {
+		}
+		SavedState state = Save();
+		sum_x_program = Link(vertex_source, sum_x_source);
+		blend_program = Link(vertex_source, blend_source);
+		if (!sum_x_program || !blend_program) {
+			Release();
+			Restore(state);
+			return false;
+		}
+		GenVertexArrays(1, &vertex_array);
+		GenFramebuffers(1, &framebuffer);
+		GenBuffers(1, &pixel_buffer);
+		glGenTextures(3, textures);
+		for (GLuint texture : textures) {
+			glBindTexture(GL_TEXTURE_2D, texture);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, gl_clamp_to_edge);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, gl_clamp_to_edge);
+		}
+		glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_texture_size);
+
+		// a float target has to be renderable here
+		Allocate(textures[2], 1, 1, nullptr);
+		BindFramebuffer(gl_framebuffer, framebuffer);
+		FramebufferTexture2D(gl_framebuffer, gl_color_attachment0, GL_TEXTURE_2D, textures[2], 0);
+		ready = CheckFramebufferStatus(gl_framebuffer) == gl_framebuffer_complete && glGetError() == GL_NO_ERROR;
+		Restore(state);
+		if (!ready) {
+			Release();
+		}
+		return ready;
+	}
+
+	// Frees the GL objects; the context must still be current
+	void Release(){
+		if (sum_x_program) DeleteProgram(sum_x_program);
+		if (blend_program) DeleteProgram(blend_program);
+		if (vertex_array) DeleteVertexArrays(1, &vertex_array);
+		if (framebuffer) DeleteFramebuffers(1, &framebuffer);
+		if (pixel_buffer) DeleteBuffers(1, &pixel_buffer);
+		if (textures[0]) glDeleteTextures(3, textures);
+		sum_x_program = blend_program = vertex_array = framebuffer = pixel_buffer = 0;
+		std::fill(std::begin(textures), std::end(textures), 0u);
+		ready = false;
+		pending = false;
+	}
+
+	bool IsReady() const{
+		return ready;
+	}
+	bool HasPending() const{
+		return pending;
+	}
+
+	// Blends the size block at from around count centres (map cells). source is
+	// the block grown by blend_range on every side, row major. False when the
+	// GPU can't take it (not ready, a result still pending, too large, too many
+	// centres); the caller then runs the CPU kernel.
+	bool Submit(const float* source, olc::vi2d from, olc::vi2d size, int blend_range, int brush_size, const olc::vi2d* centres, int count){
+		olc::vi2d source_size = size + olc::vi2d{ 2 * blend_range, 2 * blend_range };
+		if (!ready || pending || count <= 0 || count > max_centres
+			|| std::max(source_size.x, source_size.y) > max_texture_size) {
+			return false;
+		}
+
+		while (glGetError() != GL_NO_ERROR) {
+		}
+		SavedState state = Save();
+		glDisable(GL_BLEND);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		glPixelStorei(GL_PACK_ALIGNMENT, 4);
+		BindVertexArray(vertex_array);
+		BindFramebuffer(gl_framebuffer, framebuffer);
+
+		ActiveTexture(gl_texture0);
+		Allocate(textures[0], source_size.x, source_size.y, source);
+		Allocate(textures[1], size.x, source_size.y, nullptr);
+		Allocate(textures[2], size.x, size.y, nullptr);
+
+		UseProgram(sum_x_program);
+		Target(textures[1], size.x, source_size.y);
+		glBindTexture(GL_TEXTURE_2D, textures[0]);
+		Uniform1i(GetUniformLocation(sum_x_program, "source"), 0);
+		Uniform1i(GetUniformLocation(sum_x_program, "radius"), blend_range);
+		glDrawArrays(GL_TRIANGLES, 0, 3);
+
+		float centre_cells[2 * max_centres];
+		for (int i = 0; i < count; i++) {
+			centre_cells[2 * i] = float(centres[i].x - from.x);
+			centre_cells[2 * i + 1] = float(centres[i].y - from.y);
+		}
+		UseProgram(blend_program);
+		Target(textures[2], size.x, size.y);
+		ActiveTexture(gl_texture0 + 1);
+		glBindTexture(GL_TEXTURE_2D, textures[1]);
+		ActiveTexture(gl_texture0);
+		glBindTexture(GL_TEXTURE_2D, textures[0]);
+		Uniform1i(GetUniformLocation(blend_program, "source"), 0);
+		Uniform1i(GetUniformLocation(blend_program, "sums"), 1);
+		Uniform1i(GetUniformLocation(blend_program, "radius"), blend_range);
+		Uniform1f(GetUniformLocation(blend_program, "brush_size_squared"), float(brush_size * brush_size));
+		Uniform1i(GetUniformLocation(blend_program, "count"), count);
+		Uniform2fv(GetUniformLocation(blend_program, "centres"), count, centre_cells);
+		glDrawArrays(GL_TRIANGLES, 0, 3);
+
+		// queued behind the draws, so this returns without waiting for them
+		BindBuffer(gl_pixel_pack_buffer, pixel_buffer);
+		BufferData(gl_pixel_pack_buffer, GLsizeiptr(size_t(size.x) * size.y * sizeof(float)), nullptr, gl_stream_read);
+		glReadPixels(0, 0, size.x, size.y, GL_RED, GL_FLOAT, nullptr);
+		BindBuffer(gl_pixel_pack_buffer, 0);
+
+		Restore(state);
+		pending = glGetError() == GL_NO_ERROR;
+		pending_from = from;
+		pending_size = size;
+		return pending;
+	}
+
+	// Calls write(cells, from, size) with the row major result of the last
+	// Submit(), waiting for it if the GPU isn't done yet; nothing if none is pending
+	template <typename Write>
+	void Resolve(Write write){
+		if (!pending) {
+			return;
+		}
+		pending = false;
+		BindBuffer(gl_pixel_pack_buffer, pixel_buffer);
+		const float* cells = static_cast<const float*>(MapBuffer(gl_pixel_pack_buffer, gl_read_only));
+		if (cells) {
+			write(cells, pending_from, pending_size);
+			UnmapBuffer(gl_pixel_pack_buffer);
+		}
+		BindBuffer(gl_pixel_pack_buffer, 0);
+	}
+#else
+	bool Init(){
+		return false;
+	}
+	void Release(){
+	}
+	bool IsReady() const{
+		return false;
+	}
+	bool HasPending() const{
+		return false;
+	}
+	bool Submit(const float*, olc::vi2d, olc::vi2d, int, int, const olc::vi2d*, int){
+		return false;
+	}
+	template <typename Write>
+	void Resolve(Write){
+	}
+#endif
+};
@@ -0,0 +1,471 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+	#if !defined(NOMINMAX)
+		#define NOMINMAX
+	#endif
+	#include <winsock2.h>
+	#include <ws2tcpip.h>
+	#pragma comment(lib, "ws2_32.lib")
+#else
+	#include <fcntl.h>
+	#include <netdb.h>
+	#include <netinet/in.h>
+	#include <netinet/tcp.h>
+	#include <poll.h>
+	#include <sys/socket.h>
+	#include <unistd.h>
+#endif
+
+// Appends plain values to a message payload, in the machine's byte order like the terrain file
+struct NetWriter{
+	std::vector<uint8_t>& bytes;
+
+	template <typename T>
+	void Put(const T& value){
+		PutBytes(&value, sizeof(value));
+	}
+
+	void PutBytes(const void* data, size_t size){
+		const uint8_t* begin = static_cast<const uint8_t*>(data);
+		bytes.insert(bytes.end(), begin, begin + size);
+	}
+};
+
+// Reads them back; every Get() fails once the payload runs out
+struct NetReader{
+	const uint8_t* data;
+	size_t size;
+	size_t at = 0;
+
+	template <typename T>
+	bool Get(T& value){
+		return GetBytes(&value, sizeof(value));
+	}
+
+	bool GetBytes(void* out, size_t count){
+		if (size - at < count) {
+			return false;
+		}
+		std::memcpy(out, data + at, count);
+		at += count;
+		return true;
+	}
+
+	size_t Remaining() const{
+		return size - at;
+	}
+};
+
+struct NetMessage{
+	// who it came from: a client's id on the host, NetSession::host_peer on a client
+	int peer = 0;
+	uint8_t type = 0;
+	std::vector<uint8_t> payload;
+};
+
+// TCP transport of an editing session: one host, any number of clients, each
+// client connected to the host only. Messages are [uint32 size][uint8 type]
+// [payload] frames. A background thread does all the socket work: it accepts
+// clients, reads and splits frames into an inbox the main thread drains with
+// Poll(), and sends what Send() and Broadcast() queued. What the messages mean
+// is up to the caller, apart from the three types the session makes itself.
+class NetSession{
+#if defined(_WIN32)
+	using Socket = SOCKET;
+	static constexpr Socket no_socket = INVALID_SOCKET;
+#else
+	using Socket = int;
+	static constexpr Socket no_socket = -1;
+#endif
+
+	struct Peer{
+		int id = 0;
+		Socket socket = no_socket;
+		std::vector<uint8_t> in;
+		std::vector<uint8_t> out;
+		// gets Broadcast() messages
+		bool joined = false;
+	};
+
+	static constexpr uint32_t max_message_size = 64u << 20;
+
+	std::thread thread;
+	std::atomic<bool> running{ false };
+	std::mutex lock;
+	std::vector<Peer> peers;
+	std::deque<NetMessage> inbox;
+	Socket listener = no_socket;
+	std::vector<uint8_t> welcome;
+	int next_peer_id = 1;
+	bool hosting = false;
+	std::atomic<uint64_t> bytes_sent{ 0 };
+	std::atomic<uint64_t> bytes_received{ 0 };
+
+	static void CloseSocket(Socket socket){
+#if defined(_WIN32)
+		closesocket(socket);
+#else
+		close(socket);
+#endif
+	}
+
+	static bool StartSockets(){
+#if defined(_WIN32)
+		WSADATA data;
+		return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+#else
+		return true;
+#endif
+	}
+
+	static void SetNonBlocking(Socket socket){
+#if defined(_WIN32)
+		u_long enabled = 1;
+		ioctlsocket(socket, FIONBIO, &enabled);
+#else
+		fcntl(socket, F_SETFL, fcntl(socket, F_GETFL, 0) | O_NONBLOCK);
+#endif
+		// ops are small and latency matters more than packing them
+		int no_delay = 1;
+		setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&no_delay), sizeof(no_delay));
+	}
+
+	static bool WouldBlock(){
+#if defined(_WIN32)
+		return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+		return errno == EAGAIN || errno == EWOULDBLOCK;
+#endif
+	}
+
+	static int PollSockets(std::vector<pollfd>& fds, int timeout_ms){
+#if defined(_WIN32)
+		return WSAPoll(fds.data(), ULONG(fds.size()), timeout_ms);
+#else
+		return poll(fds.data(), nfds_t(fds.size()), timeout_ms);
+#endif
+	}
+
+	static void AppendFrame(std::vector<uint8_t>& out, uint8_t type, const uint8_t* payload, size_t size){
+		uint32_t frame_size = uint32_t(size);
+		const uint8_t* header = reinterpret_cast<const uint8_t*>(&frame_size);
+		out.insert(out.end(), header, header + sizeof(frame_size));
+		out.push_back(type);
+		out.insert(out.end(), payload, payload + size);
+	}
+
+	// moves the whole frames of peer.in to the inbox; false if one is malformed
+	bool SplitFrames(Peer& peer){
+		size_t at = 0;
+		while (peer.in.size() - at >= 5) {
+			uint32_t size;
+			std::memcpy(&size, peer.in.data() + at, sizeof(size));
+			if (size > max_message_size) {
+				return false;
+			}
+			if (peer.in.size() - at < 5 + size_t(size)) {
+				break;
+			}
+			NetMessage message;
+			message.peer = peer.id;
+			message.type = peer.in[at + 4];
+			message.payload.assign(peer.in.begin() + at + 5, peer.in.begin() + at + 5 + size);
+			inbox.push_back(std::move(message));
+			at += 5 + size_t(size);
+		}
+		peer.in.erase(peer.in.begin(), peer.in.begin() + at);
+		return true;
+	}
+
+	// reads and writes what the socket allows; false once the peer is gone
+	bool Service(Peer& peer, short events){
+		if (events & (POLLERR | POLLHUP | POLLNVAL)) {
+			if (!(events & POLLIN)) {
+				return false;
+			}
+		}
+		if (events & POLLIN) {
+			uint8_t buffer[16384];
+			while (true) {
+				auto received = recv(peer.socket, reinterpret_cast<char*>(buffer), int(sizeof(buffer)), 0);
+				if (received > 0) {
+					peer.in.insert(peer.in.end(), buffer, buffer + received);
+					bytes_received += uint64_t(received);
+					continue;
+				}
+				if (received == 0 || !WouldBlock()) {
+					return false;
+				}
+				break;
+			}
+			if (!SplitFrames(peer)) {
+				return false;
+			}
+		}
+		if (!peer.out.empty()) {
+#if defined(MSG_NOSIGNAL)
+			// a closed peer shows up as an error here, not as SIGPIPE
+			constexpr int flags = MSG_NOSIGNAL;
+#else
+			constexpr int flags = 0;
+#endif
+			auto sent = send(peer.socket, reinterpret_cast<const char*>(peer.out.data()), int(peer.out.size()), flags);
+			if (sent > 0) {
+				peer.out.erase(peer.out.begin(), peer.out.begin() + sent);
+				bytes_sent += uint64_t(sent);
+			}
+			else if (sent < 0 && !WouldBlock()) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	void AcceptClients(){
+		while (true) {
+			Socket socket = accept(listener, nullptr, nullptr);
+			if (socket == no_socket) {
+				return;
+			}
+			SetNonBlocking(socket);
+			Peer peer;
+			peer.id = next_peer_id++;
+			peer.socket = socket;
+			AppendFrame(peer.out, welcome_message, welcome.data(), welcome.size());
+			inbox.push_back({ peer.id, peer_joined, {} });
+			peers.push_back(std::move(peer));
+		}
+	}
+
+	void Run(){
+		std::vector<pollfd> fds;
+		while (running) {
+			{
+				std::lock_guard<std::mutex> guard(lock);
+				fds.clear();
+				if (listener != no_socket) {
+					fds.push_back({ listener, POLLIN, 0 });
+				}
+				for (const Peer& peer : peers) {
+					fds.push_back({ peer.socket, short(POLLIN | (peer.out.empty() ? 0 : POLLOUT)), 0 });
+				}
+			}
+			// short, so messages queued meanwhile don't wait long for their POLLOUT
+			PollSockets(fds, 2);
+
+			std::lock_guard<std::mutex> guard(lock);
+			size_t first_peer = 0;
+			if (listener != no_socket) {
+				if (fds[0].revents & POLLIN) {
+					AcceptClients();
+				}
+				first_peer = 1;
+			}
+			// peers accepted just now come after the polled ones
+			for (size_t i = 0; i < peers.size(); i++) {
+				short events = first_peer + i < fds.size() ? fds[first_peer + i].revents : short(0);
+				if (!Service(peers[i], short(events | (peers[i].out.empty() ? 0 : POLLOUT)))) {
+					CloseSocket(peers[i].socket);
+					inbox.push_back({ peers[i].id, peer_left, {} });
+					peers.erase(peers.begin() + i);
+					if (first_peer + i < fds.size()) {
+						fds.erase(fds.begin() + first_peer + i);
+					}
+					i--;
+				}
+			}
+		}
+	}
+
+	void Start(){
+		running = true;
+		thread = std::thread([this]() { Run(); });
+	}
+
+public:
+	// the host's id on a client
+	static constexpr int host_peer = 0;
+
+	// types below 16 belong to the session
+	enum : uint8_t{
+		// host to a new client right as it connects, with the payload given to Host()
+		welcome_message = 1,
+		// made by the session on the host when a client connects or goes, and on a
+		// client (for host_peer) when the host goes
+		peer_joined = 2,
+		peer_left = 3,
+		first_user_message = 16,
+	};
+
+	~NetSession(){
+		Close();
+	}
+
+	// Listens on port for clients, each greeted with a welcome_message carrying welcome
+	bool Host(uint16_t port, std::vector<uint8_t> welcome){
+		Close();
+		if (!StartSockets()) {
+			return false;
+		}
+		listener = socket(AF_INET6, SOCK_STREAM, IPPROTO_TCP);
+		if (listener == no_socket) {
+			return false;
+		}
+		// IPv4 clients too
+		int off = 0;
+		setsockopt(listener, IPPROTO_IPV6, IPV6_V6ONLY, reinterpret_cast<const char*>(&off), sizeof(off));
+		int reuse = 1;
+		setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&reuse), sizeof(reuse));
+		sockaddr_in6 address{};
+		address.sin6_family = AF_INET6;
+		address.sin6_addr = in6addr_any;
+		address.sin6_port = htons(port);
+		if (bind(listener, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0 || listen(listener, 8) != 0) {
+			CloseSocket(listener);
+			listener = no_socket;
+			return false;
+		}
+		SetNonBlocking(listener);
+		this->welcome = std::move(welcome);
+		hosting = true;
+		Start();
+		return true;
+	}
+
+	// Connects to a host and waits (up to timeout_ms) for its welcome payload
+	bool Join(const std::string& host, uint16_t port, std::vector<uint8_t>& welcome, int timeout_ms = 5000){
+		Close();
+		if (!StartSockets()) {
+			return false;
+		}
+		addrinfo hints{};
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		addrinfo* addresses = nullptr;
+		if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &addresses) != 0) {
+			return false;
+		}
+		Socket socket = no_socket;
+		for (addrinfo* address = addresses; address && socket == no_socket; address = address->ai_next) {
+			socket = ::socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+			if (socket != no_socket && connect(socket, address->ai_addr, int(address->ai_addrlen)) != 0) {
+				CloseSocket(socket);
+				socket = no_socket;
+			}
+		}
+		freeaddrinfo(addresses);
+		if (socket == no_socket) {
+			return false;
+		}
+		SetNonBlocking(socket);
+
+		Peer peer;
+		peer.id = host_peer;
+		peer.socket = socket;
+		peer.joined = true;
+		peers.push_back(std::move(peer));
+
+		// the host speaks first
+		auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+		while (std::chrono::steady_clock::now() < deadline) {
+			std::vector<pollfd> fds{ { socket, POLLIN, 0 } };
+			PollSockets(fds, 10);
+			if (!Service(peers[0], fds[0].revents)) {
+				break;
+			}
+			if (!inbox.empty()) {
+				if (inbox.front().type != welcome_message) {
+					break;
+				}
+				welcome = std::move(inbox.front().payload);
+				inbox.pop_front();
+				Start();
+				return true;
+			}
+		}
+		Close();
+		return false;
+	}
+
+	void Close(){
+		if (running) {
+			running = false;
+			thread.join();
+		}
+		for (Peer& peer : peers) {
+			CloseSocket(peer.socket);
+		}
+		peers.clear();
+		if (listener != no_socket) {
+			CloseSocket(listener);
+			listener = no_socket;
+		}
+		inbox.clear();
+		hosting = false;
+	}
+
+	bool IsHost() const{
+		return hosting;
+	}
+
+	// Queues a message for one peer (host_peer from a client)
+	void Send(int peer, uint8_t type, const std::vector<uint8_t>& payload){
+		std::lock_guard<std::mutex> guard(lock);
+		for (Peer& target : peers) {
+			if (target.id == peer) {
+				AppendFrame(target.out, type, payload.data(), payload.size());
+			}
+		}
+	}
+
+	// Queues a message for every joined peer
+	void Broadcast(uint8_t type, const std::vector<uint8_t>& payload){
+		std::lock_guard<std::mutex> guard(lock);
+		for (Peer& target : peers) {
+			if (target.joined) {
+				AppendFrame(target.out, type, payload.data(), payload.size());
+			}
+		}
+	}
+
+	// From now on the peer gets Broadcast() messages too, in order after those Send() queued for it
+	void SetJoined(int peer){
+		std::lock_guard<std::mutex> guard(lock);
+		for (Peer& target : peers) {
+			if (target.id == peer) {
+				target.joined = true;
+			}
+		}
+	}
+
+	// Takes the oldest message received, if any
+	bool Poll(NetMessage& message){
+		std::lock_guard<std::mutex> guard(lock);
+		if (inbox.empty()) {
+			return false;
+		}
+		message = std::move(inbox.front());
+		inbox.pop_front();
+		return true;
+	}
+
+	uint64_t BytesSent() const{
+		return bytes_sent;
+	}
+	uint64_t BytesReceived() const{
+		return bytes_received;
+	}
+};
@@ -0,0 +1,160 @@
+#pragma once
+
+#include "ChunkedDensityField.h"
+
+// Occupancy mip pyramid over a chunked field, used by the raycasts to step over
+// open space. Level 0 covers 8x8 cell blocks and every level above doubles the
+// block size until one block spans the map. Each block stores which kinds of
+// cell it contains (any non-zero cell, any cell at or above solid_threshold),
+// so "nothing here" means the flag is clear.
+// It follows the field's dirty reports: Update() rescans only the reported
+// blocks and refreshes their parents, so brushes keep it current for the cost
+// of the area they edited.
+template <typename Field>
+class OccupancyPyramid{
+public:
+	static constexpr uint8_t any_nonzero = 1;
+	static constexpr uint8_t any_solid = 2;
+
+	static constexpr int base_block_log2 = 3;
+	static constexpr float solid_threshold = 0.5f;
+
+private:
+	struct Level{
+		std::vector<uint8_t> flags;
+		int width = 0;
+		int height = 0;
+	};
+
+	Field* field = nullptr;
+	ChunkDirtyTracker dirty;
+	std::vector<Level> levels;
+	typename Field::cell_type solid_cell = 0;
+
+	uint8_t CellFlags(typename Field::cell_type cell) const{
+		return (cell != 0 ? any_nonzero : 0) | (cell >= solid_cell ? any_solid : 0);
+	}
+
+	// block_from and block_to are inclusive level 0 block coordinates
+	void RebuildBase(olc::vi2d block_from, olc::vi2d block_to){
+		Level& base = levels[0];
+		constexpr int block_size = 1 << base_block_log2;
+		constexpr int blocks_per_chunk_log2 = Field::chunk_size_log2 - base_block_log2;
+
+		for (int block_y = block_from.y; block_y <= block_to.y; block_y++) {
+			for (int block_x = block_from.x; block_x <= block_to.x; block_x++) {
+				const typename Field::Chunk& chunk = field->GetChunk(block_x >> blocks_per_chunk_log2, block_y >> blocks_per_chunk_log2);
+				uint8_t flags = 0;
+
+				if (chunk.IsUniform()) {
+					flags = CellFlags(chunk.uniform_value);
+				}
+				else {
+					olc::vi2d origin{ block_x << base_block_log2, block_y << base_block_log2 };
+					olc::vi2d end = (origin + olc::vi2d{ block_size, block_size }).min(field->Size());
+					for (int y = origin.y; y < end.y; y++) {
+						const auto* row = chunk.cells->Row(y & Field::chunk_mask);
+						for (int x = origin.x; x < end.x; x++) {
+							flags |= CellFlags(row[x & Field::chunk_mask]);
+						}
+					}
+				}
+
+				base.flags[size_t(block_y) * base.width + block_x] = flags;
+			}
+		}
+	}
+
+	// refreshes the parents of the level 0 blocks from..to inclusive
+	void PropagateUp(olc::vi2d block_from, olc::vi2d block_to){
+		for (size_t level = 1; level < levels.size(); level++) {
+			const Level& child = levels[level - 1];
+			Level& parent = levels[level];
+			block_from = block_from / 2;
+			block_to = block_to / 2;
+
+			for (int block_y = block_from.y; block_y <= block_to.y; block_y++) {
+				for (int block_x = block_from.x; block_x <= block_to.x; block_x++) {
+					uint8_t flags = 0;
+					for (int child_y = block_y * 2; child_y < std::min(block_y * 2 + 2, child.height); child_y++) {
+						for (int child_x = block_x * 2; child_x < std::min(block_x * 2 + 2, child.width); child_x++) {
+							flags |= child.flags[size_t(child_y) * child.width + child_x];
+						}
+					}
+					parent.flags[size_t(block_y) * parent.width + block_x] = flags;
+				}
+			}
+		}
+	}
+
+public:
+	~OccupancyPyramid(){
+		Detach();
+	}
+
+	void Attach(Field& field){
+		Detach();
+		this->field = &field;
+		field.AddDirtyTracker(&dirty);
+
+		// smallest cell value that Get() reports as >= solid_threshold
+		using traits = typename Field::traits;
+		solid_cell = traits::FromFloat(solid_threshold);
+		while (solid_cell > 0 && traits::ToFloat(solid_cell - 1) >= solid_threshold) solid_cell--;
+		while (traits::ToFloat(solid_cell) < solid_threshold) solid_cell++;
+
+		levels.clear();
+		constexpr int block_size = 1 << base_block_log2;
+		olc::vi2d size = (field.Size() + olc::vi2d{ block_size - 1, block_size - 1 }) / block_size;
+		while (true) {
+			Level level;
+			level.width = size.x;
+			level.height = size.y;
+			level.flags.resize(size_t(size.x) * size.y, 0);
+			levels.push_back(std::move(level));
+			if (size.x == 1 && size.y == 1) {
+				break;
+			}
+			size = (size + olc::vi2d{ 1, 1 }) / 2;
+		}
+
+		RebuildBase({ 0, 0 }, { levels[0].width - 1, levels[0].height - 1 });
+		PropagateUp({ 0, 0 }, { levels[0].width - 1, levels[0].height - 1 });
+	}
+
+	void Detach(){
+		if (field) {
+			field->RemoveDirtyTracker(&dirty);
+			field = nullptr;
+		}
+	}
+
+	// Brings the pyramid in line with everything reported dirty since the last call
+	void Update(){
+		dirty.Consume([&](int chunk_x, int chunk_y, olc::vi2d local_from, olc::vi2d local_to){
+			olc::vi2d origin = field->ChunkOrigin(chunk_x, chunk_y);
+			olc::vi2d block_from = (origin + local_from) / (1 << base_block_log2);
+			olc::vi2d block_to = ((origin + local_to) / (1 << base_block_log2)).min({ levels[0].width - 1, levels[0].height - 1 });
+			RebuildBase(block_from, block_to);
+			PropagateUp(block_from, block_to);
+		});
+	}
+
+	// log2 of the largest aligned block around the (in map) cell that holds no
+	// cell matching mask, or -1 when its level 0 block already does
+	int EmptyBlockLog2(int x, int y, uint8_t mask) const{
+		int block_x = x >> base_block_log2;
+		int block_y = y >> base_block_log2;
+		int result = -1;
+		for (size_t level = 0; level < levels.size(); level++) {
+			const Level& current = levels[level];
+			if (current.flags[size_t(block_y) * current.width + block_x] & mask) {
+				break;
+			}
+			result = base_block_log2 + int(level);
+			block_x >>= 1;
+			block_y >>= 1;
+		}
+		return result;
+	}
+};
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+// Counts of the work behind the frames, for sizing hardware and for telling
+// which optimisations matter on real sessions, next to FrameProfiler's timings.
+// The editor Add()s to the current frame as it goes; EndFrame() folds the frame
+// into the current interval and the totals since start. WriteJson() writes one
+// line with both (JSON Lines, see --stats in main.cpp) and starts the next
+// interval. Edit latencies (ms from reading the input to the edit being drawn)
+// are kept whole, so their percentiles are exact.
+class PerfCounters{
+public:
+	enum Counter{
+		frames,
+		// ray walks, and the cells they tested or sphere traced to
+		raycasts,
+		raycast_steps,
+		// Gauss tool stamps, and the rays of their cones
+		gauss_strokes,
+		gauss_rays,
+		brush_stamps,
+		// map cells the tools read and wrote (their brush squares)
+		cells_read,
+		cells_written,
+		chunks_dirtied,
+		// terrain textures rewritten, and bytes sent to the GPU for them and the GPU blend
+		textures_uploaded,
+		bytes_uploaded,
+		// operator new calls during the brush phase, on any thread
+		edit_allocations,
+		counter_count
+	};
+
+	// every operator new of the program, counted by the replacement in main.cpp
+	static inline std::atomic<uint64_t> heap_allocations{ 0 };
+
+	static const char* Name(int counter){
+		static const char* const names[counter_count] = {
+			"frames", "raycasts", "raycast_steps", "gauss_strokes", "gauss_rays", "brush_stamps",
+			"cells_read", "cells_written", "chunks_dirtied", "textures_uploaded", "bytes_uploaded", "edit_allocations"
+		};
+		return names[counter];
+	}
+
+private:
+	uint64_t frame[counter_count] = {};
+	uint64_t last_frame[counter_count] = {};
+	uint64_t interval[counter_count] = {};
+	uint64_t total[counter_count] = {};
+	std::vector<float> latencies;
+	// first latency of the current interval
+	size_t interval_start = 0;
+	std::vector<float> sorted;
+
+	static double Ratio(uint64_t count, uint64_t per){
+		return per > 0 ? double(count) / double(per) : 0.0;
+	}
+
+	void WriteCounts(std::ostream& out, const uint64_t* counts, size_t first_latency){
+		out << "{";
+		for (int counter = 0; counter < counter_count; counter++) {
+			out << "\"" << Name(counter) << "\":" << counts[counter] << ",";
+		}
+		out << "\"rays_per_gauss_stroke\":" << Ratio(counts[gauss_rays], counts[gauss_strokes])
+			<< ",\"cells_read_per_stamp\":" << Ratio(counts[cells_read], counts[brush_stamps])
+			<< ",\"cells_written_per_stamp\":" << Ratio(counts[cells_written], counts[brush_stamps])
+			<< ",\"edit_latency_ms\":{\"count\":" << latencies.size() - first_latency
+			<< ",\"p50\":" << Latency(0.5f, first_latency)
+			<< ",\"p90\":" << Latency(0.9f, first_latency)
+			<< ",\"p99\":" << Latency(0.99f, first_latency)
+			<< ",\"max\":" << Latency(1.0f, first_latency) << "}}";
+	}
+
+	// p (0..1) of the latencies from first on, nearest rank; 0 without any
+	float Latency(float p, size_t first){
+		if (first >= latencies.size()) {
+			return 0.0f;
+		}
+		sorted.assign(latencies.begin() + first, latencies.end());
+		size_t rank = std::min(sorted.size() - 1, size_t(p * float(sorted.size())));
+		std::nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+		return sorted[rank];
+	}
+
+public:
+	void Add(Counter counter, uint64_t amount = 1){
+		frame[counter] += amount;
+	}
+
+	void AddLatency(float ms){
+		latencies.push_back(ms);
+	}
+
+	void EndFrame(){
+		frame[frames] = 1;
+		for (int counter = 0; counter < counter_count; counter++) {
+			last_frame[counter] = frame[counter];
+			interval[counter] += frame[counter];
+			total[counter] += frame[counter];
+			frame[counter] = 0;
+		}
+	}
+
+	uint64_t LastFrame(Counter counter) const{
+		return last_frame[counter];
+	}
+	uint64_t Interval(Counter counter) const{
+		return interval[counter];
+	}
+	uint64_t Total(Counter counter) const{
+		return total[counter];
+	}
+
+	// p (0..1) of the edit latencies since start, or of the current interval's
+	float LatencyPercentile(float p, bool since_start){
+		return Latency(p, since_start ? 0 : interval_start);
+	}
+
+	// {"time": seconds, "interval": {...}, "total": {...}} on one line, then
+	// starts the next interval
+	void WriteJson(std::ostream& out, double time){
+		out << "{\"time\":" << time << ",\"interval\":";
+		WriteCounts(out, interval, interval_start);
+		out << ",\"total\":";
+		WriteCounts(out, total, 0);
+		out << "}\n";
+		std::fill(std::begin(interval), std::end(interval), uint64_t(0));
+		interval_start = latencies.size();
+	}
+};
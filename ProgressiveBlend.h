@@ -0,0 +1,323 @@
+#pragma once
+
+#include "ChunkedDensityField.h"
+#include "BoxBlur.h"
+#include "BrushCurves.h"
+#include "Simd.h"
+#include "WorkerPool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <deque>
+#include <limits>
+#include <vector>
+
+// The blend brush for areas too big to blend within a frame, done in two goes.
+// Start() reads the area, then right away writes a preview blended at
+// 1 / factor of the resolution: the source averaged down factor x factor cells
+// at a time, box blurred over the radius scaled down to match and sampled back
+// up bilinearly, about factor^2 times less work than the full blur. The full
+// resolution blend of what was read stays behind as a job, which Refine()
+// works through band_rows rows at a time over the next frames, as far as its
+// time budget goes, writing over the preview.
+//
+// A Start() writing cells that a pending job hasn't refined yet cancels them
+// there, so the older job can't overwrite the newer stamp later; the newer
+// stamp blends the preview of those cells rather than their refined values.
+// Cells blend like TerrainEngine::AdjustTerrain_BlendBallFractionalFast2
+// (TerrainEngine.h): a cell keeps its share keep (0..1) of its value and takes
+// the rest from the eased average of the cells around it.
+template <typename Field>
+class ProgressiveBlend{
+public:
+	static constexpr int factor = 4;
+	static constexpr int band_rows = 32;
+
+private:
+	struct Job{
+		olc::vi2d from;
+		olc::vi2d size;
+		int radius = 0;
+		// size + 2 * radius cells, offset by -radius, row major, as read before the preview
+		std::vector<float> source;
+		std::vector<float> current;
+		// share of the current value every cell keeps; below 0 once cancelled
+		std::vector<float> keep;
+		// cells written per row, x from..to from from.x; none when to < from
+		std::vector<olc::vi2d> spans;
+		// first row left to refine
+		int next_row = 0;
+	};
+	// oldest first
+	std::deque<Job> jobs;
+	// buffers of a finished job, for the next one
+	Job spare;
+
+	SeparableBoxBlur coarse_blur;
+	SeparableBoxBlur band_blur;
+	std::vector<std::vector<float>> worker_rows;
+	std::vector<std::vector<float>> worker_coarse_rows;
+	// per column of the preview, the coarse column left of it and how far on to the next
+	std::vector<int> column_cells;
+	std::vector<float> column_offsets;
+
+	// a row's span of cells: values = eased averages, blended with the job's
+	// current values; everything simd::width padded
+	static void BlendRow(const Job& job, int row, olc::vi2d span, const float* averages, float* values){
+		using namespace simd;
+		const float* current = job.current.data() + size_t(row) * job.size.x;
+		const float* keep = job.keep.data() + size_t(row) * job.size.x;
+		for (int i = span.x; i <= span.y; i += width) {
+			Float average = BrushCurves::EaseInOutCubic(Load(averages + i));
+			Float kept = Min(Load(keep + i), Set1(1.0f));
+			Store(values + i, average * (Set1(1.0f) - kept) + Load(current + i) * kept);
+		}
+	}
+
+	// Drops cells from_x..to_x of field row y from the jobs other than newer
+	void CancelOthers(int y, int from_x, int to_x, const Job* newer){
+		for (Job& job : jobs) {
+			if (&job == newer) {
+				continue;
+			}
+			int row = y - job.from.y;
+			if (row < job.next_row || row >= job.size.y) {
+				continue;
+			}
+			int first = std::max(from_x - job.from.x, job.spans[row].x);
+			int last = std::min(to_x - job.from.x, job.spans[row].y);
+			if (first <= last) {
+				float* keep = job.keep.data() + size_t(row) * job.size.x;
+				std::fill(keep + first, keep + last + 1, -1.0f);
+			}
+		}
+	}
+
+	// cells of the band it blended
+	size_t RefineBand(Field& field, WorkerPool& pool, Job& job){
+		int first = job.next_row;
+		int rows = std::min(band_rows, job.size.y - first);
+		job.next_row += rows;
+
+		// left alone if a newer stamp cancelled all of it
+		bool live = false;
+		for (int row = first; row < first + rows && !live; row++) {
+			olc::vi2d span = job.spans[row];
+			const float* keep = job.keep.data() + size_t(row) * job.size.x;
+			live = span.x <= span.y && std::any_of(keep + span.x, keep + span.y + 1, [](float kept){ return kept >= 0.0f; });
+		}
+		if (!live) {
+			return 0;
+		}
+
+		// the band's rows of the source, column major for the blur
+		int source_width = job.size.x + 2 * job.radius;
+		band_blur.Resize({ job.size.x, rows }, job.radius);
+		float* source = band_blur.SourceData();
+		ptrdiff_t stride = band_blur.SourceXStride();
+		for (int y = 0; y < rows + 2 * job.radius; y++) {
+			const float* in = job.source.data() + size_t(first + y) * source_width;
+			for (int x = 0; x < source_width; x++) {
+				source[x * stride + y] = in[x];
+			}
+		}
+		band_blur.Run(pool);
+
+		olc::vi2d band_from = job.from + olc::vi2d{ 0, first };
+		olc::vi2d band_to = band_from + olc::vi2d{ job.size.x - 1, rows - 1 };
+		field.MaterialiseRect(band_from, band_to);
+		worker_rows.resize(pool.ThreadCount());
+		pool.ParallelFor(rows, [&](int band_row, int worker) {
+			int row = first + band_row;
+			olc::vi2d span = job.spans[row];
+			if (span.y < span.x) {
+				return;
+			}
+			std::vector<float>& values = worker_rows[worker];
+			values.resize(size_t(job.size.x) + simd::width);
+			BlendRow(job, row, span, band_blur.ResultRow(band_row), values.data());
+
+			// runs of the cells still its own
+			const float* keep = job.keep.data() + size_t(row) * job.size.x;
+			for (int x = span.x; x <= span.y; x++) {
+				if (keep[x] < 0.0f) {
+					continue;
+				}
+				int end = x;
+				while (end < span.y && keep[end + 1] >= 0.0f) {
+					end++;
+				}
+				field.WriteSpan(job.from.x + x, job.from.y + row, values.data() + x, end - x + 1);
+				x = end;
+			}
+		});
+		field.MarkDirty(band_from, band_to);
+		return size_t(job.size.x) * rows;
+	}
+
+public:
+	bool Pending() const{
+		return !jobs.empty();
+	}
+
+	// Rows of the pending jobs still to refine
+	int PendingRows() const{
+		int rows = 0;
+		for (const Job& job : jobs) {
+			rows += job.size.y - job.next_row;
+		}
+		return rows;
+	}
+
+	// Previews the blend of the size cells from from, radius the box around every
+	// cell; gather_keep(row, keep, row_from, row_to) lowers keep[0..size.x) (all
+	// 1, then simd::width cells of slack) to the share each cell of the row keeps
+	// and sets the cells it lowered any of, leaving row_to < row_from for none
+	template <typename GatherKeep>
+	void Start(Field& field, olc::vi2d from, olc::vi2d size, int radius, WorkerPool& pool, GatherKeep&& gather_keep){
+		jobs.push_back(std::move(spare));
+		spare = Job();
+		Job& job = jobs.back();
+		job.from = from;
+		job.size = size;
+		job.radius = radius;
+		job.next_row = 0;
+
+		olc::vi2d source_size = size + olc::vi2d{ 2 * radius, 2 * radius };
+		job.source.resize(size_t(source_size.x) * source_size.y);
+		field.ReadRect(from - olc::vi2d{ radius, radius }, source_size, job.source.data(), 1, source_size.x);
+		job.current.resize(size_t(size.x) * size.y + simd::width);
+		for (int row = 0; row < size.y; row++) {
+			const float* in = job.source.data() + size_t(row + radius) * source_size.x + radius;
+			std::copy(in, in + size.x, job.current.begin() + size_t(row) * size.x);
+		}
+		job.keep.resize(size_t(size.x) * size.y + simd::width);
+		job.spans.resize(size.y);
+
+		worker_rows.resize(pool.ThreadCount());
+		pool.ParallelFor(size.y, [&](int row, int worker) {
+			std::vector<float>& keep = worker_rows[worker];
+			keep.assign(size_t(size.x) + simd::width, 1.0f);
+			int row_from = size.x;
+			int row_to = -1;
+			gather_keep(row, keep.data(), row_from, row_to);
+			std::copy(keep.begin(), keep.begin() + size.x, job.keep.begin() + size_t(row) * size.x);
+			job.spans[row] = { row_from, row_to };
+		});
+		for (int row = 0; row < size.y; row++) {
+			if (job.spans[row].x <= job.spans[row].y) {
+				CancelOthers(from.y + row, from.x + job.spans[row].x, from.x + job.spans[row].y, &job);
+			}
+		}
+
+		// a window of 2 * radius + 1 cells is about (2 * radius + 1) / factor
+		// coarse ones; the coarse output has to keep at least a cell
+		olc::vi2d coarse_source = (source_size + olc::vi2d{ factor - 1, factor - 1 }) / factor;
+		int coarse_radius = int(std::round((float(2 * radius + 1) / float(factor) - 1.0f) * 0.5f));
+		coarse_radius = std::clamp(coarse_radius, 0, (std::min(coarse_source.x, coarse_source.y) - 1) / 2);
+		olc::vi2d coarse_size = coarse_source - olc::vi2d{ 2 * coarse_radius, 2 * coarse_radius };
+
+		// averages of the factor x factor blocks, short ones at the far edges
+		coarse_blur.Resize(coarse_size, coarse_radius);
+		float* coarse = coarse_blur.SourceData();
+		ptrdiff_t stride = coarse_blur.SourceXStride();
+		pool.ParallelFor(coarse_source.x, [&](int coarse_x, int) {
+			int x0 = coarse_x * factor;
+			int x1 = std::min(x0 + factor, source_size.x);
+			for (int coarse_y = 0; coarse_y < coarse_source.y; coarse_y++) {
+				int y0 = coarse_y * factor;
+				int y1 = std::min(y0 + factor, source_size.y);
+				float sum = 0.0f;
+				for (int y = y0; y < y1; y++) {
+					const float* in = job.source.data() + size_t(y) * source_size.x;
+					for (int x = x0; x < x1; x++) {
+						sum += in[x];
+					}
+				}
+				coarse[coarse_x * stride + coarse_y] = sum / float((x1 - x0) * (y1 - y0));
+			}
+		});
+		coarse_blur.Run(pool);
+
+		// coarse output cell i sits at source cell (i + coarse_radius) * factor + (factor - 1) / 2
+		auto coarse_position = [&](int cell, int limit) {
+			float position = (float(cell + radius) - float(factor - 1) * 0.5f) / float(factor) - float(coarse_radius);
+			return std::clamp(position, 0.0f, float(limit - 1));
+		};
+		column_cells.resize(size.x);
+		column_offsets.resize(size.x);
+		for (int x = 0; x < size.x; x++) {
+			float u = coarse_position(x, coarse_size.x);
+			column_cells[x] = int(u);
+			column_offsets[x] = u - float(column_cells[x]);
+		}
+
+		field.MaterialiseRect(from, from + size - olc::vi2d{ 1, 1 });
+		worker_coarse_rows.resize(pool.ThreadCount());
+		pool.ParallelFor(size.y, [&](int row, int worker) {
+			olc::vi2d span = job.spans[row];
+			if (span.y < span.x) {
+				return;
+			}
+			// the coarse rows above and below, mixed once for the whole row; the
+			// last cell repeats so every column has one to its right
+			float v = coarse_position(row, coarse_size.y);
+			int v0 = int(v);
+			int v1 = std::min(v0 + 1, coarse_size.y - 1);
+			float v_t = v - float(v0);
+			const float* above = coarse_blur.ResultRow(v0);
+			const float* below = coarse_blur.ResultRow(v1);
+			std::vector<float>& coarse_row = worker_coarse_rows[worker];
+			coarse_row.resize(size_t(coarse_size.x) + 1);
+			for (int x = 0; x < coarse_size.x; x++) {
+				coarse_row[x] = above[x] + (below[x] - above[x]) * v_t;
+			}
+			coarse_row[coarse_size.x] = coarse_row[coarse_size.x - 1];
+
+			std::vector<float>& values = worker_rows[worker];
+			values.resize(size_t(size.x) + simd::width);
+			for (int x = span.x; x <= span.y; x++) {
+				const float* left = coarse_row.data() + column_cells[x];
+				values[x] = left[0] + (left[1] - left[0]) * column_offsets[x];
+			}
+			BlendRow(job, row, span, values.data(), values.data());
+			field.WriteSpan(from.x + span.x, from.y + row, values.data() + span.x, span.y - span.x + 1);
+		});
+		field.MarkDirty(from, from + size - olc::vi2d{ 1, 1 });
+	}
+
+	// Refines bands of the oldest jobs until budget_ms is spent, at least one
+	// band per call so a tight budget still gets there; returns the cells blended
+	size_t Refine(Field& field, WorkerPool& pool, float budget_ms){
+		auto start = std::chrono::steady_clock::now();
+		size_t cells = 0;
+		while (!jobs.empty()) {
+			cells += RefineBand(field, pool, jobs.front());
+			if (jobs.front().next_row >= jobs.front().size.y) {
+				spare = std::move(jobs.front());
+				jobs.pop_front();
+			}
+			std::chrono::duration<float, std::milli> spent = std::chrono::steady_clock::now() - start;
+			if (spent.count() >= budget_ms) {
+				break;
+			}
+		}
+		return cells;
+	}
+
+	// Refines everything still pending, for edits that mustn't be overwritten
+	// afterwards or that need the final cells
+	size_t Finish(Field& field, WorkerPool& pool){
+		return Refine(field, pool, std::numeric_limits<float>::infinity());
+	}
+
+	// Forgets the pending jobs, leaving their previews, for when the cells they
+	// would refine were replaced
+	void Cancel(){
+		while (!jobs.empty()) {
+			spare = std::move(jobs.front());
+			jobs.pop_front();
+		}
+	}
+};
@@ -0,0 +1,260 @@
+#pragma once
+
+#include "olcPixelGameEngine.h"
+
+#include <cmath>
+
+struct RaycastResult{
+	bool hit = false;
+	// cell the walk stopped on, and the one visited just before it
+	olc::vi2d cell;
+	olc::vi2d previous_cell;
+};
+
+// DDA walk shared by the editor raycasts ==============================
+// https://lodev.org/cgtutor/raycasting.html
+//
+// Steps cell by cell from ray_start_pos until is_hit(cell) accepts an in map
+// cell or the walked distance reaches max_distance. When occupancy is given,
+// any aligned block it reports as holding no cell for occupancy_mask is
+// crossed in one jump. The jump lands on the cell (and distance) the unit-step
+// walk would have reached; only a ray passing within float rounding of a cell
+// corner can come out on the neighbouring cell, as the step sums are rounded
+// differently.
+//
+// ray_unit_step is the distance along the ray between two crossings of the same
+// axis, see RaycastUnitStep(); callers casting many rays can compute it in bulk.
+template <typename Occupancy, typename IsHit>
+RaycastResult RaycastGrid(olc::vi2d ray_start_pos, olc::vf2d ray_dir, olc::vf2d ray_unit_step, float max_distance, olc::vi2d map_size,
+	const Occupancy* occupancy, uint8_t occupancy_mask, IsHit&& is_hit){
+	olc::vf2d vRayUnitStepSize = ray_unit_step;
+	olc::vi2d vMapCheck = ray_start_pos;
+	olc::vf2d vRayLength1D;
+	olc::vi2d vStep;
+
+	// Establish Starting Conditions
+	if (ray_dir.x < 0)
+	{
+		vStep.x = -1;
+		vRayLength1D.x = (ray_start_pos.x - float(vMapCheck.x)) * vRayUnitStepSize.x;
+	}
+	else
+	{
+		vStep.x = 1;
+		vRayLength1D.x = (float(vMapCheck.x + 1) - ray_start_pos.x) * vRayUnitStepSize.x;
+	}
+
+	if (ray_dir.y < 0)
+	{
+		vStep.y = -1;
+		vRayLength1D.y = (ray_start_pos.y - float(vMapCheck.y)) * vRayUnitStepSize.y;
+	}
+	else
+	{
+		vStep.y = 1;
+		vRayLength1D.y = (float(vMapCheck.y + 1) - ray_start_pos.y) * vRayUnitStepSize.y;
+	}
+
+	auto inside_map = [&](olc::vi2d cell){
+		return cell.x >= 0 && cell.x < map_size.x && cell.y >= 0 && cell.y < map_size.y;
+	};
+
+	// Perform "Walk" until collision or range check
+	RaycastResult result;
+	float fDistance = 0.0f;
+	olc::vi2d previous_tile = vMapCheck;
+	while (!result.hit && fDistance < max_distance)
+	{
+		int empty_log2 = -1;
+		if (inside_map(vMapCheck)) {
+			if (occupancy) {
+				empty_log2 = occupancy->EmptyBlockLog2(vMapCheck.x, vMapCheck.y, occupancy_mask);
+			}
+		}
+		// past an edge and still heading away from the map, nothing left to hit
+		else if ((vMapCheck.x < 0 && vStep.x < 0) || (vMapCheck.x >= map_size.x && vStep.x > 0) ||
+			(vMapCheck.y < 0 && vStep.y < 0) || (vMapCheck.y >= map_size.y && vStep.y > 0)) {
+			break;
+		}
+
+		if (empty_log2 >= 0) {
+			// Cross the whole empty block: count the cell boundaries left inside it
+			// on each axis, leave through whichever side the ray reaches first and
+			// take the crossings of the other axis that come before that.
+			int block_mask = (1 << empty_log2) - 1;
+			olc::vi2d block_from{ vMapCheck.x & ~block_mask, vMapCheck.y & ~block_mask };
+			int inner_x = vStep.x > 0 ? block_from.x + block_mask - vMapCheck.x : vMapCheck.x - block_from.x;
+			int inner_y = vStep.y > 0 ? block_from.y + block_mask - vMapCheck.y : vMapCheck.y - block_from.y;
+			// distance of the k-th boundary crossing ahead (k-th from 0), kept NaN free for axis aligned rays
+			auto crossing_x = [&](int k){ return k == 0 ? vRayLength1D.x : vRayLength1D.x + float(k) * vRayUnitStepSize.x; };
+			auto crossing_y = [&](int k){ return k == 0 ? vRayLength1D.y : vRayLength1D.y + float(k) * vRayUnitStepSize.y; };
+			float exit_x = crossing_x(inner_x);
+			float exit_y = crossing_y(inner_y);
+
+			int steps_x, steps_y;
+			float exit_distance;
+			// distance of the last crossing before the exit one
+			float last_inner = fDistance;
+			// same tie break as the unit walk: x only wins when strictly closer
+			if (exit_x < exit_y) {
+				steps_x = inner_x + 1;
+				steps_y = vRayLength1D.y <= exit_x ? std::min(inner_y, int(std::floor((exit_x - vRayLength1D.y) / vRayUnitStepSize.y)) + 1) : 0;
+				exit_distance = exit_x;
+				if (inner_x > 0) last_inner = std::max(last_inner, crossing_x(inner_x - 1));
+				if (steps_y > 0) last_inner = std::max(last_inner, crossing_y(steps_y - 1));
+				previous_tile = vMapCheck + olc::vi2d{ vStep.x * inner_x, vStep.y * steps_y };
+			}
+			else {
+				steps_y = inner_y + 1;
+				steps_x = vRayLength1D.x < exit_y ? std::min(inner_x, int(std::ceil((exit_y - vRayLength1D.x) / vRayUnitStepSize.x))) : 0;
+				exit_distance = exit_y;
+				if (inner_y > 0) last_inner = std::max(last_inner, crossing_y(inner_y - 1));
+				if (steps_x > 0) last_inner = std::max(last_inner, crossing_x(steps_x - 1));
+				previous_tile = vMapCheck + olc::vi2d{ vStep.x * steps_x, vStep.y * inner_y };
+			}
+
+			// the unit walk would have run out of range inside the empty block
+			if (last_inner >= max_distance) {
+				break;
+			}
+			fDistance = exit_distance;
+
+			vMapCheck += olc::vi2d{ vStep.x * steps_x, vStep.y * steps_y };
+			vRayLength1D.x = crossing_x(steps_x);
+			vRayLength1D.y = crossing_y(steps_y);
+		}
+		else
+		{
+			previous_tile = vMapCheck;
+
+			// Walk along shortest path
+			if (vRayLength1D.x < vRayLength1D.y)
+			{
+				vMapCheck.x += vStep.x;
+				fDistance = vRayLength1D.x;
+				vRayLength1D.x += vRayUnitStepSize.x;
+			}
+			else
+			{
+				vMapCheck.y += vStep.y;
+				fDistance = vRayLength1D.y;
+				vRayLength1D.y += vRayUnitStepSize.y;
+			}
+		}
+
+		// Test tile at new test point
+		if (inside_map(vMapCheck))
+		{
+			if (is_hit(vMapCheck))
+			{
+				result.hit = true;
+			}
+		}
+	}
+
+	result.cell = vMapCheck;
+	result.previous_cell = previous_tile;
+	return result;
+}
+
+inline olc::vf2d RaycastUnitStep(olc::vf2d ray_dir){
+	// Lodev.org also explains this additional optimistaion (but it's beyond scope of video)
+	// olc::vf2d vRayUnitStepSize = { abs(1.0f / ray_dir.x), abs(1.0f / ray_dir.y) };
+	return { std::sqrt(1 + (ray_dir.y / ray_dir.x) * (ray_dir.y / ray_dir.x)), std::sqrt(1 + (ray_dir.x / ray_dir.y) * (ray_dir.x / ray_dir.y)) };
+}
+
+template <typename Occupancy, typename IsHit>
+RaycastResult RaycastGrid(olc::vi2d ray_start_pos, olc::vf2d ray_dir, float max_distance, olc::vi2d map_size,
+	const Occupancy* occupancy, uint8_t occupancy_mask, IsHit&& is_hit){
+	return RaycastGrid(ray_start_pos, ray_dir, RaycastUnitStep(ray_dir), max_distance, map_size, occupancy, occupancy_mask, is_hit);
+}
+
+// Sphere traced walk ==================================================
+//
+// Finds the same cell as RaycastGrid, but where clearance(cell) says how far
+// the nearest hit cell is (distance between cell centres, never more than the
+// true one) the ray jumps ahead instead of stepping: a point of the cell is
+// within half a diagonal of its centre, and so is any point of the hit cell,
+// so nothing can be hit for clearance - sqrt(2) along the ray. Near hits, and
+// off the map, it steps cell by cell like RaycastGrid, so previous_cell is
+// still the cell the ray came from. Landing cells are found from their boundary
+// crossings instead of step sums, so a ray passing within float rounding of a
+// cell corner can come out on the neighbouring cell.
+template <typename Clearance, typename IsHit>
+RaycastResult SphereTraceGrid(olc::vi2d ray_start_pos, olc::vf2d ray_dir, olc::vf2d ray_unit_step, float max_distance, olc::vi2d map_size,
+	Clearance&& clearance, IsHit&& is_hit){
+	constexpr float cell_diagonal = 1.41421356f;
+	// shorter jumps than this cost more than the steps they save
+	constexpr float min_jump = 2.0f;
+
+	olc::vf2d start = ray_start_pos;
+	olc::vi2d step{ ray_dir.x < 0 ? -1 : 1, ray_dir.y < 0 ? -1 : 1 };
+	olc::vi2d cell = ray_start_pos;
+	// distances along the ray of the next boundary crossing on each axis
+	auto next_crossing_x = [&](int x) {
+		return step.x > 0 ? (float(x + 1) - start.x) * ray_unit_step.x : (start.x - float(x)) * ray_unit_step.x;
+	};
+	auto next_crossing_y = [&](int y) {
+		return step.y > 0 ? (float(y + 1) - start.y) * ray_unit_step.y : (start.y - float(y)) * ray_unit_step.y;
+	};
+	olc::vf2d next{ next_crossing_x(cell.x), next_crossing_y(cell.y) };
+
+	auto inside_map = [&](olc::vi2d cell){
+		return cell.x >= 0 && cell.x < map_size.x && cell.y >= 0 && cell.y < map_size.y;
+	};
+
+	RaycastResult result;
+	// where the ray entered the current cell, and where along it the walk is
+	float entered = 0.0f;
+	float position = 0.0f;
+	olc::vi2d previous_cell = cell;
+	while (!result.hit && entered < max_distance)
+	{
+		float jump = 0.0f;
+		if (inside_map(cell)) {
+			jump = clearance(cell) - cell_diagonal;
+		}
+		else if ((cell.x < 0 && step.x < 0) || (cell.x >= map_size.x && step.x > 0) ||
+			(cell.y < 0 && step.y < 0) || (cell.y >= map_size.y && step.y > 0)) {
+			break;
+		}
+
+		if (jump >= min_jump) {
+			// every cell up to the landing one is clear
+			position += jump;
+			olc::vf2d point = start + ray_dir * position;
+			olc::vi2d landing{ int(std::floor(point.x)), int(std::floor(point.y)) };
+			if (landing != cell) {
+				// the boundaries last crossed before position are where the landing cell was entered
+				float entered_x = ray_dir.x == 0.0f || landing.x == cell.x ? entered : next_crossing_x(landing.x - step.x);
+				float entered_y = ray_dir.y == 0.0f || landing.y == cell.y ? entered : next_crossing_y(landing.y - step.y);
+				entered = std::max(entered_x, entered_y);
+				cell = landing;
+				next = { next_crossing_x(cell.x), next_crossing_y(cell.y) };
+			}
+			continue;
+		}
+
+		previous_cell = cell;
+		// same tie break as RaycastGrid
+		if (next.x < next.y) {
+			cell.x += step.x;
+			entered = next.x;
+			next.x = next_crossing_x(cell.x);
+		}
+		else {
+			cell.y += step.y;
+			entered = next.y;
+			next.y = next_crossing_y(cell.y);
+		}
+		position = entered;
+
+		if (inside_map(cell) && is_hit(cell)) {
+			result.hit = true;
+		}
+	}
+
+	result.cell = cell;
+	result.previous_cell = previous_cell;
+	return result;
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+// Bump allocator for the temporaries of one frame (brush buffers, summed area
+// tables, ...). Allocate() hands out uninitialised memory from a block that is
+// kept for the editor's lifetime and Reset() just rewinds it, so once the
+// block has grown to the largest frame seen, editing does no heap allocation.
+// Nothing is destroyed on Reset(), hence only trivially destructible types.
+class ScratchArena{
+	// enough for SIMD loads on any backend
+	static constexpr size_t alignment = 32;
+
+	struct Block{
+		std::unique_ptr<unsigned char[]> data;
+		size_t size = 0;
+	};
+
+	std::vector<Block> blocks;
+	size_t block_size;
+	size_t current = 0;
+	size_t offset = 0;
+
+	void AddBlock(size_t size){
+		Block block;
+		block.data = std::make_unique<unsigned char[]>(size + alignment);
+		block.size = size;
+		blocks.push_back(std::move(block));
+	}
+
+	unsigned char* BlockStart(const Block& block) const{
+		uintptr_t address = reinterpret_cast<uintptr_t>(block.data.get());
+		return block.data.get() + ((alignment - address % alignment) % alignment);
+	}
+
+public:
+	explicit ScratchArena(size_t block_size = size_t(1) << 20) : block_size(block_size){
+		AddBlock(block_size);
+	}
+
+	// count uninitialised T, valid until the next Reset()
+	template <typename T>
+	T* Allocate(size_t count){
+		static_assert(std::is_trivially_destructible<T>::value, "scratch memory is never destroyed");
+		static_assert(alignof(T) <= alignment, "over aligned type");
+
+		size_t bytes = (count * sizeof(T) + alignment - 1) / alignment * alignment;
+		while (offset + bytes > blocks[current].size) {
+			current++;
+			offset = 0;
+			if (current == blocks.size()) {
+				AddBlock(std::max(block_size, bytes));
+			}
+		}
+
+		unsigned char* result = BlockStart(blocks[current]) + offset;
+		offset += bytes;
+		return reinterpret_cast<T*>(result);
+	}
+
+	// Releases everything allocated since the last call. A frame that spilled
+	// into extra blocks gets one block of their combined size from now on.
+	void Reset(){
+		if (blocks.size() > 1) {
+			size_t total = 0;
+			for (const Block& block : blocks) {
+				total += block.size;
+			}
+			blocks.clear();
+			block_size = std::max(block_size, total);
+			AddBlock(block_size);
+		}
+		current = 0;
+		offset = 0;
+	}
+
+	size_t Capacity() const{
+		size_t total = 0;
+		for (const Block& block : blocks) {
+			total += block.size;
+		}
+		return total;
+	}
+};
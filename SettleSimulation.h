@@ -0,0 +1,362 @@
+#pragma once
+
+#include "ChunkedDensityField.h"
+#include "WorkerPool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+// Lets loose material settle after edits, falling-sand style: a cell lighter
+// than rock_threshold is loose and every step moves all of it it can into the
+// cell below, and what doesn't fit there into the cell below and to the side,
+// the side alternating between steps. Rock (at or above the threshold) stays
+// put, so carving a cave leaves the walls where they are and only the crumbs
+// and fractional edges the brushes leave drop and pile up.
+//
+// Only awake chunks are simulated. A change to the field (anything reported
+// dirty) wakes the chunks around it, a chunk stays awake while anything in it
+// moves or something moves into it, and it goes to sleep after a step in which
+// nothing did; an unedited map costs nothing.
+//
+// A step is four phases, one per colour of a 2x2 checkerboard of chunks. In a
+// phase the awake chunks of that colour run in parallel, each from a copy of
+// its cells and the ring around them and writing back its cells and the cells
+// its material falls into below and beside it. Chunks of one colour are a chunk
+// apart, so none of them write the same cells. Moves are whole cell units,
+// so no material is lost or made.
+template <typename Field>
+class SettleSimulation{
+	using Cell = typename Field::cell_type;
+	using traits = typename Field::traits;
+	static_assert(std::is_integral_v<Cell>, "settling moves whole cell units");
+
+	static constexpr int chunk_size = Field::chunk_size;
+	static constexpr int chunk_mask = Field::chunk_mask;
+	// the chunk with a ring of one cell around it
+	static constexpr int front_size = chunk_size + 2;
+
+	enum : uint8_t{ received_left = 1, received_right = 2, received_below_left = 4, received_below = 8, received_below_right = 16 };
+
+	struct Task{
+		int chunk_x;
+		int chunk_y;
+		bool moved = false;
+		uint8_t received = 0;
+		// changed cells, map coordinates, inclusive
+		olc::vi2d from;
+		olc::vi2d to;
+	};
+
+	Field* field = nullptr;
+	WorkerPool* pool = nullptr;
+	ChunkDirtyTracker dirty;
+	std::vector<uint8_t> awake;
+	std::vector<uint8_t> awake_next;
+	std::vector<Task> tasks;
+	// per worker copies of a chunk and its ring, then what flows out of each cell
+	std::vector<std::vector<int32_t>> fronts;
+	std::vector<std::vector<int32_t>> downs;
+	std::vector<std::vector<int32_t>> diagonals;
+	// per chunk, from the is_frozen of the phase running
+	std::vector<uint8_t> frozen;
+	Cell rock_cell = Cell();
+	int chunks_x = 0;
+	int chunks_y = 0;
+	// phase of the step in progress, 0 between steps
+	int phase = 0;
+	uint32_t step_count = 0;
+	float time_owed = 0.0f;
+
+	void Wake(std::vector<uint8_t>& flags, int chunk_x, int chunk_y){
+		if (chunk_x >= 0 && chunk_x < chunks_x && chunk_y >= 0 && chunk_y < chunks_y) {
+			flags[size_t(chunk_y) * chunks_x + chunk_x] = 1;
+		}
+	}
+
+	// the chunks around every edit, which the carved space may let material into
+	void WakeEdited(){
+		dirty.Consume([&](int chunk_x, int chunk_y, olc::vi2d, olc::vi2d){
+			for (int y = chunk_y - 1; y <= chunk_y + 1; y++) {
+				for (int x = chunk_x - 1; x <= chunk_x + 1; x++) {
+					Wake(awake, x, y);
+					Wake(awake_next, x, y);
+				}
+			}
+		});
+	}
+
+	// what moved or was moved into in this step runs in the next one
+	void EndStep(){
+		phase = 0;
+		step_count++;
+		for (size_t i = 0; i < awake.size(); i++) {
+			awake[i] |= awake_next[i];
+			awake_next[i] = 0;
+		}
+	}
+
+	bool HasLoose(const typename Field::Chunk& chunk) const{
+		if (chunk.IsUniform()) {
+			return chunk.uniform_value > 0 && chunk.uniform_value < rock_cell;
+		}
+		return true;
+	}
+
+	// One chunk's phase: the flows are worked out from the front copy only, so
+	// which cell is visited first doesn't matter
+	void RunTask(Task& task, int worker, int side){
+		std::vector<int32_t>& front = fronts[worker];
+		std::vector<int32_t>& down = downs[worker];
+		std::vector<int32_t>& diagonal = diagonals[worker];
+		front.resize(size_t(front_size) * front_size);
+		down.assign(size_t(front_size) * front_size, 0);
+		diagonal.assign(size_t(front_size) * front_size, 0);
+
+		// room left in ring cells that can't take anything (off the map or frozen) is 0
+		constexpr int32_t max_cell = int32_t(traits::max_value);
+		olc::vi2d origin = field->ChunkOrigin(task.chunk_x, task.chunk_y);
+		for (int y = 0; y < front_size; y++) {
+			for (int x = 0; x < front_size; x++) {
+				int map_x = origin.x + x - 1;
+				int map_y = origin.y + y - 1;
+				int32_t value = max_cell;
+				if (field->Contains(map_x, map_y) && !frozen[size_t(map_y / chunk_size) * chunks_x + map_x / chunk_size]) {
+					value = int32_t(field->GetCellUnchecked(map_x, map_y));
+				}
+				front[size_t(y) * front_size + x] = value;
+			}
+		}
+
+		auto at = [](int x, int y){ return size_t(y) * front_size + x; };
+		olc::vi2d extent = field->ChunkExtent(task.chunk_x, task.chunk_y);
+		// this chunk's cells are front cells 1..extent
+		for (int y = 1; y <= extent.y; y++) {
+			for (int x = 1; x <= extent.x; x++) {
+				int32_t value = front[at(x, y)];
+				if (value <= 0 || value >= int32_t(rock_cell)) {
+					continue;
+				}
+				down[at(x, y)] = std::min(value, max_cell - front[at(x, y + 1)]);
+			}
+		}
+		for (int y = 1; y <= extent.y; y++) {
+			for (int x = 1; x <= extent.x; x++) {
+				int32_t value = front[at(x, y)];
+				if (value <= 0 || value >= int32_t(rock_cell)) {
+					continue;
+				}
+				int32_t rest = value - down[at(x, y)];
+				// the target also takes whatever falls straight into it
+				int32_t room = max_cell - front[at(x + side, y + 1)] - down[at(x + side, y)];
+				diagonal[at(x, y)] = std::max(std::min(rest, room), 0);
+			}
+		}
+
+		// write back the cells and the three sides of the ring material can land in
+		task.from = origin + extent;
+		task.to = origin - olc::vi2d{ 1, 1 };
+		for (int y = 1; y <= extent.y + 1; y++) {
+			int map_y = origin.y + y - 1;
+			if (map_y >= field->Height()) {
+				break;
+			}
+			for (int x = 0; x <= extent.x + 1; x++) {
+				int32_t flow = -down[at(x, y)] - diagonal[at(x, y)] + down[at(x, y - 1)];
+				if (x - side >= 0 && x - side < front_size) {
+					flow += diagonal[at(x - side, y - 1)];
+				}
+				if (flow == 0) {
+					continue;
+				}
+
+				int map_x = origin.x + x - 1;
+				typename Field::Chunk& chunk = field->GetChunk(map_x / chunk_size, map_y / chunk_size);
+				chunk.cells->Row(map_y & chunk_mask)[map_x & chunk_mask] = Cell(front[at(x, y)] + flow);
+				task.from = task.from.min({ map_x, map_y });
+				task.to = task.to.max({ map_x, map_y });
+
+				bool inside = x >= 1 && x <= extent.x && y <= extent.y;
+				if (inside) {
+					task.moved = true;
+				}
+				else {
+					bool below = y > extent.y;
+					if (x < 1) {
+						task.received |= below ? received_below_left : received_left;
+					}
+					else if (x > extent.x) {
+						task.received |= below ? received_below_right : received_right;
+					}
+					else {
+						task.received |= received_below;
+					}
+				}
+			}
+		}
+	}
+
+	template <typename IsFrozen>
+	void RunPhase(int colour, IsFrozen& is_frozen){
+		bool any_awake = false;
+		for (int chunk_y = colour / 2; chunk_y < chunks_y && !any_awake; chunk_y += 2) {
+			for (int chunk_x = colour % 2; chunk_x < chunks_x && !any_awake; chunk_x += 2) {
+				any_awake = awake[size_t(chunk_y) * chunks_x + chunk_x] != 0;
+			}
+		}
+		if (!any_awake) {
+			return;
+		}
+		frozen.resize(awake.size());
+		for (size_t i = 0; i < awake.size(); i++) {
+			frozen[i] = is_frozen(int(i)) ? 1 : 0;
+		}
+
+		tasks.clear();
+		for (int chunk_y = colour / 2; chunk_y < chunks_y; chunk_y += 2) {
+			for (int chunk_x = colour % 2; chunk_x < chunks_x; chunk_x += 2) {
+				size_t index = size_t(chunk_y) * chunks_x + chunk_x;
+				if (!awake[index]) {
+					continue;
+				}
+				awake[index] = 0;
+				if (frozen[index] || !HasLoose(field->GetChunk(chunk_x, chunk_y))) {
+					continue;
+				}
+				// from and to are set when the chunk runs
+				tasks.push_back({ chunk_x, chunk_y, false, 0, { 0, 0 }, { 0, 0 } });
+				// the chunk and the neighbours it can fall into get cells to write
+				for (int y = chunk_y; y <= std::min(chunk_y + 1, chunks_y - 1); y++) {
+					for (int x = std::max(chunk_x - 1, 0); x <= std::min(chunk_x + 1, chunks_x - 1); x++) {
+						if (!frozen[size_t(y) * chunks_x + x]) {
+							olc::vi2d origin = field->ChunkOrigin(x, y);
+							field->MaterialiseRect(origin, origin);
+						}
+					}
+				}
+			}
+		}
+		if (tasks.empty()) {
+			return;
+		}
+
+		int side = (step_count & 1) ? 1 : -1;
+		fronts.resize(pool->ThreadCount());
+		downs.resize(pool->ThreadCount());
+		diagonals.resize(pool->ThreadCount());
+		pool->ParallelFor(int(tasks.size()), [&](int index, int worker){
+			RunTask(tasks[index], worker, side);
+		});
+
+		for (const Task& task : tasks) {
+			if (task.moved) {
+				Wake(awake_next, task.chunk_x, task.chunk_y);
+			}
+			if (task.received & received_left) Wake(awake_next, task.chunk_x - 1, task.chunk_y);
+			if (task.received & received_right) Wake(awake_next, task.chunk_x + 1, task.chunk_y);
+			if (task.received & received_below_left) Wake(awake_next, task.chunk_x - 1, task.chunk_y + 1);
+			if (task.received & received_below) Wake(awake_next, task.chunk_x, task.chunk_y + 1);
+			if (task.received & received_below_right) Wake(awake_next, task.chunk_x + 1, task.chunk_y + 1);
+			if (task.from.x <= task.to.x) {
+				field->MarkDirty(task.from, task.to, &dirty);
+			}
+		}
+	}
+
+public:
+	// cells at or above this don't move
+	float rock_threshold = 0.5f;
+	float steps_per_second = 60.0f;
+	// milliseconds a frame may spend settling; what's left over runs next frame
+	float budget_ms = 2.0f;
+	bool enabled = false;
+
+	~SettleSimulation(){
+		Detach();
+	}
+
+	void Attach(Field& field, WorkerPool& pool){
+		Detach();
+		this->field = &field;
+		this->pool = &pool;
+		field.AddDirtyTracker(&dirty);
+		chunks_x = field.ChunksX();
+		chunks_y = field.ChunksY();
+		awake.assign(size_t(chunks_x) * chunks_y, 0);
+		awake_next.assign(size_t(chunks_x) * chunks_y, 0);
+		rock_cell = traits::FromFloat(rock_threshold);
+		phase = 0;
+		time_owed = 0.0f;
+	}
+
+	void Detach(){
+		if (field) {
+			field->RemoveDirtyTracker(&dirty);
+			field = nullptr;
+		}
+	}
+
+	// chunks that run in this step or the next
+	size_t AwakeChunks() const{
+		size_t count = 0;
+		for (size_t i = 0; i < awake.size(); i++) {
+			count += (awake[i] | awake_next[i]) ? 1 : 0;
+		}
+		return count;
+	}
+
+	// Runs the steps due after elapsed_time seconds, as far as budget_ms allows;
+	// is_frozen(chunk_index) marks chunks that are neither read nor written (not
+	// loaded yet, say)
+	template <typename IsFrozen>
+	void Update(float elapsed_time, IsFrozen is_frozen){
+		if (!field) {
+			return;
+		}
+		if (!enabled) {
+			// edits made while it's off don't wake anything later
+			dirty.Consume([](int, int, olc::vi2d, olc::vi2d){});
+			return;
+		}
+		WakeEdited();
+		if (phase == 0 && AwakeChunks() == 0) {
+			time_owed = 0.0f;
+			return;
+		}
+
+		float interval = 1.0f / steps_per_second;
+		// a slow frame doesn't queue up more than a few steps
+		time_owed = std::min(time_owed + elapsed_time, interval * 4.0f);
+		auto start = std::chrono::steady_clock::now();
+		while (time_owed >= interval || phase > 0) {
+			std::chrono::duration<float, std::milli> spent = std::chrono::steady_clock::now() - start;
+			if (spent.count() >= budget_ms) {
+				break;
+			}
+			if (phase == 0) {
+				time_owed -= interval;
+			}
+			RunPhase(phase, is_frozen);
+			phase++;
+			if (phase == 4) {
+				EndStep();
+			}
+		}
+	}
+
+	// One whole step right away, whatever the time and budget
+	template <typename IsFrozen>
+	void Step(IsFrozen is_frozen){
+		if (!field) {
+			return;
+		}
+		WakeEdited();
+		do {
+			RunPhase(phase, is_frozen);
+			phase++;
+		} while (phase < 4);
+		EndStep();
+	}
+};
@@ -0,0 +1,308 @@
+#pragma once
+
+// Minimal portable SIMD lanes for the terrain kernels.
+// simd::Float / simd::Int hold simd::width lanes: 8 with AVX2, 4 with SSE2 or
+// NEON, 1 otherwise. Kernels are written once against these types and process
+// width elements per iteration; comparisons give a simd::Mask used by Select().
+
+#include <cmath>
+#include <cstdint>
+
+#if defined(__AVX2__)
+	#define TERRAIN_SIMD_AVX2
+	#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#define TERRAIN_SIMD_SSE2
+	#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+	#define TERRAIN_SIMD_NEON
+	#include <arm_neon.h>
+#else
+	#define TERRAIN_SIMD_SCALAR
+#endif
+
+namespace simd{
+
+#if defined(TERRAIN_SIMD_AVX2)
+	constexpr int width = 8;
+	constexpr const char* name = "avx2";
+
+	struct Mask{ __m256 v; };
+	struct Float{ __m256 v; };
+	struct Int{ __m256i v; };
+
+	inline Float Set1(float value){ return { _mm256_set1_ps(value) }; }
+	inline Int Set1(int32_t value){ return { _mm256_set1_epi32(value) }; }
+	inline Float Load(const float* ptr){ return { _mm256_loadu_ps(ptr) }; }
+	inline Int Load(const int32_t* ptr){ return { _mm256_loadu_si256((const __m256i*)ptr) }; }
+	inline void Store(float* ptr, Float a){ _mm256_storeu_ps(ptr, a.v); }
+	inline void Store(int32_t* ptr, Int a){ _mm256_storeu_si256((__m256i*)ptr, a.v); }
+	inline Float IotaFloat(){ return { _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7) }; }
+
+	inline Float operator+(Float a, Float b){ return { _mm256_add_ps(a.v, b.v) }; }
+	inline Float operator-(Float a, Float b){ return { _mm256_sub_ps(a.v, b.v) }; }
+	inline Float operator*(Float a, Float b){ return { _mm256_mul_ps(a.v, b.v) }; }
+	inline Float operator/(Float a, Float b){ return { _mm256_div_ps(a.v, b.v) }; }
+	inline Float Min(Float a, Float b){ return { _mm256_min_ps(a.v, b.v) }; }
+	inline Float Max(Float a, Float b){ return { _mm256_max_ps(a.v, b.v) }; }
+	inline Float Sqrt(Float a){ return { _mm256_sqrt_ps(a.v) }; }
+	inline Float Floor(Float a){ return { _mm256_floor_ps(a.v) }; }
+	inline Float Ceil(Float a){ return { _mm256_ceil_ps(a.v) }; }
+
+	inline Mask operator<(Float a, Float b){ return { _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ) }; }
+	inline Mask operator<=(Float a, Float b){ return { _mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ) }; }
+	inline Mask operator>(Float a, Float b){ return { _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ) }; }
+	inline Mask operator>=(Float a, Float b){ return { _mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ) }; }
+	inline Mask operator&(Mask a, Mask b){ return { _mm256_and_ps(a.v, b.v) }; }
+	inline Mask operator|(Mask a, Mask b){ return { _mm256_or_ps(a.v, b.v) }; }
+	inline Mask AndNot(Mask a, Mask b){ return { _mm256_andnot_ps(b.v, a.v) }; }
+	inline int Bits(Mask a){ return _mm256_movemask_ps(a.v); }
+	inline Mask MaskFromBits(int bits){
+		__m256i lanes = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+		__m256i set = _mm256_and_si256(_mm256_set1_epi32(bits), lanes);
+		return { _mm256_castsi256_ps(_mm256_cmpeq_epi32(set, lanes)) };
+	}
+
+	inline Float Select(Mask m, Float a, Float b){ return { _mm256_blendv_ps(b.v, a.v, m.v) }; }
+	inline Int Select(Mask m, Int a, Int b){ return { _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(b.v), _mm256_castsi256_ps(a.v), m.v)) }; }
+
+	inline Int operator+(Int a, Int b){ return { _mm256_add_epi32(a.v, b.v) }; }
+	inline Int operator-(Int a, Int b){ return { _mm256_sub_epi32(a.v, b.v) }; }
+	inline Int operator*(Int a, Int b){ return { _mm256_mullo_epi32(a.v, b.v) }; }
+	inline Int operator&(Int a, Int b){ return { _mm256_and_si256(a.v, b.v) }; }
+	inline Int operator^(Int a, Int b){ return { _mm256_xor_si256(a.v, b.v) }; }
+	inline Int ShiftRightLogical(Int a, int bits){ return { _mm256_srli_epi32(a.v, bits) }; }
+	inline Mask operator<(Int a, Int b){ return { _mm256_castsi256_ps(_mm256_cmpgt_epi32(b.v, a.v)) }; }
+	inline Mask operator==(Int a, Int b){ return { _mm256_castsi256_ps(_mm256_cmpeq_epi32(a.v, b.v)) }; }
+
+	// truncates toward zero
+	inline Int ToInt(Float a){ return { _mm256_cvttps_epi32(a.v) }; }
+	inline Float ToFloat(Int a){ return { _mm256_cvtepi32_ps(a.v) }; }
+
+	inline Float Gather(const float* table, Int index){ return { _mm256_i32gather_ps(table, index.v, 4) }; }
+
+#elif defined(TERRAIN_SIMD_SSE2)
+	constexpr int width = 4;
+	constexpr const char* name = "sse2";
+
+	struct Mask{ __m128 v; };
+	struct Float{ __m128 v; };
+	struct Int{ __m128i v; };
+
+	inline Float Set1(float value){ return { _mm_set1_ps(value) }; }
+	inline Int Set1(int32_t value){ return { _mm_set1_epi32(value) }; }
+	inline Float Load(const float* ptr){ return { _mm_loadu_ps(ptr) }; }
+	inline Int Load(const int32_t* ptr){ return { _mm_loadu_si128((const __m128i*)ptr) }; }
+	inline void Store(float* ptr, Float a){ _mm_storeu_ps(ptr, a.v); }
+	inline void Store(int32_t* ptr, Int a){ _mm_storeu_si128((__m128i*)ptr, a.v); }
+	inline Float IotaFloat(){ return { _mm_setr_ps(0, 1, 2, 3) }; }
+
+	inline Float operator+(Float a, Float b){ return { _mm_add_ps(a.v, b.v) }; }
+	inline Float operator-(Float a, Float b){ return { _mm_sub_ps(a.v, b.v) }; }
+	inline Float operator*(Float a, Float b){ return { _mm_mul_ps(a.v, b.v) }; }
+	inline Float operator/(Float a, Float b){ return { _mm_div_ps(a.v, b.v) }; }
+	inline Float Min(Float a, Float b){ return { _mm_min_ps(a.v, b.v) }; }
+	inline Float Max(Float a, Float b){ return { _mm_max_ps(a.v, b.v) }; }
+	inline Float Sqrt(Float a){ return { _mm_sqrt_ps(a.v) }; }
+
+	inline Mask operator<(Float a, Float b){ return { _mm_cmplt_ps(a.v, b.v) }; }
+	inline Mask operator<=(Float a, Float b){ return { _mm_cmple_ps(a.v, b.v) }; }
+	inline Mask operator>(Float a, Float b){ return { _mm_cmpgt_ps(a.v, b.v) }; }
+	inline Mask operator>=(Float a, Float b){ return { _mm_cmpge_ps(a.v, b.v) }; }
+	inline Mask operator&(Mask a, Mask b){ return { _mm_and_ps(a.v, b.v) }; }
+	inline Mask operator|(Mask a, Mask b){ return { _mm_or_ps(a.v, b.v) }; }
+	inline Mask AndNot(Mask a, Mask b){ return { _mm_andnot_ps(b.v, a.v) }; }
+	inline int Bits(Mask a){ return _mm_movemask_ps(a.v); }
+	inline Mask MaskFromBits(int bits){
+		__m128i lanes = _mm_setr_epi32(1, 2, 4, 8);
+		__m128i set = _mm_and_si128(_mm_set1_epi32(bits), lanes);
+		return { _mm_castsi128_ps(_mm_cmpeq_epi32(set, lanes)) };
+	}
+
+	inline Float Select(Mask m, Float a, Float b){ return { _mm_or_ps(_mm_and_ps(m.v, a.v), _mm_andnot_ps(m.v, b.v)) }; }
+	inline Int Select(Mask m, Int a, Int b){
+		__m128i mi = _mm_castps_si128(m.v);
+		return { _mm_or_si128(_mm_and_si128(mi, a.v), _mm_andnot_si128(mi, b.v)) };
+	}
+
+	inline Int operator+(Int a, Int b){ return { _mm_add_epi32(a.v, b.v) }; }
+	inline Int operator-(Int a, Int b){ return { _mm_sub_epi32(a.v, b.v) }; }
+	// SSE2 has no 32 bit mullo, multiply even and odd lanes separately
+	inline Int operator*(Int a, Int b){
+		__m128i even = _mm_mul_epu32(a.v, b.v);
+		__m128i odd = _mm_mul_epu32(_mm_srli_si128(a.v, 4), _mm_srli_si128(b.v, 4));
+		return { _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0))) };
+	}
+	inline Int operator&(Int a, Int b){ return { _mm_and_si128(a.v, b.v) }; }
+	inline Int operator^(Int a, Int b){ return { _mm_xor_si128(a.v, b.v) }; }
+	inline Int ShiftRightLogical(Int a, int bits){ return { _mm_srli_epi32(a.v, bits) }; }
+	inline Mask operator<(Int a, Int b){ return { _mm_castsi128_ps(_mm_cmplt_epi32(a.v, b.v)) }; }
+	inline Mask operator==(Int a, Int b){ return { _mm_castsi128_ps(_mm_cmpeq_epi32(a.v, b.v)) }; }
+
+	// truncates toward zero
+	inline Int ToInt(Float a){ return { _mm_cvttps_epi32(a.v) }; }
+	inline Float ToFloat(Int a){ return { _mm_cvtepi32_ps(a.v) }; }
+
+	// SSE2 has no rounding instructions; exact for |a| < 2^31
+	inline Float Floor(Float a){
+		Float truncated = ToFloat(ToInt(a));
+		return Select(a < truncated, truncated - Set1(1.0f), truncated);
+	}
+	inline Float Ceil(Float a){
+		Float truncated = ToFloat(ToInt(a));
+		return Select(a > truncated, truncated + Set1(1.0f), truncated);
+	}
+
+#elif defined(TERRAIN_SIMD_NEON)
+	constexpr int width = 4;
+	constexpr const char* name = "neon";
+
+	struct Mask{ uint32x4_t v; };
+	struct Float{ float32x4_t v; };
+	struct Int{ int32x4_t v; };
+
+	inline Float Set1(float value){ return { vdupq_n_f32(value) }; }
+	inline Int Set1(int32_t value){ return { vdupq_n_s32(value) }; }
+	inline Float Load(const float* ptr){ return { vld1q_f32(ptr) }; }
+	inline Int Load(const int32_t* ptr){ return { vld1q_s32(ptr) }; }
+	inline void Store(float* ptr, Float a){ vst1q_f32(ptr, a.v); }
+	inline void Store(int32_t* ptr, Int a){ vst1q_s32(ptr, a.v); }
+	inline Float IotaFloat(){
+		const float lanes[4] = { 0, 1, 2, 3 };
+		return { vld1q_f32(lanes) };
+	}
+
+	inline Float operator+(Float a, Float b){ return { vaddq_f32(a.v, b.v) }; }
+	inline Float operator-(Float a, Float b){ return { vsubq_f32(a.v, b.v) }; }
+	inline Float operator*(Float a, Float b){ return { vmulq_f32(a.v, b.v) }; }
+	inline Float Min(Float a, Float b){ return { vminq_f32(a.v, b.v) }; }
+	inline Float Max(Float a, Float b){ return { vmaxq_f32(a.v, b.v) }; }
+
+	inline Mask operator<(Float a, Float b){ return { vcltq_f32(a.v, b.v) }; }
+	inline Mask operator<=(Float a, Float b){ return { vcleq_f32(a.v, b.v) }; }
+	inline Mask operator>(Float a, Float b){ return { vcgtq_f32(a.v, b.v) }; }
+	inline Mask operator>=(Float a, Float b){ return { vcgeq_f32(a.v, b.v) }; }
+	inline Mask operator&(Mask a, Mask b){ return { vandq_u32(a.v, b.v) }; }
+	inline Mask operator|(Mask a, Mask b){ return { vorrq_u32(a.v, b.v) }; }
+	inline Mask AndNot(Mask a, Mask b){ return { vbicq_u32(a.v, b.v) }; }
+	inline int Bits(Mask a){
+		const uint32_t lanes[4] = { 1, 2, 4, 8 };
+		uint32x4_t bits = vandq_u32(a.v, vld1q_u32(lanes));
+		return int(vgetq_lane_u32(bits, 0) | vgetq_lane_u32(bits, 1) | vgetq_lane_u32(bits, 2) | vgetq_lane_u32(bits, 3));
+	}
+	inline Mask MaskFromBits(int bits){
+		const uint32_t lanes[4] = { 1, 2, 4, 8 };
+		uint32x4_t lane_bits = vld1q_u32(lanes);
+		return { vceqq_u32(vandq_u32(vdupq_n_u32(uint32_t(bits)), lane_bits), lane_bits) };
+	}
+
+	inline Float Select(Mask m, Float a, Float b){ return { vbslq_f32(m.v, a.v, b.v) }; }
+	inline Int Select(Mask m, Int a, Int b){ return { vbslq_s32(m.v, a.v, b.v) }; }
+
+	inline Int operator+(Int a, Int b){ return { vaddq_s32(a.v, b.v) }; }
+	inline Int operator-(Int a, Int b){ return { vsubq_s32(a.v, b.v) }; }
+	inline Int operator*(Int a, Int b){ return { vmulq_s32(a.v, b.v) }; }
+	inline Int operator&(Int a, Int b){ return { vandq_s32(a.v, b.v) }; }
+	inline Int operator^(Int a, Int b){ return { veorq_s32(a.v, b.v) }; }
+	inline Int ShiftRightLogical(Int a, int bits){ return { vreinterpretq_s32_u32(vshlq_u32(vreinterpretq_u32_s32(a.v), vdupq_n_s32(-bits))) }; }
+	inline Mask operator<(Int a, Int b){ return { vcltq_s32(a.v, b.v) }; }
+	inline Mask operator==(Int a, Int b){ return { vceqq_s32(a.v, b.v) }; }
+
+	// truncates toward zero
+	inline Int ToInt(Float a){ return { vcvtq_s32_f32(a.v) }; }
+	inline Float ToFloat(Int a){ return { vcvtq_f32_s32(a.v) }; }
+
+	// Newton refined estimates, armv7 NEON has no divide or square root
+	inline Float operator/(Float a, Float b){
+		float32x4_t reciprocal = vrecpeq_f32(b.v);
+		reciprocal = vmulq_f32(vrecpsq_f32(b.v, reciprocal), reciprocal);
+		reciprocal = vmulq_f32(vrecpsq_f32(b.v, reciprocal), reciprocal);
+		return { vmulq_f32(a.v, reciprocal) };
+	}
+	inline Float Sqrt(Float a){
+		float32x4_t estimate = vrsqrteq_f32(a.v);
+		estimate = vmulq_f32(vrsqrtsq_f32(vmulq_f32(a.v, estimate), estimate), estimate);
+		estimate = vmulq_f32(vrsqrtsq_f32(vmulq_f32(a.v, estimate), estimate), estimate);
+		// 0 * inf estimate would give NaN for a == 0
+		return Select(a > Set1(0.0f), Float{ vmulq_f32(a.v, estimate) }, a);
+	}
+	inline Float Floor(Float a){
+		Float truncated = ToFloat(ToInt(a));
+		return Select(a < truncated, truncated - Set1(1.0f), truncated);
+	}
+	inline Float Ceil(Float a){
+		Float truncated = ToFloat(ToInt(a));
+		return Select(a > truncated, truncated + Set1(1.0f), truncated);
+	}
+
+#else
+	constexpr int width = 1;
+	constexpr const char* name = "scalar";
+
+	struct Mask{ bool v; };
+	struct Float{ float v; };
+	struct Int{ int32_t v; };
+
+	inline Float Set1(float value){ return { value }; }
+	inline Int Set1(int32_t value){ return { value }; }
+	inline Float Load(const float* ptr){ return { *ptr }; }
+	inline Int Load(const int32_t* ptr){ return { *ptr }; }
+	inline void Store(float* ptr, Float a){ *ptr = a.v; }
+	inline void Store(int32_t* ptr, Int a){ *ptr = a.v; }
+	inline Float IotaFloat(){ return { 0.0f }; }
+
+	inline Float operator+(Float a, Float b){ return { a.v + b.v }; }
+	inline Float operator-(Float a, Float b){ return { a.v - b.v }; }
+	inline Float operator*(Float a, Float b){ return { a.v * b.v }; }
+	inline Float operator/(Float a, Float b){ return { a.v / b.v }; }
+	inline Float Min(Float a, Float b){ return { b.v < a.v ? b.v : a.v }; }
+	inline Float Max(Float a, Float b){ return { a.v < b.v ? b.v : a.v }; }
+	inline Float Sqrt(Float a){ return { std::sqrt(a.v) }; }
+	inline Float Floor(Float a){ return { std::floor(a.v) }; }
+	inline Float Ceil(Float a){ return { std::ceil(a.v) }; }
+
+	inline Mask operator<(Float a, Float b){ return { a.v < b.v }; }
+	inline Mask operator<=(Float a, Float b){ return { a.v <= b.v }; }
+	inline Mask operator>(Float a, Float b){ return { a.v > b.v }; }
+	inline Mask operator>=(Float a, Float b){ return { a.v >= b.v }; }
+	inline Mask operator&(Mask a, Mask b){ return { a.v && b.v }; }
+	inline Mask operator|(Mask a, Mask b){ return { a.v || b.v }; }
+	inline Mask AndNot(Mask a, Mask b){ return { a.v && !b.v }; }
+	inline int Bits(Mask a){ return a.v ? 1 : 0; }
+	inline Mask MaskFromBits(int bits){ return { (bits & 1) != 0 }; }
+
+	inline Float Select(Mask m, Float a, Float b){ return m.v ? a : b; }
+	inline Int Select(Mask m, Int a, Int b){ return m.v ? a : b; }
+
+	inline Int operator+(Int a, Int b){ return { a.v + b.v }; }
+	inline Int operator-(Int a, Int b){ return { a.v - b.v }; }
+	inline Int operator*(Int a, Int b){ return { int32_t(uint32_t(a.v) * uint32_t(b.v)) }; }
+	inline Int operator&(Int a, Int b){ return { a.v & b.v }; }
+	inline Int operator^(Int a, Int b){ return { a.v ^ b.v }; }
+	inline Int ShiftRightLogical(Int a, int bits){ return { int32_t(uint32_t(a.v) >> bits) }; }
+	inline Mask operator<(Int a, Int b){ return { a.v < b.v }; }
+	inline Mask operator==(Int a, Int b){ return { a.v == b.v }; }
+
+	inline Int ToInt(Float a){ return { int32_t(a.v) }; }
+	inline Float ToFloat(Int a){ return { float(a.v) }; }
+#endif
+
+	inline bool Any(Mask a){ return Bits(a) != 0; }
+	inline bool All(Mask a){ return Bits(a) == (1 << width) - 1; }
+	inline Float operator-(Float a){ return Set1(0.0f) - a; }
+	inline Int Min(Int a, Int b){ return Select(a < b, a, b); }
+	inline Int Max(Int a, Int b){ return Select(a < b, b, a); }
+
+#if !defined(TERRAIN_SIMD_AVX2)
+	// table[index] for every lane, one load each
+	inline Float Gather(const float* table, Int index){
+		int32_t indices[width];
+		float values[width];
+		Store(indices, index);
+		for (int lane = 0; lane < width; lane++) {
+			values[lane] = table[indices[lane]];
+		}
+		return Load(values);
+	}
+#endif
+}
@@ -0,0 +1,134 @@
+#pragma once
+
+#include "BrushStroke.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Stroke log: the edits of a session, frame by frame, so they can be replayed
+// without a window. After the header comes one StrokeLogFrame per frame that
+// did anything (or let go of the buttons), each followed by its stamp_count
+// BrushStamps. A frame holds what OnUserUpdate acted on, in the order it did:
+// the undo stroke opened or closed, the paint circle, the clear, the undo or
+// redo, then the stamps of the tool with its settings.
+struct StrokeLogHeader{
+	static constexpr char expected_magic[8] = { 'S', 'T', 'R', 'O', 'K', 'E', 'S', '\0' };
+	static constexpr uint32_t current_version = 1;
+	static constexpr uint32_t native_byte_order = 0x01020304;
+
+	char magic[8] = {};
+	uint32_t version = 0;
+	uint32_t byte_order = 0;
+	// map the session edited
+	int32_t width = 0;
+	int32_t height = 0;
+	uint32_t reserved[2] = {};
+
+	bool IsValid() const{
+		return std::memcmp(magic, expected_magic, sizeof(magic)) == 0 && version == current_version && byte_order == native_byte_order
+			&& width > 0 && height > 0;
+	}
+};
+static_assert(sizeof(StrokeLogHeader) == 32, "stroke log header layout");
+
+struct StrokeLogFrame{
+	enum Flags : uint8_t{
+		// a mouse button was down, so the frame's edits join the open undo stroke
+		stroke_held = 1,
+		// the map was cleared (which clears the undo history too)
+		clear = 2,
+		undo = 4,
+		redo = 8,
+		// CTRL + middle button painted a circle at paint_pos
+		paint = 16,
+	};
+
+	// seconds since recording started
+	float time = 0.0f;
+	uint8_t flags = 0;
+	// Example::EditMode
+	uint8_t mode = 0;
+	// 0 left, 1 right, -1 none
+	int8_t button = -1;
+	uint8_t reserved = 0;
+	uint16_t brush_size = 0;
+	uint16_t blend_range = 0;
+	uint16_t stamp_count = 0;
+	uint16_t reserved2 = 0;
+	olc::vf2d paint_pos;
+};
+static_assert(sizeof(StrokeLogFrame) == 24, "stroke log frame layout");
+static_assert(sizeof(BrushStamp) == 16, "stroke log stamp layout");
+
+struct StrokeLogEntry{
+	StrokeLogFrame frame;
+	std::vector<BrushStamp> stamps;
+};
+
+class StrokeLogWriter{
+	std::ofstream out;
+
+public:
+	bool Open(const std::string& path, olc::vi2d map_size){
+		out = std::ofstream(path, std::ios::binary | std::ios::trunc);
+		StrokeLogHeader header;
+		std::memcpy(header.magic, StrokeLogHeader::expected_magic, sizeof(header.magic));
+		header.version = StrokeLogHeader::current_version;
+		header.byte_order = StrokeLogHeader::native_byte_order;
+		header.width = map_size.x;
+		header.height = map_size.y;
+		out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		return bool(out);
+	}
+
+	bool IsOpen() const{
+		return out.is_open();
+	}
+
+	// Appends entry; stamp_count is taken from its stamps
+	void Write(const StrokeLogEntry& entry){
+		StrokeLogFrame frame = entry.frame;
+		frame.stamp_count = uint16_t(std::min<size_t>(entry.stamps.size(), UINT16_MAX));
+		out.write(reinterpret_cast<const char*>(&frame), sizeof(frame));
+		out.write(reinterpret_cast<const char*>(entry.stamps.data()), std::streamsize(frame.stamp_count * sizeof(BrushStamp)));
+	}
+
+	// False if anything failed to write
+	bool Close(){
+		if (!out.is_open()) {
+			return true;
+		}
+		out.close();
+		return bool(out);
+	}
+};
+
+class StrokeLogReader{
+	std::ifstream in;
+	StrokeLogHeader header;
+
+public:
+	// False if path can't be read or isn't a stroke log
+	bool Open(const std::string& path){
+		in = std::ifstream(path, std::ios::binary);
+		return in.read(reinterpret_cast<char*>(&header), sizeof(header)) && header.IsValid();
+	}
+
+	olc::vi2d MapSize() const{
+		return { header.width, header.height };
+	}
+
+	// Reads the next frame into entry; false at the end of the log (a
+	// frame cut short by a crash while recording counts as the end)
+	bool Next(StrokeLogEntry& entry){
+		if (!in.read(reinterpret_cast<char*>(&entry.frame), sizeof(entry.frame))) {
+			return false;
+		}
+		entry.stamps.resize(entry.frame.stamp_count);
+		return bool(in.read(reinterpret_cast<char*>(entry.stamps.data()), std::streamsize(entry.stamps.size() * sizeof(BrushStamp))));
+	}
+};
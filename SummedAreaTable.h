@@ -0,0 +1,281 @@
+#pragma once
+
+#include "ChunkedDensityField.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+// Integral image over a chunked field, so the sum or average of any rectangle
+// of cells costs four lookups however large it is. It is kept in two levels:
+// every dense chunk has a summed-area table of its own cells, and across the
+// chunks there are running sums of whole chunks to the left and above:
+//   row_sums[y][cx]   cells of map row y's chunk row up to row y, left of chunk cx
+//   column_sums[x][cy] cells of map column x's chunk column, above chunk cy
+//   chunk_sums[cy][cx] cells of all chunks up and to the left of chunk (cx, cy)
+// which with the local table give the sum of cells [0, x] x [0, y].
+// Sums are exact, in cell units (integers for integer cells).
+//
+// It follows the field's dirty reports, like OccupancyPyramid: Update() redoes
+// the local tables from the first reported row and column on, then the running
+// sums of the chunk rows and columns that changed. Queries are const and read
+// only the tables, so they may run from several threads between Update()s.
+template <typename Field>
+class SummedAreaTable{
+	using Cell = typename Field::cell_type;
+	using traits = typename Field::traits;
+	static constexpr int chunk_size = Field::chunk_size;
+	static constexpr int chunk_size_log2 = Field::chunk_size_log2;
+	static constexpr int chunk_mask = Field::chunk_mask;
+
+public:
+	// 64 bits hold 2^47 full cells of 16 bits
+	using Sum = std::conditional_t<std::is_integral_v<Cell>, int64_t, double>;
+
+private:
+	// one chunk's cells sum to at most 2^28 for 16 bit cells
+	using LocalSum = std::conditional_t<std::is_integral_v<Cell>, uint32_t, double>;
+
+	struct Chunk{
+		// inclusive local table, empty while the chunk held uniform_value at the last Update()
+		std::vector<LocalSum> sums;
+		Cell uniform_value = Cell();
+
+		Sum At(int local_x, int local_y) const{
+			if (sums.empty()) {
+				return Sum(uniform_value) * Sum(local_x + 1) * Sum(local_y + 1);
+			}
+			return Sum(sums[size_t(local_y) * chunk_size + local_x]);
+		}
+	};
+
+	Field* field = nullptr;
+	ChunkDirtyTracker dirty;
+	std::vector<Chunk> chunks;
+	std::vector<Sum> row_sums;
+	std::vector<Sum> column_sums;
+	std::vector<Sum> chunk_sums;
+	// first chunk column / row whose running sums are out of date, per chunk row / column
+	std::vector<int> rows_from;
+	std::vector<int> columns_from;
+	int chunks_x = 0;
+	int chunks_y = 0;
+	int width = 0;
+	int height = 0;
+	// ToFloat() is a plain scale for every cell type
+	float cell_scale = traits::ToFloat(Cell(1));
+
+	// redoes the chunk's table for cells at or past local_from on both axes
+	void RebuildChunk(int chunk_x, int chunk_y, olc::vi2d local_from){
+		const typename Field::Chunk& source = field->GetChunk(chunk_x, chunk_y);
+		Chunk& chunk = chunks[size_t(chunk_y) * chunks_x + chunk_x];
+		if (source.IsUniform()) {
+			chunk.sums.clear();
+			chunk.sums.shrink_to_fit();
+			chunk.uniform_value = source.uniform_value;
+			return;
+		}
+		if (chunk.sums.empty()) {
+			// the uniform value it had is no use to the cells around local_from
+			chunk.sums.resize(size_t(chunk_size) * chunk_size);
+			local_from = { 0, 0 };
+		}
+
+		LocalSum* sums = chunk.sums.data();
+		for (int y = local_from.y; y < chunk_size; y++) {
+			const Cell* row = source.cells->Row(y);
+			LocalSum* out = sums + size_t(y) * chunk_size;
+			const LocalSum* above = y > 0 ? out - chunk_size : nullptr;
+			// the one before local_from.x holds this row's sum so far plus the rows above
+			LocalSum row_sum = 0;
+			if (local_from.x > 0) {
+				row_sum = out[local_from.x - 1] - (above ? above[local_from.x - 1] : 0);
+			}
+			for (int x = local_from.x; x < chunk_size; x++) {
+				row_sum += LocalSum(row[x]);
+				out[x] = row_sum + (above ? above[x] : 0);
+			}
+		}
+	}
+
+	void RebuildRowSums(int chunk_y, int chunk_from){
+		for (int local_y = 0; local_y < chunk_size; local_y++) {
+			Sum* out = row_sums.data() + size_t(chunk_y * chunk_size + local_y) * (chunks_x + 1);
+			for (int chunk_x = chunk_from; chunk_x < chunks_x; chunk_x++) {
+				out[chunk_x + 1] = out[chunk_x] + chunks[size_t(chunk_y) * chunks_x + chunk_x].At(chunk_mask, local_y);
+			}
+		}
+	}
+
+	void RebuildColumnSums(int chunk_x, int chunk_from){
+		for (int local_x = 0; local_x < chunk_size; local_x++) {
+			Sum* out = column_sums.data() + size_t(chunk_x * chunk_size + local_x) * (chunks_y + 1);
+			for (int chunk_y = chunk_from; chunk_y < chunks_y; chunk_y++) {
+				out[chunk_y + 1] = out[chunk_y] + chunks[size_t(chunk_y) * chunks_x + chunk_x].At(local_x, chunk_mask);
+			}
+		}
+	}
+
+	// the bottom right entries of the row sums of every chunk row are the
+	// chunk row totals, so the whole chunk grid is cheap to redo
+	void RebuildChunkSums(){
+		for (int chunk_y = 0; chunk_y < chunks_y; chunk_y++) {
+			const Sum* row_total = row_sums.data() + size_t(chunk_y * chunk_size + chunk_mask) * (chunks_x + 1);
+			const Sum* above = chunk_sums.data() + size_t(chunk_y) * (chunks_x + 1);
+			Sum* out = chunk_sums.data() + size_t(chunk_y + 1) * (chunks_x + 1);
+			for (int chunk_x = 0; chunk_x <= chunks_x; chunk_x++) {
+				out[chunk_x] = above[chunk_x] + row_total[chunk_x];
+			}
+		}
+	}
+
+	// running sums of the chunk rows and columns marked in rows_from / columns_from
+	void RebuildSums(){
+		for (int chunk_y = 0; chunk_y < chunks_y; chunk_y++) {
+			if (rows_from[chunk_y] < chunks_x) {
+				RebuildRowSums(chunk_y, rows_from[chunk_y]);
+				rows_from[chunk_y] = chunks_x;
+			}
+		}
+		for (int chunk_x = 0; chunk_x < chunks_x; chunk_x++) {
+			if (columns_from[chunk_x] < chunks_y) {
+				RebuildColumnSums(chunk_x, columns_from[chunk_x]);
+				columns_from[chunk_x] = chunks_y;
+			}
+		}
+		RebuildChunkSums();
+	}
+
+	// sum of cells [0, x] x [0, y], x and y in the map
+	Sum PrefixSum(int x, int y) const{
+		int chunk_x = x >> chunk_size_log2;
+		int chunk_y = y >> chunk_size_log2;
+		return chunk_sums[size_t(chunk_y) * (chunks_x + 1) + chunk_x]
+			+ row_sums[size_t(y) * (chunks_x + 1) + chunk_x]
+			+ column_sums[size_t(x) * (chunks_y + 1) + chunk_y]
+			+ chunks[size_t(chunk_y) * chunks_x + chunk_x].At(x & chunk_mask, y & chunk_mask);
+	}
+
+	// PrefixSum() of any cell, those off the map counting as 0
+	Sum ClampedPrefixSum(int x, int y) const{
+		if (x < 0 || y < 0) {
+			return 0;
+		}
+		return PrefixSum(std::min(x, width - 1), std::min(y, height - 1));
+	}
+
+	// ClampedPrefixSum() of one row for x in increasing order, the per chunk
+	// terms only looked up when x enters another chunk
+	struct RowCursor{
+		const SummedAreaTable& table;
+		int y;
+		int chunk_y;
+		int chunk_x = -1;
+		Sum base = 0;
+		const Chunk* chunk = nullptr;
+		const Sum* columns = nullptr;
+
+		RowCursor(const SummedAreaTable& table, int y) : table(table), y(std::min(y, table.height - 1)), chunk_y(this->y >> chunk_size_log2){
+		}
+
+		Sum At(int x){
+			if (x < 0 || y < 0) {
+				return 0;
+			}
+			x = std::min(x, table.width - 1);
+			if ((x >> chunk_size_log2) != chunk_x) {
+				chunk_x = x >> chunk_size_log2;
+				base = table.chunk_sums[size_t(chunk_y) * (table.chunks_x + 1) + chunk_x]
+					+ table.row_sums[size_t(y) * (table.chunks_x + 1) + chunk_x];
+				chunk = &table.chunks[size_t(chunk_y) * table.chunks_x + chunk_x];
+				columns = table.column_sums.data() + chunk_y;
+			}
+			return base + columns[size_t(x) * (table.chunks_y + 1)] + chunk->At(x & chunk_mask, y & chunk_mask);
+		}
+	};
+
+public:
+	~SummedAreaTable(){
+		Detach();
+	}
+
+	void Attach(Field& field){
+		Detach();
+		this->field = &field;
+		field.AddDirtyTracker(&dirty);
+
+		chunks_x = field.ChunksX();
+		chunks_y = field.ChunksY();
+		width = field.Width();
+		height = field.Height();
+		chunks.assign(size_t(chunks_x) * chunks_y, Chunk{});
+		row_sums.assign(size_t(chunks_y) * chunk_size * (chunks_x + 1), 0);
+		column_sums.assign(size_t(chunks_x) * chunk_size * (chunks_y + 1), 0);
+		chunk_sums.assign(size_t(chunks_y + 1) * (chunks_x + 1), 0);
+		rows_from.assign(chunks_y, 0);
+		columns_from.assign(chunks_x, 0);
+		for (int chunk_y = 0; chunk_y < chunks_y; chunk_y++) {
+			for (int chunk_x = 0; chunk_x < chunks_x; chunk_x++) {
+				RebuildChunk(chunk_x, chunk_y, { 0, 0 });
+			}
+		}
+		RebuildSums();
+	}
+
+	void Detach(){
+		if (field) {
+			field->RemoveDirtyTracker(&dirty);
+			field = nullptr;
+		}
+	}
+
+	// Brings the tables in line with everything reported dirty since the last call
+	void Update(){
+		if (dirty.Empty()) {
+			return;
+		}
+		dirty.Consume([&](int chunk_x, int chunk_y, olc::vi2d local_from, olc::vi2d){
+			RebuildChunk(chunk_x, chunk_y, local_from);
+			rows_from[chunk_y] = std::min(rows_from[chunk_y], chunk_x);
+			columns_from[chunk_x] = std::min(columns_from[chunk_x], chunk_y);
+		});
+		RebuildSums();
+	}
+
+	// Sum of the cells in from..to (inclusive), in cell units; cells off the map count as 0
+	Sum BoxSum(olc::vi2d from, olc::vi2d to) const{
+		if (from.x > to.x || from.y > to.y) {
+			return 0;
+		}
+		return ClampedPrefixSum(to.x, to.y) - ClampedPrefixSum(from.x - 1, to.y)
+			- ClampedPrefixSum(to.x, from.y - 1) + ClampedPrefixSum(from.x - 1, from.y - 1);
+	}
+
+	// Average value (as Field::Get() reads it) of the cells in from..to, cells off the map counting as 0
+	float BoxAverage(olc::vi2d from, olc::vi2d to) const{
+		float area = float(to.x - from.x + 1) * float(to.y - from.y + 1);
+		return float(BoxSum(from, to)) * (cell_scale / area);
+	}
+
+	// Average of the (2 * radius + 1)^2 cells around centre
+	float BoxAverage(olc::vi2d centre, int radius) const{
+		return BoxAverage(centre - olc::vi2d{ radius, radius }, centre + olc::vi2d{ radius, radius });
+	}
+
+	// BoxAverage(centre, radius) for the count cells from from on along its row,
+	// into out; the prefix sums are walked along the row instead of looked up
+	void BoxAverageRow(olc::vi2d from, int count, int radius, float* out) const{
+		float scale = cell_scale / (float(2 * radius + 1) * float(2 * radius + 1));
+		RowCursor top_left{ *this, from.y - radius - 1 };
+		RowCursor top_right{ *this, from.y - radius - 1 };
+		RowCursor bottom_left{ *this, from.y + radius };
+		RowCursor bottom_right{ *this, from.y + radius };
+		for (int i = 0; i < count; i++) {
+			int left = from.x + i - radius - 1;
+			int right = from.x + i + radius;
+			Sum sum = bottom_right.At(right) - bottom_left.At(left) - top_right.At(right) + top_left.At(left);
+			out[i] = float(sum) * scale;
+		}
+	}
+};
@@ -0,0 +1,1093 @@
+#pragma once
+
+#include "olcPixelGameEngine.h"
+
+#define _USE_MATH_DEFINES
+#include <math.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "ChunkedDensityField.h"
+#include "OccupancyPyramid.h"
+#include "SummedAreaTable.h"
+#include "DistanceField.h"
+#include "Raycast.h"
+#include "ConeCast.h"
+#include "BoxBlur.h"
+#include "BrushExecutor.h"
+#include "ScratchArena.h"
+#include "PerfCounters.h"
+#include "GpuBlend.h"
+#include "ProgressiveBlend.h"
+#include "BrushStampCache.h"
+#include "BrushCurves.h"
+#include "BrushKernels.h"
+#include "Simd.h"
+
+// Cells live in the frame's scratch arena, so the buffer is only valid until
+// the arena is next reset
+template <typename T>
+class BlockBuffer{
+	T* buffer;
+	int x_offset;
+	int y_offset;
+	int x_size;
+	int y_size;
+
+public:
+	// from and to inclusive
+	BlockBuffer(ScratchArena& arena, olc::vi2d from, olc::vi2d to){
+		x_offset = from.x;
+		y_offset = from.y;
+		x_size = to.x - from.x + 1;
+		y_size = to.y - from.y + 1;
+		buffer = arena.Allocate<T>(size_t(x_size) * y_size);
+		std::fill(buffer, buffer + size_t(x_size) * y_size, T());
+	}
+
+	int get_index(int x, int y){
+		return (y - y_offset) * x_size + (x - x_offset);
+	}
+	void set(int x, int y, T value){
+		int index = get_index(x, y);
+		buffer[index] = value;
+	}
+	T get(int x, int y){
+		return buffer[get_index(x, y)];
+	}
+};
+
+// The terrain editing engine without a window: the map, the caches the tools
+// and raycasts keep over it, and the tools themselves. The editor (Example in
+// main.cpp) is one host of it; a tool embedding it makes its own, sets
+// brush_size and blend_range, aims with Aim() and calls the tools, raycasts
+// and kernels directly, then EndEdits() once a batch of them is done.
+//
+// The terrain is shared without copies: ViewChunk() and ViewChunks() give
+// the cells of a chunk where they are stored, EditCells() hands out writable
+// row pieces in place, and a DirtyListener added with AddListener() hears
+// which cells changed at every NotifyListeners() (EndEdits() calls it).
+//
+// Not thread safe: one thread makes every call, though the tools themselves
+// run on brushes' worker pool.
+//
+// Builds on olcPixelGameEngine.h (olc::vi2d, olc::Pixel) and GpuBlend.h, so a
+// host links the Pixel Game Engine even if it never opens a window: one of its
+// source files defines OLC_PGE_APPLICATION before including
+// olcPixelGameEngine.h, and it links what that needs (X11, GL and png on Linux,
+// e.g. -lX11 -lGL -lpng -lpthread).
+class TerrainEngine{
+public:
+	// 16 bits per cell keeps repeated fractional strokes from losing precision
+	using TerrainCell = uint16_t;
+	using TerrainMap = ChunkedDensityField<TerrainCell>;
+
+	// The cells of a chunk as the map stores them. cells is null while every
+	// cell holds uniform_value; otherwise row y (of extent.y, from origin.y)
+	// starts at cells + y * stride. Valid until the next edit or Compact() of
+	// the map. TerrainMap::traits::ToFloat() gives a cell's 0..1 value.
+	struct ChunkView{
+		olc::vi2d origin;
+		olc::vi2d extent;
+		const TerrainCell* cells = nullptr;
+		int stride = TerrainMap::chunk_size;
+		TerrainCell uniform_value = 0;
+
+		bool IsUniform() const{
+			return !cells;
+		}
+		// x and y local to the chunk
+		TerrainCell GetCell(int x, int y) const{
+			return cells ? cells[size_t(y) * stride + x] : uniform_value;
+		}
+	};
+
+	// Told the cells that changed since the last NotifyListeners(), a rect per
+	// chunk (map cells, both ends inclusive)
+	class DirtyListener{
+	public:
+		virtual void TerrainChanged(olc::vi2d from, olc::vi2d to) = 0;
+
+	protected:
+		~DirtyListener() = default;
+	};
+
+	olc::vi2d map_size;
+	// where the raycasting tools cast from (the player) and towards (the mouse)
+	olc::vf2d player_pos = map_size/2;
+	olc::vf2d mouse_pos;
+
+	TerrainMap map{map_size.x, map_size.y};
+	// lets the raycasts jump over empty space
+	using Occupancy = OccupancyPyramid<TerrainMap>;
+	Occupancy occupancy;
+	// box sums of the terrain for the blend tools, see SummedAreaTable.h
+	SummedAreaTable<TerrainMap> area_sums;
+	// distances to the terrain for collision and the target raycast, see DistanceField.h
+	DistanceField<TerrainMap> distances;
+	ConeCaster cone_caster;
+	// per frame temporaries of the tools, see BlockBuffer
+	ScratchArena scratch;
+	// runs the brush kernels across all cores
+	BrushExecutor brushes;
+	// scratch of AdjustTerrain_BlendBallFractionalFast2, kept between strokes
+	SeparableBoxBlur blend_blur;
+	std::vector<float> blend_current;
+	std::vector<float> blend_span;
+	// the same brush as fragment shaders, when the renderer has them (the
+	// host calls gpu_blend.Init() with a GL context current)
+	GpuBlendBrush gpu_blend;
+	bool use_gpu_blend = true;
+	// preview now, full blend over the next frames, for batches whose source
+	// reaches progressive_cells cells; see ProgressiveBlend.h
+	ProgressiveBlend<TerrainMap> progressive_blend;
+	bool use_progressive_blend = true;
+	int progressive_cells = 160 * 160;
+	float refine_budget_ms = 4.0f;
+
+	// counts of the work done, see PerfCounters.h
+	PerfCounters counters;
+
+	int blend_range = 15;
+	int brush_size = 16;
+	float raycast_max_distance = 500.0f;
+
+	// stamp centres of AdjustTerrain_BlendBallFractionalFast2, applied together
+	std::vector<olc::vi2d> blend_centres;
+	// per worker rows of AdjustTerrain_BlendBallFractionalFast2
+	std::vector<std::vector<float>> blend_rows;
+
+	// which tool a cached stamp belongs to
+	enum StampTool {
+		circle_falloff,
+		blend_keep,
+		blend_keep_fast,
+		gauss_cone
+	};
+	// brush weights precomputed for the current settings, see BrushStampCache.h
+	StampCache<RadialMask> stamp_masks;
+	StampCache<std::vector<float>> cone_weights;
+
+	float terraform_angle = 50.0f;
+	float terraform_raycast_step = 0.5f;
+
+private:
+	std::vector<DirtyListener*> listeners;
+	// what the listeners haven't been told yet; on the map while there are any
+	ChunkDirtyTracker listener_dirty;
+
+public:
+	TerrainEngine(olc::vi2d map_size = { 512, 512 }) : map_size(map_size)
+	{
+		occupancy.Attach(map);
+		area_sums.Attach(map);
+		distances.Attach(map);
+	}
+
+	// the caches keep pointers into the map
+	TerrainEngine(const TerrainEngine&) = delete;
+	TerrainEngine& operator=(const TerrainEngine&) = delete;
+
+	// where the raycasting tools cast from and towards, in map cells
+	void Aim(olc::vf2d from, olc::vf2d towards) {
+		player_pos = from;
+		mouse_pos = towards;
+	}
+
+	ChunkView ViewChunk(int chunk_x, int chunk_y) const {
+		const TerrainMap::Chunk& chunk = map.GetChunk(chunk_x, chunk_y);
+		ChunkView view;
+		view.origin = map.ChunkOrigin(chunk_x, chunk_y);
+		view.extent = map.ChunkExtent(chunk_x, chunk_y);
+		view.cells = chunk.cells ? chunk.cells->Row(0) : nullptr;
+		view.uniform_value = chunk.uniform_value;
+		return view;
+	}
+
+	// Calls visit(view) for every chunk overlapping from..to (inclusive, clipped to the map)
+	template <typename Visit>
+	void ViewChunks(olc::vi2d from, olc::vi2d to, Visit&& visit) const {
+		from = from.max({ 0, 0 });
+		to = to.min(map.Size() - olc::vi2d{ 1, 1 });
+		if (from.x > to.x || from.y > to.y) {
+			return;
+		}
+		for (int chunk_y = from.y >> TerrainMap::chunk_size_log2; chunk_y <= to.y >> TerrainMap::chunk_size_log2; chunk_y++) {
+			for (int chunk_x = from.x >> TerrainMap::chunk_size_log2; chunk_x <= to.x >> TerrainMap::chunk_size_log2; chunk_x++) {
+				visit(ViewChunk(chunk_x, chunk_y));
+			}
+		}
+	}
+
+	// Calls edit(cells, x, y, count) for the piece of every row of from..to
+	// (inclusive, clipped to the map) in each chunk it crosses, cells pointing
+	// at the map's own cells from (x, y) on, then marks the rect dirty. The
+	// journal and trackers see the edit like any tool's.
+	template <typename Edit>
+	void EditCells(olc::vi2d from, olc::vi2d to, Edit&& edit) {
+		from = from.max({ 0, 0 });
+		to = to.min(map.Size() - olc::vi2d{ 1, 1 });
+		if (from.x > to.x || from.y > to.y) {
+			return;
+		}
+		for (int y = from.y; y <= to.y; y++) {
+			map.EditSpan(from.x, to.x, y, [&](TerrainCell* cells, int x, int count) {
+				edit(cells, x, y, count);
+			});
+		}
+		map.MarkDirty(from, to);
+		uint64_t cells = uint64_t(to.x - from.x + 1) * uint64_t(to.y - from.y + 1);
+		counters.Add(PerfCounters::cells_written, cells);
+	}
+
+	// Listeners must outlive the engine or be removed
+	void AddListener(DirtyListener* listener) {
+		if (listeners.empty()) {
+			map.AddDirtyTracker(&listener_dirty);
+		}
+		listeners.push_back(listener);
+	}
+	void RemoveListener(DirtyListener* listener) {
+		listeners.erase(std::remove(listeners.begin(), listeners.end(), listener), listeners.end());
+		if (listeners.empty()) {
+			map.RemoveDirtyTracker(&listener_dirty);
+		}
+	}
+
+	void NotifyListeners() {
+		listener_dirty.Consume([&](int chunk_x, int chunk_y, olc::vi2d local_from, olc::vi2d local_to) {
+			olc::vi2d origin = map.ChunkOrigin(chunk_x, chunk_y);
+			for (DirtyListener* listener : listeners) {
+				listener->TerrainChanged(origin + local_from, origin + local_to);
+			}
+		});
+	}
+
+	// Closes a batch of edits for a host without frames: lands what the
+	// progressive and GPU blends still owe, folds chunks that came out uniform
+	// back into one value, drops the tools' temporaries and tells the listeners
+	void EndEdits() {
+		FinishBlends();
+		ResolveGpuBlend();
+		map.Compact();
+		scratch.Reset();
+		NotifyListeners();
+	}
+
+	// a cell a ray looked at, for the stats; always true
+	bool CountedStep() {
+		counters.Add(PerfCounters::raycast_steps);
+		return true;
+	}
+
+	// cells of a square brush of radius
+	static uint64_t BrushSquare(int radius) {
+		return uint64_t(2 * radius + 1) * uint64_t(2 * radius + 1);
+	}
+
+	// Cell hit by the ray: anything that isn't completely empty
+	bool RaycastPixel(olc::vi2d ray_start_pos, olc::vf2d ray_dir, float max_distance, olc::vi2d& intersection_result) {
+		occupancy.Update();
+		counters.Add(PerfCounters::raycasts);
+
+		RaycastResult result = RaycastGrid(ray_start_pos, ray_dir, max_distance, map_size, &occupancy, Occupancy::any_nonzero,
+			[&](olc::vi2d cell) { return CountedStep() && MapLocationIsEmpty(cell) == false; });
+
+		intersection_result = result.cell;
+
+		// Calculate intersection location
+		/*if (bTileFound)
+		{
+
+			intersection_result = ray_start_pos + ray_dir * fDistance;
+		}*/
+
+		return result.hit;
+	}
+
+	// Like RaycastPixel, but steps back to the free cell in front of a fully solid hit
+	bool RaycastPrePixel(olc::vi2d ray_start_pos, olc::vf2d ray_dir, float max_distance, olc::vi2d& intersection_result) {
+		occupancy.Update();
+		counters.Add(PerfCounters::raycasts);
+
+		RaycastResult result = RaycastGrid(ray_start_pos, ray_dir, max_distance, map_size, &occupancy, Occupancy::any_nonzero,
+			[&](olc::vi2d cell) { return CountedStep() && MapLocationIsEmpty(cell) == false; });
+
+		if (MapLocationIsFull(result.cell)) {
+			intersection_result = result.previous_cell;
+		}
+		else {
+			intersection_result = result.cell;
+		}
+
+		return result.hit;
+	}
+
+	// Fan of RaycastPixel rays around ray_dir, angles in degrees
+	const std::vector<ConeHit>& CastGaussCone(olc::vi2d ray_start_pos, olc::vf2d ray_dir, float max_distance, float cone_angle, float step) {
+		occupancy.Update();
+
+		const std::vector<ConeHit>& hits = cone_caster.Cast(ray_start_pos, ray_dir, cone_angle, step, max_distance, map_size, &occupancy, Occupancy::any_nonzero,
+			[&](olc::vi2d cell) { return CountedStep() && MapLocationIsEmpty(cell) == false; });
+		counters.Add(PerfCounters::raycasts, hits.size());
+		counters.Add(PerfCounters::gauss_strokes);
+		counters.Add(PerfCounters::gauss_rays, hits.size());
+		return hits;
+	}
+
+	// Cell hit by the ray, counting only cells that are at least half solid
+	bool RaycastPixelTarget(olc::vi2d ray_start_pos, olc::vf2d ray_dir, float max_distance, olc::vi2d& intersection_result) {
+		distances.Update();
+		counters.Add(PerfCounters::raycasts);
+
+		RaycastResult result = SphereTraceGrid(ray_start_pos, ray_dir, RaycastUnitStep(ray_dir), max_distance, map_size,
+			[&](olc::vi2d cell) { CountedStep(); return distances.CellClearance(cell); },
+			[&](olc::vi2d cell) { return GetColourValue(cell) >= DistanceField<TerrainMap>::solid_threshold; });
+
+		intersection_result = result.cell;
+
+		return result.hit;
+	}
+
+	// DestructTerrain_CircleFractional's gaussian falloff, by whole cell distance
+	const RadialMask& CircleFalloffMask(int radius) {
+		return stamp_masks.Get({ circle_falloff, radius }, [&](RadialMask& mask) {
+			auto distance = [](int x, int y) {
+				return int32_t((olc::vi2d{0, 0} - olc::vi2d{ x, y }).mag());
+			};
+			mask.Build(radius, 0.0f, [&](int x, int y) {
+				return distance(x, y) <= radius;
+			}, [&](int x, int y) {
+				float mapped = MapValue(float(distance(x, y)), 0.0f, float(radius), 0.0f, 1.0f);
+				// gaussian e^(-x^2)
+				return BrushCurves::GaussianCurve(mapped) - 0.2f;
+			});
+		});
+	}
+
+	// Share of the current value AdjustTerrain_BlendBallFractional keeps per
+	// cell of the brush circle, the rest being the blend
+	const RadialMask& BlendKeepMask() {
+		return stamp_masks.Get({ blend_keep, brush_size }, [&](RadialMask& mask) {
+			double brush_size_squared = brush_size * brush_size;
+			mask.Build(brush_size, 1.0f, [&](int x, int y) {
+				return double(x * x + y * y) < brush_size_squared;
+			}, [&](int x, int y) {
+				float distance_normalised = double(x * x + y * y) / brush_size_squared;
+				return std::max(distance_normalised * 2.0f - 1.0f, 0.0f);
+			});
+		});
+	}
+
+	// The same for AdjustTerrain_BlendBallFractionalFast2, which works in float
+	const RadialMask& BlendKeepMaskFast() {
+		return stamp_masks.Get({ blend_keep_fast, brush_size }, [&](RadialMask& mask) {
+			int brush_size_squared = brush_size * brush_size;
+			mask.Build(brush_size, 1.0f, [&](int x, int y) {
+				return x * x + y * y < brush_size_squared;
+			}, [&](int x, int y) {
+				float distance_normalised = float(x * x + y * y) / float(brush_size_squared);
+				return std::max(distance_normalised * 2.0f - 1.0f, 0.0f);
+			});
+		});
+	}
+
+	// Strength of every ray of the Gauss tools' cone, in CastGaussCone()'s order
+	const std::vector<float>& GaussConeWeights(float cone_angle, float step, int ray_count) {
+		return cone_weights.Get({ gauss_cone, 0, ray_count, cone_angle, step }, [&](std::vector<float>& weights) {
+			weights.resize(ray_count);
+			for (int ray = 0; ray < ray_count; ray++) {
+				// same angle as ConeHit::angle
+				float i = -cone_angle + float(ray) * step;
+				float mapped;
+				if (i < 0) {
+					mapped = MapValue(i, -cone_angle, 0, -1.0f, 0.0f);
+				}
+				else {
+					mapped = MapValue(i, 0, cone_angle, 0.0f, 1.0f);
+				}
+
+				// gaussian e^(-x^2)
+				weights[ray] = BrushCurves::GaussianCurve(mapped) - 0.3f;
+			}
+		});
+	}
+
+	void PaintMouseLocation(olc::vi2d vCell) {
+		int32_t radius = 32;
+		map.FillCircle(vCell, radius, 1.0f);
+		MarkMapDirty(vCell, radius);
+		counters.Add(PerfCounters::cells_written, BrushSquare(radius));
+	}
+
+	// void AdjustTerrain_BlendBallFull(olc::vf2d vCell, olc::vf2d direction){
+    //     double brush_size_squared = brush_size * brush_size;
+    //     // all changes are initially performed into a buffer to prevent the
+    //     // results bleeding into each other
+
+	// 	BlockBuffer<int> buffer{{-brush_size, -brush_size}, {brush_size, brush_size}};
+
+	// 	olc::vf2d ray_start_pos = player_pos;
+	// 	olc::vf2d ray_dir = (mouse_pos - player_pos).norm();
+	// 	olc::vi2d intersection_pos;
+
+	// 	float max_distance = std::min(raycast_max_distance, (mouse_pos - player_pos).mag());
+
+	// 	bool raycast_hit = RaycastPixel(ray_start_pos, ray_dir, max_distance, intersection_pos);
+	// 	if(!raycast_hit){
+	// 		return;
+	// 	}
+
+    //     int tx = intersection_pos.x;
+    //     int ty = intersection_pos.y;
+
+	// 	std::map<int, int> frequency;
+
+    //     for (int x = -brush_size; x <= brush_size; x++) {
+    //         int x0 = x + tx;
+    //         for (int y = -brush_size; y <= brush_size; y++) {
+    //             int y0 = y + ty;
+
+	// 			int currentState;
+	// 			if(!MapLocationIsEmpty(olc::vi2d{x0, y0})){
+	// 				currentState = 1;
+	// 			}
+	// 			else{
+	// 				currentState = 0;
+	// 			}
+
+	// 			if (x * x + y * y >= brush_size_squared) {
+	// 				buffer.set(x, y, currentState);
+	// 				continue;
+	// 			}
+	// 			int highest = 1;
+	// 			int highestState = currentState;
+	// 			frequency.clear();
+	// 			bool tie = false;
+	// 			for (int ox = -blend_range; ox <= blend_range; ox++) {
+	// 				for (int oy = -blend_range; oy <= blend_range; oy++) {
+	// 					int state;
+	// 					if(!MapLocationIsEmpty({x0 + ox, y0 + oy})){
+	// 						state = 1;
+	// 					}
+	// 					else{
+	// 						state = 0;
+	// 					}
+	// 					int count = frequency[state];
+	// 					if (count == 0) {
+	// 						count = 1;
+	// 					} else {
+	// 						count++;
+	// 					}
+	// 					if (count > highest) {
+	// 						highest = count;
+	// 						highestState = state;
+	// 						tie = false;
+	// 					} else if (count == highest) {
+	// 						tie = true;
+	// 					}
+	// 					frequency[state] = count;
+	// 				}
+	// 			}
+	// 			if (!tie && currentState != highestState) {
+	// 				buffer.set(x, y, highestState);
+	// 			}
+    //         }
+    //     }
+
+    //     // apply the buffer to the world
+    //     for (int x = -brush_size; x <= brush_size; x++) {
+    //         int x0 = x + tx;
+    //         for (int y = -brush_size; y <= brush_size; y++) {
+    //             int y0 = y + ty;
+	// 			if(buffer.contains(x, y)){
+	// 				SetColourValue({x0, y0}, (float)buffer.get(x, y));
+	// 			}
+    //         }
+    //     }
+	// }
+
+	// The blend kernels take the curves to ease with as a policy, see BrushCurves.h
+	template <typename Curves = BrushCurves>
+	void AdjustTerrain_BlendBallFractional(olc::vf2d vCell, olc::vf2d direction){
+		olc::vf2d ray_start_pos = player_pos;
+		olc::vf2d ray_dir = (mouse_pos - player_pos).norm();
+		olc::vi2d intersection_pos;
+
+		float max_distance = std::min(raycast_max_distance, (mouse_pos - player_pos).mag());
+
+		bool raycast_hit = RaycastPixel(ray_start_pos, ray_dir, max_distance, intersection_pos);
+		if(!raycast_hit){
+			return;
+		}
+
+		AdjustTerrain_BlendBallFractional<Curves>(intersection_pos);
+	}
+
+	// The blend of the brush circle around centre
+	template <typename Curves = BrushCurves>
+	void AdjustTerrain_BlendBallFractional(olc::vi2d centre){
+		// all changes are initially performed into a buffer to prevent the
+		// results bleeding into each other
+		BlockBuffer<float> buffer{scratch, {-brush_size, -brush_size}, {brush_size, brush_size}};
+
+		int tx = centre.x;
+		int ty = centre.y;
+		const RadialMask& keep = BlendKeepMask();
+
+		// the blend_range neighbourhoods come from the summed-area table, which
+		// still holds the terrain from before this stamp
+		area_sums.Update();
+
+		// tiles run in parallel; the buffer gets the eased average of the cells in the circle
+		brushes.ForEachTile({-brush_size, -brush_size}, {brush_size, brush_size}, [&](olc::vi2d tile_from, olc::vi2d tile_to) {
+			float averages[BrushExecutor::tile_size];
+			for (int y = tile_from.y; y <= tile_to.y; y++) {
+				int span = keep.Span(y);
+				int x_from = std::max(tile_from.x, -span);
+				int x_to = std::min(tile_to.x, span);
+				area_sums.BoxAverageRow({tx + x_from, ty + y}, x_to - x_from + 1, blend_range, averages);
+				for (int x = x_from; x <= x_to; x++) {
+					float average = averages[x - x_from];
+					// NOTE: When using for real thing, check if value needs to be remapped to avoid floating errors
+					average = Curves::EaseInOutCubic(average);
+
+					buffer.set(x, y, average);
+				}
+			}
+		});
+
+		// apply the changes, keeping the share of each cell's value the mask says
+		StampRadialMask<LerpOp>(map, {tx, ty}, keep, [&](int x, int y) { return buffer.get(x, y); });
+
+		MarkMapDirty({tx, ty}, brush_size);
+		// the neighbourhoods come from the summed-area table
+		counters.Add(PerfCounters::cells_read, BrushSquare(brush_size));
+		counters.Add(PerfCounters::cells_written, BrushSquare(brush_size));
+	}
+
+	template <typename Curves = BrushCurves>
+	void AdjustTerrain_BlendBallFractionalFast(){
+	
+		olc::vf2d ray_start_pos = player_pos;
+		olc::vf2d ray_dir = (mouse_pos - player_pos).norm();
+		olc::vi2d intersection_pos;
+
+		float max_distance = std::min(raycast_max_distance, (mouse_pos - player_pos).mag());
+
+		bool raycast_hit = RaycastPixel(ray_start_pos, ray_dir, max_distance, intersection_pos);
+		if(!raycast_hit){
+			return;
+		}
+
+		AdjustTerrain_BlendBallFractionalFast<Curves>(intersection_pos);
+	}
+
+	// The same around centre
+	template <typename Curves = BrushCurves>
+	void AdjustTerrain_BlendBallFractionalFast(olc::vi2d centre){
+		int tx = centre.x;
+		int ty = centre.y;
+	
+		// for distance normalization
+		double brush_size_squared = brush_size * brush_size;
+	
+		// the summed-area table of the terrain is kept up to date across strokes
+		// (https://en.wikipedia.org/wiki/Summed-area_table), so it only has to
+		// catch up with the previous stamps; it still holds the terrain from
+		// before this one while the brush writes into the map
+		area_sums.Update();
+	
+		// apply brush to the brush square (the blend is 0 outside the circle),
+		// tiles in parallel straight into the map
+		map.MaterialiseRect({tx - brush_size, ty - brush_size}, {tx + brush_size, ty + brush_size});
+		brushes.ForEachTile({-brush_size, -brush_size}, {brush_size, brush_size}, [&](olc::vi2d tile_from, olc::vi2d tile_to) {
+			float averages[BrushExecutor::tile_size];
+			for (int dy = tile_from.y; dy <= tile_to.y; ++dy) {
+				int y0 = ty + dy;
+				/* using the summed-area table method, we only need to 
+				   sample 4 points to get the sum of the brush region */
+				area_sums.BoxAverageRow({tx + tile_from.x, y0}, tile_to.x - tile_from.x + 1, blend_range, averages);
+			
+				for (int dx = tile_from.x; dx <= tile_to.x; ++dx) {
+					int x0 = tx + dx;
+				
+					float average = averages[dx - tile_from.x];
+					average = Curves::EaseInOutCubic(average);
+				
+					double distance = dx * dx + dy * dy;
+					float distance_normalised = 1.0 - (distance / brush_size_squared);
+					// distance_normalised = (distance / brush_size_squared);
+					distance_normalised = std::max(distance_normalised * 2.0 - 1.0, 0.0);
+				
+					olc::vi2d pos{x0,y0};
+				
+					float cur_voxel_value = GetColourValue(pos);
+					float new_voxel_value = Lerp(cur_voxel_value, average, distance_normalised);
+					// new_voxel_value = Lerp(average, cur_voxel_value, distance_normalised);
+				
+					SetColourValue(pos, new_voxel_value);
+				}
+			}
+		});
+
+		MarkMapDirty({tx, ty}, brush_size);
+		// the neighbourhoods come from the summed-area table
+		counters.Add(PerfCounters::cells_read, BrushSquare(brush_size));
+		counters.Add(PerfCounters::cells_written, BrushSquare(brush_size));
+	}
+
+	// NOTE: this pre-average method requires less and less iterations after each average
+	// (blend_range > brush_size is among the cases --verify checks, see RunVerification())
+	template <typename Curves = BrushCurves>
+	void AdjustTerrain_BlendBallFractionalFast2(){
+		olc::vf2d ray_start_pos = player_pos;
+		olc::vf2d ray_dir = (mouse_pos - player_pos).norm();
+		olc::vi2d intersection_pos;
+
+		float max_distance = std::min(raycast_max_distance, (mouse_pos - player_pos).mag());
+
+		bool raycast_hit = RaycastPixel(ray_start_pos, ray_dir, max_distance, intersection_pos);
+		if(!raycast_hit){
+			return;
+		}
+
+		AdjustTerrain_BlendBallFractionalFast2<Curves>(&intersection_pos, 1);
+	}
+
+	// Blends the brush circles around count centres in one pass: the union of
+	// their squares is blurred once and every cell is written once, instead of
+	// each stamp re-reading what the previous one wrote. Where circles overlap a
+	// cell takes the strongest blend of them rather than the blends chained.
+	template <typename Curves = BrushCurves>
+	void AdjustTerrain_BlendBallFractionalFast2(const olc::vi2d* centres, int count){
+		if (count <= 0) {
+			return;
+		}
+		if (use_gpu_blend && BlendOnGpu(centres, count)) {
+			return;
+		}
+
+		olc::vi2d from = centres[0];
+		olc::vi2d to = centres[0];
+		for (int i = 1; i < count; i++) {
+			from = from.min(centres[i]);
+			to = to.max(centres[i]);
+		}
+		from -= olc::vi2d{ brush_size, brush_size };
+		to += olc::vi2d{ brush_size, brush_size };
+		olc::vi2d size = to - from + olc::vi2d{ 1, 1 };
+		olc::vi2d source_size = size + olc::vi2d{ 2 * blend_range, 2 * blend_range };
+
+		if (std::is_same<Curves, BrushCurves>::value && use_progressive_blend && source_size.x * source_size.y >= progressive_cells) {
+			BlendProgressively(centres, count, from, size);
+			return;
+		}
+
+		// x then y blur of the union square; all changes are initially performed
+		// into the blur buffers to prevent the results bleeding into each other
+		blend_blur.Resize(size, blend_range);
+		map.ReadRect(from - olc::vi2d{ blend_range, blend_range }, size + olc::vi2d{ 2 * blend_range, 2 * blend_range },
+			blend_blur.SourceData(), blend_blur.SourceXStride(), 1);
+		blend_blur.Run(brushes.Pool());
+
+		blend_current.resize(size_t(size.x) * size.y + simd::width);
+		map.ReadRect(from, size, blend_current.data(), 1, size.x);
+
+		// processing and pasting result, rows in parallel straight into the map;
+		// a row first gathers how much of the current value every stamp keeps
+		const RadialMask& keep_mask = BlendKeepMaskFast();
+		blend_rows.resize(brushes.Pool().ThreadCount());
+		map.MaterialiseRect(from, to);
+		brushes.Pool().ParallelFor(size.y, [&](int row, int worker) {
+			int y0 = from.y + row;
+			std::vector<float>& keep = blend_rows[worker];
+			keep.assign(size_t(size.x) + simd::width, 1.0f);
+			int row_from = size.x;
+			int row_to = -1;
+			GatherBlendKeep(keep_mask, centres, count, from, y0, keep.data(), row_from, row_to);
+			if (row_to < row_from) {
+				return;
+			}
+
+			const float* averages = blend_blur.ResultRow(row);
+			const float* current = blend_current.data() + size_t(row) * size.x;
+			for (int i = row_from; i <= row_to; i += simd::width) {
+				simd::Float average = Curves::EaseInOutCubic(simd::Load(averages + i));
+				simd::Float curr_voxel_value = simd::Load(current + i);
+				simd::Float kept = simd::Min(simd::Load(keep.data() + i), simd::Set1(1.0f));
+				simd::Store(keep.data() + i, Lerp(average, curr_voxel_value, kept));
+			}
+
+			map.WriteSpan(from.x + row_from, y0, keep.data() + row_from, row_to - row_from + 1);
+		});
+
+		map.MarkDirty(from, to);
+		counters.Add(PerfCounters::cells_read, uint64_t(source_size.x) * source_size.y + uint64_t(size.x) * size.y);
+		counters.Add(PerfCounters::cells_written, uint64_t(size.x) * size.y);
+	}
+
+	// Lowers keep (cells from from.x of row y0) to the least share of its value
+	// any of the count stamps lets a cell keep, widening row_from..row_to to the
+	// cells they cover
+	void GatherBlendKeep(const RadialMask& keep_mask, const olc::vi2d* centres, int count, olc::vi2d from, int y0, float* keep, int& row_from, int& row_to) {
+		for (int stamp = 0; stamp < count; stamp++) {
+			int y = y0 - centres[stamp].y;
+			if (std::abs(y) > brush_size || keep_mask.Span(y) < 0) {
+				continue;
+			}
+			int span_half = keep_mask.Span(y);
+			const float* weights = keep_mask.Row(y) - span_half;
+
+			int first = centres[stamp].x - span_half - from.x;
+			int span_count = 2 * span_half + 1;
+			row_from = std::min(row_from, first);
+			row_to = std::max(row_to, first + span_count - 1);
+
+			// lanes past the span read the mask's padding, which keeps everything
+			for (int i = 0; i < span_count; i += simd::width) {
+				simd::Store(keep + first + i, simd::Min(simd::Load(keep + first + i), simd::Load(weights + i)));
+			}
+		}
+	}
+
+	// AdjustTerrain_BlendBallFractionalFast2() as a preview now and the full
+	// blend over the next frames, see ProgressiveBlend.h
+	void BlendProgressively(const olc::vi2d* centres, int count, olc::vi2d from, olc::vi2d size) {
+		const RadialMask& keep_mask = BlendKeepMaskFast();
+		progressive_blend.Start(map, from, size, blend_range, brushes.Pool(), [&](int row, float* keep, int& row_from, int& row_to) {
+			GatherBlendKeep(keep_mask, centres, count, from, from.y + row, keep, row_from, row_to);
+		});
+		// the preview's reads and writes; the refinement reads what was read here
+		olc::vi2d source_size = size + olc::vi2d{ 2 * blend_range, 2 * blend_range };
+		counters.Add(PerfCounters::cells_read, uint64_t(source_size.x) * source_size.y + uint64_t(size.x) * size.y);
+		counters.Add(PerfCounters::cells_written, uint64_t(size.x) * size.y);
+	}
+
+	// AdjustTerrain_BlendBallFractionalFast2() on the GPU; its cells land in the
+	// map at the next ResolveGpuBlend(). False if the GPU can't take this batch.
+	bool BlendOnGpu(const olc::vi2d* centres, int count) {
+		if (!gpu_blend.IsReady() || count > GpuBlendBrush::max_centres) {
+			return false;
+		}
+		// the source has to include what a previous batch wrote
+		ResolveGpuBlend();
+
+		olc::vi2d from = centres[0];
+		olc::vi2d to = centres[0];
+		for (int i = 1; i < count; i++) {
+			from = from.min(centres[i]);
+			to = to.max(centres[i]);
+		}
+		from -= olc::vi2d{ brush_size, brush_size };
+		to += olc::vi2d{ brush_size, brush_size };
+		olc::vi2d size = to - from + olc::vi2d{ 1, 1 };
+
+		olc::vi2d source_size = size + olc::vi2d{ 2 * blend_range, 2 * blend_range };
+		float* source = scratch.Allocate<float>(size_t(source_size.x) * source_size.y);
+		map.ReadRect(from - olc::vi2d{ blend_range, blend_range }, source_size, source, 1, source_size.x);
+		uint64_t source_cells = uint64_t(source_size.x) * source_size.y;
+		counters.Add(PerfCounters::cells_read, source_cells);
+		counters.Add(PerfCounters::bytes_uploaded, source_cells * sizeof(float));
+		return gpu_blend.Submit(source, from, size, blend_range, brush_size, centres, count);
+	}
+
+	// Refines what the progressive blend has left, before an edit it can't follow
+	void FinishBlends() {
+		CountRefined(progressive_blend.Finish(map, brushes.Pool()));
+	}
+
+	void CountRefined(size_t cells) {
+		counters.Add(PerfCounters::cells_read, cells);
+		counters.Add(PerfCounters::cells_written, cells);
+	}
+
+	void ResolveGpuBlend() {
+		gpu_blend.Resolve([&](const float* cells, olc::vi2d from, olc::vi2d size) {
+			for (int row = 0; row < size.y; row++) {
+				map.WriteSpan(from.x, from.y + row, cells + size_t(row) * size.x, size.x);
+			}
+			map.MarkDirty(from, from + size - olc::vi2d{ 1, 1 });
+			counters.Add(PerfCounters::cells_written, uint64_t(size.x) * size.y);
+		});
+	}
+
+	// 230 -> 35
+	/*void AdjustTerrain_BlendBallFractionalFast(olc::vf2d vCell, olc::vf2d direction){
+		double brush_size_squared = brush_size * brush_size;
+
+		// all changes are initially performed into a buffer to prevent the
+		// results bleeding into each other
+		BlockBuffer<float> buffer{scratch, {-brush_size, -brush_size}, {brush_size, brush_size}};
+
+		olc::vf2d ray_start_pos = player_pos;
+		olc::vf2d ray_dir = (mouse_pos - player_pos).norm();
+		olc::vi2d intersection_pos;
+
+		float max_distance = std::min(raycast_max_distance, (mouse_pos - player_pos).mag());
+
+		bool raycast_hit = RaycastPixel(ray_start_pos, ray_dir, max_distance, intersection_pos);
+		if(!raycast_hit){
+			return;
+		}
+
+		int tx = intersection_pos.x;
+		int ty = intersection_pos.y;
+
+		// Optimised version doesn't fully average corners, but we calculate if we need to increase brush size to accomdate this.
+		int extra_iterations = 0;
+		if(blend_range + M_PI_4 >= brush_size){
+			extra_iterations = std::ceil(blend_range + M_PI_4 - brush_size);
+		}
+
+		int adjusted_brush_size = brush_size + extra_iterations;
+		for (int x = -adjusted_brush_size; x <= adjusted_brush_size; x++) {
+			int x0 = x + tx;
+			for (int y = -adjusted_brush_size; y <= adjusted_brush_size; y++) {
+				int y0 = y + ty;
+
+				float max_sum_weighted = 0.0f;
+				float colour_sum_weighted = 0.0f;
+
+				for (int ox = -blend_range; ox <= blend_range; ox++) {
+					for (int oy = -blend_range; oy <= blend_range; oy++) {
+						olc::vi2d pos{x0 + ox, y0 + oy};
+
+						max_sum_weighted += 1;
+						colour_sum_weighted += GetColourValue(pos);
+					}
+				}
+
+				float average = colour_sum_weighted / max_sum_weighted;
+				// NOTE: When using for real thing, check if value needs to be remapped to avoid floating errors
+				average = EaseInOutCubic(average);
+
+				float curr_voxel_value = GetColourValue({x0, y0});
+				
+				float distance_normalised = distance / brush_size_squared;
+				distance_normalised = std::max(distance_normalised * 2.0f - 1.0f, 0.0f);
+				float new_voxel_value = curr_voxel_value * distance_normalised + average * (1 - distance_normalised);
+
+				buffer.set(x, y, new_voxel_value);
+			}
+		}
+
+		for (int x = -brush_size; x <= brush_size; x++) {
+			int x0 = x + tx;
+			for (int y = -brush_size; y <= brush_size; y++) {
+				int y0 = y + ty;
+				double distance = x * x + y * y;
+				if (distance >= brush_size_squared) {
+					buffer.set(x, y, GetColourValue({x0, y0}));
+					continue;
+				}
+				float max_sum_weighted = 0.0f;
+				float colour_sum_weighted = 0.0f;
+
+				for (int ox = -blend_range; ox <= blend_range; ox++) {
+					for (int oy = -blend_range; oy <= blend_range; oy++) {
+						olc::vi2d pos{x0 + ox, y0 + oy};
+
+						max_sum_weighted += 1;
+						colour_sum_weighted += GetColourValue(pos);
+					}
+				}
+
+				float average = colour_sum_weighted / max_sum_weighted;
+				// NOTE: When using for real thing, check if value needs to be remapped to avoid floating errors
+				average = EaseInOutCubic(average);
+
+				float curr_voxel_value = GetColourValue({x0, y0});
+				
+				float distance_normalised = distance / brush_size_squared;
+				distance_normalised = std::max(distance_normalised * 2.0f - 1.0f, 0.0f);
+				float new_voxel_value = curr_voxel_value * distance_normalised + average * (1 - distance_normalised);
+
+				buffer.set(x, y, new_voxel_value);
+			}
+		}
+
+		// apply the changes
+		for (int x = -brush_size; x <= brush_size; x++) {
+			int x0 = x + tx;
+			for (int y = -brush_size; y <= brush_size; y++) {
+				int y0 = y + ty;
+				SetColourValue({x0, y0}, buffer.get(x, y));
+			}
+		}
+	}*/
+
+	void DestructTerrain_CircleFull(olc::vf2d vCell, olc::vf2d direction) {
+		int32_t radius = brush_size;
+		olc::vf2d size = { float(radius), float(radius) };
+		olc::vf2d pos = vCell;
+
+		pos -= direction * (float(radius) - 2.0f);
+
+		map.FillCircle(pos, radius, 0.0f);
+		MarkMapDirty(pos, radius);
+		counters.Add(PerfCounters::cells_written, BrushSquare(radius));
+	}
+
+	void DestructTerrain_CircleFractional(olc::vf2d vCell, olc::vf2d direction) {
+		int32_t radius = brush_size;
+		olc::vf2d pos = vCell;
+
+		pos -= direction * ((float)radius - 2.0f);
+
+		// tiles in parallel straight into the map; the offsets are taken from the
+		// floored centre so that no two of them land on the same cell
+		olc::vi2d centre = pos.floor();
+		const RadialMask& falloff = CircleFalloffMask(radius);
+		map.MaterialiseRect(centre - olc::vi2d{radius, radius}, centre + olc::vi2d{radius, radius});
+		brushes.ForEachTile({-radius, -radius}, {radius, radius}, [&](olc::vi2d tile_from, olc::vi2d tile_to) {
+			StampRadialMask<SubtractOp>(map, centre, falloff, tile_from, tile_to, [](int, int) { return 0.0f; });
+		});
+
+		// exactly the cells written, the rect materialised above
+		MarkMapDirty(centre, radius);
+		counters.Add(PerfCounters::cells_read, BrushSquare(radius));
+		counters.Add(PerfCounters::cells_written, BrushSquare(radius));
+	}
+
+	void DestructTerrain_GaussFractional(olc::vf2d vCell, olc::vf2d direction) {
+		olc::vi2d last_raycast_hit_pos;
+
+		olc::vf2d ray_start_pos = player_pos;
+		olc::vf2d ray_dir = (mouse_pos - player_pos).norm();
+
+		float max_distance = std::min(raycast_max_distance, (mouse_pos - player_pos).mag());
+		float cone_angle = terraform_angle;
+		float step = terraform_raycast_step;
+
+		// all rays are cast before any of them edits the map
+		const std::vector<ConeHit>& hits = CastGaussCone(ray_start_pos, ray_dir, max_distance, cone_angle, step);
+		const std::vector<float>& weights = GaussConeWeights(cone_angle, step, int(hits.size()));
+		for (size_t ray = 0; ray < hits.size(); ray++) {
+			const ConeHit& hit = hits[ray];
+			if (hit.hit == false) {
+				continue;
+			}
+
+			olc::vi2d intersection_pos = hit.cell;
+			last_raycast_hit_pos = intersection_pos;
+
+			float value = weights[ray];
+
+			SubtractValueFromColour(intersection_pos, value);
+			MarkMapDirty(intersection_pos, 0);
+			counters.Add(PerfCounters::cells_read);
+			counters.Add(PerfCounters::cells_written);
+		}
+
+		/*for each point on curve
+			pixel = Position2D(point)
+			pixel.rate = easing_function(distance(point, origin))
+			dir = normalize(point - origin) * step_factor
+
+			for i in (0, some_limit)
+				pixel = Position2D(point + dir * i)
+				pixel.rate = easing_function(distance(origin, point + dir * i))*/
+	}
+
+	void RestoreTerrain_GaussFractional(olc::vf2d vCell, olc::vf2d direction) {
+		olc::vi2d last_raycast_hit_pos;
+
+		olc::vf2d ray_start_pos = player_pos;
+		olc::vf2d ray_dir = (mouse_pos - player_pos).norm();
+
+		float max_distance = std::min(raycast_max_distance, (mouse_pos - player_pos).mag());
+		float cone_angle = terraform_angle;
+		float step = terraform_raycast_step;
+
+		// all rays are cast before any of them edits the map
+		const std::vector<ConeHit>& hits = CastGaussCone(ray_start_pos, ray_dir, max_distance, cone_angle, step);
+		const std::vector<float>& weights = GaussConeWeights(cone_angle, step, int(hits.size()));
+		for (size_t ray = 0; ray < hits.size(); ray++) {
+			const ConeHit& hit = hits[ray];
+			if (hit.hit == false) {
+				continue;
+			}
+
+			// same as RaycastPrePixel
+			olc::vi2d intersection_pos = MapLocationIsFull(hit.cell) ? hit.previous_cell : hit.cell;
+			last_raycast_hit_pos = intersection_pos;
+
+			float value = weights[ray];
+
+			AddValueToColour(intersection_pos, value);
+			MarkMapDirty(intersection_pos, 0);
+			counters.Add(PerfCounters::cells_read);
+			counters.Add(PerfCounters::cells_written);
+		}
+
+		/*for each point on curve
+			pixel = Position2D(point)
+			pixel.rate = easing_function(distance(point, origin))
+			dir = normalize(point - origin) * step_factor
+
+			for i in (0, some_limit)
+				pixel = Position2D(point + dir * i)
+				pixel.rate = easing_function(distance(origin, point + dir * i))*/
+	}
+
+
+	bool MapLocationIsEmpty(olc::vi2d pos) {
+		return map.GetCell(pos.x, pos.y) == 0;
+	}
+
+	bool MapLocationIsFull(olc::vi2d pos) {
+		return map.GetCell(pos.x, pos.y) == DensityTraits<TerrainCell>::max_value;
+	}
+
+	void SubtractValueFromColour(olc::vi2d pos, float fraction) {
+		map.Set(pos, map.Get(pos) - fraction);
+	}
+
+	void AddValueToColour(olc::vi2d pos, float fraction) {
+		map.Set(pos, map.Get(pos) + fraction);
+	}
+
+	void SetColourValue(olc::vi2d pos, float fraction) {
+		map.Set(pos, fraction);
+	}
+
+	float GetColourValue(olc::vi2d pos) {
+		return map.Get(pos);
+	}
+
+	// square of cells around centre that an edit may have changed
+	void MarkMapDirty(olc::vi2d centre, int radius) {
+		map.MarkDirty(centre - olc::vi2d{ radius, radius }, centre + olc::vi2d{ radius, radius });
+	}
+
+	olc::vf2d RotateVector(olc::vf2d vec, float radians) {
+		olc::vf2d result;
+		result.x = vec.x * std::cos(radians) + vec.y * std::sin(radians);
+		result.y = vec.x * -std::sin(radians) + vec.y * std::cos(radians);
+		return result;
+	}
+
+	float AngleToRadians(float angle) {
+		return angle * float(M_PI) / 180.0f;
+	}
+
+	float MapValue(float value, float in_min, float in_max, float out_min, float out_max) {
+		return (value - in_min) * (out_max - out_min) / (in_max - in_min) + out_min;
+	}
+
+	float EaseInOutSine(float x) {
+		return -(cos(M_PI * x) - 1.0) / 2.0;
+	}
+
+	float Lerp(float from, float to, float t) {
+		return from * (1 - t) + to * t;
+	}
+
+	// simd::width lanes of the one above at once
+	simd::Float Lerp(simd::Float from, simd::Float to, simd::Float t) {
+		return from * (simd::Set1(1.0f) - t) + to * t;
+	}
+};
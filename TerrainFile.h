@@ -0,0 +1,605 @@
+#pragma once
+
+#include "ChunkedDensityField.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#if defined(_WIN32)
+	#if !defined(NOMINMAX)
+		#define NOMINMAX
+	#endif
+	#include <windows.h>
+#else
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif
+
+// Read only mapping of a whole file. Pages are only read from disk once they
+// are touched, so opening a large file costs next to nothing.
+class MappedFile{
+	const uint8_t* data = nullptr;
+	size_t size = 0;
+
+public:
+	MappedFile() = default;
+	~MappedFile(){
+		Close();
+	}
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	bool Open(const std::string& path){
+		Close();
+#if defined(_WIN32)
+		// shared for writing so the terrain file can be saved into while mapped
+		HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+			OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file == INVALID_HANDLE_VALUE) {
+			return false;
+		}
+		LARGE_INTEGER file_size;
+		if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) {
+			CloseHandle(file);
+			return false;
+		}
+		HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		CloseHandle(file);
+		if (mapping == nullptr) {
+			return false;
+		}
+		// the view keeps the mapping alive
+		data = static_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+		CloseHandle(mapping);
+		if (data == nullptr) {
+			return false;
+		}
+		size = size_t(file_size.QuadPart);
+#else
+		int file = open(path.c_str(), O_RDONLY);
+		if (file < 0) {
+			return false;
+		}
+		struct stat info;
+		if (fstat(file, &info) != 0 || info.st_size == 0) {
+			close(file);
+			return false;
+		}
+		void* view = mmap(nullptr, size_t(info.st_size), PROT_READ, MAP_SHARED, file, 0);
+		// the mapping keeps the file alive
+		close(file);
+		if (view == MAP_FAILED) {
+			return false;
+		}
+		data = static_cast<const uint8_t*>(view);
+		size = size_t(info.st_size);
+#endif
+		return true;
+	}
+
+	void Close(){
+		if (data == nullptr) {
+			return;
+		}
+#if defined(_WIN32)
+		UnmapViewOfFile(data);
+#else
+		munmap(const_cast<uint8_t*>(data), size);
+#endif
+		data = nullptr;
+		size = 0;
+	}
+
+	bool IsOpen() const{
+		return data != nullptr;
+	}
+	const uint8_t* Data() const{
+		return data;
+	}
+	size_t Size() const{
+		return size;
+	}
+};
+
+// Native terrain file: a header, an index with one entry per chunk and then the
+// payloads of the chunks that aren't uniform, either raw cells or run length
+// encoded, whichever is smaller. Everything is in the byte order of the
+// machine that wrote it, which byte_order lets a reader check.
+struct TerrainFileHeader{
+	static constexpr char expected_magic[8] = { '2', 'D', 'T', 'E', 'R', 'R', 'A', 'N' };
+	static constexpr uint32_t current_version = 1;
+	static constexpr uint32_t native_byte_order = 0x01020304;
+
+	char magic[8] = {};
+	uint32_t version = 0;
+	uint32_t byte_order = 0;
+	uint32_t cell_bytes = 0;
+	int32_t width = 0;
+	int32_t height = 0;
+	int32_t chunk_size_log2 = 0;
+	int32_t chunks_x = 0;
+	int32_t chunks_y = 0;
+	uint32_t reserved[2] = {};
+
+	bool IsValid() const{
+		return std::memcmp(magic, expected_magic, sizeof(magic)) == 0 && version == current_version && byte_order == native_byte_order
+			&& width > 0 && height > 0 && chunk_size_log2 > 0 && chunk_size_log2 < 16
+			&& chunks_x == (width + (1 << chunk_size_log2) - 1) >> chunk_size_log2
+			&& chunks_y == (height + (1 << chunk_size_log2) - 1) >> chunk_size_log2;
+	}
+};
+static_assert(sizeof(TerrainFileHeader) == 48, "terrain file header layout");
+
+// Index entry of one chunk, in row order of the chunk grid right after the header
+struct TerrainFileChunk{
+	enum Encoding : uint32_t{
+		uniform = 0,
+		raw = 1,
+		run_length = 2,
+	};
+
+	// payload, or 0 for a uniform chunk that never had one
+	uint64_t offset = 0;
+	uint32_t size = 0;
+	// bytes reserved at offset, so a payload that shrank is rewritten in place
+	uint32_t capacity = 0;
+	uint32_t encoding = uniform;
+	// cell value of a uniform chunk; for the others their mean, which stands in
+	// for the cells until they are read
+	uint32_t uniform_value = 0;
+};
+static_assert(sizeof(TerrainFileChunk) == 24, "terrain file index layout");
+
+// Header of the terrain file at path; false if it can't be read or isn't one
+inline bool ReadTerrainFileHeader(const std::string& path, TerrainFileHeader& header){
+	std::ifstream in(path, std::ios::binary);
+	return in.read(reinterpret_cast<char*>(&header), sizeof(header)) && header.IsValid();
+}
+
+// Keeps a ChunkedDensityField backed by a terrain file. Open() maps the file and
+// Attach() only takes the uniform chunks from the index; every other chunk
+// stays in the file until Fetch() asks for an area covering it, so nothing but
+// the index is read up front. Save() writes back only the chunks written since
+// the last save, in place where they still fit and appended otherwise. Until
+// a chunk is read it shows the mean of its cells, and Evict() takes an unedited
+// chunk back to that to free its cells.
+//
+// Cells have to be fetched before they are edited: a chunk written while still
+// pending keeps what was written and drops the rest of its file contents.
+template <typename Field>
+class TerrainFile{
+	using T = typename Field::cell_type;
+	using Block = typename Field::Block;
+	static constexpr int chunk_size = Field::chunk_size;
+	static constexpr size_t chunk_cells = size_t(chunk_size) * chunk_size;
+	// run lengths are stored as 16 bits
+	static_assert(chunk_cells <= 65535, "chunk too large for the run length encoding");
+	static_assert(sizeof(T) <= sizeof(uint32_t), "uniform value must fit the index");
+
+	struct Run{
+		uint16_t length;
+		T value;
+	};
+
+	std::string path;
+	MappedFile mapping;
+	TerrainFileHeader header;
+	std::vector<TerrainFileChunk> index;
+	// 1 while a chunk's cells are only in the file
+	std::vector<uint8_t> pending;
+	size_t pending_count = 0;
+	uint64_t end_of_file = 0;
+
+	Field* field = nullptr;
+	ChunkDirtyTracker dirty;
+	std::vector<uint8_t> encoded;
+
+	static uint64_t IndexOffset(){
+		return sizeof(TerrainFileHeader);
+	}
+
+	// the bits of a cell, so float cells survive the trip too
+	static uint32_t CellBits(T value){
+		uint32_t bits = 0;
+		std::memcpy(&bits, &value, sizeof(T));
+		return bits;
+	}
+	static T CellFromBits(uint32_t bits){
+		T value;
+		std::memcpy(&value, &bits, sizeof(T));
+		return value;
+	}
+
+	// payload of chunk_index into encoded, or false if the chunk is uniform
+	bool Encode(int chunk_index, TerrainFileChunk& entry){
+		const typename Field::Chunk& chunk = field->GetChunk(chunk_index % header.chunks_x, chunk_index / header.chunks_x);
+		entry.size = 0;
+		if (chunk.IsUniform()) {
+			entry.encoding = TerrainFileChunk::uniform;
+			entry.uniform_value = CellBits(chunk.uniform_value);
+			return false;
+		}
+
+		olc::vi2d extent = field->ChunkExtent(chunk_index % header.chunks_x, chunk_index / header.chunks_x);
+		float sum = 0.0f;
+		for (int y = 0; y < extent.y; y++) {
+			const T* row = chunk.cells->Row(y);
+			for (int x = 0; x < extent.x; x++) {
+				sum += Field::traits::ToFloat(row[x]);
+			}
+		}
+		entry.uniform_value = CellBits(Field::traits::FromFloat(sum / float(extent.x * extent.y)));
+
+		const T* cells = chunk.cells->Row(0);
+		encoded.clear();
+		for (size_t i = 0; i < chunk_cells && encoded.size() < chunk_cells * sizeof(T);) {
+			size_t run_end = i + 1;
+			while (run_end < chunk_cells && cells[run_end] == cells[i]) {
+				run_end++;
+			}
+			Run run{ uint16_t(run_end - i), cells[i] };
+			const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&run);
+			encoded.insert(encoded.end(), bytes, bytes + sizeof(Run));
+			i = run_end;
+		}
+
+		if (encoded.size() < chunk_cells * sizeof(T)) {
+			entry.encoding = TerrainFileChunk::run_length;
+		}
+		else {
+			entry.encoding = TerrainFileChunk::raw;
+			const uint8_t* bytes = reinterpret_cast<const uint8_t*>(cells);
+			encoded.assign(bytes, bytes + chunk_cells * sizeof(T));
+		}
+		entry.size = uint32_t(encoded.size());
+		return true;
+	}
+
+	bool DecodeEntry(const TerrainFileChunk& entry, Block& block) const{
+		const uint8_t* payload = mapping.Data() + entry.offset;
+		T* cells = block.Row(0);
+		if (entry.encoding == TerrainFileChunk::raw) {
+			std::memcpy(cells, payload, chunk_cells * sizeof(T));
+			return true;
+		}
+
+		size_t cell = 0;
+		for (size_t at = 0; at + sizeof(Run) <= entry.size; at += sizeof(Run)) {
+			Run run;
+			std::memcpy(&run, payload + at, sizeof(Run));
+			if (cell + run.length > chunk_cells) {
+				return false;
+			}
+			std::fill(cells + cell, cells + cell + run.length, run.value);
+			cell += run.length;
+		}
+		return cell == chunk_cells;
+	}
+
+	bool ReadIndex(){
+		header = TerrainFileHeader{};
+		if (mapping.Size() < sizeof(header)) {
+			return false;
+		}
+		std::memcpy(&header, mapping.Data(), sizeof(header));
+		if (!header.IsValid() || header.cell_bytes != sizeof(T) || header.chunk_size_log2 != Field::chunk_size_log2) {
+			return false;
+		}
+
+		size_t chunk_count = size_t(header.chunks_x) * header.chunks_y;
+		if (mapping.Size() < IndexOffset() + chunk_count * sizeof(TerrainFileChunk)) {
+			return false;
+		}
+		index.resize(chunk_count);
+		std::memcpy(index.data(), mapping.Data() + IndexOffset(), chunk_count * sizeof(TerrainFileChunk));
+
+		end_of_file = mapping.Size();
+		pending.assign(chunk_count, 0);
+		pending_count = 0;
+		for (size_t i = 0; i < chunk_count; i++) {
+			const TerrainFileChunk& entry = index[i];
+			if (entry.offset + entry.capacity > mapping.Size() || entry.size > entry.capacity) {
+				return false;
+			}
+			if (entry.encoding == TerrainFileChunk::raw && entry.size != chunk_cells * sizeof(T)) {
+				return false;
+			}
+			if (entry.encoding != TerrainFileChunk::uniform) {
+				pending[i] = 1;
+				pending_count++;
+			}
+		}
+		return true;
+	}
+
+	void Track(Field& field){
+		if (this->field != &field) {
+			Detach();
+			this->field = &field;
+			field.AddDirtyTracker(&dirty);
+		}
+	}
+
+public:
+	TerrainFile() = default;
+	~TerrainFile(){
+		Detach();
+	}
+
+	TerrainFile(const TerrainFile&) = delete;
+	TerrainFile& operator=(const TerrainFile&) = delete;
+
+	// Maps the file and reads its index; false if it isn't a terrain file of this cell type
+	bool Open(const std::string& path){
+		Detach();
+		this->path = path;
+		if (!mapping.Open(path) || !ReadIndex()) {
+			mapping.Close();
+			index.clear();
+			pending.clear();
+			pending_count = 0;
+			return false;
+		}
+		return true;
+	}
+
+	bool IsOpen() const{
+		return mapping.IsOpen();
+	}
+	const std::string& Path() const{
+		return path;
+	}
+	olc::vi2d Size() const{
+		return { header.width, header.height };
+	}
+	size_t PendingChunks() const{
+		return pending_count;
+	}
+
+	int ChunkCount() const{
+		return int(index.size());
+	}
+	bool IsPending(int chunk_index) const{
+		return pending[chunk_index] != 0;
+	}
+
+	// Makes field (of Size()) show the opened file: uniform chunks are set from
+	// the index, the others hold their mean until fetched
+	bool Attach(Field& field){
+		if (!IsOpen() || field.Size() != Size()) {
+			return false;
+		}
+		for (size_t i = 0; i < index.size(); i++) {
+			typename Field::Chunk& chunk = field.GetChunk(int(i) % header.chunks_x, int(i) / header.chunks_x);
+			chunk.cells.reset();
+			chunk.uniform_value = CellFromBits(index[i].uniform_value);
+		}
+		Track(field);
+		field.MarkDirty({ 0, 0 }, Size() - olc::vi2d{ 1, 1 }, &dirty);
+		// whatever happened to the field before is overwritten
+		dirty.Consume([](int, int, olc::vi2d, olc::vi2d){});
+		return true;
+	}
+
+	void Detach(){
+		if (field) {
+			field->RemoveDirtyTracker(&dirty);
+			field = nullptr;
+		}
+	}
+
+	// Reads the cells of a pending chunk from the file. Only looks at the mapping
+	// and the chunk's index entry, so it may run on another thread as long as
+	// nothing saves meanwhile.
+	bool Decode(int chunk_index, Block& block) const{
+		return DecodeEntry(index[chunk_index], block);
+	}
+
+	// Gives a pending chunk the cells Decode() read for it; false if the chunk
+	// isn't pending anymore, and when it was written over while it was
+	bool Install(int chunk_index, std::unique_ptr<Block> block){
+		if (!field || !pending[chunk_index]) {
+			return false;
+		}
+		pending[chunk_index] = 0;
+		pending_count--;
+
+		int chunk_x = chunk_index % header.chunks_x;
+		int chunk_y = chunk_index / header.chunks_x;
+		if (dirty.IsDirty(chunk_x, chunk_y)) {
+			return false;
+		}
+		typename Field::Chunk& chunk = field->GetChunk(chunk_x, chunk_y);
+		chunk.cells = std::move(block);
+
+		olc::vi2d origin = field->ChunkOrigin(chunk_x, chunk_y);
+		field->MarkDirty(origin, origin + field->ChunkExtent(chunk_x, chunk_y) - olc::vi2d{ 1, 1 }, &dirty);
+		return true;
+	}
+
+	// Drops the cells of a chunk that are the same as in the file, leaving its
+	// mean in their place until it is fetched again. False for chunks with
+	// edits not saved yet, and for those with nothing in the file to go back to.
+	bool Evict(int chunk_index){
+		if (!field) {
+			return false;
+		}
+		int chunk_x = chunk_index % header.chunks_x;
+		int chunk_y = chunk_index / header.chunks_x;
+		const TerrainFileChunk& entry = index[chunk_index];
+		typename Field::Chunk& chunk = field->GetChunk(chunk_x, chunk_y);
+		if (pending[chunk_index] || chunk.IsUniform() || dirty.IsDirty(chunk_x, chunk_y)
+			|| entry.encoding == TerrainFileChunk::uniform || entry.offset + entry.size > mapping.Size()) {
+			return false;
+		}
+
+		chunk.cells.reset();
+		chunk.uniform_value = CellFromBits(entry.uniform_value);
+		pending[chunk_index] = 1;
+		pending_count++;
+
+		olc::vi2d origin = field->ChunkOrigin(chunk_x, chunk_y);
+		field->MarkDirty(origin, origin + field->ChunkExtent(chunk_x, chunk_y) - olc::vi2d{ 1, 1 }, &dirty);
+		return true;
+	}
+
+	// Reads the pending chunks overlapping from..to (inclusive, clipped) from the file
+	void Fetch(olc::vi2d from, olc::vi2d to){
+		if (!field || pending_count == 0) {
+			return;
+		}
+		from = from.max({ 0, 0 });
+		to = to.min(Size() - olc::vi2d{ 1, 1 });
+		if (from.x > to.x || from.y > to.y) {
+			return;
+		}
+
+		for (int chunk_y = from.y >> Field::chunk_size_log2; chunk_y <= to.y >> Field::chunk_size_log2; chunk_y++) {
+			for (int chunk_x = from.x >> Field::chunk_size_log2; chunk_x <= to.x >> Field::chunk_size_log2; chunk_x++) {
+				int chunk_index = chunk_y * header.chunks_x + chunk_x;
+				if (!pending[chunk_index]) {
+					continue;
+				}
+				auto block = std::make_unique<Block>(chunk_size, chunk_size);
+				if (Decode(chunk_index, *block)) {
+					Install(chunk_index, std::move(block));
+				}
+			}
+		}
+	}
+
+	// Writes the chunks of the attached field edited since they were loaded or
+	// last saved back into the file
+	bool Save(){
+		if (!field || !IsOpen()) {
+			return false;
+		}
+		std::vector<int> chunks;
+		dirty.Consume([&](int chunk_x, int chunk_y, olc::vi2d, olc::vi2d){
+			chunks.push_back(chunk_y * header.chunks_x + chunk_x);
+		});
+		if (chunks.empty()) {
+			return true;
+		}
+
+		std::fstream out(path, std::ios::in | std::ios::out | std::ios::binary);
+		for (int chunk_index : chunks) {
+			if (!out) {
+				break;
+			}
+			TerrainFileChunk& entry = index[chunk_index];
+			if (pending[chunk_index]) {
+				// the field holds what was written over it
+				pending[chunk_index] = 0;
+				pending_count--;
+			}
+			if (!Encode(chunk_index, entry)) {
+				continue;
+			}
+			if (entry.size > entry.capacity) {
+				entry.offset = end_of_file;
+				entry.capacity = entry.size;
+				end_of_file += entry.size;
+			}
+			out.seekp(std::streamoff(entry.offset));
+			out.write(reinterpret_cast<const char*>(encoded.data()), std::streamsize(encoded.size()));
+		}
+		out.seekp(std::streamoff(IndexOffset()));
+		out.write(reinterpret_cast<const char*>(index.data()), std::streamsize(index.size() * sizeof(TerrainFileChunk)));
+		out.flush();
+
+		if (!out) {
+			// try these again next time
+			for (int chunk_index : chunks) {
+				olc::vi2d origin = field->ChunkOrigin(chunk_index % header.chunks_x, chunk_index / header.chunks_x);
+				dirty.Mark(origin, origin + field->ChunkExtent(chunk_index % header.chunks_x, chunk_index / header.chunks_x) - olc::vi2d{ 1, 1 });
+			}
+			return false;
+		}
+		if (end_of_file > mapping.Size()) {
+			// so the appended payloads can be read back after an Evict()
+			mapping.Open(path);
+		}
+		return true;
+	}
+
+	// Writes all of field to a new file at path, packed with no free space, and
+	// keeps it attached to that file from then on. The chunks of the open file
+	// still pending are copied over as they are, without reading them in.
+	bool SaveAs(Field& field, const std::string& path){
+		bool copy_pending = this->field == &field && IsOpen() && pending_count > 0;
+		std::vector<TerrainFileChunk> old_index;
+		std::vector<uint8_t> old_pending;
+		if (copy_pending) {
+			old_index = index;
+			old_pending = pending;
+		}
+		Detach();
+		this->field = &field;
+
+		header = TerrainFileHeader{};
+		std::memcpy(header.magic, TerrainFileHeader::expected_magic, sizeof(header.magic));
+		header.version = TerrainFileHeader::current_version;
+		header.byte_order = TerrainFileHeader::native_byte_order;
+		header.cell_bytes = sizeof(T);
+		header.width = field.Width();
+		header.height = field.Height();
+		header.chunk_size_log2 = Field::chunk_size_log2;
+		header.chunks_x = field.ChunksX();
+		header.chunks_y = field.ChunksY();
+		index.assign(size_t(header.chunks_x) * header.chunks_y, TerrainFileChunk{});
+
+		// the old file may be the one being replaced, and is still read from
+		std::string temp_path = path + ".tmp";
+		std::ofstream out(temp_path, std::ios::binary | std::ios::trunc);
+		out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		out.write(reinterpret_cast<const char*>(index.data()), std::streamsize(index.size() * sizeof(TerrainFileChunk)));
+		uint64_t offset = IndexOffset() + index.size() * sizeof(TerrainFileChunk);
+		for (size_t i = 0; i < index.size() && out; i++) {
+			TerrainFileChunk& entry = index[i];
+			if (copy_pending && old_pending[i]) {
+				entry = old_index[i];
+				out.write(reinterpret_cast<const char*>(mapping.Data() + entry.offset), std::streamsize(entry.size));
+			}
+			else if (Encode(int(i), entry)) {
+				out.write(reinterpret_cast<const char*>(encoded.data()), std::streamsize(encoded.size()));
+			}
+			else {
+				continue;
+			}
+			entry.offset = offset;
+			entry.capacity = entry.size;
+			offset += entry.size;
+		}
+		out.seekp(std::streamoff(IndexOffset()));
+		out.write(reinterpret_cast<const char*>(index.data()), std::streamsize(index.size() * sizeof(TerrainFileChunk)));
+		out.close();
+		mapping.Close();
+		this->field = nullptr;
+		if (!out) {
+			std::remove(temp_path.c_str());
+			return false;
+		}
+		std::remove(path.c_str());
+		if (std::rename(temp_path.c_str(), path.c_str()) != 0 || !Open(path)) {
+			return false;
+		}
+
+		// everything else is in memory already
+		pending_count = 0;
+		for (size_t i = 0; i < pending.size(); i++) {
+			pending[i] = copy_pending ? old_pending[i] : 0;
+			pending_count += pending[i];
+		}
+		Track(field);
+		return true;
+	}
+};
@@ -0,0 +1,181 @@
+#pragma once
+
+#include "ChunkedDensityField.h"
+#include "BrushCurves.h"
+#include "Simd.h"
+#include "WorkerPool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+
+struct TerrainGeneratorSettings{
+	uint32_t seed = 1;
+	// size of the largest landmasses, in cells
+	float feature_size = 256.0f;
+	// noise layers, each lacunarity times finer and persistence times weaker
+	int octaves = 6;
+	float lacunarity = 2.0f;
+	float persistence = 0.5f;
+	// noise level where ground starts, and how far past it the ground eases
+	// from empty to solid; see ThresholdForSolid()
+	float threshold = 0.0f;
+	float softness = 0.02f;
+	// tunnels follow the zero line of a second noise, cave_width to either side
+	// of it (in noise units; 0 carves none) and cave_feature_size between turns
+	float cave_width = 0.025f;
+	float cave_feature_size = 128.0f;
+	int cave_octaves = 3;
+};
+
+// Seeds a map with procedural terrain: multi-octave gradient noise, shaped into
+// ground by a threshold eased with EaseInOutCubic so its edges come out as
+// fractional cells, with tunnels carved along the zero line of a second noise.
+// Every chunk is one job on the worker pool, filled with simd::width cells at a
+// time straight into its own cells, which makes it safe to run several at once;
+// chunks that come out uniform keep just their value. The noise hashes integer
+// lattice coordinates only, so a seed gives the same map on any thread count
+// (though the float maths may differ slightly between SIMD widths).
+template <typename Field>
+class TerrainGenerator{
+	using Cell = typename Field::cell_type;
+
+	static simd::Int Hash(simd::Int x, simd::Int y, int32_t seed){
+		using namespace simd;
+		Int h = x * Set1(int32_t(0x27d4eb2d)) ^ y * Set1(int32_t(0x165667b1)) ^ Set1(seed);
+		h = (h ^ ShiftRightLogical(h, 15)) * Set1(int32_t(0x2c1b3c6d));
+		h = (h ^ ShiftRightLogical(h, 12)) * Set1(int32_t(0x297a2d39));
+		return h ^ ShiftRightLogical(h, 15);
+	}
+
+	// dot of a hashed gradient (components in -1..1) with the offset from its lattice point
+	static simd::Float Corner(simd::Int x, simd::Int y, simd::Float dx, simd::Float dy, int32_t seed){
+		using namespace simd;
+		Int h = Hash(x, y, seed);
+		Float gx = ToFloat(h & Set1(int32_t(0xff))) * Set1(1.0f / 127.5f) - Set1(1.0f);
+		Float gy = ToFloat(ShiftRightLogical(h, 8) & Set1(int32_t(0xff))) * Set1(1.0f / 127.5f) - Set1(1.0f);
+		return gx * dx + gy * dy;
+	}
+
+	static simd::Float Fade(simd::Float t){
+		using namespace simd;
+		return t * t * t * (t * (t * Set1(6.0f) - Set1(15.0f)) + Set1(10.0f));
+	}
+
+	// 2D gradient noise, about -1..1
+	static simd::Float Noise(simd::Float x, simd::Float y, int32_t seed){
+		using namespace simd;
+		Float floor_x = Floor(x);
+		Float floor_y = Floor(y);
+		Int ix = ToInt(floor_x);
+		Int iy = ToInt(floor_y);
+		Float tx = x - floor_x;
+		Float ty = y - floor_y;
+		Int one = Set1(int32_t(1));
+		Float n00 = Corner(ix, iy, tx, ty, seed);
+		Float n10 = Corner(ix + one, iy, tx - Set1(1.0f), ty, seed);
+		Float n01 = Corner(ix, iy + one, tx, ty - Set1(1.0f), seed);
+		Float n11 = Corner(ix + one, iy + one, tx - Set1(1.0f), ty - Set1(1.0f), seed);
+		Float u = Fade(tx);
+		Float v = Fade(ty);
+		Float top = n00 + (n10 - n00) * u;
+		Float bottom = n01 + (n11 - n01) * u;
+		// gradients up to sqrt(2) long reach about 0.7
+		return (top + (bottom - top) * v) * Set1(1.4f);
+	}
+
+	// octaves of Noise() at cells x, y, normalised back to about -1..1
+	static simd::Float Fractal(simd::Float x, simd::Float y, float feature_size, int octaves, float lacunarity, float persistence, uint32_t seed){
+		using namespace simd;
+		Float sum = Set1(0.0f);
+		float frequency = 1.0f / std::max(feature_size, 1.0f);
+		float amplitude = 1.0f;
+		float total = 0.0f;
+		for (int octave = 0; octave < octaves; octave++) {
+			// every octave its own lattice, so their zero points don't line up on cell 0
+			int32_t octave_seed = int32_t(seed + uint32_t(octave) * 0x9e3779b9u);
+			Float offset = Set1(float(octave) * 17.31f);
+			sum = sum + Noise(x * Set1(frequency) + offset, y * Set1(frequency) - offset, octave_seed) * Set1(amplitude);
+			total += amplitude;
+			frequency *= lacunarity;
+			amplitude *= persistence;
+		}
+		return sum * Set1(1.0f / std::max(total, 1e-6f));
+	}
+
+	static simd::Float Saturate(simd::Float x){
+		return simd::Min(simd::Max(x, simd::Set1(0.0f)), simd::Set1(1.0f));
+	}
+
+	// densities of chunk_size cells of row y from x
+	static void Row(const TerrainGeneratorSettings& settings, int x, int y, float* out){
+		using namespace simd;
+		Float row_y = Set1(float(y) + 0.5f);
+		float ground_scale = 0.5f / std::max(settings.softness, 1e-6f);
+		for (int i = 0; i < Field::chunk_size; i += width) {
+			Float cell_x = IotaFloat() + Set1(float(x + i) + 0.5f);
+			Float ground = Fractal(cell_x, row_y, settings.feature_size, settings.octaves, settings.lacunarity, settings.persistence, settings.seed);
+			Float density = BrushCurves::EaseInOutCubic(Saturate((ground - Set1(settings.threshold)) * Set1(ground_scale) + Set1(0.5f)));
+			// open ground needs no tunnel
+			if (settings.cave_width > 0.0f && Any(density > Set1(0.0f))) {
+				Float tunnel = Fractal(cell_x, row_y, settings.cave_feature_size, settings.cave_octaves, settings.lacunarity, settings.persistence,
+					settings.seed ^ 0x5bd1e995u);
+				Float distance = Max(tunnel, -tunnel) * Set1(1.0f / settings.cave_width);
+				density = density * BrushCurves::EaseInOutCubic(Saturate(distance - Set1(1.0f)));
+			}
+			Store(out + i, density);
+		}
+	}
+
+	static void GenerateChunk(Field& field, const TerrainGeneratorSettings& settings, int chunk_x, int chunk_y){
+		typename Field::Chunk& chunk = field.GetChunk(chunk_x, chunk_y);
+		olc::vi2d origin = field.ChunkOrigin(chunk_x, chunk_y);
+		olc::vi2d extent = field.ChunkExtent(chunk_x, chunk_y);
+		std::unique_ptr<typename Field::Block> cells = std::make_unique<typename Field::Block>(Field::chunk_size, Field::chunk_size);
+
+		float densities[Field::chunk_size];
+		Cell first = Cell();
+		bool uniform = true;
+		for (int y = 0; y < extent.y; y++) {
+			Row(settings, origin.x, origin.y + y, densities);
+			Cell* row = cells->Row(y);
+			for (int x = 0; x < extent.x; x++) {
+				row[x] = Field::traits::FromFloat(densities[x]);
+			}
+			if (y == 0) {
+				first = row[0];
+			}
+			uniform = uniform && std::all_of(row, row + extent.x, [&](Cell cell){ return cell == first; });
+		}
+
+		if (uniform) {
+			chunk.cells.reset();
+			chunk.uniform_value = first;
+		}
+		else {
+			chunk.cells = std::move(cells);
+		}
+	}
+
+public:
+	// threshold that leaves about solid (0..1) of the map ground: Fractal() comes
+	// out close to normally distributed with a deviation near 0.12, taken here
+	// through the logistic curve that resembles it
+	static float ThresholdForSolid(float solid){
+		solid = std::clamp(solid, 0.001f, 0.999f);
+		return -0.066f * std::log(solid / (1.0f - solid));
+	}
+
+	// Replaces every cell of field. Goes around Materialise() like Fill() does,
+	// so a write listener (the undo journal) isn't told; clear its history.
+	static void Generate(Field& field, const TerrainGeneratorSettings& settings, WorkerPool& pool){
+		// drops every buffer and marks the whole map dirty for the trackers,
+		// which only read it after this returns
+		field.Fill(0.0f);
+		int chunks_x = field.ChunksX();
+		pool.ParallelFor(chunks_x * field.ChunksY(), [&](int index, int){
+			GenerateChunk(field, settings, index % chunks_x, index / chunks_x);
+		});
+	}
+};
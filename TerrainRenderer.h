@@ -0,0 +1,395 @@
+#pragma once
+
+#include "olcPixelGameEngine.h"
+#include "olcPGEX_TransformedView.h"
+
+#include "ChunkedDensityField.h"
+
+// Draws a ChunkedDensityField as decals through a TransformedView, so zoom and
+// pan are applied on the GPU. Each edited chunk owns a small texture; only the
+// chunks the field reported dirty get their pixels rewritten and re-uploaded,
+// an idle frame just submits one quad per visible non-empty chunk.
+// Uniform chunks have no texture and become a single filled rect (nothing when empty).
+//
+// Zoomed out, the chunks give way to a mip chain: level L holds the map box
+// filtered down 2^L times, in tiles of chunk_size texels, and the view draws the
+// level with about a texel per screen pixel, so it submits and samples roughly a
+// screen's worth of texels however much of the map is in view. Like the field's
+// chunks, a tile whose texels are all the same is kept as that value, so the
+// levels cost memory for the map's detail rather than its area. The levels follow
+// the same dirty reports; a tile's texture is only rewritten when it is drawn.
+template <typename Field>
+class ChunkedTerrainRenderer{
+public:
+	// textures (re)written since the last TakeUploads(), and the bytes sent for them
+	struct Uploads{
+		uint64_t textures = 0;
+		uint64_t bytes = 0;
+	};
+
+private:
+	struct ChunkView{
+		std::unique_ptr<olc::Sprite> sprite;
+		std::unique_ptr<olc::Decal> decal;
+	};
+
+	struct MipTile{
+		std::unique_ptr<olc::Sprite> sprite;
+		std::unique_ptr<olc::Decal> decal;
+		// chunk_size^2 texels, empty while every one is uniform_value
+		std::vector<uint8_t> texels;
+		uint8_t uniform_value = 0;
+		// texels changed since the texture was written
+		bool stale = true;
+	};
+
+	// level L + 1 texel (x, y) averages texels 2x..2x+1, 2y..2y+1 of level L
+	// (map cells for level 1) that are in the map
+	struct MipLevel{
+		int width = 0;
+		int height = 0;
+		int tiles_x = 0;
+		int tiles_y = 0;
+		std::vector<MipTile> tiles;
+
+		MipTile& Tile(int tile_x, int tile_y){
+			return tiles[size_t(tile_y) * tiles_x + tile_x];
+		}
+		uint8_t Texel(int x, int y) const{
+			const MipTile& tile = tiles[size_t(y / Field::chunk_size) * tiles_x + x / Field::chunk_size];
+			if (tile.texels.empty()) {
+				return tile.uniform_value;
+			}
+			return tile.texels[size_t(y % Field::chunk_size) * Field::chunk_size + x % Field::chunk_size];
+		}
+	};
+
+	Field* field = nullptr;
+	ChunkDirtyTracker dirty;
+	std::vector<ChunkView> views;
+	// levels[0] is level 1, the chunks themselves being level 0
+	std::vector<MipLevel> levels;
+	std::vector<float> cells;
+	Uploads uploads;
+
+	void CountUpload(const olc::Sprite& sprite){
+		uploads.textures++;
+		uploads.bytes += uint64_t(sprite.width) * sprite.height * sizeof(olc::Pixel);
+	}
+
+	void BuildLevels(){
+		levels.clear();
+		int width = field->Width();
+		int height = field->Height();
+		// until one tile spans the map
+		while (width > Field::chunk_size || height > Field::chunk_size) {
+			width = (width + 1) / 2;
+			height = (height + 1) / 2;
+			MipLevel level;
+			level.width = width;
+			level.height = height;
+			level.tiles_x = (width + Field::chunk_size - 1) / Field::chunk_size;
+			level.tiles_y = (height + Field::chunk_size - 1) / Field::chunk_size;
+			level.tiles.resize(size_t(level.tiles_x) * level.tiles_y);
+			levels.push_back(std::move(level));
+		}
+	}
+
+	// true if every texel of tile_x, tile_y of levels[l] comes from uniform
+	// sources (field chunks for level 1) that all hold the same value, set to it
+	bool SourcesUniform(size_t l, int tile_x, int tile_y, uint8_t& value) const{
+		bool first = true;
+		int sources_x = l == 0 ? field->ChunksX() : levels[l - 1].tiles_x;
+		int sources_y = l == 0 ? field->ChunksY() : levels[l - 1].tiles_y;
+		for (int y = 2 * tile_y; y <= std::min(2 * tile_y + 1, sources_y - 1); y++) {
+			for (int x = 2 * tile_x; x <= std::min(2 * tile_x + 1, sources_x - 1); x++) {
+				uint8_t source_value;
+				if (l == 0) {
+					const typename Field::Chunk& chunk = field->GetChunk(x, y);
+					if (!chunk.IsUniform()) {
+						return false;
+					}
+					source_value = Field::traits::ToByte(chunk.uniform_value);
+				}
+				else {
+					const MipTile& source = levels[l - 1].tiles[size_t(y) * levels[l - 1].tiles_x + x];
+					if (!source.texels.empty()) {
+						return false;
+					}
+					source_value = source.uniform_value;
+				}
+				if (!first && source_value != value) {
+					return false;
+				}
+				value = source_value;
+				first = false;
+			}
+		}
+		return true;
+	}
+
+	// redoes texels from..to (inclusive, within the tile) of tile_x, tile_y of levels[l]
+	void UpdateTile(size_t l, int tile_x, int tile_y, olc::vi2d from, olc::vi2d to){
+		MipLevel& level = levels[l];
+		MipTile& tile = level.Tile(tile_x, tile_y);
+		tile.stale = true;
+		uint8_t value = 0;
+		if (SourcesUniform(l, tile_x, tile_y, value)) {
+			tile.texels.clear();
+			tile.texels.shrink_to_fit();
+			tile.uniform_value = value;
+			return;
+		}
+		if (tile.texels.empty()) {
+			// the texels outside from..to keep the value they had
+			tile.texels.assign(size_t(Field::chunk_size) * Field::chunk_size, tile.uniform_value);
+		}
+
+		olc::vi2d origin{ tile_x * Field::chunk_size, tile_y * Field::chunk_size };
+		if (l == 0) {
+			// level 1 straight from the cells
+			olc::vi2d cells_from = from * 2;
+			olc::vi2d cells_size = (to - from + olc::vi2d{ 1, 1 }) * 2;
+			cells.resize(size_t(cells_size.x) * cells_size.y);
+			field->ReadRect(cells_from, cells_size, cells.data(), 1, cells_size.x);
+			for (int y = from.y; y <= to.y; y++) {
+				const float* top = cells.data() + size_t(2 * (y - from.y)) * cells_size.x;
+				const float* bottom = top + cells_size.x;
+				uint8_t* out = tile.texels.data() + size_t(y - origin.y) * Field::chunk_size;
+				int rows = 2 * y + 1 < field->Height() ? 2 : 1;
+				for (int x = from.x; x <= to.x; x++) {
+					int i = 2 * (x - from.x);
+					int columns = 2 * x + 1 < field->Width() ? 2 : 1;
+					// cells off the map read as 0 and are left out of the count
+					float sum = top[i] + top[i + 1] + bottom[i] + bottom[i + 1];
+					float mean = sum / float(rows * columns);
+					// as a cell of that value shows at level 0
+					out[x - origin.x] = Field::traits::ToByte(Field::traits::FromFloat(mean));
+				}
+			}
+		}
+		else {
+			const MipLevel& source = levels[l - 1];
+			for (int y = from.y; y <= to.y; y++) {
+				int y0 = 2 * y;
+				int y1 = std::min(y0 + 1, source.height - 1);
+				uint8_t* out = tile.texels.data() + size_t(y - origin.y) * Field::chunk_size;
+				for (int x = from.x; x <= to.x; x++) {
+					int x0 = 2 * x;
+					int x1 = std::min(x0 + 1, source.width - 1);
+					// a missing row or column repeats the last one, which averages the same
+					int sum = source.Texel(x0, y0) + source.Texel(x1, y0) + source.Texel(x0, y1) + source.Texel(x1, y1);
+					out[x - origin.x] = uint8_t((sum + 2) / 4);
+				}
+			}
+		}
+
+		// an edit can leave the tile all one value again
+		olc::vi2d extent = (origin + olc::vi2d{ Field::chunk_size, Field::chunk_size }).min({ level.width, level.height }) - origin;
+		uint8_t first = tile.texels[0];
+		bool uniform = true;
+		for (int y = 0; y < extent.y && uniform; y++) {
+			const uint8_t* row = tile.texels.data() + size_t(y) * Field::chunk_size;
+			uniform = std::all_of(row, row + extent.x, [&](uint8_t texel){ return texel == first; });
+		}
+		if (uniform) {
+			tile.texels.clear();
+			tile.texels.shrink_to_fit();
+			tile.uniform_value = first;
+		}
+	}
+
+	// redoes the texels of every level over map cells from..to (inclusive)
+	void UpdateLevels(olc::vi2d from, olc::vi2d to){
+		for (size_t l = 0; l < levels.size(); l++) {
+			from /= 2;
+			to /= 2;
+			for (int tile_y = from.y / Field::chunk_size; tile_y <= to.y / Field::chunk_size; tile_y++) {
+				for (int tile_x = from.x / Field::chunk_size; tile_x <= to.x / Field::chunk_size; tile_x++) {
+					olc::vi2d origin{ tile_x * Field::chunk_size, tile_y * Field::chunk_size };
+					olc::vi2d end = origin + olc::vi2d{ Field::chunk_size - 1, Field::chunk_size - 1 };
+					UpdateTile(l, tile_x, tile_y, from.max(origin), to.min(end));
+				}
+			}
+		}
+	}
+
+	void RefreshTile(MipLevel& level, int tile_x, int tile_y){
+		MipTile& tile = level.Tile(tile_x, tile_y);
+		tile.stale = false;
+		if (tile.texels.empty()) {
+			tile.decal.reset();
+			tile.sprite.reset();
+			return;
+		}
+
+		olc::vi2d origin{ tile_x * Field::chunk_size, tile_y * Field::chunk_size };
+		olc::vi2d extent = (origin + olc::vi2d{ Field::chunk_size, Field::chunk_size }).min({ level.width, level.height }) - origin;
+		if (!tile.sprite) {
+			tile.sprite = std::make_unique<olc::Sprite>(extent.x, extent.y);
+		}
+		for (int y = 0; y < extent.y; y++) {
+			const uint8_t* row = tile.texels.data() + size_t(y) * Field::chunk_size;
+			olc::Pixel* dst = tile.sprite->GetData() + size_t(y) * tile.sprite->width;
+			for (int x = 0; x < extent.x; x++) {
+				dst[x] = olc::Pixel{ row[x], row[x], row[x] };
+			}
+		}
+		if (tile.decal) {
+			tile.decal->Update();
+		}
+		else {
+			tile.decal = std::make_unique<olc::Decal>(tile.sprite.get());
+		}
+		CountUpload(*tile.sprite);
+	}
+
+	void DrawLevel(olc::TileTransformedView& tv, MipLevel& level, int scale){
+		int tile_cells = Field::chunk_size * scale;
+		olc::vi2d from = olc::vi2d(tv.GetWorldTL().floor()) / tile_cells;
+		olc::vi2d to = olc::vi2d(tv.GetWorldBR().ceil()) / tile_cells;
+		from = from.max({ 0, 0 });
+		to = to.min({ level.tiles_x - 1, level.tiles_y - 1 });
+
+		for (int tile_y = from.y; tile_y <= to.y; tile_y++) {
+			for (int tile_x = from.x; tile_x <= to.x; tile_x++) {
+				MipTile& tile = level.Tile(tile_x, tile_y);
+				if (tile.stale) {
+					RefreshTile(level, tile_x, tile_y);
+				}
+				olc::vf2d origin{ float(tile_x * tile_cells), float(tile_y * tile_cells) };
+				if (tile.texels.empty()) {
+					if (tile.uniform_value != 0) {
+						uint8_t value = tile.uniform_value;
+						olc::vf2d size = (origin + olc::vf2d{ float(tile_cells), float(tile_cells) }).min(olc::vf2d(field->Size())) - origin;
+						tv.FillRectDecal(origin, size, olc::Pixel{ value, value, value });
+					}
+					continue;
+				}
+				tv.DrawDecal(origin, tile.decal.get(), { float(scale), float(scale) });
+			}
+		}
+	}
+
+	// local_from and local_to inclusive
+	void WritePixels(ChunkView& view, const typename Field::Chunk& chunk, olc::vi2d local_from, olc::vi2d local_to){
+		for (int y = local_from.y; y <= local_to.y; y++) {
+			const auto* row = chunk.cells->Row(y);
+			olc::Pixel* dst = view.sprite->GetData() + size_t(y) * view.sprite->width;
+			for (int x = local_from.x; x <= local_to.x; x++) {
+				uint8_t value = Field::traits::ToByte(row[x]);
+				dst[x] = olc::Pixel{ value, value, value };
+			}
+		}
+	}
+
+	void Refresh(int chunk_x, int chunk_y, olc::vi2d local_from, olc::vi2d local_to){
+		const typename Field::Chunk& chunk = field->GetChunk(chunk_x, chunk_y);
+		ChunkView& view = views[size_t(chunk_y) * field->ChunksX() + chunk_x];
+
+		if (chunk.IsUniform()) {
+			view.decal.reset();
+			view.sprite.reset();
+			return;
+		}
+
+		olc::vi2d extent = field->ChunkExtent(chunk_x, chunk_y);
+		if (!view.decal) {
+			view.sprite = std::make_unique<olc::Sprite>(extent.x, extent.y);
+			WritePixels(view, chunk, { 0, 0 }, extent - olc::vi2d{ 1, 1 });
+			view.decal = std::make_unique<olc::Decal>(view.sprite.get());
+			CountUpload(*view.sprite);
+			return;
+		}
+
+		WritePixels(view, chunk, local_from, local_to.min(extent - olc::vi2d{ 1, 1 }));
+		view.decal->Update();
+		CountUpload(*view.sprite);
+	}
+
+public:
+	~ChunkedTerrainRenderer(){
+		Detach();
+	}
+
+	void Attach(Field& field){
+		Detach();
+		this->field = &field;
+		field.AddDirtyTracker(&dirty);
+		views.clear();
+		views.resize(size_t(field.ChunksX()) * field.ChunksY());
+		BuildLevels();
+		UpdateLevels({ 0, 0 }, field.Size() - olc::vi2d{ 1, 1 });
+	}
+
+	// Level Draw() uses at the view's zoom: 0 for the chunks, L for 2^L cells a texel
+	int LevelFor(const olc::TileTransformedView& tv) const{
+		float cells_per_pixel = 1.0f / tv.GetWorldScale().x;
+		int level = 0;
+		while (level < int(levels.size()) && float(2 << level) <= cells_per_pixel) {
+			level++;
+		}
+		return level;
+	}
+
+	void Detach(){
+		if (field) {
+			field->RemoveDirtyTracker(&dirty);
+			field = nullptr;
+		}
+	}
+
+	Uploads TakeUploads(){
+		Uploads taken = uploads;
+		uploads = Uploads{};
+		return taken;
+	}
+
+	// Uploads whatever changed since the last call, then queues the visible chunks
+	// (or tiles of the mip level that suits the zoom)
+	void Draw(olc::TileTransformedView& tv){
+		dirty.Consume([&](int chunk_x, int chunk_y, olc::vi2d local_from, olc::vi2d local_to){
+			Refresh(chunk_x, chunk_y, local_from, local_to);
+			olc::vi2d origin = field->ChunkOrigin(chunk_x, chunk_y);
+			UpdateLevels(origin + local_from, (origin + local_to).min(field->Size() - olc::vi2d{ 1, 1 }));
+		});
+
+		int level = LevelFor(tv);
+		if (level > 0) {
+			DrawLevel(tv, levels[level - 1], 1 << level);
+			return;
+		}
+
+		olc::vi2d from = olc::vi2d(tv.GetWorldTL().floor()) / Field::chunk_size;
+		olc::vi2d to = olc::vi2d(tv.GetWorldBR().ceil()) / Field::chunk_size;
+		from = from.max({ 0, 0 });
+		to = to.min({ field->ChunksX() - 1, field->ChunksY() - 1 });
+
+		for (int chunk_y = from.y; chunk_y <= to.y; chunk_y++) {
+			for (int chunk_x = from.x; chunk_x <= to.x; chunk_x++) {
+				const typename Field::Chunk& chunk = field->GetChunk(chunk_x, chunk_y);
+				ChunkView& view = views[size_t(chunk_y) * field->ChunksX() + chunk_x];
+				olc::vi2d origin = field->ChunkOrigin(chunk_x, chunk_y);
+
+				if (chunk.IsUniform()) {
+					// folded by Compact() since it was last drawn
+					if (view.decal) {
+						view.decal.reset();
+						view.sprite.reset();
+					}
+					uint8_t value = Field::traits::ToByte(chunk.uniform_value);
+					if (value != 0) {
+						tv.FillRectDecal(origin, field->ChunkExtent(chunk_x, chunk_y), olc::Pixel{ value, value, value });
+					}
+					continue;
+				}
+
+				// written without being reported dirty, build it from scratch
+				if (!view.decal) {
+					Refresh(chunk_x, chunk_y, { 0, 0 }, { 0, 0 });
+				}
+				tv.DrawDecal(origin, view.decal.get());
+			}
+		}
+	}
+};
@@ -0,0 +1,310 @@
+#pragma once
+
+#include "ChunkedDensityField.h"
+
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+// Undo history of a ChunkedDensityField, one step per stroke. While a stroke is
+// open every chunk is copied right before its first write (a uniform chunk is
+// just its value); when the stroke ends only the dirty rects the tools reported
+// are compared against those copies, and each chunk keeps the runs of cells
+// that changed with their values before and after. Undo and redo then write
+// back just those cells. Strokes are dropped oldest first once the history
+// outgrows its byte budget.
+template <typename Field>
+class UndoJournal : public Field::WriteListener{
+	using T = typename Field::cell_type;
+	using Chunk = typename Field::Chunk;
+	static constexpr int chunk_size = Field::chunk_size;
+	static constexpr size_t chunk_cells = size_t(chunk_size) * chunk_size;
+	static_assert(chunk_cells <= 65536, "chunk local indices are stored as 16 bits");
+
+	struct ChunkDelta{
+		int chunk_index = 0;
+		// chunk local bounds of the changed cells, inclusive
+		olc::vi2d from;
+		olc::vi2d to;
+		// start and length of every run of changed chunk local cell indices
+		std::vector<uint16_t> runs;
+		// a chunk that was uniform before keeps its value instead of before
+		bool before_uniform = false;
+		T before_value = T();
+		std::vector<T> before;
+		std::vector<T> after;
+
+		size_t Bytes() const{
+			return sizeof(ChunkDelta) + runs.size() * sizeof(uint16_t) + (before.size() + after.size()) * sizeof(T);
+		}
+	};
+
+	struct Stroke{
+		std::vector<ChunkDelta> chunks;
+		size_t bytes = 0;
+	};
+
+	// a chunk as it was before the open stroke first wrote to it
+	struct Snapshot{
+		int chunk_index = 0;
+		bool uniform = false;
+		T value = T();
+		// into snapshot_cells when not uniform
+		size_t offset = 0;
+	};
+
+	Field* field = nullptr;
+	ChunkDirtyTracker dirty;
+
+	std::deque<Stroke> undo_strokes;
+	std::vector<Stroke> redo_strokes;
+	size_t bytes = 0;
+	size_t budget;
+
+	bool recording = false;
+	bool applying = false;
+	std::vector<Snapshot> snapshots;
+	// index into snapshots, -1 if the chunk has none
+	std::vector<int> snapshot_of_chunk;
+	std::vector<T> snapshot_cells;
+
+	void Diff(const Snapshot& snapshot, olc::vi2d from, olc::vi2d to, Stroke& stroke){
+		int chunk_x = snapshot.chunk_index % field->ChunksX();
+		int chunk_y = snapshot.chunk_index / field->ChunksX();
+		const Chunk& chunk = field->GetChunk(chunk_x, chunk_y);
+		const T* before_cells = snapshot.uniform ? nullptr : snapshot_cells.data() + snapshot.offset;
+
+		ChunkDelta delta;
+		delta.chunk_index = snapshot.chunk_index;
+		delta.from = to;
+		delta.to = from;
+		delta.before_uniform = snapshot.uniform;
+		delta.before_value = snapshot.value;
+
+		for (int y = from.y; y <= to.y; y++) {
+			int run_start = -1;
+			for (int x = from.x; x <= to.x + 1; x++) {
+				int cell = y * chunk_size + x;
+				bool changed = false;
+				if (x <= to.x) {
+					T before = before_cells ? before_cells[cell] : snapshot.value;
+					T after = chunk.GetCell(x, y);
+					changed = before != after;
+					if (changed) {
+						if (!delta.before_uniform) {
+							delta.before.push_back(before);
+						}
+						delta.after.push_back(after);
+						delta.from = delta.from.min({ x, y });
+						delta.to = delta.to.max({ x, y });
+					}
+				}
+
+				if (changed && run_start < 0) {
+					run_start = cell;
+				}
+				else if (!changed && run_start >= 0) {
+					delta.runs.push_back(uint16_t(run_start));
+					delta.runs.push_back(uint16_t(cell - run_start));
+					run_start = -1;
+				}
+			}
+		}
+
+		if (!delta.runs.empty()) {
+			stroke.bytes += delta.Bytes();
+			stroke.chunks.push_back(std::move(delta));
+		}
+	}
+
+	void Apply(const Stroke& stroke, bool use_before){
+		applying = true;
+		for (const ChunkDelta& delta : stroke.chunks) {
+			olc::vi2d origin = field->ChunkOrigin(delta.chunk_index % field->ChunksX(), delta.chunk_index / field->ChunksX());
+			size_t value_index = 0;
+			for (size_t run = 0; run < delta.runs.size(); run += 2) {
+				for (int cell = delta.runs[run]; cell < delta.runs[run] + delta.runs[run + 1]; cell++, value_index++) {
+					T value;
+					if (!use_before) {
+						value = delta.after[value_index];
+					}
+					else {
+						value = delta.before_uniform ? delta.before_value : delta.before[value_index];
+					}
+					field->SetCellUnchecked(origin.x + cell % chunk_size, origin.y + cell / chunk_size, value);
+				}
+			}
+			field->MarkDirty(origin + delta.from, origin + delta.to, &dirty);
+		}
+		applying = false;
+	}
+
+	void DropRedo(){
+		for (const Stroke& stroke : redo_strokes) {
+			bytes -= stroke.bytes;
+		}
+		redo_strokes.clear();
+	}
+
+	void Trim(){
+		while (bytes > budget && !undo_strokes.empty()) {
+			bytes -= undo_strokes.front().bytes;
+			undo_strokes.pop_front();
+		}
+	}
+
+public:
+	explicit UndoJournal(size_t budget = size_t(256) << 20) : budget(budget){
+	}
+	~UndoJournal(){
+		Detach();
+	}
+
+	UndoJournal(const UndoJournal&) = delete;
+	UndoJournal& operator=(const UndoJournal&) = delete;
+
+	void Attach(Field& field){
+		Detach();
+		this->field = &field;
+		field.SetWriteListener(this);
+		field.AddDirtyTracker(&dirty);
+		snapshot_of_chunk.assign(size_t(field.ChunksX()) * field.ChunksY(), -1);
+		Clear();
+	}
+
+	void Detach(){
+		if (field) {
+			field->SetWriteListener(nullptr);
+			field->RemoveDirtyTracker(&dirty);
+			field = nullptr;
+		}
+	}
+
+	void SetBudget(size_t budget){
+		this->budget = budget;
+		Trim();
+	}
+	size_t Bytes() const{
+		return bytes;
+	}
+
+	bool CanUndo() const{
+		return !undo_strokes.empty() || recording;
+	}
+	bool CanRedo() const{
+		return !redo_strokes.empty();
+	}
+
+	// Forgets everything, for when the field changed in a way the history can't follow
+	void Clear(){
+		recording = false;
+		for (const Snapshot& snapshot : snapshots) {
+			snapshot_of_chunk[snapshot.chunk_index] = -1;
+		}
+		snapshots.clear();
+		snapshot_cells.clear();
+		undo_strokes.clear();
+		redo_strokes.clear();
+		bytes = 0;
+	}
+
+	// Writes from now until EndStroke() are one undo step; does nothing while a
+	// stroke is already open, so it can be called every frame a button is held
+	void BeginStroke(){
+		if (recording || !field) {
+			return;
+		}
+		recording = true;
+		// marks made outside a stroke have nothing to compare against
+		dirty.Consume([](int, int, olc::vi2d, olc::vi2d){});
+	}
+
+	void EndStroke(){
+		if (!recording) {
+			return;
+		}
+		recording = false;
+
+		Stroke stroke;
+		dirty.Consume([&](int chunk_x, int chunk_y, olc::vi2d from, olc::vi2d to){
+			int snapshot = snapshot_of_chunk[size_t(chunk_y) * field->ChunksX() + chunk_x];
+			if (snapshot >= 0) {
+				Diff(snapshots[snapshot], from, to, stroke);
+			}
+		});
+
+		for (const Snapshot& snapshot : snapshots) {
+			snapshot_of_chunk[snapshot.chunk_index] = -1;
+		}
+		snapshots.clear();
+		snapshot_cells.clear();
+
+		if (!stroke.chunks.empty()) {
+			DropRedo();
+			bytes += stroke.bytes;
+			undo_strokes.push_back(std::move(stroke));
+			Trim();
+		}
+	}
+
+	// Calls callback(chunk_index) for every chunk the next Undo() or Redo() writes
+	// to. Those end an open stroke first, which this doesn't see: EndStroke()
+	// before asking, or an undo gets the chunks of the stroke before it.
+	template <typename Callback>
+	void ForEachUndoChunk(Callback callback) const{
+		if (!undo_strokes.empty()) {
+			for (const ChunkDelta& delta : undo_strokes.back().chunks) {
+				callback(delta.chunk_index);
+			}
+		}
+	}
+	template <typename Callback>
+	void ForEachRedoChunk(Callback callback) const{
+		if (!redo_strokes.empty()) {
+			for (const ChunkDelta& delta : redo_strokes.back().chunks) {
+				callback(delta.chunk_index);
+			}
+		}
+	}
+
+	// Both end an open stroke first; false if there was nothing to undo or redo
+	bool Undo(){
+		EndStroke();
+		if (undo_strokes.empty()) {
+			return false;
+		}
+		Apply(undo_strokes.back(), true);
+		redo_strokes.push_back(std::move(undo_strokes.back()));
+		undo_strokes.pop_back();
+		return true;
+	}
+
+	bool Redo(){
+		EndStroke();
+		if (redo_strokes.empty()) {
+			return false;
+		}
+		Apply(redo_strokes.back(), false);
+		undo_strokes.push_back(std::move(redo_strokes.back()));
+		redo_strokes.pop_back();
+		return true;
+	}
+
+	void BeforeWrite(int chunk_index, const Chunk& chunk) override{
+		if (!recording || applying || snapshot_of_chunk[chunk_index] >= 0) {
+			return;
+		}
+		snapshot_of_chunk[chunk_index] = int(snapshots.size());
+
+		Snapshot snapshot;
+		snapshot.chunk_index = chunk_index;
+		snapshot.uniform = chunk.IsUniform();
+		snapshot.value = chunk.uniform_value;
+		if (!snapshot.uniform) {
+			snapshot.offset = snapshot_cells.size();
+			const T* cells = chunk.cells->Row(0);
+			snapshot_cells.insert(snapshot_cells.end(), cells, cells + chunk_cells);
+		}
+		snapshots.push_back(snapshot);
+	}
+};
@@ -0,0 +1,264 @@
+#pragma once
+
+#include "olcPixelGameEngine.h"
+
+#include "Raycast.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// How far one kernel strayed from its reference over every case it ran, split
+// into cells whose blend window crossed the map's edge and the rest (for a
+// raycast, rays and the ones that ended at the edge)
+struct VerifyResult{
+	std::string kernel;
+	double tolerance = 0.0;
+	int cases = 0;
+	uint64_t cells = 0;
+	double max_error = 0.0;
+	double total_error = 0.0;
+	uint64_t edge_cells = 0;
+	double edge_max_error = 0.0;
+	double edge_total_error = 0.0;
+	// where max_error came from
+	int worst_case = -1;
+	olc::vi2d worst_cell;
+	int worst_brush_size = 0;
+	int worst_blend_range = 0;
+
+	bool Passed() const{
+		return max_error <= tolerance;
+	}
+	double MeanError() const{
+		return cells > 0 ? total_error / double(cells) : 0.0;
+	}
+	double EdgeMeanError() const{
+		return edge_cells > 0 ? edge_total_error / double(edge_cells) : 0.0;
+	}
+};
+
+// Collects the differences between kernels and their references, one result
+// per kernel however many cases it ran. The cases come from the caller, see
+// RunVerification() in main.cpp.
+class VerifyRunner{
+	std::vector<VerifyResult> results;
+
+	VerifyResult& Result(const std::string& kernel, double tolerance){
+		for (VerifyResult& result : results) {
+			if (result.kernel == kernel) {
+				return result;
+			}
+		}
+		results.push_back({});
+		results.back().kernel = kernel;
+		results.back().tolerance = tolerance;
+		return results.back();
+	}
+
+	static void AddRay(VerifyResult& result, int case_index, olc::vi2d map_size, olc::vi2d cell, double error){
+		result.cells++;
+		result.total_error += error;
+		bool edge = cell.x <= 0 || cell.y <= 0 || cell.x >= map_size.x - 1 || cell.y >= map_size.y - 1;
+		if (edge) {
+			result.edge_cells++;
+			result.edge_total_error += error;
+			result.edge_max_error = std::max(result.edge_max_error, error);
+		}
+		if (error > result.max_error) {
+			result.max_error = error;
+			result.worst_case = case_index;
+			result.worst_cell = cell;
+			result.worst_brush_size = 0;
+			result.worst_blend_range = 0;
+		}
+	}
+
+public:
+	// Compares the size cells from from of the kernel's output (actual) with the
+	// reference's (expected), both row major; cells off the map are skipped. A
+	// cell is an edge cell when the blend_range window around it leaves the map.
+	void Compare(const std::string& kernel, double tolerance, int case_index, int brush_size, int blend_range, olc::vi2d map_size,
+		olc::vi2d from, olc::vi2d size, const double* expected, const float* actual){
+		VerifyResult& result = Result(kernel, tolerance);
+		result.cases++;
+		for (int j = 0; j < size.y; j++) {
+			int y = from.y + j;
+			if (y < 0 || y >= map_size.y) {
+				continue;
+			}
+			for (int i = 0; i < size.x; i++) {
+				int x = from.x + i;
+				if (x < 0 || x >= map_size.x) {
+					continue;
+				}
+				size_t index = size_t(j) * size.x + i;
+				double error = std::abs(double(actual[index]) - expected[index]);
+				result.cells++;
+				result.total_error += error;
+				bool edge = x - blend_range < 0 || y - blend_range < 0 || x + blend_range >= map_size.x || y + blend_range >= map_size.y;
+				if (edge) {
+					result.edge_cells++;
+					result.edge_total_error += error;
+					result.edge_max_error = std::max(result.edge_max_error, error);
+				}
+				if (error > result.max_error) {
+					result.max_error = error;
+					result.worst_case = case_index;
+					result.worst_cell = { x, y };
+					result.worst_brush_size = brush_size;
+					result.worst_blend_range = blend_range;
+				}
+			}
+		}
+	}
+
+	// Compares where count rays of a raycast hit (actual) with where the plain
+	// unit-step walk hit for the same rays (expected). A ray's error is how many
+	// cells apart the two put the hit cell or the cell before it (the larger of
+	// the two axes), 0 when neither hit (where a miss stops means nothing), and
+	// its max_distance when only one of them hit. Each ray counts as a cell, and
+	// as an edge cell when the walk ended within a cell of the map's edge or past it.
+	void CompareRays(const std::string& kernel, double tolerance, int case_index, olc::vi2d map_size,
+		size_t count, const RaycastResult* expected, const RaycastResult* actual, const float* max_distances){
+		auto apart = [](olc::vi2d a, olc::vi2d b){
+			return std::max(std::abs(a.x - b.x), std::abs(a.y - b.y));
+		};
+		VerifyResult& result = Result(kernel, tolerance);
+		result.cases++;
+		for (size_t i = 0; i < count; i++) {
+			double error = 0.0;
+			if (expected[i].hit != actual[i].hit) {
+				error = double(max_distances[i]);
+			}
+			else if (expected[i].hit) {
+				error = double(std::max(apart(expected[i].cell, actual[i].cell), apart(expected[i].previous_cell, actual[i].previous_cell)));
+			}
+			AddRay(result, case_index, map_size, expected[i].cell, error);
+		}
+	}
+
+	// Adds count rays of a cast that stops at a smoothed surface rather than at
+	// cells, so it can't be compared cell for cell: depths[i] is how far ray i
+	// ran inside one cell the unit-step walk would hit before the cast stopped,
+	// the deepest such cell counting, and cells[i] where the walk stopped.
+	void CompareDepths(const std::string& kernel, double tolerance, int case_index, olc::vi2d map_size,
+		size_t count, const olc::vi2d* cells, const float* depths){
+		VerifyResult& result = Result(kernel, tolerance);
+		result.cases++;
+		for (size_t i = 0; i < count; i++) {
+			AddRay(result, case_index, map_size, cells[i], double(depths[i]));
+		}
+	}
+
+	const std::vector<VerifyResult>& Results() const{
+		return results;
+	}
+
+	bool Passed() const{
+		return std::all_of(results.begin(), results.end(), [](const VerifyResult& result){ return result.Passed(); });
+	}
+
+	void WriteCsv(std::ostream& out) const{
+		out << "kernel,cases,cells,max_error,mean_error,edge_cells,edge_max_error,edge_mean_error,tolerance,"
+			"worst_case,worst_x,worst_y,worst_brush_size,worst_blend_range,passed\n";
+		for (const VerifyResult& result : results) {
+			out << result.kernel << ',' << result.cases << ',' << result.cells << ',' << result.max_error << ',' << result.MeanError() << ','
+				<< result.edge_cells << ',' << result.edge_max_error << ',' << result.EdgeMeanError() << ',' << result.tolerance << ','
+				<< result.worst_case << ',' << result.worst_cell.x << ',' << result.worst_cell.y << ','
+				<< result.worst_brush_size << ',' << result.worst_blend_range << ',' << (result.Passed() ? "yes" : "no") << '\n';
+		}
+	}
+
+	void WriteJson(std::ostream& out) const{
+		out << "[\n";
+		for (size_t i = 0; i < results.size(); i++) {
+			const VerifyResult& result = results[i];
+			out << "\t{ \"kernel\": \"" << result.kernel << "\", \"cases\": " << result.cases << ", \"cells\": " << result.cells
+				<< ", \"max_error\": " << result.max_error << ", \"mean_error\": " << result.MeanError()
+				<< ", \"edge_cells\": " << result.edge_cells << ", \"edge_max_error\": " << result.edge_max_error
+				<< ", \"edge_mean_error\": " << result.EdgeMeanError() << ", \"tolerance\": " << result.tolerance
+				<< ", \"worst\": { \"case\": " << result.worst_case << ", \"x\": " << result.worst_cell.x << ", \"y\": " << result.worst_cell.y
+				<< ", \"brush_size\": " << result.worst_brush_size << ", \"blend_range\": " << result.worst_blend_range << " }"
+				<< ", \"passed\": " << (result.Passed() ? "true" : "false") << (i + 1 < results.size() ? " },\n" : " }\n");
+		}
+		out << "]\n";
+	}
+};
+
+// The blend brushes written the plain way, as the reference the optimised
+// kernels are checked against: every average is summed cell by cell in double
+// precision from the cells as they were before the stamp (0 off the map), and
+// eased with the exact cubic. Every blend kernel of the editor takes its
+// averages from the summed-area table or a box blur, so this is the only
+// plain one.
+template <typename Field>
+class BlendReference{
+public:
+	enum Falloff{
+		// AdjustTerrain_BlendBallFractional and Fast2: the circle of the brush
+		// keeps max(2 d^2 / r^2 - 1, 0) of each cell's value; where several
+		// stamps of a batch cover a cell the least share kept counts
+		circle_keep,
+		// AdjustTerrain_BlendBallFractionalFast: the whole square takes
+		// max(1 - 2 d^2 / r^2, 0) of the average
+		square_blend
+	};
+
+	static double EaseInOutCubic(double x){
+		return x < 0.5 ? 4.0 * x * x * x : 1.0 - std::pow(-2.0 * x + 2.0, 3.0) / 2.0;
+	}
+
+	// Writes the cells the stamps at count centres leave in the size cells from
+	// from (row major) into out
+	static void Blend(const Field& field, const olc::vi2d* centres, int count, int brush_size, int blend_range, Falloff falloff,
+		olc::vi2d from, olc::vi2d size, std::vector<double>& out){
+		olc::vi2d source_from = from - olc::vi2d{ blend_range, blend_range };
+		olc::vi2d source_size = size + olc::vi2d{ 2 * blend_range, 2 * blend_range };
+		std::vector<float> source(size_t(source_size.x) * source_size.y);
+		field.ReadRect(source_from, source_size, source.data(), 1, source_size.x);
+		auto before = [&](int i, int j) {
+			return double(source[size_t(j + blend_range) * source_size.x + i + blend_range]);
+		};
+
+		double brush_size_squared = double(brush_size) * brush_size;
+		double window = double(2 * blend_range + 1) * double(2 * blend_range + 1);
+		out.assign(size_t(size.x) * size.y, 0.0);
+		for (int j = 0; j < size.y; j++) {
+			for (int i = 0; i < size.x; i++) {
+				olc::vi2d cell = from + olc::vi2d{ i, j };
+				// share of the average the cell takes
+				double blend = 0.0;
+				for (int stamp = 0; stamp < count; stamp++) {
+					olc::vi2d offset = cell - centres[stamp];
+					double distance_squared = double(offset.x) * offset.x + double(offset.y) * offset.y;
+					if (falloff == circle_keep) {
+						if (distance_squared < brush_size_squared) {
+							blend = std::max(blend, 1.0 - std::max(distance_squared / brush_size_squared * 2.0 - 1.0, 0.0));
+						}
+					}
+					else if (std::abs(offset.x) <= brush_size && std::abs(offset.y) <= brush_size) {
+						blend = std::max(blend, std::max(1.0 - 2.0 * distance_squared / brush_size_squared, 0.0));
+					}
+				}
+
+				double current = before(i, j);
+				if (blend <= 0.0) {
+					out[size_t(j) * size.x + i] = current;
+					continue;
+				}
+				double sum = 0.0;
+				for (int y = -blend_range; y <= blend_range; y++) {
+					for (int x = -blend_range; x <= blend_range; x++) {
+						sum += before(i + x, j + y);
+					}
+				}
+				double average = EaseInOutCubic(sum / window);
+				out[size_t(j) * size.x + i] = average * blend + current * (1.0 - blend);
+			}
+		}
+	}
+};
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Persistent worker threads for the editing kernels. ParallelFor hands out job
+// indices to the workers and the calling thread until all are done, so a frame
+// pays for a wake up instead of creating threads. Not reentrant: a job must
+// not call ParallelFor on the same pool.
+class WorkerPool{
+	std::vector<std::thread> threads;
+
+	std::mutex mutex;
+	std::condition_variable work_ready;
+	std::condition_variable work_done;
+	// the job is called through a plain function pointer so that starting one
+	// never allocates (a std::function of a capturing lambda may)
+	void (*job_invoke)(void* job, int index, int worker) = nullptr;
+	void* job = nullptr;
+	int job_count = 0;
+	std::atomic<int> next_job{ 0 };
+	int busy_workers = 0;
+	uint64_t generation = 0;
+	bool stopping = false;
+
+	void RunJobs(int worker){
+		for (int index = next_job++; index < job_count; index = next_job++) {
+			job_invoke(job, index, worker);
+		}
+	}
+
+	void WorkerLoop(int worker){
+		uint64_t seen_generation = 0;
+		while (true) {
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				work_ready.wait(lock, [&]{ return stopping || generation != seen_generation; });
+				if (stopping) {
+					return;
+				}
+				seen_generation = generation;
+			}
+
+			RunJobs(worker);
+
+			std::lock_guard<std::mutex> lock(mutex);
+			if (--busy_workers == 0) {
+				work_done.notify_one();
+			}
+		}
+	}
+
+public:
+	// one thread per core, counting the caller
+	static int DefaultWorkerCount(){
+		unsigned cores = std::thread::hardware_concurrency();
+		return cores > 1 ? int(cores) - 1 : 0;
+	}
+
+	explicit WorkerPool(int worker_count = DefaultWorkerCount()){
+		for (int worker = 1; worker <= worker_count; worker++) {
+			threads.emplace_back([this, worker]{ WorkerLoop(worker); });
+		}
+	}
+
+	~WorkerPool(){
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		work_ready.notify_all();
+		for (std::thread& thread : threads) {
+			thread.join();
+		}
+	}
+
+	WorkerPool(const WorkerPool&) = delete;
+	WorkerPool& operator=(const WorkerPool&) = delete;
+
+	// workers plus the calling thread; worker indices passed to jobs are below this
+	int ThreadCount() const{
+		return int(threads.size()) + 1;
+	}
+
+	// Runs job(index, worker) for every index in [0, count) and returns once all
+	// of them finished. The caller takes part as worker 0.
+	template <typename Job>
+	void ParallelFor(int count, Job&& job){
+		if (count <= 0) {
+			return;
+		}
+		if (threads.empty() || count == 1) {
+			for (int index = 0; index < count; index++) {
+				job(index, 0);
+			}
+			return;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			job_invoke = [](void* job, int index, int worker){
+				(*static_cast<std::remove_reference_t<Job>*>(job))(index, worker);
+			};
+			this->job = const_cast<void*>(static_cast<const void*>(&job));
+			job_count = count;
+			next_job = 0;
+			busy_workers = int(threads.size());
+			generation++;
+		}
+		work_ready.notify_all();
+
+		RunJobs(0);
+
+		std::unique_lock<std::mutex> lock(mutex);
+		work_done.wait(lock, [&]{ return busy_workers == 0; });
+		this->job = nullptr;
+		job_invoke = nullptr;
+	}
+};
@@ -1,6 +1,6 @@
 /**
  * Controls:
- * - WASD: move player (red ball)
+ * - WASD: move player (red ball), which can't go into the terrain (cells at least half solid).
  * - Left mouse button: Apply selected tool onto raycasted area (if it hits the "terrain").
  * - Left mouse button + CTRL: Apply selected tool onto raycasted area just once on click.
  * - Right mouse button: Apply selected tool onto raycasted area (if it hits the "terrain").
@@ -9,11 +9,100 @@
  * - Middle mouse button + CTRL: Draw white ball (terrain).
  * - Scrolling: Zoom in/out
  * - Scrolling + CTRL: Increase/decrease size of brush.
- * - Enter: Clear away canvas.
+ * - Enter: Clear away canvas (this also clears the undo history).
+ * - CTRL + Z: Undo the last stroke (everything drawn while a mouse button was held).
+ * - CTRL + Y or CTRL + SHIFT + Z: Redo.
  * - Space: Show/hide player/mouse circles.
  * - Keys 1-5: Select terraform tool.
  * - Escape: Reset transformed view (reset zoom and panned position)
  * - Shift: Increase player speed 2.5x times.
+ * - F5: Save the map into its terrain file (see --map), writing only chunks changed since the last save.
+ * - P: Show/hide the frame profiler overlay.
+ * - T: Save a Chrome trace of the recent frames (editor_trace.json, see --trace).
+ * - G: Switch the right button blend between the GPU and the CPU kernel (GPU needs a build with
+ *   OLC_GFX_OPENGL33 defined; the OpenGL 1.0 and headless renderers always blend on the CPU).
+ * - F: Switch settling on/off: loose material (cells under half solid) left around edits falls and
+ *   piles up, a small time budget per frame, while the rock stays put.
+ * - C: Show/hide the outline of the terrain (the marching squares contour at half solid).
+ * - E: Export that outline as OBJ polylines (terrain_contours.obj, see --contours).
+ * - N: Switch noclip on/off, letting the player move through the terrain.
+ * - B: Switch the progressive CPU blend on/off: a right button blend over a large area (a big brush
+ *   or blend range) first shows a preview blended at a quarter of the resolution, then refines it to
+ *   the full blend over the next frames within a time budget (see --refine-budget), so the frame a
+ *   stamp lands in only pays for the preview (see ProgressiveBlend.h). Other tools, undo, saving and
+ *   a new stroke first finish the refinement, and a stroke's undo step includes it.
+ *
+ * Sessions (see --host and --join): several editors work on one map, the host's. Every edit (the
+ * paint circle, the clear and the tool stamps of a frame) goes to the host, which numbers them and
+ * sends them to everyone in that order, so all apply the same edits to the same cells; a client's
+ * own edits show once the host has sent them back. Now and then the host sends the versions and
+ * checksums of the chunks edited since, and a client whose copy of one differs asks for the
+ * host's. Undo and redo, settling, the GPU blend and the progressive blend are off in a session, as
+ * their results would differ between editors.
+ *
+ * Embedding: the map and its tools live in TerrainEngine (TerrainEngine.h), which needs no window;
+ * this editor is one host of it. Other tools include that header, read and write the map's chunks
+ * in place and hear which cells changed through its listeners, see the comment on the class.
+ *
+ * Options:
+ * - --map-size <width> <height>: Size of the map in cells (default 512 512).
+ * - --map <file>: Terrain file to open (its size replaces --map-size) and to save into. Chunks are
+ *   read from it in the background as they come near the view or the player, or where either is
+ *   heading, and show their average value until then; tools and undo wait for the chunks they
+ *   touch. Without this option F5 writes terrain.map.
+ * - --resident-chunks <n>: Chunks of the terrain file kept in memory before the farthest ones
+ *   without unsaved edits are dropped again (default 4096, 8KB each).
+ * - --undo-budget <MB>: Memory the undo history may use before dropping the oldest strokes (default 256).
+ * - --trace <file>: Where T saves the trace; it is also saved there on exit.
+ * - --stats <file>: Append the editor's work counters to file as JSON Lines, a line every
+ *   --stats-interval seconds and one when it closes: rays and their steps, Gauss cone rays, cells the
+ *   tools read and wrote, chunks dirtied, textures and bytes uploaded, heap allocations while editing
+ *   and edit latency percentiles, for the interval and since start (see PerfCounters.h). With
+ *   --replay it gets one line for the whole replay.
+ * - --stats-interval <seconds>: How often --stats writes a line (default 1).
+ * - --cpu-blend: Start with the blend brush on the CPU even when the GPU could run it.
+ * - --full-blend: Start with the progressive blend off (see B).
+ * - --refine-budget <ms>: Time per frame the progressive blend refines in (default 4).
+ * - --settle: Start with settling on (see F).
+ * - --contours <file>: Where E exports the outline.
+ * - --record <file>: Log every edit of the session (tool, settings, stamps, paint, clear, undo and
+ *   redo) to a stroke log, see StrokeLog.h.
+ * - --replay <file>: Replay a stroke log instead of opening the editor, as fast as it goes and with
+ *   no window, onto the map of --map (when it exists, it must be the log's size) or an empty one,
+ *   then print the time taken and a checksum of the map. Blends run on the CPU at full resolution
+ *   and settling is left out, so a replay always gives the same map. A frame whose tool or settings
+ *   the editor wouldn't use itself (as for a session's frames) stops it with an error.
+ * - --replay-output <file>: Save the replayed map as a terrain file.
+ * - --generate <seed>: Start on generated terrain (noise shaped into ground, with caves carved through
+ *   it) instead of an empty map, unless --map opens a file. The map is generated on all cores, so
+ *   even 16384x16384 takes seconds. --replay starts from the same terrain when given it too.
+ * - --generate-scale <cells>: Size of the largest landmasses (default 256).
+ * - --generate-octaves <n>: Noise layers, each twice as fine as the one before (default 6).
+ * - --generate-solid <fraction>: About how much of the map is ground before the caves (default 0.5).
+ * - --generate-caves <width>: Width of the tunnels in noise units; 0 carves none (default 0.025).
+ * - --host <port>: Start a session on this editor's map that others can join on TCP port.
+ * - --join <host:port>: Join the session of the editor at host (a name or an address; IPv6
+ *   addresses in brackets) instead of opening a map, taking its map as it is now.
+ * - --contour-simplify <cells>: How far the outline may stray from the exact contour to save
+ *   points (default 0, every crossing kept).
+ * - --benchmark [csv|json]: Time every tool and raycast on generated terrain instead of
+ *   opening the editor, and print ns/op and cells/second (default csv). Needs no window,
+ *   so a build with OLC_PGE_HEADLESS defined (Renderer_Headless, no X11/GL) runs it too.
+ * - --benchmark-output <file>: Write the benchmark results to file instead of stdout.
+ * - --benchmark-iterations <n>: Timed iterations per kernel and setting (default 50).
+ * - --benchmark-brush-sizes <a,b,...>: brush_size sweep (default 4,8,16,32,64).
+ * - --benchmark-blend-ranges <a,b,...>: blend_range sweep (default 5,15,30).
+ * - --benchmark-seed <n>: Seed of the generated terrain (default 1).
+ * - --verify [csv|json]: Check every CPU blend kernel against a plain reference (Verify.h) on random
+ *   terrain, brush sizes, blend ranges and centres, some over the map's edge, and the raycasts that
+ *   skip cells (and DistanceField::SphereCast) against the plain unit-step walk on random rays,
+ *   instead of opening the editor; print
+ *   each kernel's max and mean error, overall and for cells whose blend reaches past the edge (rays
+ *   that end there), and exit with 1 if one is off by more than it may be. --benchmark runs the same check
+ *   first and doesn't time anything when it fails. Needs no window either.
+ * - --verify-output <file>: Write the check's results to file instead of stdout.
+ * - --verify-cases <n>: Random cases the check runs (default 40).
+ * - --verify-seed <n>: Seed of the cases (default 1).
 */
 
 
@@ -27,39 +116,65 @@
 #include <math.h>
 
 #include <queue>
-
-template <typename T>
-class BlockBuffer{
-	std::vector<T> buffer;
-	int x_offset;
-	int y_offset;
-	int x_size;
-	int y_size;
-
-public:
-	// from and to inclusive
-	BlockBuffer(olc::vi2d from, olc::vi2d to){
-		x_offset = from.x;
-		y_offset = from.y;
-		x_size = to.x - from.x + 1;
-		y_size = to.y - from.y + 1;
-		buffer.resize(x_size * y_size);
-		std::fill(buffer.begin(), buffer.end(), T()));
-	}
-
-	int get_index(int x, int y){
-		return (y - y_offset) * x_size + (x - x_offset);
-	}
-	void set(int x, int y, T value){
-		int index = get_index(x, y);
-		buffer[index] = value;
-	}
-	T get(int x, int y){
-		return buffer[get_index(x, y)];
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <new>
+#include <sstream>
+
+#include "ChunkedDensityField.h"
+#include "TerrainRenderer.h"
+#include "OccupancyPyramid.h"
+#include "SummedAreaTable.h"
+#include "SettleSimulation.h"
+#include "DistanceField.h"
+#include "ContourMesher.h"
+#include "StrokeLog.h"
+#include "TerrainGenerator.h"
+#include "NetSession.h"
+#include "ChunkSync.h"
+#include "Raycast.h"
+#include "ConeCast.h"
+#include "BoxBlur.h"
+#include "BrushExecutor.h"
+#include "ScratchArena.h"
+#include "Benchmark.h"
+#include "Verify.h"
+#include "FrameProfiler.h"
+#include "PerfCounters.h"
+#include "TerrainFile.h"
+#include "UndoJournal.h"
+#include "BrushStroke.h"
+#include "ChunkStreamer.h"
+#include "GpuBlend.h"
+#include "ProgressiveBlend.h"
+#include "BrushStampCache.h"
+#include "BrushCurves.h"
+#include "BrushKernels.h"
+#include "TerrainEngine.h"
+
+// every heap allocation is counted, so the stats can tell how many the edits make;
+// kept out of line, or GCC takes the inlined malloc() / free() for a mismatch
+[[gnu::noinline]] void* operator new(std::size_t size)
+{
+	PerfCounters::heap_allocations.fetch_add(1, std::memory_order_relaxed);
+	if (void* block = std::malloc(size ? size : 1)) {
+		return block;
 	}
-};
+	throw std::bad_alloc();
+}
+[[gnu::noinline]] void operator delete(void* block) noexcept
+{
+	std::free(block);
+}
+[[gnu::noinline]] void operator delete(void* block, std::size_t) noexcept
+{
+	std::free(block);
+}
 
-class Example : public olc::PixelGameEngine
+// The editor's window and input around TerrainEngine, which holds the map and
+// its tools
+class Example : public olc::PixelGameEngine, public TerrainEngine
 {
 public:
 	enum class EditMode {
@@ -74,34 +189,106 @@ public:
 
 	olc::TileTransformedView tv;
 	
-	olc::vi2d map_size = { 512, 512 };
-	olc::vf2d player_pos = map_size/2;
-
-	olc::vf2d mouse_pos;
-
-	olc::Sprite map{map_size.x, map_size.y};
+	ChunkedTerrainRenderer<TerrainMap> map_renderer;
+	// where F5 saves to; opened at start when load_map_file is set
+	TerrainFile<TerrainMap> map_file;
+	std::string map_path = "terrain.map";
+	bool load_map_file = false;
+	// what the map starts as when no file is loaded, see TerrainGenerator.h
+	bool generate_map = false;
+	TerrainGeneratorSettings generator;
+	// reads the chunks of map_file in the background
+	ChunkStreamer<TerrainMap> streamer{ map_file, map };
+	olc::vf2d last_player_pos;
+	olc::vf2d last_view_centre;
+	// -1 while an undo waits for its chunks to be read, 1 for a redo
+	int history_step = 0;
+	// a mouse button was down last frame
+	bool buttons_held = false;
+	float player_radius = 8.0f;
+	bool noclip = false;
+	UndoJournal<TerrainMap> undo;
+	// lets loose material fall after edits, see SettleSimulation.h
+	SettleSimulation<TerrainMap> settle;
+	// outline of the terrain, kept per chunk, see ContourMesher.h
+	ContourMesher<TerrainMap> contours;
+	bool show_contours = false;
+	std::string contour_path = "terrain_contours.obj";
+	// times the phases of OnUserUpdate for the overlay and trace
+	FrameProfiler profiler;
+	int phase_input = profiler.AddPhase("input", olc::Pixel(0x3e, 0x95, 0xef));
+	int phase_load = profiler.AddPhase("load", olc::YELLOW);
+	int phase_session = profiler.AddPhase("session", olc::CYAN);
+	int phase_raycast = profiler.AddPhase("raycast", olc::Pixel(0xd3, 0x8e, 0x28));
+	int phase_brush = profiler.AddPhase("brush", olc::RED);
+	int phase_refine = profiler.AddPhase("refine", olc::Pixel(0xff, 0x80, 0x80));
+	int phase_settle = profiler.AddPhase("settle", olc::Pixel(0xa0, 0x70, 0x40));
+	int phase_draw = profiler.AddPhase("draw", olc::GREEN);
+	int phase_overlay = profiler.AddPhase("overlay", olc::MAGENTA);
+	std::string trace_path = "editor_trace.json";
+	bool save_trace_on_exit = false;
+
+	// counts of the work done, written to stats_path every stats_interval seconds
+	ChunkDirtyTracker counted_dirty;
+	std::string stats_path;
+	std::ofstream stats_file;
+	float stats_interval = 1.0f;
+	float stats_timer = 0.0f;
+	double stats_time = 0.0;
+	std::chrono::steady_clock::time_point frame_start;
+	// the frame applied stamps, so its latency counts
+	bool frame_edited = false;
+
+	// edits of the session, logged per frame when record_path is set
+	std::string record_path;
+	StrokeLogWriter stroke_log;
+	StrokeLogEntry logged_frame;
+	float log_time = 0.0f;
+	bool log_was_held = false;
+
+	// shared editing session when hosting or joined, see NetSession.h
+	std::unique_ptr<NetSession> session;
+	ChunkSync<TerrainMap> chunk_sync;
+	enum SessionMessage : uint8_t {
+		// a frame's edits, StrokeLogFrame and stamps: from a client to the host,
+		// then from the host to everyone after a uint32 sequence number
+		op_message = NetSession::first_user_message,
+		// host to client: uint32 chunk index, uint32 version, ChunkSync::Encode()
+		chunk_message,
+		// host to clients: uint32 sequence number of the last op, then uint32
+		// index, uint32 version and uint64 checksum of every chunk edited lately
+		checksum_message,
+		// client to host: uint32 index of a chunk to send again
+		chunk_request_message,
+		// host to a new client after the map's chunks: uint32 sequence number they are as of
+		synced_message,
+	};
+	// the last op applied
+	uint32_t session_seq = 0;
+	float checksum_interval = 1.0f;
+	float checksum_timer = 0.0f;
+	std::vector<int> checksum_chunks;
+	int chunks_resynced = 0;
 
-	int blend_range = 15;
+	// terrain decals go on their own layer underneath the tool overlay on layer 0
+	uint8_t map_layer = 0;
 
-	int brush_size = 16;
 	float brush_size_f = brush_size;
 	float brush_size_min = 4.0f;
 	float brush_size_max = 200.0f;
 	float brush_size_multiplier = 1.1f;
+	// widest blend a session op may ask for; the blends read a halo this wide
+	int blend_range_max = 64;
 
 	float speed = 100.0f;
-	float raycast_max_distance = 500.0f;
 
+	// seconds between stamps of a held button
 	float draw_speed = (2.0f / 60.0f);
-	float accumulate_delta = 0.0f;
-	bool can_edit_terrain = true;
-
+	StrokeTimer stroke_timer{ draw_speed };
+	std::vector<BrushStamp> stamps;
 	bool draw_edit_tools = true;
 
-	float terraform_angle = 50.0f;
-	float terraform_raycast_step = 0.5f;
-
-	Example()
+	Example(olc::vi2d map_size = { 512, 512 }) : TerrainEngine(map_size)
 	{
 		sAppName = "Editor";
 	}
@@ -109,1119 +296,1653 @@ public:
 public:
 	bool OnUserCreate() override
 	{
-		ResetMap();
-
-		tv = olc::TileTransformedView({ ScreenWidth(), ScreenHeight() }, { 1, 1 });
-
-		return true;
-	}
-
-	bool OnUserUpdate(float fElapsedTime) override
-	{
-		if(!GetKey(olc::Key::CTRL).bHeld){
-			tv.HandlePanAndZoom();
+		map_layer = uint8_t(CreateLayer());
+		EnableLayer(map_layer, true);
+		map_renderer.Attach(map);
+		contours.Attach(map);
+		map.AddDirtyTracker(&counted_dirty);
+		if (!stats_path.empty() && !OpenStats()) {
+			return false;
 		}
-		
-		Clear(olc::BLACK);
 
-		if (accumulate_delta > draw_speed) {
-			can_edit_terrain = true;
+		if (load_map_file) {
+			if (!map_file.Open(map_path) || !map_file.Attach(map)) {
+				std::cerr << "Can't open terrain file " << map_path << "\n";
+				return false;
+			}
+		}
+		else if (generate_map) {
+			GenerateMap();
 		}
 		else {
-			accumulate_delta += fElapsedTime;
+			ResetMap();
 		}
-
-		// Form ray cast from player into scene
-		olc::vf2d ray_start_pos = player_pos;
-		olc::vf2d ray_dir = (mouse_pos - player_pos).norm();
-
-		mouse_pos = { float(GetMouseX()), float(GetMouseY()) };
-		mouse_pos = tv.ScreenToWorld(mouse_pos);
-
-		if(GetKey(olc::Key::CTRL).bHeld){
-			if (GetMouseWheel() > 0) {
-				brush_size_f *= brush_size_multiplier;
-				brush_size_f = std::clamp(brush_size_f, brush_size_min, brush_size_max);
-				brush_size = std::floor(brush_size_f);
-			}
-			else if (GetMouseWheel() < 0){
-				brush_size_f /= brush_size_multiplier;
-				brush_size_f = std::clamp(brush_size_f, brush_size_min, brush_size_max);
-				brush_size = std::floor(brush_size_f);
-			}
-
-			if (GetMouse(2).bHeld) {
-				PaintMouseLocation(mouse_pos);
-			}
+		undo.Attach(map);
+		settle.Attach(map, brushes.Pool());
+		if (session) {
+			StartSession();
 		}
 
-		if (GetKey(olc::Key::ENTER).bPressed) {
-			ResetMap();
+		if (use_gpu_blend) {
+			use_gpu_blend = gpu_blend.Init();
+			std::cout << "Blend brush runs on the " << (use_gpu_blend ? "GPU" : "CPU") << "\n";
 		}
 
-		if (GetKey(olc::Key::ESCAPE).bPressed) {
-			tv.SetWorldScale({1.0f, 1.0f});
-			tv.SetWorldOffset({0.0f, 0.0f});
+		if (!record_path.empty() && !stroke_log.Open(record_path, map.Size())) {
+			std::cerr << "Can't write " << record_path << "\n";
+			return false;
 		}
 
-		if (GetKey(olc::Key::SPACE).bPressed) {
-			draw_edit_tools = !draw_edit_tools;
-		}		
-
-		float player_speed = speed;
-		if (GetKey(olc::Key::SHIFT).bHeld) {
-			player_speed *= 2.5f;
-		}
+		tv = olc::TileTransformedView({ ScreenWidth(), ScreenHeight() }, { 1, 1 });
+		last_player_pos = player_pos;
+		last_view_centre = (tv.GetWorldTL() + tv.GetWorldBR()) * 0.5f;
 
-		if (GetKey(olc::Key::W).bHeld) player_pos.y -= player_speed * fElapsedTime;
-		if (GetKey(olc::Key::S).bHeld) player_pos.y += player_speed * fElapsedTime;
-		if (GetKey(olc::Key::A).bHeld) player_pos.x -= player_speed * fElapsedTime;
-		if (GetKey(olc::Key::D).bHeld) player_pos.x += player_speed * fElapsedTime;
+		return true;
+	}
 
-		if (GetKey(olc::Key::K1).bPressed) {
-			mode = EditMode::CircleFull;
+	bool OnUserDestroy() override
+	{
+		if (save_trace_on_exit) {
+			SaveTrace();
 		}
-		else if (GetKey(olc::Key::K2).bPressed) {
-			mode = EditMode::CircleFractional;
+		if (stats_file.is_open()) {
+			counters.WriteJson(stats_file, stats_time);
 		}
-		else if (GetKey(olc::Key::K3).bPressed) {
-			mode = EditMode::GaussFractional;
+		if (!stroke_log.Close()) {
+			std::cerr << "Can't write " << record_path << "\n";
 		}
-		else if (GetKey(olc::Key::K4).bPressed) {
-			mode = EditMode::AdjustTerrain_BlendBallFull;
+		if (session) {
+			std::cout << "Session sent " << session->BytesSent() << " bytes, received " << session->BytesReceived() << " bytes, "
+				<< chunks_resynced << " chunks resynced\n";
+			session.reset();
 		}
-		else if (GetKey(olc::Key::K5).bPressed) {
-			mode = EditMode::AdjustTerrain_BlendBallFractional;
+		gpu_blend.Release();
+		return true;
+	}
+
+	bool OnUserUpdate(float fElapsedTime) override
+	{
+		profiler.BeginFrame(fElapsedTime);
+		frame_start = std::chrono::steady_clock::now();
+		frame_edited = false;
+		// last frame's GPU blend, long done by now
+		ResolveGpuBlend();
+		log_time += fElapsedTime;
+		logged_frame.frame = StrokeLogFrame{};
+		logged_frame.frame.time = log_time;
+		logged_frame.stamps.clear();
+
+		{
+			FrameProfiler::Scope scope(profiler, phase_session);
+			ProcessSession(fElapsedTime);
 		}
 
-		olc::vi2d intersection_result;
-		float max_distance = std::min(raycast_max_distance, (mouse_pos - player_pos).mag());
-		bool raycast_hit = RaycastPixelTarget(ray_start_pos, ray_dir, max_distance, intersection_result);
-
-		if (raycast_hit) {
-			// Right mouse button
-			if (GetKey(olc::Key::CTRL).bHeld && GetMouse(1).bPressed || !GetKey(olc::Key::CTRL).bHeld && GetMouse(1).bHeld) {
-				if (can_edit_terrain) {
-					can_edit_terrain = false;
-					accumulate_delta = 0.0f;
-
-					switch (mode) {
-					case EditMode::CircleFull:
-						DestructTerrain_CircleFull(intersection_result, ray_dir);
-						break;
-					case EditMode::CircleFractional:
-						DestructTerrain_CircleFractional(intersection_result, ray_dir);
-						break;
-					case EditMode::GaussFractional:
-						DestructTerrain_GaussFractional(intersection_result, ray_dir);
-						break;
-					case EditMode::AdjustTerrain_BlendBallFull:
-						AdjustTerrain_BlendBallFractional(intersection_result, ray_dir);
-						break;
-					case EditMode::AdjustTerrain_BlendBallFractional:
-						AdjustTerrain_BlendBallFractionalFast2();
-						break;
-					default:
-						std::cout << "Error\n";
-					}
+		olc::vf2d ray_start_pos;
+		olc::vf2d ray_dir;
+
+		{
+			FrameProfiler::Scope scope(profiler, phase_input);
+
+			if(!GetKey(olc::Key::CTRL).bHeld){
+				tv.HandlePanAndZoom();
+			}
+		
+			Clear(olc::BLANK);
+			// last frame's temporaries are no longer referenced
+			scratch.Reset();
+
+			// everything drawn while a mouse button stays down is one undo step,
+			// along with the refinement of its blends
+			bool held = GetMouse(0).bHeld || GetMouse(1).bHeld || GetMouse(2).bHeld;
+			if (held) {
+				if (!buttons_held && progressive_blend.Pending()) {
+					FinishBlends();
+					undo.EndStroke();
 				}
+				undo.BeginStroke();
+				logged_frame.frame.flags |= StrokeLogFrame::stroke_held;
+			}
+			else if (!progressive_blend.Pending()) {
+				undo.EndStroke();
 			}
+			buttons_held = held;
+
+			// Form ray cast from player into scene
+			ray_start_pos = player_pos;
+			ray_dir = (mouse_pos - player_pos).norm();
 
-			// Left mouse button
-			else if (GetKey(olc::Key::CTRL).bHeld && GetMouse(0).bPressed || !GetKey(olc::Key::CTRL).bHeld && GetMouse(0).bHeld) {
-				if (can_edit_terrain) {
-					can_edit_terrain = false;
-					accumulate_delta = 0.0f;
-
-					switch (mode) {
-					case EditMode::CircleFull:
-						DestructTerrain_CircleFull(intersection_result, ray_dir);
-						break;
-					case EditMode::CircleFractional:
-						DestructTerrain_CircleFractional(intersection_result, ray_dir);
-						break;
-					case EditMode::GaussFractional:
-						RestoreTerrain_GaussFractional(intersection_result, ray_dir);
-						break;
-					case EditMode::AdjustTerrain_BlendBallFull:
-						AdjustTerrain_BlendBallFractional(intersection_result, ray_dir);
-						break;
-					case EditMode::AdjustTerrain_BlendBallFractional:
-						AdjustTerrain_BlendBallFractional(intersection_result, ray_dir);
-						break;
-					default:
-						std::cout << "Error\n";
+			mouse_pos = { float(GetMouseX()), float(GetMouseY()) };
+			mouse_pos = tv.ScreenToWorld(mouse_pos);
+
+			if(GetKey(olc::Key::CTRL).bHeld){
+				if (GetMouseWheel() > 0) {
+					brush_size_f *= brush_size_multiplier;
+					brush_size_f = std::clamp(brush_size_f, brush_size_min, brush_size_max);
+					brush_size = std::floor(brush_size_f);
+				}
+				else if (GetMouseWheel() < 0){
+					brush_size_f /= brush_size_multiplier;
+					brush_size_f = std::clamp(brush_size_f, brush_size_min, brush_size_max);
+					brush_size = std::floor(brush_size_f);
+				}
+
+				olc::vi2d paint_radius{ 32, 32 };
+				if (GetMouse(2).bHeld && streamer.Ensure(olc::vi2d(mouse_pos) - paint_radius, olc::vi2d(mouse_pos) + paint_radius)) {
+					if (EditsLocally()) {
+						FinishBlends();
+						PaintMouseLocation(mouse_pos);
 					}
+					logged_frame.frame.flags |= StrokeLogFrame::paint;
+					logged_frame.frame.paint_pos = mouse_pos;
 				}
 			}
-		}
-
-		tv.DrawSprite({ 0,0 }, &map);
 
-		if(draw_edit_tools){
-			if (raycast_hit) {
-				tv.DrawCircle(intersection_result, brush_size, olc::Pixel(0x3e, 0x95, 0xef));
+			if (GetKey(olc::Key::ENTER).bPressed) {
+				if (EditsLocally()) {
+					ResetMap();
+				}
+				logged_frame.frame.flags |= StrokeLogFrame::clear;
 			}
 
-			tv.DrawLine(player_pos, mouse_pos, olc::Pixel(0xd38e28ff), 0xF0F0F0F0);
+			if (GetKey(olc::Key::ESCAPE).bPressed) {
+				tv.SetWorldScale({1.0f, 1.0f});
+				tv.SetWorldOffset({0.0f, 0.0f});
+			}
 
-			// Draw Player
-			tv.FillCircle(player_pos, 8, olc::RED);
+			if (GetKey(olc::Key::SPACE).bPressed) {
+				draw_edit_tools = !draw_edit_tools;
+			}		
 
-			// Draw Mouse
-			if (GetMouse(0).bHeld || GetMouse(1).bHeld) {
-				tv.FillCircle(mouse_pos, brush_size, olc::GREEN);
+			if (GetKey(olc::Key::CTRL).bHeld && GetKey(olc::Key::Z).bPressed) {
+				history_step = GetKey(olc::Key::SHIFT).bHeld ? 1 : -1;
 			}
-			else {
-				tv.FillCircle(mouse_pos, brush_size, olc::DARK_GREEN);
+			else if (GetKey(olc::Key::CTRL).bHeld && GetKey(olc::Key::Y).bPressed) {
+				history_step = 1;
 			}
-		}
-		
-		return true;
-	}
-
-	bool RaycastPixel(olc::vi2d ray_start_pos, olc::vf2d ray_dir, float max_distance, olc::vi2d& intersection_result) {
-		// DDA Algorithm ==============================================
-		// https://lodev.org/cgtutor/raycasting.html
-
-
-		// Lodev.org also explains this additional optimistaion (but it's beyond scope of video)
-		// olc::vf2d vRayUnitStepSize = { abs(1.0f / ray_dir.x), abs(1.0f / ray_dir.y) };
-
-		olc::vf2d vRayUnitStepSize = { sqrt(1 + (ray_dir.y / ray_dir.x) * (ray_dir.y / ray_dir.x)), sqrt(1 + (ray_dir.x / ray_dir.y) * (ray_dir.x / ray_dir.y)) };
-		olc::vi2d vMapCheck = ray_start_pos;
-		olc::vf2d vRayLength1D;
-		olc::vi2d vStep;
+			if (session) {
+				history_step = 0;
+			}
+			StepHistory();
 
-		// Establish Starting Conditions
-		if (ray_dir.x < 0)
-		{
-			vStep.x = -1;
-			vRayLength1D.x = (ray_start_pos.x - float(vMapCheck.x)) * vRayUnitStepSize.x;
-		}
-		else
-		{
-			vStep.x = 1;
-			vRayLength1D.x = (float(vMapCheck.x + 1) - ray_start_pos.x) * vRayUnitStepSize.x;
-		}
+			if (GetKey(olc::Key::F5).bPressed) {
+				SaveMap();
+			}
 
-		if (ray_dir.y < 0)
-		{
-			vStep.y = -1;
-			vRayLength1D.y = (ray_start_pos.y - float(vMapCheck.y)) * vRayUnitStepSize.y;
-		}
-		else
-		{
-			vStep.y = 1;
-			vRayLength1D.y = (float(vMapCheck.y + 1) - ray_start_pos.y) * vRayUnitStepSize.y;
-		}
+			if (GetKey(olc::Key::P).bPressed) {
+				profiler.show_overlay = !profiler.show_overlay;
+			}
 
-		// Perform "Walk" until collision or range check
-		bool bTileFound = false;
-		float fDistance = 0.0f;
-		while (!bTileFound && fDistance < max_distance)
-		{
-			// Walk along shortest path
-			if (vRayLength1D.x < vRayLength1D.y)
-			{
-				vMapCheck.x += vStep.x;
-				fDistance = vRayLength1D.x;
-				vRayLength1D.x += vRayUnitStepSize.x;
-			}
-			else
-			{
-				vMapCheck.y += vStep.y;
-				fDistance = vRayLength1D.y;
-				vRayLength1D.y += vRayUnitStepSize.y;
-			}
-
-			// Test tile at new test point
-			if (vMapCheck.x >= 0 && vMapCheck.x < map_size.x && vMapCheck.y >= 0 && vMapCheck.y < map_size.y)
-			{
-				if (MapLocationIsEmpty(vMapCheck) == false)
-				{
-					bTileFound = true;
-				}
+			if (GetKey(olc::Key::T).bPressed) {
+				SaveTrace();
 			}
-		}
 
-		intersection_result = vMapCheck;
+			if (GetKey(olc::Key::G).bPressed && gpu_blend.IsReady() && !session) {
+				use_gpu_blend = !use_gpu_blend;
+			}
 
-		// Calculate intersection location
-		/*if (bTileFound)
-		{
+			if (GetKey(olc::Key::F).bPressed && !session) {
+				settle.enabled = !settle.enabled;
+			}
 
-			intersection_result = ray_start_pos + ray_dir * fDistance;
-		}*/
+			if (GetKey(olc::Key::C).bPressed) {
+				show_contours = !show_contours;
+			}
 
-		return bTileFound;
-	}
+			if (GetKey(olc::Key::E).bPressed) {
+				ExportContours();
+			}
 
-	bool RaycastPrePixel(olc::vi2d ray_start_pos, olc::vf2d ray_dir, float max_distance, olc::vi2d& intersection_result) {
-		// DDA Algorithm ==============================================
-		// https://lodev.org/cgtutor/raycasting.html
+			float player_speed = speed;
+			if (GetKey(olc::Key::SHIFT).bHeld) {
+				player_speed *= 2.5f;
+			}
 
+			if (GetKey(olc::Key::N).bPressed) {
+				noclip = !noclip;
+			}
 
-		// Lodev.org also explains this additional optimistaion (but it's beyond scope of video)
-		// olc::vf2d vRayUnitStepSize = { abs(1.0f / ray_dir.x), abs(1.0f / ray_dir.y) };
+			if (GetKey(olc::Key::B).bPressed && !session) {
+				FinishBlends();
+				use_progressive_blend = !use_progressive_blend;
+			}
 
-		olc::vf2d vRayUnitStepSize = { sqrt(1 + (ray_dir.y / ray_dir.x) * (ray_dir.y / ray_dir.x)), sqrt(1 + (ray_dir.x / ray_dir.y) * (ray_dir.x / ray_dir.y)) };
-		olc::vi2d vMapCheck = ray_start_pos;
-		olc::vf2d vRayLength1D;
-		olc::vi2d vStep;
+			olc::vf2d move;
+			if (GetKey(olc::Key::W).bHeld) move.y -= player_speed * fElapsedTime;
+			if (GetKey(olc::Key::S).bHeld) move.y += player_speed * fElapsedTime;
+			if (GetKey(olc::Key::A).bHeld) move.x -= player_speed * fElapsedTime;
+			if (GetKey(olc::Key::D).bHeld) move.x += player_speed * fElapsedTime;
+			MovePlayer(move);
 
-		// Establish Starting Conditions
-		if (ray_dir.x < 0)
-		{
-			vStep.x = -1;
-			vRayLength1D.x = (ray_start_pos.x - float(vMapCheck.x)) * vRayUnitStepSize.x;
-		}
-		else
-		{
-			vStep.x = 1;
-			vRayLength1D.x = (float(vMapCheck.x + 1) - ray_start_pos.x) * vRayUnitStepSize.x;
+			if (GetKey(olc::Key::K1).bPressed) {
+				mode = EditMode::CircleFull;
+			}
+			else if (GetKey(olc::Key::K2).bPressed) {
+				mode = EditMode::CircleFractional;
+			}
+			else if (GetKey(olc::Key::K3).bPressed) {
+				mode = EditMode::GaussFractional;
+			}
+			else if (GetKey(olc::Key::K4).bPressed) {
+				mode = EditMode::AdjustTerrain_BlendBallFull;
+			}
+			else if (GetKey(olc::Key::K5).bPressed) {
+				mode = EditMode::AdjustTerrain_BlendBallFractional;
+			}
 		}
 
-		if (ray_dir.y < 0)
 		{
-			vStep.y = -1;
-			vRayLength1D.y = (ray_start_pos.y - float(vMapCheck.y)) * vRayUnitStepSize.y;
+			FrameProfiler::Scope scope(profiler, phase_load);
+			StreamMap(fElapsedTime);
 		}
-		else
+
+		olc::vi2d intersection_result;
+		bool raycast_hit;
 		{
-			vStep.y = 1;
-			vRayLength1D.y = (float(vMapCheck.y + 1) - ray_start_pos.y) * vRayUnitStepSize.y;
+			FrameProfiler::Scope scope(profiler, phase_raycast);
+			float max_distance = std::min(raycast_max_distance, (mouse_pos - player_pos).mag());
+			raycast_hit = RaycastPixelTarget(ray_start_pos, ray_dir, max_distance, intersection_result);
 		}
 
-		// Perform "Walk" until collision or range check
-		bool bTileFound = false;
-		float fDistance = 0.0f;
-		olc::vi2d previous_tile = vMapCheck;
-		while (!bTileFound && fDistance < max_distance)
 		{
-			previous_tile = vMapCheck;
-
-			// Walk along shortest path
-			if (vRayLength1D.x < vRayLength1D.y)
-			{
-				vMapCheck.x += vStep.x;
-				fDistance = vRayLength1D.x;
-				vRayLength1D.x += vRayUnitStepSize.x;
-			}
-			else
-			{
-				vMapCheck.y += vStep.y;
-				fDistance = vRayLength1D.y;
-				vRayLength1D.y += vRayUnitStepSize.y;
-			}
-
-			// Test tile at new test point
-			if (vMapCheck.x >= 0 && vMapCheck.x < map_size.x && vMapCheck.y >= 0 && vMapCheck.y < map_size.y)
-			{
-				if (MapLocationIsEmpty(vMapCheck) == false)
-				{
-					bTileFound = true;
+			FrameProfiler::Scope scope(profiler, phase_brush);
+			uint64_t allocations = PerfCounters::heap_allocations.load(std::memory_order_relaxed);
+
+			// CTRL clicks apply the tool once, a held button at the fixed draw_speed rate
+			bool ctrl = GetKey(olc::Key::CTRL).bHeld;
+			int button = -1;
+			if (ctrl && GetMouse(1).bPressed || !ctrl && GetMouse(1).bHeld) {
+				button = 1;
+			}
+			else if (ctrl && GetMouse(0).bPressed || !ctrl && GetMouse(0).bHeld) {
+				button = 0;
+			}
+
+			stamps.clear();
+			if (ctrl) {
+				stroke_timer.Stop();
+				if (button >= 0) {
+					stamps.push_back({ player_pos, mouse_pos });
 				}
 			}
-		}
+			else {
+				stroke_timer.interval = draw_speed;
+				stroke_timer.Advance(button >= 0, fElapsedTime, player_pos, mouse_pos, stamps);
+			}
+			// the tools wait for every chunk they could reach to be read
+			if (!stamps.empty() && !EnsureReach(stamps)) {
+				stamps.clear();
+			}
+			if (EditsLocally()) {
+				ApplyStamps(button, stamps);
+			}
+			LogFrame(button, stamps);
 
-		if (MapLocationIsFull(vMapCheck)) {
-			intersection_result = previous_tile;
+			map.Compact();
+			counters.Add(PerfCounters::edit_allocations, PerfCounters::heap_allocations.load(std::memory_order_relaxed) - allocations);
 		}
-		else {
-			intersection_result = vMapCheck;
-		}
-
-		// Calculate intersection location
-		/*if (bTileFound)
-		{
-
-			intersection_result = ray_start_pos + ray_dir * fDistance;
-		}*/
-
-		return bTileFound;
-	}
 
-	bool RaycastPixelTarget(olc::vi2d ray_start_pos, olc::vf2d ray_dir, float max_distance, olc::vi2d& intersection_result) {
-		// DDA Algorithm ==============================================
-		// https://lodev.org/cgtutor/raycasting.html
-
-
-		// Lodev.org also explains this additional optimistaion (but it's beyond scope of video)
-		// olc::vf2d vRayUnitStepSize = { abs(1.0f / ray_dir.x), abs(1.0f / ray_dir.y) };
-
-		olc::vf2d vRayUnitStepSize = { sqrt(1 + (ray_dir.y / ray_dir.x) * (ray_dir.y / ray_dir.x)), sqrt(1 + (ray_dir.x / ray_dir.y) * (ray_dir.x / ray_dir.y)) };
-		olc::vi2d vMapCheck = ray_start_pos;
-		olc::vf2d vRayLength1D;
-		olc::vi2d vStep;
-
-		// Establish Starting Conditions
-		if (ray_dir.x < 0)
-		{
-			vStep.x = -1;
-			vRayLength1D.x = (ray_start_pos.x - float(vMapCheck.x)) * vRayUnitStepSize.x;
-		}
-		else
 		{
-			vStep.x = 1;
-			vRayLength1D.x = (float(vMapCheck.x + 1) - ray_start_pos.x) * vRayUnitStepSize.x;
+			FrameProfiler::Scope scope(profiler, phase_refine);
+			CountRefined(progressive_blend.Refine(map, brushes.Pool(), refine_budget_ms));
 		}
 
-		if (ray_dir.y < 0)
 		{
-			vStep.y = -1;
-			vRayLength1D.y = (ray_start_pos.y - float(vMapCheck.y)) * vRayUnitStepSize.y;
-		}
-		else
-		{
-			vStep.y = 1;
-			vRayLength1D.y = (float(vMapCheck.y + 1) - ray_start_pos.y) * vRayUnitStepSize.y;
+			FrameProfiler::Scope scope(profiler, phase_settle);
+			// chunks still being read hold a placeholder, which mustn't move, and
+			// blends being refined would write over what fell
+			if (!progressive_blend.Pending()) {
+				settle.Update(fElapsedTime, [&](int chunk_index) {
+					return map_file.PendingChunks() > 0 && map_file.IsPending(chunk_index);
+				});
+			}
+			// the refinement and settling wrote after the brush phase's Compact();
+			// a chunk left touched would never tell the undo journal about the
+			// next stroke's first write to it, so that stroke couldn't be undone
+			map.Compact();
 		}
 
-		// Perform "Walk" until collision or range check
-		bool bTileFound = false;
-		float fDistance = 0.0f;
-		while (!bTileFound && fDistance < max_distance)
 		{
-			// Walk along shortest path
-			if (vRayLength1D.x < vRayLength1D.y)
-			{
-				vMapCheck.x += vStep.x;
-				fDistance = vRayLength1D.x;
-				vRayLength1D.x += vRayUnitStepSize.x;
-			}
-			else
-			{
-				vMapCheck.y += vStep.y;
-				fDistance = vRayLength1D.y;
-				vRayLength1D.y += vRayUnitStepSize.y;
-			}
-
-			// Test tile at new test point
-			if (vMapCheck.x >= 0 && vMapCheck.x < map_size.x && vMapCheck.y >= 0 && vMapCheck.y < map_size.y)
-			{
-				if(GetColourValue(vMapCheck) >= 0.5f){
-					bTileFound = true;
-				}
+			FrameProfiler::Scope scope(profiler, phase_draw);
+			SetDrawTarget(map_layer, false);
+			map_renderer.Draw(tv);
+			SetDrawTarget(nullptr);
+			CountUploads();
+			if (frame_edited) {
+				std::chrono::duration<float, std::milli> latency = std::chrono::steady_clock::now() - frame_start;
+				counters.AddLatency(latency.count());
 			}
 		}
 
-		intersection_result = vMapCheck;
-
-		return bTileFound;
-	}
+		{
+			FrameProfiler::Scope scope(profiler, phase_overlay);
 
-	void PaintMouseLocation(olc::vi2d vCell) {
-		olc::Sprite* previous_target = GetDrawTarget();
-		SetDrawTarget(&map);
+			if (show_contours) {
+				DrawContours();
+			}
 
-		int32_t radius = 32;
-		olc::vf2d size = { float(radius), float(radius) };
-		FillCircle(vCell, radius);
-		
-		SetDrawTarget(previous_target);
-	}
+			if(draw_edit_tools){
+				if (raycast_hit) {
+					tv.DrawCircle(intersection_result, brush_size, olc::Pixel(0x3e, 0x95, 0xef));
+				}
 
-	// void AdjustTerrain_BlendBallFull(olc::vf2d vCell, olc::vf2d direction){
-    //     double brush_size_squared = brush_size * brush_size;
-    //     // all changes are initially performed into a buffer to prevent the
-    //     // results bleeding into each other
-
-	// 	BlockBuffer<int> buffer{{-brush_size, -brush_size}, {brush_size, brush_size}};
-
-	// 	olc::vf2d ray_start_pos = player_pos;
-	// 	olc::vf2d ray_dir = (mouse_pos - player_pos).norm();
-	// 	olc::vi2d intersection_pos;
-
-	// 	float max_distance = std::min(raycast_max_distance, (mouse_pos - player_pos).mag());
-
-	// 	bool raycast_hit = RaycastPixel(ray_start_pos, ray_dir, max_distance, intersection_pos);
-	// 	if(!raycast_hit){
-	// 		return;
-	// 	}
-
-    //     int tx = intersection_pos.x;
-    //     int ty = intersection_pos.y;
-
-	// 	std::map<int, int> frequency;
-
-    //     for (int x = -brush_size; x <= brush_size; x++) {
-    //         int x0 = x + tx;
-    //         for (int y = -brush_size; y <= brush_size; y++) {
-    //             int y0 = y + ty;
-
-	// 			int currentState;
-	// 			if(!MapLocationIsEmpty(olc::vi2d{x0, y0})){
-	// 				currentState = 1;
-	// 			}
-	// 			else{
-	// 				currentState = 0;
-	// 			}
-
-	// 			if (x * x + y * y >= brush_size_squared) {
-	// 				buffer.set(x, y, currentState);
-	// 				continue;
-	// 			}
-	// 			int highest = 1;
-	// 			int highestState = currentState;
-	// 			frequency.clear();
-	// 			bool tie = false;
-	// 			for (int ox = -blend_range; ox <= blend_range; ox++) {
-	// 				for (int oy = -blend_range; oy <= blend_range; oy++) {
-	// 					int state;
-	// 					if(!MapLocationIsEmpty({x0 + ox, y0 + oy})){
-	// 						state = 1;
-	// 					}
-	// 					else{
-	// 						state = 0;
-	// 					}
-	// 					int count = frequency[state];
-	// 					if (count == 0) {
-	// 						count = 1;
-	// 					} else {
-	// 						count++;
-	// 					}
-	// 					if (count > highest) {
-	// 						highest = count;
-	// 						highestState = state;
-	// 						tie = false;
-	// 					} else if (count == highest) {
-	// 						tie = true;
-	// 					}
-	// 					frequency[state] = count;
-	// 				}
-	// 			}
-	// 			if (!tie && currentState != highestState) {
-	// 				buffer.set(x, y, highestState);
-	// 			}
-    //         }
-    //     }
-
-    //     // apply the buffer to the world
-    //     for (int x = -brush_size; x <= brush_size; x++) {
-    //         int x0 = x + tx;
-    //         for (int y = -brush_size; y <= brush_size; y++) {
-    //             int y0 = y + ty;
-	// 			if(buffer.contains(x, y)){
-	// 				SetColourValue({x0, y0}, (float)buffer.get(x, y));
-	// 			}
-    //         }
-    //     }
-	// }
-
-	void AdjustTerrain_BlendBallFractional(olc::vf2d vCell, olc::vf2d direction){
-		double brush_size_squared = brush_size * brush_size;
-
-		// all changes are initially performed into a buffer to prevent the
-		// results bleeding into each other
-		BlockBuffer<float> buffer{{-brush_size, -brush_size}, {brush_size, brush_size}};
-
-		olc::vf2d ray_start_pos = player_pos;
-		olc::vf2d ray_dir = (mouse_pos - player_pos).norm();
-		olc::vi2d intersection_pos;
-
-		float max_distance = std::min(raycast_max_distance, (mouse_pos - player_pos).mag());
-
-		bool raycast_hit = RaycastPixel(ray_start_pos, ray_dir, max_distance, intersection_pos);
-		if(!raycast_hit){
-			return;
-		}
+				tv.DrawLine(player_pos, mouse_pos, olc::Pixel(0xd38e28ff), 0xF0F0F0F0);
 
-		int tx = intersection_pos.x;
-		int ty = intersection_pos.y;
+				// Draw Player
+				tv.FillCircle(player_pos, player_radius, olc::RED);
 
-		for (int x = -brush_size; x <= brush_size; x++) {
-			int x0 = x + tx;
-			for (int y = -brush_size; y <= brush_size; y++) {
-				int y0 = y + ty;
-				double distance = x * x + y * y;
-				if (distance >= brush_size_squared) {
-					buffer.set(x, y, GetColourValue({x0, y0}));
-					continue;
+				// Draw Mouse
+				if (GetMouse(0).bHeld || GetMouse(1).bHeld) {
+					tv.FillCircle(mouse_pos, brush_size, olc::GREEN);
 				}
-				float max_sum_weighted = 0.0f;
-				float colour_sum_weighted = 0.0f;
-
-				for (int ox = -blend_range; ox <= blend_range; ox++) {
-					for (int oy = -blend_range; oy <= blend_range; oy++) {
-						olc::vi2d pos{x0 + ox, y0 + oy};
-
-						max_sum_weighted += 1;
-						colour_sum_weighted += GetColourValue(pos);
-					}
+				else {
+					tv.FillCircle(mouse_pos, brush_size, olc::DARK_GREEN);
 				}
-
-				float average = colour_sum_weighted / max_sum_weighted;
-				// NOTE: When using for real thing, check if value needs to be remapped to avoid floating errors
-				average = EaseInOutCubic(average);
-
-				float curr_voxel_value = GetColourValue({x0, y0});
-				
-				float distance_normalised = distance / brush_size_squared;
-				distance_normalised = std::max(distance_normalised * 2.0f - 1.0f, 0.0f);
-				float new_voxel_value = curr_voxel_value * distance_normalised + average * (1 - distance_normalised);
-
-				buffer.set(x, y, new_voxel_value);
 			}
 		}
 
-		// apply the changes
-		for (int x = -brush_size; x <= brush_size; x++) {
-			int x0 = x + tx;
-			for (int y = -brush_size; y <= brush_size; y++) {
-				int y0 = y + ty;
-				SetColourValue({x0, y0}, buffer.get(x, y));
-			}
+		if (profiler.show_overlay) {
+			profiler.DrawOverlay(*this, { 4, 4 });
 		}
+
+		EndStatsFrame(fElapsedTime);
+		profiler.EndFrame();
+		return true;
 	}
 
-	void AdjustTerrain_BlendBallFractionalFast(){
-		std::vector<float> sums;
-	
-		olc::vf2d ray_start_pos = player_pos;
-		olc::vf2d ray_dir = (mouse_pos - player_pos).norm();
-		olc::vi2d intersection_pos;
+	bool OpenStats() {
+		stats_file.open(stats_path, std::ios::app);
+		if (!stats_file) {
+			std::cerr << "Can't write " << stats_path << "\n";
+			return false;
+		}
+		return true;
+	}
 
-		float max_distance = std::min(raycast_max_distance, (mouse_pos - player_pos).mag());
+	void CountUploads() {
+		auto uploads = map_renderer.TakeUploads();
+		counters.Add(PerfCounters::textures_uploaded, uploads.textures);
+		counters.Add(PerfCounters::bytes_uploaded, uploads.bytes);
+	}
 
-		bool raycast_hit = RaycastPixel(ray_start_pos, ray_dir, max_distance, intersection_pos);
-		if(!raycast_hit){
+	// Closes the frame's counts, writing a stats line when one is due
+	void EndStatsFrame(float elapsed_time) {
+		counted_dirty.Consume([&](int, int, olc::vi2d, olc::vi2d) {
+			counters.Add(PerfCounters::chunks_dirtied);
+		});
+		counters.EndFrame();
+		stats_time += elapsed_time;
+		stats_timer += elapsed_time;
+		if (stats_file.is_open() && stats_timer >= stats_interval) {
+			stats_timer = 0.0f;
+			counters.WriteJson(stats_file, stats_time);
+			stats_file.flush();
+		}
+	}
+
+	// Moves the player by move, unless noclip is on sliding along the terrain it
+	// runs into, and pushes it back out of terrain drawn over it
+	void MovePlayer(olc::vf2d move) {
+		if (noclip) {
+			player_pos += move;
 			return;
 		}
-	
-		int tx = intersection_pos.x;
-		int ty = intersection_pos.y;
-	
-		int blend_range = 5;
-	
-		// for distance normalization
-		double brush_size_squared = brush_size * brush_size;
-	
-		double brush_region_half = brush_size + blend_range;
-		double brush_region_size = 2 * brush_region_half + 1;
-		double brush_region_squared = brush_region_size * brush_region_size;
-	
-		int x, y, i, dx, dy, x0, y0, xmin, xmax, ymin, ymax;
-		double distance, area;
-		float a, b, c, d, sum, average, distance_normalised, cur_voxel_value, new_voxel_value;
-	
-		// create the summed-area table for the selected region
-		// https://en.wikipedia.org/wiki/Summed-area_table
-		sums.resize(brush_region_squared, 0);
-		for (y = 0, i = 0; y < brush_region_size; ++y) {
-			dy = y - brush_region_half;
-			y0 = ty + dy;
-			for (x = 0; x < brush_region_size; ++x) {
-				dx = x - brush_region_half;
-				x0 = tx + dx;
-				/* sample the current voxel value, and add the sums to the left and top of it
-				   (minus the overlap because otherwise it is counted twice) */
-				sum = GetColourValue({x0, y0});
-				if (x > 0) sum += sums[i-1];
-				if (y > 0) sum += sums[i-brush_region_size];
-				if (x > 0 && y > 0) sum -= sums[i-(brush_region_size+1)];
-				sums[i++] = sum;
+		distances.Update();
+
+		float length = move.mag();
+		if (length > 0.0f) {
+			SphereCastResult cast = distances.SphereCast(player_pos, move / length, player_radius, length);
+			player_pos = cast.position;
+			if (cast.hit) {
+				// what is left of the move, less the part into the surface
+				olc::vf2d rest = move * (1.0f - cast.distance / length);
+				player_pos += rest - cast.normal * std::min(0.0f, rest.dot(cast.normal));
 			}
 		}
-	
-		// apply brush to region
-		for (y = 0, i = 0; y < brush_region_size; ++y) {
-			dy = y - brush_region_half;
-			y0 = ty + dy;
-			ymin = std::max(y - blend_range, 0) - 1;
-			ymax = std::min(y + blend_range, (int)(brush_region_size - 1));
-		
-			for (x = 0; x < brush_region_size; ++x) {
-				dx = x - brush_region_half;
-				x0 = tx + dx;
-				xmin = std::max(x - blend_range, 0) - 1;
-				xmax = std::min(x + blend_range, (int)(brush_region_size - 1));
-			
-				area = (xmax - xmin) * (ymax - ymin);
-			
-				/* using the summed-area table method, we only need to 
-				   sample 4 points to get the sum of the brush region */
-				a = xmin < 0 || ymin < 0 ? 0 : sums[ymin*brush_region_size+xmin];
-				b = ymin < 0 ? 0 : sums[ymin*brush_region_size+xmax];
-				c = xmin < 0 ? 0 : sums[ymax*brush_region_size+xmin];
-				d = sums[ymax*brush_region_size+xmax];
-				sum = (d + a) - (b + c);
-			
-				average = sum / area;
-				average = EaseInOutCubic(average);
-			
-				distance = dx * dx + dy * dy;
-				distance_normalised = 1.0 - (distance / brush_size_squared);
-				// distance_normalised = (distance / brush_size_squared);
-				distance_normalised = std::max(distance_normalised * 2.0 - 1.0, 0.0);
-			
-				olc::vi2d pos{x0,y0};
-			
-				cur_voxel_value = GetColourValue(pos);
-				new_voxel_value = Lerp(cur_voxel_value, average, distance_normalised);
-				// new_voxel_value = Lerp(average, cur_voxel_value, distance_normalised);
-			
-				SetColourValue(pos, new_voxel_value);
-			}
+
+		float gap = distances.QueryDistance(player_pos) - player_radius;
+		if (gap < 0.0f) {
+			player_pos -= distances.QueryNormal(player_pos) * gap;
 		}
 	}
 
-	// NOTE: this pre-average method requires less and less iterations after each average
-	// TODO: analyse if code will work well with blend_range > brush_size
-	void AdjustTerrain_BlendBallFractionalFast2(){
-		int brush_size_squared = brush_size * brush_size;
-
-		// TODO: think of better variable name for this
-		int extended_brush_size = brush_size + blend_range;
+	// how far from the player the tools may read or write cells
+	float ToolReach() const {
+		return raycast_max_distance + float(brush_size + blend_range + 2);
+	}
 
-		// all changes are initially performed into a buffer to prevent the
-		// results bleeding into each other
-		BlockBuffer<float> buffer{{-extended_brush_size, -extended_brush_size}, {extended_brush_size, extended_brush_size}};
+	// Asks for the chunks of the terrain file around the view and the player,
+	// and ahead of where they move
+	void StreamMap(float elapsed_time) {
+		olc::vf2d view_tl = tv.GetWorldTL();
+		olc::vf2d view_br = tv.GetWorldBR();
+		olc::vf2d view_centre = (view_tl + view_br) * 0.5f;
+		olc::vf2d player_velocity;
+		olc::vf2d view_velocity;
+		if (elapsed_time > 0.0f) {
+			player_velocity = (player_pos - last_player_pos) / elapsed_time;
+			view_velocity = (view_centre - last_view_centre) / elapsed_time;
+		}
+		last_player_pos = player_pos;
+		last_view_centre = view_centre;
 
-		olc::vf2d ray_start_pos = player_pos;
-		olc::vf2d ray_dir = (mouse_pos - player_pos).norm();
-		olc::vi2d intersection_pos;
+		streamer.Update(player_pos, player_velocity, ToolReach(), view_tl, view_br, view_velocity);
+	}
 
-		float max_distance = std::min(raycast_max_distance, (mouse_pos - player_pos).mag());
+	// True once every chunk the tools could touch from the players of stamps is in memory
+	bool EnsureReach(const std::vector<BrushStamp>& stamps) {
+		olc::vf2d from = stamps.front().player_pos;
+		olc::vf2d to = from;
+		for (const BrushStamp& stamp : stamps) {
+			from = from.min(stamp.player_pos);
+			to = to.max(stamp.player_pos);
+		}
+		olc::vf2d reach{ ToolReach(), ToolReach() };
+		return streamer.Ensure(olc::vi2d((from - reach).floor()), olc::vi2d((to + reach).ceil()));
+	}
 
-		bool raycast_hit = RaycastPixel(ray_start_pos, ray_dir, max_distance, intersection_pos);
-		if(!raycast_hit){
+	// Runs the undo or redo asked for once the chunks it writes to are in memory
+	void StepHistory() {
+		if (history_step == 0) {
+			return;
+		}
+		// the step undoes the open stroke, if there is one, so close it (with
+		// what the progressive blend owes it) before asking which chunks it needs
+		FinishBlends();
+		undo.EndStroke();
+		bool resident = true;
+		auto ensure = [&](int chunk_index) {
+			resident = streamer.EnsureChunk(chunk_index) && resident;
+		};
+		if (history_step < 0) {
+			undo.ForEachUndoChunk(ensure);
+		}
+		else {
+			undo.ForEachRedoChunk(ensure);
+		}
+		if (!resident) {
 			return;
 		}
 
-		int brush_pos_x = intersection_pos.x;
-		int brush_pos_y = intersection_pos.y;
-
-		float total_blend_elements = 2 * blend_range + 1;
-
-		// x blur
-		for (int y = -extended_brush_size; y <= extended_brush_size; y++) {
-			int y0 = y + brush_pos_y;
-			float colour_sum = 0.0f;
-			std::queue<float> buffered_values;
+		if (history_step < 0) {
+			undo.Undo();
+			logged_frame.frame.flags |= StrokeLogFrame::undo;
+		}
+		else {
+			undo.Redo();
+			logged_frame.frame.flags |= StrokeLogFrame::redo;
+		}
+		history_step = 0;
+	}
 
-			for (int x = -brush_size; x <= brush_size; x++){
-				int x0 = x + brush_pos_x;
+	void SaveMap() {
+		FinishBlends();
+		auto start = std::chrono::steady_clock::now();
+		bool saved = map_file.IsOpen() ? streamer.Save() : streamer.SaveAs(map_path);
+		if (!saved) {
+			std::cerr << "Can't save " << map_path << "\n";
+			return;
+		}
+		std::chrono::duration<float, std::milli> took = std::chrono::steady_clock::now() - start;
+		std::cout << "Saved " << map_path << " in " << took.count() << " ms\n";
+	}
 
-				if(x == -brush_size){
-					for (int ox = -blend_range; ox <= blend_range; ox++){
-						float value = GetColourValue({x0 + ox, y0});
-						buffered_values.push(value);
-						colour_sum += value;
+	// Outlines of the chunks in view, brought up to date first
+	void DrawContours() {
+		contours.Update();
+		olc::vi2d from = olc::vi2d(tv.GetWorldTL().floor()).max({ 0, 0 }) / TerrainMap::chunk_size;
+		olc::vi2d to = olc::vi2d(tv.GetWorldBR().ceil()).min({ map.Width() - 1, map.Height() - 1 }) / TerrainMap::chunk_size;
+		for (int chunk_y = from.y; chunk_y <= to.y; chunk_y++) {
+			for (int chunk_x = from.x; chunk_x <= to.x; chunk_x++) {
+				for (const ContourLine& line : contours.ChunkLines(chunk_x, chunk_y)) {
+					size_t count = line.points.size();
+					for (size_t i = 0; i + 1 < count; i++) {
+						tv.DrawLine(line.points[i], line.points[i + 1], olc::CYAN);
+					}
+					if (line.closed && count > 1) {
+						tv.DrawLine(line.points[count - 1], line.points[0], olc::CYAN);
 					}
 				}
-				else{
-					float value = GetColourValue({x0 + blend_range, y0});
-					buffered_values.push(value);
-					colour_sum += value;
-
-					colour_sum -= buffered_values.front();
-					buffered_values.pop();
-				}
-
-				float average = colour_sum / total_blend_elements;
-				buffer.set(x, y, average);
 			}
 		}
+	}
 
-		// y blur
-		for (int x = -brush_size; x <= brush_size; x++) {
-			float colour_sum = 0.0f;
-			std::queue<float> buffered_values;
+	void ExportContours() {
+		auto start = std::chrono::steady_clock::now();
+		int extracted = contours.Update();
+		if (!contours.ExportObj(contour_path)) {
+			std::cerr << "Can't write " << contour_path << "\n";
+			return;
+		}
+		std::chrono::duration<float, std::milli> took = std::chrono::steady_clock::now() - start;
+		std::cout << "Exported " << contour_path << " in " << took.count() << " ms (" << extracted << " chunks re-extracted)\n";
+	}
 
-			for (int y = -brush_size; y <= brush_size; y++){
-				if(y == -brush_size){
-					for (int oy = -blend_range; oy <= blend_range; oy++){
-						float value = buffer.get(x, y + oy);
-						buffered_values.push(value);
-						colour_sum += value;
-					}
-				}
-				else{
-					float value = buffer.get(x, y + blend_range);
-					buffered_values.push(value);
-					colour_sum += value;
+	// Writes this frame's edits to the stroke log, if it did any or let go of the
+	// buttons, and hands them to the session
+	void LogFrame(int button, const std::vector<BrushStamp>& stamps) {
+		if (!stroke_log.IsOpen() && !session) {
+			return;
+		}
+		StrokeLogFrame& frame = logged_frame.frame;
+		bool held = (frame.flags & StrokeLogFrame::stroke_held) != 0;
+		if (!stamps.empty()) {
+			frame.button = int8_t(button);
+			frame.mode = uint8_t(mode);
+			frame.brush_size = uint16_t(brush_size);
+			frame.blend_range = uint16_t(blend_range);
+			logged_frame.stamps = stamps;
+		}
+		bool edited = (frame.flags & ~StrokeLogFrame::stroke_held) != 0 || !stamps.empty();
+		if (stroke_log.IsOpen() && (edited || held != log_was_held)) {
+			stroke_log.Write(logged_frame);
+		}
+		log_was_held = held;
+		if (session && edited) {
+			SubmitFrame(logged_frame);
+		}
+	}
 
-					colour_sum -= buffered_values.front();
-					buffered_values.pop();
-				}
+	// Runs the edits of a logged frame as OnUserUpdate did them, with the tool
+	// settings it had; with_history also opens and closes its undo stroke and
+	// runs its undo or redo
+	void ApplyFrame(const StrokeLogEntry& entry, bool with_history) {
+		const StrokeLogFrame& frame = entry.frame;
+		if (with_history) {
+			if (frame.flags & StrokeLogFrame::stroke_held) {
+				undo.BeginStroke();
+			}
+			else {
+				undo.EndStroke();
+			}
+		}
+		if (frame.flags & StrokeLogFrame::paint) {
+			PaintMouseLocation(frame.paint_pos);
+		}
+		if (frame.flags & StrokeLogFrame::clear) {
+			ResetMap();
+		}
+		if (with_history && (frame.flags & StrokeLogFrame::undo)) {
+			undo.Undo();
+		}
+		if (with_history && (frame.flags & StrokeLogFrame::redo)) {
+			undo.Redo();
+		}
+		if (!entry.stamps.empty()) {
+			EditMode own_mode = mode;
+			int own_brush_size = brush_size;
+			int own_blend_range = blend_range;
+			mode = EditMode(frame.mode);
+			brush_size = frame.brush_size;
+			blend_range = frame.blend_range;
+			scratch.Reset();
+			ApplyStamps(frame.button, entry.stamps);
+			mode = own_mode;
+			brush_size = own_brush_size;
+			blend_range = own_blend_range;
+		}
+		map.Compact();
+	}
 
-				float average = colour_sum / total_blend_elements;
-				buffer.set(x, y, average);
+	// Runs the frames of log onto the map, as OnUserUpdate did them but with no
+	// window or frame pacing; the map is the log's size, or load_map_file's.
+	// Returns false if the map file can't be opened, or stops at the first
+	// frame that isn't valid (see FrameIsValid()) and returns false.
+	bool ReplayStrokes(StrokeLogReader& log, size_t& frame_count, size_t& stamp_count) {
+		if (load_map_file) {
+			if (!map_file.Open(map_path) || !map_file.Attach(map)) {
+				std::cerr << "Can't open terrain file " << map_path << "\n";
+				return false;
 			}
+			// the tools have to find every chunk in memory
+			map_file.Fetch({ 0, 0 }, map.Size() - olc::vi2d{ 1, 1 });
+		}
+		else if (generate_map) {
+			GenerateMap();
+		}
+		undo.Attach(map);
+		use_gpu_blend = false;
+		use_progressive_blend = false;
+
+		frame_count = 0;
+		stamp_count = 0;
+		map.AddDirtyTracker(&counted_dirty);
+		if (!stats_path.empty() && !OpenStats()) {
+			return false;
 		}
 
-		// processing and pasting result
-		for (int x = -brush_size; x <= brush_size; x++) {
-			int x0 = x + brush_pos_x;
-			for (int y = -brush_size; y <= brush_size; y++){
-				int y0 = y + brush_pos_y;
+		StrokeLogEntry entry;
+		while (log.Next(entry)) {
+			if (!FrameIsValid(entry.frame)) {
+				std::cerr << "Frame " << frame_count << " of the stroke log has settings this editor wouldn't use, stopping the replay\n";
+				return false;
+			}
+			auto start = std::chrono::steady_clock::now();
+			uint64_t allocations = PerfCounters::heap_allocations.load(std::memory_order_relaxed);
+			ApplyFrame(entry, true);
+			counters.Add(PerfCounters::edit_allocations, PerfCounters::heap_allocations.load(std::memory_order_relaxed) - allocations);
+			if (!entry.stamps.empty()) {
+				// no drawing, so applied is as good as shown
+				std::chrono::duration<float, std::milli> latency = std::chrono::steady_clock::now() - start;
+				counters.AddLatency(latency.count());
+			}
+			EndStatsFrame(0.0f);
+			stats_time = entry.frame.time;
+			frame_count++;
+			stamp_count += entry.stamps.size();
+		}
+		undo.EndStroke();
+		if (stats_file.is_open()) {
+			counters.WriteJson(stats_file, stats_time);
+		}
+		return true;
+	}
 
-				int distance = x * x + y * y;
-				if (distance >= brush_size_squared) {
-					continue;
+	// FNV-1a of every cell, to tell replayed maps apart
+	uint64_t MapChecksum() const {
+		uint64_t hash = 14695981039346656037ull;
+		for (int y = 0; y < map.Height(); y++) {
+			for (int x = 0; x < map.Width(); x++) {
+				TerrainMap::cell_type cell = map.GetCell(x, y);
+				for (size_t i = 0; i < sizeof(cell); i++) {
+					hash = (hash ^ ((cell >> (8 * i)) & 0xff)) * 1099511628211ull;
 				}
-
-				float average = buffer.get(x, y);
-
-				average = EaseInOutCubic(average);
-
-				float curr_voxel_value = GetColourValue({x0, y0});
-				
-				float distance_normalised = (float)distance / (float)brush_size_squared;
-				distance_normalised = std::max(distance_normalised * 2.0f - 1.0f, 0.0f);
-				float new_voxel_value = Lerp(average, curr_voxel_value, distance_normalised);
-
-				SetColourValue({x0, y0}, new_voxel_value);
 			}
 		}
+		return hash;
 	}
 
-	// 230 -> 35
-	/*void AdjustTerrain_BlendBallFractionalFast(olc::vf2d vCell, olc::vf2d direction){
-		double brush_size_squared = brush_size * brush_size;
-
-		// all changes are initially performed into a buffer to prevent the
-		// results bleeding into each other
-		BlockBuffer<float> buffer{{-brush_size, -brush_size}, {brush_size, brush_size}};
-
-		olc::vf2d ray_start_pos = player_pos;
-		olc::vf2d ray_dir = (mouse_pos - player_pos).norm();
-		olc::vi2d intersection_pos;
-
-		float max_distance = std::min(raycast_max_distance, (mouse_pos - player_pos).mag());
+	// True unless this editor's edits have to wait for the host to order them
+	bool EditsLocally() const {
+		return !session || session->IsHost();
+	}
 
-		bool raycast_hit = RaycastPixel(ray_start_pos, ray_dir, max_distance, intersection_pos);
-		if(!raycast_hit){
-			return;
+	// Sets the editor up for the session, once the map is there
+	void StartSession() {
+		// the same edits have to give the same cells on every editor
+		use_gpu_blend = false;
+		use_progressive_blend = false;
+		settle.enabled = false;
+		if (load_map_file) {
+			// the host may have to send or check any chunk, so all of them stay in memory
+			map_file.Fetch({ 0, 0 }, map.Size() - olc::vi2d{ 1, 1 });
+			streamer.max_resident_chunks = std::max(streamer.max_resident_chunks, size_t(map.ChunksX()) * map.ChunksY());
 		}
+		chunk_sync.Attach(map);
+	}
 
-		int tx = intersection_pos.x;
-		int ty = intersection_pos.y;
+	static void PutFrame(NetWriter& writer, const StrokeLogEntry& entry) {
+		StrokeLogFrame frame = entry.frame;
+		frame.stamp_count = uint16_t(std::min<size_t>(entry.stamps.size(), UINT16_MAX));
+		writer.Put(frame);
+		writer.PutBytes(entry.stamps.data(), frame.stamp_count * sizeof(BrushStamp));
+	}
 
-		// Optimised version doesn't fully average corners, but we calculate if we need to increase brush size to accomdate this.
-		int extra_iterations = 0;
-		if(blend_range + M_PI_4 >= brush_size){
-			extra_iterations = std::ceil(blend_range + M_PI_4 - brush_size);
+	// False if the frame has a tool this editor doesn't know or settings it
+	// wouldn't use itself: brush and blend sizes past its limits, or more stamps
+	// than a frame of its stroke timer makes
+	bool FrameIsValid(const StrokeLogFrame& frame) const {
+		if (frame.mode > uint8_t(EditMode::AdjustTerrain_BlendBallFractional) || frame.stamp_count > stroke_timer.max_stamps_per_frame) {
+			return false;
 		}
+		return frame.stamp_count == 0 || (frame.brush_size >= brush_size_min && frame.brush_size <= brush_size_max && frame.blend_range <= blend_range_max);
+	}
 
-		int adjusted_brush_size = brush_size + extra_iterations;
-		for (int x = -adjusted_brush_size; x <= adjusted_brush_size; x++) {
-			int x0 = x + tx;
-			for (int y = -adjusted_brush_size; y <= adjusted_brush_size; y++) {
-				int y0 = y + ty;
-
-				float max_sum_weighted = 0.0f;
-				float colour_sum_weighted = 0.0f;
-
-				for (int ox = -blend_range; ox <= blend_range; ox++) {
-					for (int oy = -blend_range; oy <= blend_range; oy++) {
-						olc::vi2d pos{x0 + ox, y0 + oy};
-
-						max_sum_weighted += 1;
-						colour_sum_weighted += GetColourValue(pos);
-					}
-				}
-
-				float average = colour_sum_weighted / max_sum_weighted;
-				// NOTE: When using for real thing, check if value needs to be remapped to avoid floating errors
-				average = EaseInOutCubic(average);
+	// False if the frame is cut short or not valid (see FrameIsValid())
+	bool GetFrame(NetReader& reader, StrokeLogEntry& entry) const {
+		if (!reader.Get(entry.frame) || !FrameIsValid(entry.frame)) {
+			return false;
+		}
+		entry.stamps.resize(entry.frame.stamp_count);
+		return reader.GetBytes(entry.stamps.data(), entry.stamps.size() * sizeof(BrushStamp));
+	}
 
-				float curr_voxel_value = GetColourValue({x0, y0});
-				
-				float distance_normalised = distance / brush_size_squared;
-				distance_normalised = std::max(distance_normalised * 2.0f - 1.0f, 0.0f);
-				float new_voxel_value = curr_voxel_value * distance_normalised + average * (1 - distance_normalised);
+	// Hands a frame's edits to the session: the host has applied its own already
+	// and sends them to everyone under the next number, a client sends its to
+	// the host and applies them once they come back
+	void SubmitFrame(const StrokeLogEntry& entry) {
+		std::vector<uint8_t> payload;
+		NetWriter writer{ payload };
+		if (session->IsHost()) {
+			chunk_sync.Commit();
+			writer.Put(++session_seq);
+			PutFrame(writer, entry);
+			session->Broadcast(op_message, payload);
+		}
+		else {
+			PutFrame(writer, entry);
+			session->Send(NetSession::host_peer, op_message, payload);
+		}
+	}
 
-				buffer.set(x, y, new_voxel_value);
+	// Handles what the session received since the last frame, and on the host
+	// sends the checksums of the chunks edited since the last ones when it's time
+	void ProcessSession(float elapsed_time) {
+		NetMessage message;
+		while (session && session->Poll(message)) {
+			if (session->IsHost()) {
+				HandleHostMessage(message);
+			}
+			else {
+				HandleClientMessage(message);
 			}
 		}
-
-		for (int x = -brush_size; x <= brush_size; x++) {
-			int x0 = x + tx;
-			for (int y = -brush_size; y <= brush_size; y++) {
-				int y0 = y + ty;
-				double distance = x * x + y * y;
-				if (distance >= brush_size_squared) {
-					buffer.set(x, y, GetColourValue({x0, y0}));
-					continue;
-				}
-				float max_sum_weighted = 0.0f;
-				float colour_sum_weighted = 0.0f;
-
-				for (int ox = -blend_range; ox <= blend_range; ox++) {
-					for (int oy = -blend_range; oy <= blend_range; oy++) {
-						olc::vi2d pos{x0 + ox, y0 + oy};
-
-						max_sum_weighted += 1;
-						colour_sum_weighted += GetColourValue(pos);
-					}
-				}
-
-				float average = colour_sum_weighted / max_sum_weighted;
-				// NOTE: When using for real thing, check if value needs to be remapped to avoid floating errors
-				average = EaseInOutCubic(average);
-
-				float curr_voxel_value = GetColourValue({x0, y0});
-				
-				float distance_normalised = distance / brush_size_squared;
-				distance_normalised = std::max(distance_normalised * 2.0f - 1.0f, 0.0f);
-				float new_voxel_value = curr_voxel_value * distance_normalised + average * (1 - distance_normalised);
-
-				buffer.set(x, y, new_voxel_value);
+		if (session && session->IsHost()) {
+			checksum_timer += elapsed_time;
+			if (checksum_timer >= checksum_interval) {
+				checksum_timer = 0.0f;
+				BroadcastChecksums();
 			}
 		}
+	}
 
-		// apply the changes
-		for (int x = -brush_size; x <= brush_size; x++) {
-			int x0 = x + tx;
-			for (int y = -brush_size; y <= brush_size; y++) {
-				int y0 = y + ty;
-				SetColourValue({x0, y0}, buffer.get(x, y));
+	void HandleHostMessage(const NetMessage& message) {
+		NetReader reader{ message.payload.data(), message.payload.size() };
+		switch (message.type) {
+		case NetSession::peer_joined:
+			std::cout << "Editor " << message.peer << " joined the session\n";
+			SendMap(message.peer);
+			break;
+		case NetSession::peer_left:
+			std::cout << "Editor " << message.peer << " left the session\n";
+			break;
+		case op_message: {
+			StrokeLogEntry entry;
+			if (!GetFrame(reader, entry)) {
+				break;
 			}
+			ApplyFrame(entry, false);
+			chunk_sync.Commit();
+			std::vector<uint8_t> payload;
+			NetWriter writer{ payload };
+			writer.Put(++session_seq);
+			PutFrame(writer, entry);
+			session->Broadcast(op_message, payload);
+			break;
+		}
+		case chunk_request_message: {
+			uint32_t index;
+			if (reader.Get(index) && index < chunk_sync.ChunkCount()) {
+				SendChunk(message.peer, int(index));
+			}
+			break;
+		}
 		}
-	}*/
-
-	void DestructTerrain_CircleFull(olc::vf2d vCell, olc::vf2d direction) {
-		olc::Sprite* previous_target = GetDrawTarget();
-		SetDrawTarget(&map);
-
-		int32_t radius = brush_size;
-		olc::vf2d size = { float(radius), float(radius) };
-		olc::vf2d pos = vCell;
-
-		pos -= direction * (float(radius) - 2.0f);
-
-		FillCircle(pos, radius, olc::BLACK);
-		
-		SetDrawTarget(previous_target);
 	}
 
-	void DestructTerrain_CircleFractional(olc::vf2d vCell, olc::vf2d direction) {
-		olc::Sprite* previous_target = GetDrawTarget();
-		SetDrawTarget(&map);
-
-		int32_t radius = brush_size;
-		olc::vf2d size = { float(radius), float(radius) };
-		olc::vf2d pos = vCell;
-
-		pos -= direction * ((float)radius - 2.0f);
-
-		for (int i = -radius; i <= radius; i++) {
-			for (int j = -radius; j <= radius; j++) {
-				int32_t distance = (olc::vi2d{0, 0} - olc::vi2d{ i, j }).mag();
-
-				if (distance > radius) {
-					continue;
+	void HandleClientMessage(const NetMessage& message) {
+		NetReader reader{ message.payload.data(), message.payload.size() };
+		switch (message.type) {
+		case NetSession::peer_left:
+			std::cout << "Lost the session's host, editing alone from here\n";
+			session.reset();
+			chunk_sync.Detach();
+			break;
+		case chunk_message: {
+			uint32_t index;
+			uint32_t version;
+			if (reader.Get(index) && reader.Get(version) && index < chunk_sync.ChunkCount()) {
+				chunk_sync.Decode(int(index), version, message.payload.data() + reader.at, reader.Remaining());
+				map.Compact();
+			}
+			break;
+		}
+		case synced_message:
+			if (reader.Get(session_seq)) {
+				std::cout << "Joined the session at edit " << session_seq << "\n";
+			}
+			break;
+		case op_message: {
+			uint32_t seq;
+			StrokeLogEntry entry;
+			if (reader.Get(seq) && GetFrame(reader, entry)) {
+				ApplyFrame(entry, false);
+				chunk_sync.Commit();
+				session_seq = seq;
+			}
+			break;
+		}
+		case checksum_message: {
+			// the ops come in order, so this editor is as far as the host was
+			uint32_t seq;
+			if (!reader.Get(seq) || seq != session_seq) {
+				break;
+			}
+			uint32_t index;
+			uint32_t version;
+			uint64_t checksum;
+			while (reader.Get(index) && reader.Get(version) && reader.Get(checksum)) {
+				if (index < chunk_sync.ChunkCount()
+					&& (chunk_sync.Version(int(index)) != version || chunk_sync.Checksum(int(index)) != checksum)) {
+					std::vector<uint8_t> payload;
+					NetWriter writer{ payload };
+					writer.Put(index);
+					session->Send(NetSession::host_peer, chunk_request_message, payload);
+					chunks_resynced++;
 				}
-
-				float mapped = MapValue(float(distance), 0.0f, float(radius), 0.0f, 1.0f);
-
-				// gaussian e^(-x^2)
-				float value = GaussianCurve(mapped);
-				value -= 0.2f;
-				SubtractValueFromColour(pos + olc::vi2d{i, j}, value);
 			}
+			break;
+		}
 		}
-		
-		SetDrawTarget(previous_target);
 	}
 
-	void DestructTerrain_GaussFractional(olc::vf2d vCell, olc::vf2d direction) {
-		olc::Sprite* previous_target = GetDrawTarget();
-		SetDrawTarget(&map);
-
-		olc::vi2d last_raycast_hit_pos;
+	void SendChunk(int peer, int index) {
+		std::vector<uint8_t> payload;
+		NetWriter writer{ payload };
+		writer.Put(uint32_t(index));
+		writer.Put(chunk_sync.Version(index));
+		chunk_sync.Encode(index, payload);
+		session->Send(peer, chunk_message, payload);
+	}
 
-		olc::vf2d ray_start_pos = player_pos;
-		olc::vf2d ray_dir = (mouse_pos - player_pos).norm();
+	// Gives a new client every chunk as it is now, then the ops from here on
+	void SendMap(int peer) {
+		for (size_t i = 0; i < chunk_sync.ChunkCount(); i++) {
+			SendChunk(peer, int(i));
+		}
+		std::vector<uint8_t> payload;
+		NetWriter writer{ payload };
+		writer.Put(session_seq);
+		session->Send(peer, synced_message, payload);
+		session->SetJoined(peer);
+	}
 
-		float max_distance = std::min(raycast_max_distance, (mouse_pos - player_pos).mag());
-		float cone_angle = terraform_angle;
-		float step = terraform_raycast_step;
+	void BroadcastChecksums() {
+		chunk_sync.TakeChanged(checksum_chunks);
+		if (checksum_chunks.empty()) {
+			return;
+		}
+		std::vector<uint8_t> payload;
+		NetWriter writer{ payload };
+		writer.Put(session_seq);
+		for (int index : checksum_chunks) {
+			writer.Put(uint32_t(index));
+			writer.Put(chunk_sync.Version(index));
+			writer.Put(chunk_sync.Checksum(index));
+		}
+		session->Broadcast(checksum_message, payload);
+	}
 
-		for (float i = -cone_angle; i <= cone_angle; i += step) {
-			olc::vf2d rotated_dir = RotateVector(ray_dir, AngleToRadians(i));
+	// Runs the tool of button (0 left, 1 right) for every stamp, each aimed from
+	// its own player and mouse position. Blend stamps of the right button are
+	// collected and applied in batches instead, see AdjustTerrain_BlendBallFractionalFast2.
+	void ApplyStamps(int button, const std::vector<BrushStamp>& stamps) {
+		olc::vf2d frame_player_pos = player_pos;
+		olc::vf2d frame_mouse_pos = mouse_pos;
+		blend_centres.clear();
+		counters.Add(PerfCounters::brush_stamps, stamps.size());
+		// only the batched blend knows about the blends being refined
+		bool batched = mode == EditMode::AdjustTerrain_BlendBallFractional && button == 1;
+		if (!batched && !stamps.empty()) {
+			FinishBlends();
+		}
+		frame_edited = frame_edited || !stamps.empty();
 
-			olc::vi2d intersection_pos;
-			bool raycast_hit = RaycastPixel(ray_start_pos, rotated_dir, max_distance, intersection_pos);
+		for (const BrushStamp& stamp : stamps) {
+			player_pos = stamp.player_pos;
+			mouse_pos = stamp.mouse_pos;
+			olc::vf2d ray_dir = (mouse_pos - player_pos).norm();
+			float max_distance = std::min(raycast_max_distance, (mouse_pos - player_pos).mag());
 
-			if (raycast_hit == false) {
+			olc::vi2d intersection_result;
+			if (!RaycastPixelTarget(player_pos, ray_dir, max_distance, intersection_result)) {
 				continue;
 			}
 
-			last_raycast_hit_pos = intersection_pos;
-
-			float distance = (ray_start_pos - intersection_pos).mag();
-
-			float mapped;
-			if (i < 0) {
-				mapped = MapValue(i, -cone_angle, 0, -1.0f, 0.0f);
-			}
-			else {
-				mapped = MapValue(i, 0, cone_angle, 0.0f, 1.0f);
+			switch (mode) {
+			case EditMode::CircleFull:
+				DestructTerrain_CircleFull(intersection_result, ray_dir);
+				break;
+			case EditMode::CircleFractional:
+				DestructTerrain_CircleFractional(intersection_result, ray_dir);
+				break;
+			case EditMode::GaussFractional:
+				if (button == 1) {
+					DestructTerrain_GaussFractional(intersection_result, ray_dir);
+				}
+				else {
+					RestoreTerrain_GaussFractional(intersection_result, ray_dir);
+				}
+				break;
+			case EditMode::AdjustTerrain_BlendBallFull:
+				AdjustTerrain_BlendBallFractional(intersection_result, ray_dir);
+				break;
+			case EditMode::AdjustTerrain_BlendBallFractional:
+				if (button == 1) {
+					// same target as AdjustTerrain_BlendBallFractionalFast2()
+					olc::vi2d centre;
+					if (RaycastPixel(player_pos, ray_dir, max_distance, centre)) {
+						blend_centres.push_back(centre);
+					}
+				}
+				else {
+					AdjustTerrain_BlendBallFractional(intersection_result, ray_dir);
+				}
+				break;
+			default:
+				std::cout << "Error\n";
 			}
-
-			// gaussian e^(-x^2)
-			float value = GaussianCurve(mapped);
-			value -= 0.3f;
-
-			SubtractValueFromColour(intersection_pos, value);
 		}
 
-		/*for each point on curve
-			pixel = Position2D(point)
-			pixel.rate = easing_function(distance(point, origin))
-			dir = normalize(point - origin) * step_factor
-
-			for i in (0, some_limit)
-				pixel = Position2D(point + dir * i)
-				pixel.rate = easing_function(distance(origin, point + dir * i))*/
+		player_pos = frame_player_pos;
+		mouse_pos = frame_mouse_pos;
 
-		SetDrawTarget(previous_target);
+		// consecutive stamps whose brush squares overlap go in one batch
+		size_t batch_start = 0;
+		for (size_t i = 1; i <= blend_centres.size(); i++) {
+			if (i < blend_centres.size()) {
+				olc::vi2d step = blend_centres[i] - blend_centres[i - 1];
+				if (std::max(std::abs(step.x), std::abs(step.y)) <= 2 * brush_size) {
+					continue;
+				}
+			}
+			AdjustTerrain_BlendBallFractionalFast2(blend_centres.data() + batch_start, int(i - batch_start));
+			batch_start = i;
+		}
 	}
 
-	void RestoreTerrain_GaussFractional(olc::vf2d vCell, olc::vf2d direction) {
-		olc::Sprite* previous_target = GetDrawTarget();
-		SetDrawTarget(&map);
-
-		olc::vi2d last_raycast_hit_pos;
-
-		olc::vf2d ray_start_pos = player_pos;
-		olc::vf2d ray_dir = (mouse_pos - player_pos).norm();
-
-		float max_distance = std::min(raycast_max_distance, (mouse_pos - player_pos).mag());
-		float cone_angle = terraform_angle;
-		float step = terraform_raycast_step;
-
-		for (float i = -cone_angle; i <= cone_angle; i += step) {
-			olc::vf2d rotated_dir = RotateVector(ray_dir, AngleToRadians(i));
-
-			olc::vi2d intersection_pos;
-			bool raycast_hit = RaycastPrePixel(ray_start_pos, rotated_dir, max_distance, intersection_pos);
+	void SaveTrace() {
+		std::ofstream file(trace_path);
+		if (!file) {
+			std::cerr << "Can't write " << trace_path << "\n";
+			return;
+		}
+		profiler.WriteChromeTrace(file);
+		std::cout << "Saved trace to " << trace_path << "\n";
+	}
 
-			if (raycast_hit == false) {
-				continue;
+	// Times every tool and raycast on BenchmarkTerrain with no window needed:
+	// the player sits in the middle of the cave and aims at a different spot of
+	// its wall every iteration. Tools are swept over brush_sizes and blend_ranges
+	// where they use them, each point starting from freshly generated terrain.
+	void RunBenchmarks(BenchmarkRunner& runner, const std::vector<int>& brush_sizes, const std::vector<int>& blend_ranges, uint32_t seed) {
+		using Terrain = BenchmarkTerrain<TerrainMap>;
+
+		int saved_brush_size = brush_size;
+		int saved_blend_range = blend_range;
+		// the kernels are timed whole, the progressive blend has rows of its own
+		bool saved_progressive = use_progressive_blend;
+		use_progressive_blend = false;
+		olc::vf2d centre = Terrain::Centre(map);
+		float reach = float(Terrain::CaveRadius(map)) * 1.5f;
+
+		olc::vf2d ray_dir;
+		olc::vi2d target;
+		bool target_hit = false;
+
+		// what OnUserUpdate does around a tool: end the last frame, then aim
+		auto aim = [&](int iteration) {
+			FinishBlends();
+			map.Compact();
+			scratch.Reset();
+
+			// golden angle steps spread the targets evenly around the cave
+			float angle = float(iteration) * 2.39996323f;
+			player_pos = centre;
+			mouse_pos = centre + olc::vf2d{ std::cos(angle), std::sin(angle) } * reach;
+			ray_dir = (mouse_pos - player_pos).norm();
+
+			float max_distance = std::min(raycast_max_distance, (mouse_pos - player_pos).mag());
+			target_hit = RaycastPixelTarget(player_pos, ray_dir, max_distance, target);
+		};
+
+		auto sweep = [&](const char* kernel, bool uses_brush_size, bool uses_blend_range, auto&& op) {
+			for (int size : uses_brush_size ? brush_sizes : std::vector<int>{ saved_brush_size }) {
+				for (int range : uses_blend_range ? blend_ranges : std::vector<int>{ saved_blend_range }) {
+					brush_size = size;
+					blend_range = range;
+					// nothing of the last point's blends is refined onto the new terrain
+					progressive_blend.Cancel();
+					Terrain::Generate(map, seed);
+					runner.Run(kernel, uses_brush_size ? size : 0, uses_blend_range ? range : 0, aim, op);
+				}
 			}
+		};
+
+		// cells processed: the brush square, one per cone ray, or the cells a ray walked
+		auto brush_cells = [&]() {
+			return target_hit ? (2 * brush_size + 1) * (2 * brush_size + 1) : 0;
+		};
+		auto cone_cells = [&]() {
+			return target_hit ? int(std::floor(2.0f * terraform_angle / terraform_raycast_step)) + 1 : 0;
+		};
+		auto ray_cells = [&](olc::vi2d cell) {
+			olc::vi2d start = player_pos;
+			return std::abs(cell.x - start.x) + std::abs(cell.y - start.y) + 1;
+		};
+
+		sweep("DestructTerrain_CircleFull", true, false, [&](int) {
+			if (target_hit) DestructTerrain_CircleFull(target, ray_dir);
+			return brush_cells();
+		});
+		sweep("DestructTerrain_CircleFractional", true, false, [&](int) {
+			if (target_hit) DestructTerrain_CircleFractional(target, ray_dir);
+			return brush_cells();
+		});
+		sweep("DestructTerrain_GaussFractional", false, false, [&](int) {
+			if (target_hit) DestructTerrain_GaussFractional(target, ray_dir);
+			return cone_cells();
+		});
+		sweep("RestoreTerrain_GaussFractional", false, false, [&](int) {
+			if (target_hit) RestoreTerrain_GaussFractional(target, ray_dir);
+			return cone_cells();
+		});
+		sweep("AdjustTerrain_BlendBallFractional", true, true, [&](int) {
+			if (target_hit) AdjustTerrain_BlendBallFractional(target, ray_dir);
+			return brush_cells();
+		});
+		sweep("AdjustTerrain_BlendBallFractionalFast", true, true, [&](int) {
+			if (target_hit) AdjustTerrain_BlendBallFractionalFast();
+			return brush_cells();
+		});
+		sweep("AdjustTerrain_BlendBallFractionalFast2", true, true, [&](int) {
+			if (target_hit) AdjustTerrain_BlendBallFractionalFast2();
+			return brush_cells();
+		});
+		// the same with the other curve policies
+		sweep("AdjustTerrain_BlendBallFractionalFast2<ExactCurves>", true, true, [&](int) {
+			if (target_hit) AdjustTerrain_BlendBallFractionalFast2<ExactCurves>();
+			return brush_cells();
+		});
+		sweep("AdjustTerrain_BlendBallFractionalFast2<TableCurves>", true, true, [&](int) {
+			if (target_hit) AdjustTerrain_BlendBallFractionalFast2<TableCurves<1024>>();
+			return brush_cells();
+		});
+		// what a stamp costs the frame it's made in: just the preview, the
+		// refinement is finished between iterations
+		use_progressive_blend = true;
+		int saved_progressive_cells = progressive_cells;
+		progressive_cells = 0;
+		sweep("AdjustTerrain_BlendBallFractionalProgressive", true, true, [&](int) {
+			if (target_hit) AdjustTerrain_BlendBallFractionalFast2();
+			return brush_cells();
+		});
+		progressive_blend.Cancel();
+		progressive_cells = saved_progressive_cells;
+		use_progressive_blend = false;
+
+		float max_distance = std::min(raycast_max_distance, reach);
+		sweep("RaycastPixel", false, false, [&](int) {
+			olc::vi2d cell;
+			RaycastPixel(player_pos, ray_dir, max_distance, cell);
+			return ray_cells(cell);
+		});
+		sweep("RaycastPrePixel", false, false, [&](int) {
+			olc::vi2d cell;
+			RaycastPrePixel(player_pos, ray_dir, max_distance, cell);
+			return ray_cells(cell);
+		});
+		sweep("RaycastPixelTarget", false, false, [&](int) {
+			olc::vi2d cell;
+			RaycastPixelTarget(player_pos, ray_dir, max_distance, cell);
+			return ray_cells(cell);
+		});
+
+		// the whole map, without the trackers brought up to date
+		TerrainGeneratorSettings generated;
+		generated.seed = seed;
+		runner.Run("TerrainGenerator", 0, 0, [&](int) {}, [&](int) {
+			TerrainGenerator<TerrainMap>::Generate(map, generated, brushes.Pool());
+			return map.Width() * map.Height();
+		});
+
+		brush_size = saved_brush_size;
+		blend_range = saved_blend_range;
+		use_progressive_blend = saved_progressive;
+	}
 
-			last_raycast_hit_pos = intersection_pos;
-
-			float distance = (ray_start_pos - intersection_pos).mag();
-
-			float mapped;
-			if (i < 0) {
-				mapped = MapValue(i, -cone_angle, 0, -1.0f, 0.0f);
+	// Checks every optimised blend kernel against BlendReference (Verify.h) with
+	// no window needed: each case generates terrain with random detail, then
+	// picks a brush_size, a blend_range (often past the brush size) and a centre
+	// (every third one near or over the map's edge), and runs every kernel on
+	// the same fresh terrain, then the raycasts on it (see VerifyRaycasts()).
+	// The GPU blend needs a window, so it isn't covered.
+	void RunVerification(VerifyRunner& runner, int cases, uint32_t seed) {
+		int saved_brush_size = brush_size;
+		int saved_blend_range = blend_range;
+		bool saved_progressive = use_progressive_blend;
+		int saved_progressive_cells = progressive_cells;
+		bool saved_gpu = use_gpu_blend;
+		use_gpu_blend = false;
+		progressive_cells = 0;
+
+		// the uint16 cells are off by up to half a step, the float kernels by
+		// rounding. The preview is only meant to look close: its quarter
+		// resolution misses sharp edges by up to about a quarter with the small
+		// ranges it never gets in the editor (see progressive_cells)
+		const double tolerance = 1e-4;
+		const double preview_tolerance = 0.5;
+		using Reference = BlendReference<TerrainMap>;
+
+		std::mt19937 random(seed);
+		auto uniform = [&](int from, int to) {
+			return from + int(random() % uint32_t(to - from + 1));
+		};
+		TerrainGeneratorSettings terrain;
+		std::vector<olc::vi2d> centres;
+		std::vector<double> expected;
+		std::vector<float> actual;
+		for (int index = 0; index < cases; index++) {
+			terrain.seed = random();
+			terrain.feature_size = float(uniform(8, 128));
+			terrain.softness = float(uniform(2, 40)) / 100.0f;
+			brush_size = uniform(1, 48);
+			blend_range = uniform(1, 40);
+
+			olc::vi2d centre{ uniform(0, map.Width() - 1), uniform(0, map.Height() - 1) };
+			if (index % 3 == 0) {
+				// up to brush_size past one of the edges
+				int offset = uniform(-brush_size, blend_range);
+				switch (uniform(0, 3)) {
+				case 0: centre.x = offset; break;
+				case 1: centre.y = offset; break;
+				case 2: centre.x = map.Width() - 1 - offset; break;
+				default: centre.y = map.Height() - 1 - offset; break;
+				}
 			}
-			else {
-				mapped = MapValue(i, 0, cone_angle, 0.0f, 1.0f);
+			// a batch: the next stamps of a stroke, overlapping or not
+			centres.assign(1, centre);
+			for (int stamp = uniform(1, 3); stamp > 0; stamp--) {
+				centres.push_back(centres.back() + olc::vi2d{ uniform(-2 * brush_size, 2 * brush_size), uniform(-2 * brush_size, 2 * brush_size) });
 			}
 
-			// gaussian e^(-x^2)
-			float value = GaussianCurve(mapped);
-			value -= 0.3f;
-
-			AddValueToColour(intersection_pos, value);
+			// run(count) stamps the first count centres; the cells compared are
+			// their squares and a cell around, to catch writes past them. The
+			// reference is summed again only when the falloff or count change.
+			int expected_falloff = -1;
+			int expected_count = 0;
+			auto check = [&](const char* kernel, double kernel_tolerance, Reference::Falloff falloff, int count, auto&& run) {
+				TerrainGenerator<TerrainMap>::Generate(map, terrain, brushes.Pool());
+				scratch.Reset();
+				olc::vi2d from = centres[0];
+				olc::vi2d to = centres[0];
+				for (int i = 1; i < count; i++) {
+					from = from.min(centres[i]);
+					to = to.max(centres[i]);
+				}
+				from -= olc::vi2d{ brush_size + 1, brush_size + 1 };
+				to += olc::vi2d{ brush_size + 1, brush_size + 1 };
+				olc::vi2d size = to - from + olc::vi2d{ 1, 1 };
+
+				if (falloff != expected_falloff || count != expected_count) {
+					Reference::Blend(map, centres.data(), count, brush_size, blend_range, falloff, from, size, expected);
+					expected_falloff = falloff;
+					expected_count = count;
+				}
+				run(count);
+				actual.resize(size_t(size.x) * size.y);
+				map.ReadRect(from, size, actual.data(), 1, size.x);
+				runner.Compare(kernel, kernel_tolerance, index, brush_size, blend_range, map.Size(), from, size, expected.data(), actual.data());
+				progressive_blend.Cancel();
+				map.Compact();
+			};
+
+			use_progressive_blend = false;
+			check("AdjustTerrain_BlendBallFractionalFast", tolerance, Reference::square_blend, 1, [&](int) {
+				AdjustTerrain_BlendBallFractionalFast(centre);
+			});
+			check("AdjustTerrain_BlendBallFractional", tolerance, Reference::circle_keep, 1, [&](int) {
+				AdjustTerrain_BlendBallFractional(centre);
+			});
+			check("AdjustTerrain_BlendBallFractionalFast2", tolerance, Reference::circle_keep, 1, [&](int) {
+				AdjustTerrain_BlendBallFractionalFast2(&centre, 1);
+			});
+			check("AdjustTerrain_BlendBallFractionalFast2<ExactCurves>", tolerance, Reference::circle_keep, 1, [&](int) {
+				AdjustTerrain_BlendBallFractionalFast2<ExactCurves>(&centre, 1);
+			});
+			check("AdjustTerrain_BlendBallFractionalFast2<TableCurves>", tolerance, Reference::circle_keep, 1, [&](int) {
+				AdjustTerrain_BlendBallFractionalFast2<TableCurves<1024>>(&centre, 1);
+			});
+
+			use_progressive_blend = true;
+			check("AdjustTerrain_BlendBallFractionalProgressive preview", preview_tolerance, Reference::circle_keep, 1, [&](int) {
+				AdjustTerrain_BlendBallFractionalFast2(&centre, 1);
+			});
+			check("AdjustTerrain_BlendBallFractionalProgressive", tolerance, Reference::circle_keep, 1, [&](int) {
+				AdjustTerrain_BlendBallFractionalFast2(&centre, 1);
+				FinishBlends();
+			});
+
+			use_progressive_blend = false;
+			check("AdjustTerrain_BlendBallFractionalFast2 batch", tolerance, Reference::circle_keep, int(centres.size()), [&](int count) {
+				AdjustTerrain_BlendBallFractionalFast2(centres.data(), count);
+			});
+
+			TerrainGenerator<TerrainMap>::Generate(map, terrain, brushes.Pool());
+			VerifyRaycasts(runner, index, terrain.seed);
 		}
 
-		/*for each point on curve
-			pixel = Position2D(point)
-			pixel.rate = easing_function(distance(point, origin))
-			dir = normalize(point - origin) * step_factor
-
-			for i in (0, some_limit)
-				pixel = Position2D(point + dir * i)
-				pixel.rate = easing_function(distance(origin, point + dir * i))*/
-
-		SetDrawTarget(previous_target);
+		brush_size = saved_brush_size;
+		blend_range = saved_blend_range;
+		use_progressive_blend = saved_progressive;
+		progressive_cells = saved_progressive_cells;
+		use_gpu_blend = saved_gpu;
 	}
 
-	bool MapLocationIsEmpty(olc::vi2d pos) {
-		olc::Pixel pixel = map.GetPixel(pos);
-		return pixel.r == 0 && pixel.g == 0 && pixel.b == 0;
+	// Part of RunVerification(): casts rays from random cells in random directions
+	// and lengths over the map as it is, and checks the raycasts that skip cells
+	// against the plain unit-step walk (RaycastGrid with no occupancy) for the
+	// same rays. The occupancy skip and the sphere-traced walk must hit where it
+	// does; they may come out a cell off for a ray passing within rounding of a
+	// cell corner, so one cell apart passes and anything more fails.
+	// SphereCast stops at the bilinear surface between cell centres instead, which
+	// cuts across the corners of solid cells, so it is checked by how deep the
+	// ray ran into a single cell the walk counts as solid before it stopped: the
+	// surface passes within half a cell of a lone solid cell's centre (the diamond
+	// between its edge midpoints), and a corner outside that is at most half a
+	// diagonal across, so deeper than that means the cast went through solid.
+	void VerifyRaycasts(VerifyRunner& runner, int case_index, uint32_t seed) {
+		constexpr int rays = 1024;
+		const double tolerance = 1.0;
+		const double depth_tolerance = std::sqrt(0.5);
+
+		occupancy.Update();
+		distances.Update();
+		std::mt19937 random(seed);
+		std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+		std::vector<RaycastResult> expected(rays);
+		std::vector<RaycastResult> skipping(rays);
+		std::vector<RaycastResult> tracing(rays);
+		std::vector<RaycastResult> solid_expected(rays);
+		std::vector<olc::vi2d> solid_cells(rays);
+		std::vector<float> cast_depths(rays);
+		std::vector<float> max_distances(rays);
+		for (int i = 0; i < rays; i++) {
+			olc::vi2d start{ int(random() % uint32_t(map.Width())), int(random() % uint32_t(map.Height())) };
+			float angle = unit(random) * 2.0f * float(M_PI);
+			olc::vf2d dir{ std::cos(angle), std::sin(angle) };
+			max_distances[i] = unit(random) * float(map.Width() + map.Height());
+
+			auto any_solid = [&](olc::vi2d cell) { return MapLocationIsEmpty(cell) == false; };
+			expected[i] = RaycastGrid<Occupancy>(start, dir, max_distances[i], map.Size(), nullptr, 0, any_solid);
+			skipping[i] = RaycastGrid(start, dir, max_distances[i], map.Size(), &occupancy, Occupancy::any_nonzero, any_solid);
+
+			// the sphere-traced walk and SphereCast count only cells at least half solid
+			auto solid = [&](olc::vi2d cell) { return GetColourValue(cell) >= DistanceField<TerrainMap>::solid_threshold; };
+			solid_expected[i] = RaycastGrid<Occupancy>(start, dir, max_distances[i], map.Size(), nullptr, 0, solid);
+			tracing[i] = SphereTraceGrid(start, dir, RaycastUnitStep(dir), max_distances[i], map.Size(),
+				[&](olc::vi2d cell) { return distances.CellClearance(cell); }, solid);
+			solid_cells[i] = solid_expected[i].cell;
+
+			// the deepest the cast's ray runs through one solid cell the walk crosses before it stopped
+			olc::vf2d origin = start;
+			SphereCastResult cast = distances.SphereCast(origin, dir, 0.0f, max_distances[i]);
+			float depth = 0.0f;
+			RaycastGrid<Occupancy>(start, dir, cast.distance, map.Size(), nullptr, 0, [&](olc::vi2d cell) {
+				if (solid(cell)) {
+					float enter = 0.0f;
+					float leave = cast.distance;
+					for (int axis = 0; axis < 2; axis++) {
+						float from = axis == 0 ? origin.x : origin.y;
+						float along = axis == 0 ? dir.x : dir.y;
+						float low = float(axis == 0 ? cell.x : cell.y);
+						if (along == 0.0f) continue;
+						float t0 = (low - from) / along;
+						float t1 = (low + 1.0f - from) / along;
+						enter = std::max(enter, std::min(t0, t1));
+						leave = std::min(leave, std::max(t0, t1));
+					}
+					depth = std::max(depth, leave - enter);
+				}
+				return false;
+			});
+			cast_depths[i] = depth;
+		}
+		runner.CompareRays("RaycastGrid occupancy skip", tolerance, case_index, map.Size(), rays, expected.data(), skipping.data(), max_distances.data());
+		runner.CompareRays("SphereTraceGrid distance field", tolerance, case_index, map.Size(), rays, solid_expected.data(), tracing.data(), max_distances.data());
+		runner.CompareDepths("DistanceField::SphereCast", depth_tolerance, case_index, map.Size(), rays, solid_cells.data(), cast_depths.data());
 	}
 
-	bool MapLocationIsFull(olc::vi2d pos) {
-		olc::Pixel pixel = map.GetPixel(pos);
-		return pixel.r == 255 && pixel.g == 255 && pixel.b == 255;
+	void ResetMap() {
+		// Fill() marks the whole map dirty itself
+		progressive_blend.Cancel();
+		map.Fill(0.0f);
+		undo.Clear();
 	}
 
-	void SubtractValueFromColour(olc::vi2d pos, float fraction) {
-		olc::Pixel pixel = map.GetPixel(pos);
-		float curr_fraction = float(pixel.r) / 255.0f;
+	void GenerateMap() {
+		auto start = std::chrono::steady_clock::now();
+		TerrainGenerator<TerrainMap>::Generate(map, generator, brushes.Pool());
+		undo.Clear();
+		std::chrono::duration<float, std::milli> took = std::chrono::steady_clock::now() - start;
+		std::cout << "Generated " << map.Width() << "x" << map.Height() << " terrain (seed " << generator.seed << ") in " << took.count()
+			<< " ms, " << map.DenseChunkCount() << " of " << size_t(map.ChunksX()) * map.ChunksY() << " chunks hold cells\n";
+	}
+};
 
-		float result_fraction = std::clamp(curr_fraction - fraction, 0.0f, 1.0f);
-		uint8_t projected = uint8_t(result_fraction * 255.0f);
-		map.SetPixel(pos, olc::Pixel{ projected, projected, projected });
+// "4,8,16" -> { 4, 8, 16 }
+std::vector<int> ParseIntList(const std::string& text)
+{
+	std::vector<int> values;
+	std::stringstream stream(text);
+	std::string item;
+	while (std::getline(stream, item, ',')) {
+		if (!item.empty()) {
+			values.push_back(std::max(1, std::atoi(item.c_str())));
+		}
 	}
+	return values;
+}
 
-	void AddValueToColour(olc::vi2d pos, float fraction) {
-		olc::Pixel pixel = map.GetPixel(pos);
-		float curr_fraction = float(pixel.r) / 255.0f;
+int main(int argc, char* argv[])
+{
+	olc::vi2d map_size = { 512, 512 };
+	bool benchmark = false;
+	std::string benchmark_format = "csv";
+	std::string benchmark_output;
+	BenchmarkRunner benchmark_runner;
+	std::vector<int> benchmark_brush_sizes = { 4, 8, 16, 32, 64 };
+	std::vector<int> benchmark_blend_ranges = { 5, 15, 30 };
+	uint32_t benchmark_seed = 1;
+	bool verify = false;
+	std::string verify_format = "csv";
+	std::string verify_output;
+	int verify_cases = 40;
+	uint32_t verify_seed = 1;
+	std::string trace_path;
+	std::string map_path;
+	int undo_budget_mb = 256;
+	size_t resident_chunks = 4096;
+	bool cpu_blend = false;
+	bool full_blend = false;
+	float refine_budget_ms = 4.0f;
+	bool settle = false;
+	std::string contour_path;
+	float contour_simplify = 0.0f;
+	std::string record_path;
+	std::string replay_path;
+	std::string replay_output;
+	int host_port = 0;
+	std::string join_address;
+	std::string stats_path;
+	float stats_interval = 1.0f;
+	bool generate = false;
+	TerrainGeneratorSettings generator;
+
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--map-size" && i + 2 < argc) {
+			map_size.x = std::max(1, std::atoi(argv[++i]));
+			map_size.y = std::max(1, std::atoi(argv[++i]));
+		}
+		else if (arg == "--map" && i + 1 < argc) {
+			map_path = argv[++i];
+		}
+		else if (arg == "--undo-budget" && i + 1 < argc) {
+			undo_budget_mb = std::max(0, std::atoi(argv[++i]));
+		}
+		else if (arg == "--resident-chunks" && i + 1 < argc) {
+			resident_chunks = size_t(std::max(1, std::atoi(argv[++i])));
+		}
+		else if (arg == "--trace" && i + 1 < argc) {
+			trace_path = argv[++i];
+		}
+		else if (arg == "--stats" && i + 1 < argc) {
+			stats_path = argv[++i];
+		}
+		else if (arg == "--stats-interval" && i + 1 < argc) {
+			stats_interval = std::max(0.01f, float(std::atof(argv[++i])));
+		}
+		else if (arg == "--cpu-blend") {
+			cpu_blend = true;
+		}
+		else if (arg == "--full-blend") {
+			full_blend = true;
+		}
+		else if (arg == "--refine-budget" && i + 1 < argc) {
+			refine_budget_ms = std::max(0.0f, float(std::atof(argv[++i])));
+		}
+		else if (arg == "--settle") {
+			settle = true;
+		}
+		else if (arg == "--contours" && i + 1 < argc) {
+			contour_path = argv[++i];
+		}
+		else if (arg == "--record" && i + 1 < argc) {
+			record_path = argv[++i];
+		}
+		else if (arg == "--replay" && i + 1 < argc) {
+			replay_path = argv[++i];
+		}
+		else if (arg == "--replay-output" && i + 1 < argc) {
+			replay_output = argv[++i];
+		}
+		else if (arg == "--generate" && i + 1 < argc) {
+			generate = true;
+			generator.seed = uint32_t(std::strtoul(argv[++i], nullptr, 10));
+		}
+		else if (arg == "--generate-scale" && i + 1 < argc) {
+			generator.feature_size = std::max(1.0f, float(std::atof(argv[++i])));
+		}
+		else if (arg == "--generate-octaves" && i + 1 < argc) {
+			generator.octaves = std::max(1, std::atoi(argv[++i]));
+		}
+		else if (arg == "--generate-solid" && i + 1 < argc) {
+			generator.threshold = TerrainGenerator<Example::TerrainMap>::ThresholdForSolid(float(std::atof(argv[++i])));
+		}
+		else if (arg == "--generate-caves" && i + 1 < argc) {
+			generator.cave_width = std::max(0.0f, float(std::atof(argv[++i])));
+		}
+		else if (arg == "--host" && i + 1 < argc) {
+			host_port = std::atoi(argv[++i]);
+		}
+		else if (arg == "--join" && i + 1 < argc) {
+			join_address = argv[++i];
+		}
+		else if (arg == "--contour-simplify" && i + 1 < argc) {
+			contour_simplify = std::max(0.0f, float(std::atof(argv[++i])));
+		}
+		else if (arg == "--benchmark") {
+			benchmark = true;
+			if (i + 1 < argc && argv[i + 1][0] != '-') {
+				benchmark_format = argv[++i];
+			}
+		}
+		else if (arg == "--benchmark-output" && i + 1 < argc) {
+			benchmark_output = argv[++i];
+		}
+		else if (arg == "--benchmark-iterations" && i + 1 < argc) {
+			benchmark_runner.iterations = std::max(1, std::atoi(argv[++i]));
+		}
+		else if (arg == "--benchmark-brush-sizes" && i + 1 < argc) {
+			benchmark_brush_sizes = ParseIntList(argv[++i]);
+		}
+		else if (arg == "--benchmark-blend-ranges" && i + 1 < argc) {
+			benchmark_blend_ranges = ParseIntList(argv[++i]);
+		}
+		else if (arg == "--benchmark-seed" && i + 1 < argc) {
+			benchmark_seed = uint32_t(std::strtoul(argv[++i], nullptr, 10));
+		}
+		else if (arg == "--verify") {
+			verify = true;
+			if (i + 1 < argc && argv[i + 1][0] != '-') {
+				verify_format = argv[++i];
+			}
+		}
+		else if (arg == "--verify-output" && i + 1 < argc) {
+			verify_output = argv[++i];
+		}
+		else if (arg == "--verify-cases" && i + 1 < argc) {
+			verify_cases = std::max(1, std::atoi(argv[++i]));
+		}
+		else if (arg == "--verify-seed" && i + 1 < argc) {
+			verify_seed = uint32_t(std::strtoul(argv[++i], nullptr, 10));
+		}
+	}
 
-		float result_fraction = std::clamp(curr_fraction + fraction, 0.0f, 1.0f);
-		uint8_t projected = uint8_t(result_fraction * 255.0f);
-		map.SetPixel(pos, olc::Pixel{ projected, projected, projected });
+	// an existing map file decides the size, a new one is created by the first save
+	bool load_map_file = false;
+	if (!map_path.empty() && std::ifstream(map_path).good()) {
+		TerrainFileHeader header;
+		if (!ReadTerrainFileHeader(map_path, header)) {
+			std::cerr << map_path << " is not a terrain file\n";
+			return 1;
+		}
+		map_size = { header.width, header.height };
+		load_map_file = true;
 	}
 
-	void SetColourValue(olc::vi2d pos, float fraction) {
-		olc::Pixel pixel = map.GetPixel(pos);
+	StrokeLogReader replay_log;
+	if (!replay_path.empty()) {
+		if (!replay_log.Open(replay_path)) {
+			std::cerr << replay_path << " is not a stroke log\n";
+			return 1;
+		}
+		if (load_map_file && replay_log.MapSize() != map_size) {
+			std::cerr << replay_path << " was recorded on a " << replay_log.MapSize().x << "x" << replay_log.MapSize().y
+				<< " map, " << map_path << " is " << map_size.x << "x" << map_size.y << "\n";
+			return 1;
+		}
+		map_size = replay_log.MapSize();
+	}
 
-		float result_fraction = std::clamp(fraction, 0.0f, 1.0f);
-		uint8_t projected = uint8_t(result_fraction * 255.0f);
-		map.SetPixel(pos, olc::Pixel{ projected, projected, projected });
+	// a client takes the host's map, so its size has to be known before the editor is made
+	std::unique_ptr<NetSession> session;
+	if (replay_path.empty() && !benchmark && !verify && (host_port != 0 || !join_address.empty())) {
+		session = std::make_unique<NetSession>();
+		if (host_port != 0) {
+			std::vector<uint8_t> welcome;
+			NetWriter writer{ welcome };
+			writer.Put(int32_t(map_size.x));
+			writer.Put(int32_t(map_size.y));
+			if (host_port < 1 || host_port > 65535 || !session->Host(uint16_t(host_port), welcome)) {
+				std::cerr << "Can't host a session on port " << host_port << "\n";
+				return 1;
+			}
+			std::cout << "Hosting a session on port " << host_port << "\n";
+		}
+		else {
+			size_t colon = join_address.rfind(':');
+			std::string host = join_address.substr(0, colon);
+			int port = colon == std::string::npos ? 0 : std::atoi(join_address.c_str() + colon + 1);
+			if (host.size() > 1 && host.front() == '[' && host.back() == ']') {
+				host = host.substr(1, host.size() - 2);
+			}
+			std::vector<uint8_t> welcome;
+			bool joined = port >= 1 && port <= 65535 && session->Join(host, uint16_t(port), welcome);
+			NetReader reader{ welcome.data(), welcome.size() };
+			int32_t width = 0;
+			int32_t height = 0;
+			if (!joined || !reader.Get(width) || !reader.Get(height) || width <= 0 || height <= 0) {
+				std::cerr << "Can't join a session at " << join_address << "\n";
+				return 1;
+			}
+			map_size = { width, height };
+			// F5 still saves a copy of the host's map there
+			load_map_file = false;
+		}
 	}
 
-	float GetColourValue(olc::vi2d pos) {
-		olc::Pixel pixel = map.GetPixel(pos);
-		float fraction = float(pixel.r) / 255.0f;
-		return fraction;
+	Example demo{map_size};
+	demo.generate_map = generate;
+	demo.generator = generator;
+	demo.stats_path = stats_path;
+	demo.stats_interval = stats_interval;
+
+	if (!replay_path.empty()) {
+		demo.map_path = map_path;
+		demo.load_map_file = load_map_file;
+		auto start = std::chrono::steady_clock::now();
+		size_t frames = 0;
+		size_t stamps = 0;
+		if (!demo.ReplayStrokes(replay_log, frames, stamps)) {
+			return 1;
+		}
+		std::chrono::duration<double, std::milli> took = std::chrono::steady_clock::now() - start;
+		std::cout << "Replayed " << frames << " frames, " << stamps << " stamps in " << took.count() << " ms\n";
+		std::cout << "Map checksum " << std::hex << demo.MapChecksum() << std::dec << "\n";
+		if (!replay_output.empty()) {
+			if (!demo.map_file.SaveAs(demo.map, replay_output)) {
+				std::cerr << "Can't save " << replay_output << "\n";
+				return 1;
+			}
+		}
+		return 0;
 	}
 
-	void ResetMap() {
-		olc::Sprite* previous_target = GetDrawTarget();
-		SetDrawTarget(&map);
+	if (verify) {
+		if (verify_format != "csv" && verify_format != "json") {
+			std::cerr << "Unknown verify format " << verify_format << ", expected csv or json\n";
+			return 1;
+		}
+		std::ofstream file;
+		if (!verify_output.empty()) {
+			file.open(verify_output);
+			if (!file) {
+				std::cerr << "Can't write " << verify_output << "\n";
+				return 1;
+			}
+		}
 
-		FillRect({ 0,0 }, map.Size(), olc::BLACK);
-		
-		SetDrawTarget(previous_target);
-	}
+		VerifyRunner verify_runner;
+		demo.RunVerification(verify_runner, verify_cases, verify_seed);
 
-	olc::vf2d RotateVector(olc::vf2d vec, float radians) {
-		olc::vf2d result;
-		result.x = vec.x * std::cos(radians) + vec.y * std::sin(radians);
-		result.y = vec.x * -std::sin(radians) + vec.y * std::cos(radians);
-		return result;
+		std::ostream& out = verify_output.empty() ? std::cout : file;
+		if (verify_format == "json") {
+			verify_runner.WriteJson(out);
+		}
+		else {
+			verify_runner.WriteCsv(out);
+		}
+		return verify_runner.Passed() ? 0 : 1;
 	}
 
-	float AngleToRadians(float angle) {
-		return angle * float(M_PI) / 180.0f;
-	}
+	if (benchmark) {
+		if (benchmark_format != "csv" && benchmark_format != "json") {
+			std::cerr << "Unknown benchmark format " << benchmark_format << ", expected csv or json\n";
+			return 1;
+		}
+		std::ofstream file;
+		if (!benchmark_output.empty()) {
+			file.open(benchmark_output);
+			if (!file) {
+				std::cerr << "Can't write " << benchmark_output << "\n";
+				return 1;
+			}
+		}
 
-	float MapValue(float value, float in_min, float in_max, float out_min, float out_max) {
-		return (value - in_min) * (out_max - out_min) / (in_max - in_min) + out_min;
-	}
+		// no timings for kernels that give the wrong cells
+		VerifyRunner verify_runner;
+		demo.RunVerification(verify_runner, verify_cases, verify_seed);
+		if (!verify_runner.Passed()) {
+			std::cerr << "Blend kernels differ from the reference, not benchmarking:\n";
+			verify_runner.WriteCsv(std::cerr);
+			return 1;
+		}
 
-	float GaussianCurve(float x) {
-		return float(pow(M_E, -x * x));
-	}
+		demo.RunBenchmarks(benchmark_runner, benchmark_brush_sizes, benchmark_blend_ranges, benchmark_seed);
 
-	float EaseInOutSine(float x) {
-		return -(cos(M_PI * x) - 1.0) / 2.0;
+		std::ostream& out = benchmark_output.empty() ? std::cout : file;
+		if (benchmark_format == "json") {
+			benchmark_runner.WriteJson(out);
+		}
+		else {
+			benchmark_runner.WriteCsv(out);
+		}
+		return 0;
 	}
 
-	float EaseInOutCubic(float x) {
-		return (x < 0.5) ? (4 * x * x * x) : (1 - pow(-2 * x + 2, 3) / 2);
+	demo.undo.SetBudget(size_t(undo_budget_mb) << 20);
+	demo.streamer.max_resident_chunks = resident_chunks;
+	demo.use_gpu_blend = !cpu_blend;
+	demo.use_progressive_blend = !full_blend;
+	demo.refine_budget_ms = refine_budget_ms;
+	demo.settle.enabled = settle;
+	demo.record_path = record_path;
+	demo.contours.SetSimplifyTolerance(contour_simplify);
+	if (!contour_path.empty()) {
+		demo.contour_path = contour_path;
 	}
-
-	float Lerp(float from, float to, float t) {
-		return from * (1 - t) + to * t;
+	if (!map_path.empty()) {
+		demo.map_path = map_path;
+		demo.load_map_file = load_map_file;
 	}
-};
+	if (!trace_path.empty()) {
+		demo.trace_path = trace_path;
+		demo.save_trace_on_exit = true;
+	}
+	demo.session = std::move(session);
 
-int main()
-{
-	Example demo;
 	if (demo.Construct(512, 512, 1, 1, false, true, false))
 		demo.Start();
 	return 0;
-}
\ No newline at end of file
+}